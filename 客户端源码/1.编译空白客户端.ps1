@@ -25,7 +25,7 @@ if (-not (Test-Path $vsPath)) {
     exit 1
 }
 
-cmd /c "`"$vsPath`" >nul 2>&1 && cl /EHsc /O2 /std:c++14 /utf-8 /Fe`"tcp_proxy_client_base.exe`" tcp_proxy_client_no_config.cpp /link ws2_32.lib advapi32.lib"
+cmd /c "`"$vsPath`" >nul 2>&1 && cl /EHsc /O2 /std:c++14 /utf-8 /I`"..\服务器源码`" /Fe`"tcp_proxy_client_base.exe`" tcp_proxy_client_no_config.cpp /link ws2_32.lib advapi32.lib"
 
 if ($LASTEXITCODE -ne 0) {
     Write-Host ""
@@ -611,14 +611,15 @@ bool ServerSelectorGUI::StartChildProcess(const ServerInfo& server) {
     GetModuleFileNameA(NULL, exe_path, MAX_PATH);
 
     // 构建命令行
-    // 格式: "程序路径" --worker <server_id> <game_server_ip> <tunnel_server_ip> <tunnel_port>
+    // 格式: "程序路径" --worker <server_id> <game_server_ip> <tunnel_server_ip> <tunnel_port> <心跳版本>
     char cmdline[2048];
-    sprintf(cmdline, "\"%s\" --worker %d %s %s %d",
+    sprintf(cmdline, "\"%s\" --worker %d %s %s %d %d",
             exe_path,
             server.id,
             server.game_server_ip.c_str(),
             server.tunnel_server_ip.c_str(),
-            server.tunnel_port);
+            server.tunnel_port,
+            server.heartbeat_v2 ? 2 : 1);
 
     // 添加调试日志
     AppendLog(L"启动命令: ");
@@ -21,6 +21,7 @@ struct ServerInfo {
     std::string tunnel_server_ip;
     int tunnel_port;
     std::string download_url;
+    bool heartbeat_v2;           // v12.4.1: 服务器支持v2心跳(服务器列表"heartbeat_v2":true)
 };
 
 // TCP配置客户端类
@@ -1,7 +1,12 @@
 /*
- * DNF游戏代理客户端 - C++ 版本 v12.4.0 (多服务器版)
+ * DNF游戏代理客户端 - C++ 版本 v12.4.1 (多服务器版)
  * 从自身exe末尾读取配置，支持HTTP API动态获取服务器列表
  *
+ * v12.4.1 更新:
+ * - v2心跳: 服务器列表带"heartbeat_v2":true时，心跳携带序号和发送时间戳(QueryPerformanceCounter微秒)
+ * - 服务器回显时间戳，客户端据此计算RTT并在下一次心跳中上报，服务器统计每个会话的RTT和抖动
+ * - worker命令行增加心跳版本参数(1/2)，旧服务器仍使用7字节心跳
+ *
  * v12.4.0 更新 (2025-11-11):
  * - 🎯 新功能: 服务器切换功能 - 启动时从HTTP API获取服务器列表并显示GUI选择窗口
  * - GUI窗口: Win32原生窗口，仿DNF频道选择风格，支持列表选择和双击连接
@@ -92,6 +97,11 @@
 #include "server_selector_gui.h"
 #include "config_manager.h"
 
+// 隧道协议编解码(与服务器共用，位于服务器源码目录，编译脚本通过/I引入)
+#include "tunnel_protocol.h"
+// 注入包构造(calculate_checksum、build_complete_packet)，同样位于服务器源码目录，dnf-microbench直接测量
+#include "client_packet.h"
+
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "advapi32.lib")
 #pragma comment(lib, "iphlpapi.lib")  // 用于GetAdaptersAddresses
@@ -667,6 +677,7 @@ vector<ServerInfo> parse_server_list(const string& json_str) {
 
         string obj_content = array_content.substr(obj_start, obj_end - obj_start + 1);
         ServerInfo info;
+        info.heartbeat_v2 = false;
 
         // 解析id
         size_t id_pos = obj_content.find("\"id\"");
@@ -760,6 +771,16 @@ vector<ServerInfo> parse_server_list(const string& json_str) {
             }
         }
 
+        // v12.4.1: 解析heartbeat_v2(旧服务器没有该字段)
+        size_t hb_pos = obj_content.find("\"heartbeat_v2\"");
+        if (hb_pos != string::npos) {
+            size_t hb_colon = obj_content.find(":", hb_pos);
+            if (hb_colon != string::npos) {
+                size_t hb_value = obj_content.find_first_not_of(" \t", hb_colon + 1);
+                info.heartbeat_v2 = hb_value != string::npos && obj_content.compare(hb_value, 4, "true") == 0;
+            }
+        }
+
         // 添加到列表
         servers.push_back(info);
 
@@ -871,6 +892,18 @@ string Logger::current_log_level = "DEBUG";  // v12.3.7: 默认INFO级别，避
 // ==================== 会话UUID ====================
 // 全局会话UUID，用于在服务器日志中唯一标识此客户端
 string g_session_uuid;
+// v12.4.1: 服务器支持时发送v2心跳(worker命令行第6个参数为2)
+bool g_heartbeat_v2 = false;
+
+// v12.4.1: v2心跳的发送时间戳(微秒)，只在本机计算RTT，服务器原样回显
+uint64_t heartbeat_clock_us() {
+    static LARGE_INTEGER freq = {};
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000ULL +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart;
+}
 
 // 生成简单的UUID (格式: xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx)
 string generate_session_uuid() {
@@ -954,11 +987,9 @@ bool test_tunnel_handshake(const string& tunnel_ip, uint16_t tunnel_port) {
 
     // 发送测试握手包: conn_id(4)=0 + dst_port(2)=65535 (特殊标记表示测试连接) + session_uuid_len(1) + session_uuid(N)
     uint8_t session_uuid_len = (uint8_t)g_session_uuid.length();
-    vector<uint8_t> handshake(7 + session_uuid_len);
-    *(uint32_t*)&handshake[0] = htonl(0);      // conn_id=0 表示测试
-    *(uint16_t*)&handshake[4] = htons(65535);  // port=65535 表示测试
-    handshake[6] = session_uuid_len;
-    memcpy(&handshake[7], g_session_uuid.c_str(), session_uuid_len);
+    vector<uint8_t> handshake(HANDSHAKE_HEADER + session_uuid_len);
+    // conn_id=0, port=65535 表示测试
+    encode_handshake(handshake.data(), 0, 65535, g_session_uuid.c_str(), session_uuid_len);
 
     if (send(test_sock, (char*)handshake.data(), handshake.size(), 0) != (int)handshake.size()) {
         cout << "[启动测试] ✗ 发送测试握手失败" << endl;
@@ -1676,27 +1707,6 @@ bool auto_setup_loopback_adapter(const string& primary_ip, const string& seconda
     return true;
 }
 
-// ==================== 工具函数 ====================
-uint16_t calculate_checksum(const uint8_t* data, int len) {
-    uint32_t sum = 0;
-    for (int i = 0; i < len - 1; i += 2) {
-        sum += (data[i] << 8) | data[i + 1];
-    }
-    if (len % 2 == 1) {
-        sum += data[len - 1] << 8;
-    }
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    return (uint16_t)~sum;
-}
-
-void ip_str_to_bytes(const string& ip, uint8_t* bytes) {
-    int a, b, c, d;
-    sscanf(ip.c_str(), "%d.%d.%d.%d", &a, &b, &c, &d);
-    bytes[0] = a; bytes[1] = b; bytes[2] = c; bytes[3] = d;
-}
-
 // ==================== TCP连接类 ====================
 class TCPConnection {
 private:
@@ -1744,6 +1754,9 @@ private:
     // v12.3.9: 心跳保活机制
     DWORD last_heartbeat_time;
     const int HEARTBEAT_INTERVAL_MS = 20000;  // 20秒心跳间隔
+    // v12.4.1: v2心跳序号和上一次测得的RTT(下一次心跳中上报，0=暂无)，只由隧道接收线程访问
+    uint32_t heartbeat_seq;
+    uint32_t heartbeat_rtt_us;
 public:
     TCPConnection(int id, const string& sip, uint16_t sport,
                   const string& dip, uint16_t dport,
@@ -1759,7 +1772,7 @@ public:
           client_acked_seq(0),
           tunnel_sock(INVALID_SOCKET), running(false), established(false), closing(false),
           last_window_probe_time(0), window_zero_start_time(0), window_probe_logged(false),
-          last_heartbeat_time(0) {
+          last_heartbeat_time(0), heartbeat_seq(0), heartbeat_rtt_us(0) {
 
         // v12.3.12: 窗口策略完整修复
         // advertised_window: 65535 - SYN-ACK握手时通告给游戏客户端的接收窗口
@@ -1909,11 +1922,9 @@ public:
                         "\n                    " + hex_dump);
 
             // 转发到隧道：msg_type(1) + conn_id(4) + data_len(2) + payload
-            vector<uint8_t> packet(7 + len);
-            packet[0] = 0x01;
-            *(uint32_t*)&packet[1] = htonl(conn_id);
-            *(uint16_t*)&packet[5] = htons(len);
-            memcpy(&packet[7], payload, len);
+            vector<uint8_t> packet(TCP_FRAME_HEADER + len);
+            encode_tcp_header(packet.data(), conn_id, (uint16_t)len);
+            memcpy(&packet[TCP_FRAME_HEADER], payload, len);
 
             if (send(tunnel_sock, (char*)packet.data(), packet.size(), 0) != (int)packet.size()) {
                 Logger::error("[连接" + to_string(conn_id) + "] 转发数据失败");
@@ -2076,11 +2087,8 @@ private:
 
         // 发送握手：conn_id(4) + dst_port(2) + session_uuid_len(1) + session_uuid(N)
         uint8_t session_uuid_len = (uint8_t)g_session_uuid.length();
-        vector<uint8_t> handshake(7 + session_uuid_len);
-        *(uint32_t*)&handshake[0] = htonl(conn_id);
-        *(uint16_t*)&handshake[4] = htons(dst_port);
-        handshake[6] = session_uuid_len;
-        memcpy(&handshake[7], g_session_uuid.c_str(), session_uuid_len);
+        vector<uint8_t> handshake(HANDSHAKE_HEADER + session_uuid_len);
+        encode_handshake(handshake.data(), conn_id, dst_port, g_session_uuid.c_str(), session_uuid_len);
 
         if (send(tunnel_sock, (char*)handshake.data(), handshake.size(), 0) != (int)handshake.size()) {
             Logger::error("[连接" + to_string(conn_id) + "] 发送握手失败");
@@ -2166,7 +2174,9 @@ private:
     }
 
     void recv_from_tunnel() {
-        vector<uint8_t> buffer;
+        // 帧直接在recv_buf中解析，跨recv的半帧由decoder拼接
+        FrameDecoder decoder(frame_type_bit(FRAME_TCP_DATA) | frame_type_bit(FRAME_HEARTBEAT));
+        decoder.expect_conn_id((uint32_t)conn_id);
         uint8_t recv_buf[4096];
         // v12.3.8: 移除未使用的MAX_SEND_BUFFER限制，使用动态缓冲区管理
 
@@ -2177,12 +2187,13 @@ private:
             DWORD current_time = GetTickCount();
             if (current_time - last_heartbeat_time >= HEARTBEAT_INTERVAL_MS) {
                 // 心跳包: msg_type(0x02) + conn_id(4) + data_len(2) = 7字节
-                uint8_t heartbeat[7];
-                heartbeat[0] = 0x02;  // 心跳消息类型
-                *(uint32_t*)&heartbeat[1] = htonl(conn_id);
-                *(uint16_t*)&heartbeat[5] = htons(0);  // 数据长度0
+                // v12.4.1: v2心跳追加 seq(4) + 发送时间戳(8) + 上次RTT(4)
+                uint8_t heartbeat[HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REQUEST_LEN];
+                int heartbeat_len = g_heartbeat_v2
+                    ? (int)encode_heartbeat_v2(heartbeat, conn_id, heartbeat_seq++, heartbeat_clock_us(), heartbeat_rtt_us)
+                    : (int)encode_heartbeat(heartbeat, conn_id);
 
-                if (send(tunnel_sock, (char*)heartbeat, 7, 0) == 7) {
+                if (send(tunnel_sock, (char*)heartbeat, heartbeat_len, 0) == heartbeat_len) {
                     Logger::debug("[连接" + to_string(conn_id) + "|端口" + to_string(dst_port) +
                                  "] 💓 发送心跳包");
                     last_heartbeat_time = current_time;
@@ -2238,51 +2249,39 @@ private:
 
             Logger::debug("[连接" + to_string(conn_id) + "|端口" + to_string(dst_port) +
                         "] ←[隧道] 接收 " + to_string(n) + "字节");
-            buffer.insert(buffer.end(), recv_buf, recv_buf + n);
+            decoder.feed(recv_buf, n);
 
             // 解析：msg_type(1) + conn_id(4) + data_len(2) + data
-            while (buffer.size() >= 7) {
-                uint8_t msg_type = buffer[0];
-                uint32_t msg_conn_id = ntohl(*(uint32_t*)&buffer[1]);
-                uint16_t data_len = ntohs(*(uint16_t*)&buffer[5]);
+            FrameView frame;
+            for (;;) {
+                FrameResult result = decoder.next(frame);
+                if (result == FRAME_INCOMPLETE) break;
 
                 // 调试：打印协议头解析结果
                 static int parse_count = 0;
-                bool abnormal = (data_len == 0 || data_len > 65535 || msg_type != 1 || msg_conn_id != (uint32_t)conn_id);
+                bool abnormal = (result == FRAME_UNKNOWN || frame.conn_id != (uint32_t)conn_id ||
+                                 (frame.type == FRAME_TCP_DATA && frame.length == 0));
                 if (parse_count < 20 || parse_count % 100 == 0 || abnormal) {
-                    Logger::debug("[连接" + to_string(conn_id) + "] 协议头: type=" +
-                                to_string((int)msg_type) + " conn_id=" + to_string(msg_conn_id) +
-                                " data_len=" + to_string(data_len) + " buffer_size=" + to_string(buffer.size()));
-
-                    // 如果异常，打印buffer前30字节
+                    string header_desc = "type=" + to_string((int)frame.type) +
+                                         " conn_id=" + to_string(frame.conn_id);
+                    if (result == FRAME_OK) header_desc += " data_len=" + to_string(frame.length);
                     if (abnormal) {
-                        string buf_hex;
-                        for (size_t i = 0; i < min((size_t)30, buffer.size()); i++) {
-                            char hex[4];
-                            sprintf(hex, "%02x ", buffer[i]);
-                            buf_hex += hex;
-                        }
-                        Logger::warning("[连接" + to_string(conn_id) + "] ⚠ 异常协议头! Buffer: " + buf_hex);
+                        Logger::warning("[连接" + to_string(conn_id) + "] ⚠ 异常协议头! " + header_desc);
+                    } else {
+                        Logger::debug("[连接" + to_string(conn_id) + "] 协议头: " + header_desc);
                     }
                 }
                 parse_count++;
 
                 // 检测conn_id错误（可能是协议不同步）
-                if (msg_conn_id != (uint32_t)conn_id) {
+                if (frame.conn_id != (uint32_t)conn_id) {
                     static int error_count = 0;
                     error_count++;
 
                     // 只打印前几次错误，避免日志爆炸
                     if (error_count <= 5) {
-                        string buffer_hex;
-                        for (size_t i = 0; i < min((size_t)30, buffer.size()); i++) {
-                            char hex[4];
-                            sprintf(hex, "%02x ", buffer[i]);
-                            buffer_hex += hex;
-                        }
                         Logger::warning("[连接" + to_string(conn_id) + "] 收到错误连接ID: " +
-                                      to_string(msg_conn_id) + " (期望:" + to_string(conn_id) +
-                                      ") Buffer: " + buffer_hex);
+                                      to_string(frame.conn_id) + " (期望:" + to_string(conn_id) + ")");
                     }
 
                     if (error_count == 6) {
@@ -2290,64 +2289,53 @@ private:
                     }
 
                     // 跳过1字节，尝试重新同步协议
-                    buffer.erase(buffer.begin(), buffer.begin() + 1);
-                    continue;
-                }
-
-                // v12.3.9: 处理心跳包回复
-                if (msg_type == 0x02) {
-                    Logger::debug("[连接" + to_string(conn_id) + "] 💓 收到心跳包回复");
-                    buffer.erase(buffer.begin(), buffer.begin() + 7);
+                    decoder.skip(1);
                     continue;
                 }
 
-                if (msg_type != 0x01) {
+                if (result == FRAME_UNKNOWN) {
                     Logger::warning("[连接" + to_string(conn_id) + "] 未知消息类型: " +
-                                  to_string((int)msg_type));
-                    buffer.erase(buffer.begin(), buffer.begin() + 7);
+                                  to_string((int)frame.type));
+                    decoder.skip(TCP_FRAME_HEADER);
                     continue;
                 }
 
-                if (buffer.size() < 7 + data_len) {
-                    Logger::debug("[连接" + to_string(conn_id) + "] 等待更多数据 (需要" +
-                                to_string(7 + data_len) + "字节，当前" + to_string(buffer.size()) + "字节)");
-                    break;
-                }
-
-                size_t before_size = buffer.size();
-                vector<uint8_t> payload(buffer.begin() + 7, buffer.begin() + 7 + data_len);
-                buffer.erase(buffer.begin(), buffer.begin() + 7 + data_len);
-                size_t after_size = buffer.size();
-
-                // 验证消费的字节数
-                size_t consumed = before_size - after_size;
-                if (consumed != 7 + data_len) {
-                    Logger::warning("[连接" + to_string(conn_id) + "] ⚠ 字节消费异常: 期望" +
-                                  to_string(7 + data_len) + "实际" + to_string(consumed));
+                // v12.3.9: 处理心跳包回复
+                if (frame.type == FRAME_HEARTBEAT) {
+                    Logger::debug("[连接" + to_string(conn_id) + "] 💓 收到心跳包回复");
+                    // v12.4.1: v2回复回显了发送时间戳，得到本次RTT
+                    HeartbeatV2 hb;
+                    if (decode_heartbeat_v2_reply(frame.payload, frame.length, hb)) {
+                        uint64_t rtt_us = heartbeat_clock_us() - hb.client_send_us;
+                        heartbeat_rtt_us = rtt_us > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (rtt_us == 0 ? 1 : (uint32_t)rtt_us);
+                        Logger::debug("[连接" + to_string(conn_id) + "] 💓 心跳RTT: " +
+                                      to_string(heartbeat_rtt_us) + "us (seq=" + to_string(hb.seq) + ")");
+                    }
+                    continue;
                 }
 
                 // 打印载荷（大数据包只打印前128字节）
                 const int MAX_HEX_DUMP = 128;
                 string hex_dump = "";
-                int dump_size = min((int)payload.size(), MAX_HEX_DUMP);
+                int dump_size = min((int)frame.length, MAX_HEX_DUMP);
 
                 for (int i = 0; i < dump_size; i++) {
                     if (i > 0 && i % 16 == 0) {
                         hex_dump += "\n                    ";
                     }
                     char buf[4];
-                    sprintf(buf, "%02x ", payload[i]);
+                    sprintf(buf, "%02x ", frame.payload[i]);
                     hex_dump += buf;
                 }
 
-                if (payload.size() > MAX_HEX_DUMP) {
-                    hex_dump += "\n                    ... (省略 " + to_string(payload.size() - MAX_HEX_DUMP) + " 字节)";
+                if (frame.length > MAX_HEX_DUMP) {
+                    hex_dump += "\n                    ... (省略 " + to_string(frame.length - MAX_HEX_DUMP) + " 字节)";
                 }
 
                 Logger::debug("[连接" + to_string(conn_id) + "|端口" + to_string(dst_port) +
-                            "] 解析隧道数据 " + to_string(payload.size()) + "字节\n                    " + hex_dump);
+                            "] 解析隧道数据 " + to_string(frame.length) + "字节\n                    " + hex_dump);
 
-                send_data_to_client(payload);
+                send_data_to_client(frame.payload, frame.length);
             }
         }
 
@@ -2355,9 +2343,9 @@ private:
         running = false;
     }
 
-    void send_data_to_client(const vector<uint8_t>& payload) {
+    void send_data_to_client(const uint8_t* payload, size_t len) {
         lock_guard<mutex> lock(send_lock);
-        send_buffer.insert(send_buffer.end(), payload.begin(), payload.end());
+        send_buffer.insert(send_buffer.end(), payload, payload + len);
         Logger::debug("[连接" + to_string(conn_id) + "] 缓冲区: " + to_string(send_buffer.size()) + "字节");
         try_send_buffered_data();
     }
@@ -2437,69 +2425,12 @@ private:
         inject_packet(packet);
     }
 
+    // 校验和与包构造见client_packet.h
     vector<uint8_t> build_complete_packet(uint8_t flags, uint32_t seq, uint32_t ack,
                                           const uint8_t* payload, int payload_len,
                                           uint16_t window) {
-        // 构造TCP头部（无校验和）
-        uint8_t tcp_header[20];
-        *(uint16_t*)&tcp_header[0] = htons(dst_port);  // 源端口（游戏服务器）
-        *(uint16_t*)&tcp_header[2] = htons(src_port);  // 目标端口（游戏客户端）
-        *(uint32_t*)&tcp_header[4] = htonl(seq);
-        *(uint32_t*)&tcp_header[8] = htonl(ack);
-        tcp_header[12] = 5 << 4;  // 数据偏移
-        tcp_header[13] = flags;
-        *(uint16_t*)&tcp_header[14] = htons(window);
-        *(uint16_t*)&tcp_header[16] = 0;  // 校验和（稍后计算）
-        *(uint16_t*)&tcp_header[18] = 0;  // 紧急指针
-
-        // 构造伪头部
-        uint8_t src_ip_bytes[4], dst_ip_bytes[4];
-        ip_str_to_bytes(dst_ip, src_ip_bytes);  // 源IP（游戏服务器）
-        ip_str_to_bytes(src_ip, dst_ip_bytes);  // 目标IP（游戏客户端）
-
-        vector<uint8_t> pseudo_header(12);
-        memcpy(&pseudo_header[0], src_ip_bytes, 4);
-        memcpy(&pseudo_header[4], dst_ip_bytes, 4);
-        pseudo_header[8] = 0;
-        pseudo_header[9] = 6;  // TCP协议
-        *(uint16_t*)&pseudo_header[10] = htons(20 + payload_len);
-
-        // 计算TCP校验和
-        vector<uint8_t> checksum_data = pseudo_header;
-        checksum_data.insert(checksum_data.end(), tcp_header, tcp_header + 20);
-        if (payload_len > 0) {
-            checksum_data.insert(checksum_data.end(), payload, payload + payload_len);
-        }
-
-        uint16_t tcp_checksum = calculate_checksum(checksum_data.data(), checksum_data.size());
-        *(uint16_t*)&tcp_header[16] = tcp_checksum;
-
-        // 构造IP头部（无校验和）
-        uint8_t ip_header[20];
-        ip_header[0] = 0x45;  // 版本4 + 头长度5
-        ip_header[1] = 0;  // TOS
-        *(uint16_t*)&ip_header[2] = htons(20 + 20 + payload_len);  // 总长度
-        *(uint16_t*)&ip_header[4] = htons(ip_id++);
-        *(uint16_t*)&ip_header[6] = 0;  // 标志 + 片偏移
-        ip_header[8] = 64;  // TTL
-        ip_header[9] = 6;  // 协议（TCP）
-        *(uint16_t*)&ip_header[10] = 0;  // 校验和（稍后计算）
-        memcpy(&ip_header[12], src_ip_bytes, 4);
-        memcpy(&ip_header[16], dst_ip_bytes, 4);
-
-        // 计算IP校验和
-        uint16_t ip_checksum = calculate_checksum(ip_header, 20);
-        *(uint16_t*)&ip_header[10] = ip_checksum;
-
-        // 组合完整包
-        vector<uint8_t> packet;
-        packet.insert(packet.end(), ip_header, ip_header + 20);
-        packet.insert(packet.end(), tcp_header, tcp_header + 20);
-        if (payload_len > 0) {
-            packet.insert(packet.end(), payload, payload + payload_len);
-        }
-
-        return packet;
+        return ::build_complete_packet(src_ip, src_port, dst_ip, dst_port, ip_id,
+                                       flags, seq, ack, payload, payload_len, window);
     }
 
     void inject_packet(vector<uint8_t>& packet) {
@@ -3143,13 +3074,9 @@ private:
             }
 
             // 构造tunnel协议: msg_type(0x03) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
-            vector<uint8_t> packet(11 + payload_len);
-            packet[0] = 0x03;  // UDP消息类型
-            *(uint32_t*)&packet[1] = htonl(conn_id);
-            *(uint16_t*)&packet[5] = htons(src_port);
-            *(uint16_t*)&packet[7] = htons(dst_port);
-            *(uint16_t*)&packet[9] = htons((uint16_t)payload_len);
-            memcpy(&packet[11], payload, payload_len);
+            vector<uint8_t> packet(UDP_FRAME_HEADER + payload_len);
+            encode_udp_header(packet.data(), conn_id, src_port, dst_port, (uint16_t)payload_len);
+            memcpy(&packet[UDP_FRAME_HEADER], payload, payload_len);
 
             int sent = send(udp_tunnel_sock, (char*)packet.data(), (int)packet.size(), 0);
             if (sent != (int)packet.size()) {
@@ -3213,11 +3140,9 @@ private:
         // 发送UDP tunnel握手: conn_id(4) = 0xFFFFFFFF (特殊标记) + port(2) = 10011 (使用真实端口) + session_uuid_len(1) + session_uuid(N)
         // 注意: 服务器会为每个tunnel创建一个TunnelConnection，UDP流量通过这个连接转发
         uint8_t session_uuid_len = (uint8_t)g_session_uuid.length();
-        vector<uint8_t> handshake(7 + session_uuid_len);
-        *(uint32_t*)&handshake[0] = htonl(0xFFFFFFFF);  // 特殊conn_id标记UDP tunnel
-        *(uint16_t*)&handshake[4] = htons(10011);  // 使用10011端口作为默认游戏端口
-        handshake[6] = session_uuid_len;
-        memcpy(&handshake[7], g_session_uuid.c_str(), session_uuid_len);
+        vector<uint8_t> handshake(HANDSHAKE_HEADER + session_uuid_len);
+        // 特殊conn_id标记UDP tunnel，使用10011端口作为默认游戏端口
+        encode_handshake(handshake.data(), UDP_TUNNEL_CONN_ID, 10011, g_session_uuid.c_str(), session_uuid_len);
 
         if (send(udp_tunnel_sock, (char*)handshake.data(), handshake.size(), 0) != (int)handshake.size()) {
             int err = WSAGetLastError();
@@ -3272,12 +3197,12 @@ private:
         Logger::info("[UDP] 已发送客户端IPv4地址,等待服务器确认");
 
         // 等待服务器的握手确认(6字节: conn_id + port)
-        uint8_t ack[6];
+        uint8_t ack[HANDSHAKE_ACK_SIZE];
         DWORD timeout = 5000;  // 5秒超时
         setsockopt(udp_tunnel_sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
 
-        int received = recv(udp_tunnel_sock, (char*)ack, 6, MSG_WAITALL);
-        if (received != 6) {
+        int received = recv(udp_tunnel_sock, (char*)ack, sizeof(ack), MSG_WAITALL);
+        if (received != (int)sizeof(ack)) {
             int err = WSAGetLastError();
             Logger::error("[UDP] 握手确认失败: received=" + to_string(received) +
                         " WSA错误=" + to_string(err));
@@ -3287,10 +3212,10 @@ private:
         }
 
         // 解析握手确认
-        uint32_t ack_conn_id = ntohl(*(uint32_t*)ack);
-        uint16_t ack_port = ntohs(*(uint16_t*)(ack + 4));
+        uint32_t ack_conn_id = load_be32(ack);
+        uint16_t ack_port = load_be16(ack + 4);
 
-        if (ack_conn_id != 0xFFFFFFFF) {
+        if (ack_conn_id != UDP_TUNNEL_CONN_ID) {
             Logger::error("[UDP] 握手确认失败: 期望conn_id=0xFFFFFFFF, 收到=" + to_string(ack_conn_id));
             closesocket(udp_tunnel_sock);
             udp_tunnel_sock = INVALID_SOCKET;
@@ -3323,7 +3248,8 @@ private:
         Logger::info("[UDP] running状态: " + string(running ? "true" : "false"));
         Logger::info("[UDP] ========================================");
 
-        vector<uint8_t> buffer;
+        // 帧直接在recv_buf中解析，跨recv的半帧由decoder拼接
+        FrameDecoder decoder(frame_type_bit(FRAME_UDP_DATA));
         uint8_t recv_buf[65536];  // v12.3.7: 增大缓冲区到64KB，减少recv()调用次数
         int reconnect_attempts = 0;
         const int MAX_RECONNECT_ATTEMPTS = 5;
@@ -3380,7 +3306,7 @@ private:
                     // 重新创建UDP tunnel
                     if (create_udp_tunnel()) {
                         Logger::info("[UDP] ✓ 重连成功！清空缓冲区继续接收");
-                        buffer.clear();  // 清空缓冲区
+                        decoder.reset();  // 清空缓冲区
                         reconnect_attempts = 0;  // 重置重连计数
                         continue;  // 继续接收
                     } else {
@@ -3398,37 +3324,31 @@ private:
             reconnect_attempts = 0;
 
             Logger::debug("[UDP] ✓ ←[Tunnel] 成功接收 " + to_string(n) + "字节");
-            buffer.insert(buffer.end(), recv_buf, recv_buf + n);
+            decoder.feed(recv_buf, n);
 
             // 解析: msg_type(0x03) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
-            while (buffer.size() >= 11) {
-                uint8_t msg_type = buffer[0];
-                if (msg_type != 0x03) {
-                    Logger::warning("[UDP] 未知消息类型: " + to_string((int)msg_type));
-                    buffer.erase(buffer.begin());
+            FrameView frame;
+            for (;;) {
+                FrameResult result = decoder.next(frame);
+                if (result == FRAME_INCOMPLETE) break;
+                if (result == FRAME_UNKNOWN) {
+                    Logger::warning("[UDP] 未知消息类型: " + to_string((int)frame.type));
+                    decoder.skip(1);
                     continue;
                 }
 
-                uint32_t conn_id = ntohl(*(uint32_t*)&buffer[1]);
-                uint16_t src_port = ntohs(*(uint16_t*)&buffer[5]);
-                uint16_t dst_port = ntohs(*(uint16_t*)&buffer[7]);
-                uint16_t data_len = ntohs(*(uint16_t*)&buffer[9]);
-
-                if (buffer.size() < 11 + data_len) {
-                    Logger::debug("[UDP] 等待更多数据 (需要" + to_string(11 + data_len) +
-                                "字节，当前" + to_string(buffer.size()) + "字节)");
-                    break;
-                }
-
-                vector<uint8_t> payload(buffer.begin() + 11, buffer.begin() + 11 + data_len);
-                buffer.erase(buffer.begin(), buffer.begin() + 11 + data_len);
+                uint32_t conn_id = frame.conn_id;
+                uint16_t src_port = frame.src_port;
+                uint16_t dst_port = frame.dst_port;
+                size_t data_len = frame.length;
+                const uint8_t* payload = frame.payload;
 
                 Logger::debug("[UDP] 解析响应: conn_id=" + to_string(conn_id) +
                             " " + to_string(src_port) + "→" + to_string(dst_port) +
                             " 数据=" + to_string(data_len) + "字节");
 
                 // 特殊处理握手响应(conn_id=0xFFFFFFFF)
-                if (conn_id == 0xFFFFFFFF) {
+                if (conn_id == UDP_TUNNEL_CONN_ID) {
                     // 握手响应包,直接使用协议头的端口信息注入
                     // 协议格式: src_port=游戏服务器端口, dst_port=游戏客户端端口
                     // 响应方向: 游戏服务器 -> 游戏客户端,所以local=游戏客户端,remote=游戏服务器
@@ -3451,7 +3371,7 @@ private:
                         inject_udp_response(windivert_handle,
                                           client_ip, dst_port,           // 本地游戏客户端
                                           game_server_ip, src_port,      // 远程游戏服务器
-                                          payload.data(), payload.size(),
+                                          payload, data_len,
                                           iface_addr);
 
                         Logger::info("[UDP|握手响应] ✓ 已注入握手响应");
@@ -3494,10 +3414,10 @@ private:
                         // 使用工具函数注入UDP响应
                         Logger::info("[UDP|" + to_string(conn_id) + "] 准备注入UDP响应: 端口" +
                                    to_string(local_port) + " ← 端口" + to_string(src_port) +
-                                   " (" + to_string(payload.size()) + "字节)");
+                                   " (" + to_string(data_len) + "字节)");
 
                         inject_udp_response(windivert_handle, local_ip, local_port,
-                                          remote_ip, src_port, payload.data(), payload.size(),
+                                          remote_ip, src_port, payload, data_len,
                                           iface_addr);
                     } else {
                         Logger::error("[UDP] 解析port_key失败: " + port_key);
@@ -3537,6 +3457,8 @@ int main(int argc, char* argv[]) {
         worker_game_ip = argv[3];
         worker_tunnel_ip = argv[4];
         worker_tunnel_port = atoi(argv[5]);
+        // v12.4.1: 心跳版本(旧GUI不传，按v1)
+        if (argc >= 7) g_heartbeat_v2 = atoi(argv[6]) >= 2;
     }
 
     // 隐藏控制台窗口
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+dnf-microbench 结果对比
+
+运行方法:
+python3 bench_compare.py 基准.json 本次.json [--threshold 10] [--noise 2]
+
+按用例名称对比 ns_per_op(各轮中位数):
+- 变慢超过 threshold 百分比记为回归，退出码为1
+- 两次结果的 ns_per_op_min 相差不到 noise 百分比时不计回归(中位数受调度抖动影响，最小值更稳定)
+- 只在一边出现的用例单独列出，不影响退出码
+"""
+
+import argparse
+import json
+import sys
+
+
+def load_results(path):
+    with open(path, encoding='utf-8') as f:
+        data = json.load(f)
+    return data, {r['name']: r for r in data.get('results', [])}
+
+
+def change_percent(old, new):
+    if old <= 0:
+        return 0.0
+    return (new - old) / old * 100.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='对比两次dnf-microbench结果，标出超过阈值的回归')
+    parser.add_argument('baseline', help='基准结果JSON')
+    parser.add_argument('current', help='本次结果JSON')
+    parser.add_argument('--threshold', type=float, default=10.0, help='回归阈值，百分比(默认10)')
+    parser.add_argument('--noise', type=float, default=2.0,
+                        help='最小值变化不超过该百分比时视为噪声(默认2)')
+    args = parser.parse_args()
+
+    base_info, base = load_results(args.baseline)
+    cur_info, cur = load_results(args.current)
+
+    if base_info.get('cpu') != cur_info.get('cpu'):
+        print('注意: 两次结果的CPU不同 (%s / %s)' % (base_info.get('cpu'), cur_info.get('cpu')))
+    if base_info.get('ip_rewriter_impl') != cur_info.get('ip_rewriter_impl'):
+        print('注意: IP替换的SIMD实现不同 (%s / %s)' %
+              (base_info.get('ip_rewriter_impl'), cur_info.get('ip_rewriter_impl')))
+
+    regressions = []
+    print('%-36s %12s %12s %9s  %s' % ('用例', '基准ns/op', '本次ns/op', '变化', ''))
+    for name in [n for n in cur if n in base]:
+        old = base[name]
+        new = cur[name]
+        change = change_percent(old['ns_per_op'], new['ns_per_op'])
+        min_change = change_percent(old.get('ns_per_op_min', old['ns_per_op']),
+                                    new.get('ns_per_op_min', new['ns_per_op']))
+        mark = ''
+        if change > args.threshold:
+            if min_change > args.noise:
+                mark = '回归'
+                regressions.append((name, change))
+            else:
+                mark = '(噪声)'
+        elif change < -args.threshold:
+            mark = '提升'
+        print('%-36s %12.1f %12.1f %+8.1f%%  %s' % (name, old['ns_per_op'], new['ns_per_op'], change, mark))
+
+    only_base = [n for n in base if n not in cur]
+    only_cur = [n for n in cur if n not in base]
+    if only_base:
+        print('\n仅在基准中: ' + ', '.join(only_base))
+    if only_cur:
+        print('\n仅在本次中: ' + ', '.join(only_cur))
+
+    if regressions:
+        print('\n%d个用例变慢超过%.1f%%:' % (len(regressions), args.threshold))
+        for name, change in regressions:
+            print('  %s %+.1f%%' % (name, change))
+        return 1
+    print('\n没有超过%.1f%%的回归' % args.threshold)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,255 @@
+/*
+ * 二进制日志格式 (服务器与dnf-log-decode共用，仅头文件)
+ *
+ * 文件: 魔数"DNFBLOG1"(8字节) + 连续的记录
+ * 记录: 固定头24字节 + 参数(varint) + 字符串，整数为小端序
+ *   size(2)     整条记录的字节数
+ *   level(1)    0=DEBUG 1=INFO 2=WARN 3=ERROR
+ *   argc(1)     参数个数(不超过BINLOG_MAX_ARGS)
+ *   event(2)    事件编号(LogEventId)
+ *   str_len(2)  字符串参数字节数
+ *   time_ms(8)  UTC毫秒时间戳，北京时间在解码时换算
+ *   conn_id(4)  连接ID，0表示无
+ *   session(4)  会话序号，0表示无；序号与UUID的对应关系由EVT_SESSION记录给出
+ *   args        argc个无符号LEB128整数
+ *   str         str_len字节(UTF-8)
+ *
+ * EVT_TEXT记录的字符串即原文本日志的内容；其他事件按log_event_table中的模板还原文本:
+ *   {N} 第N个参数(十进制)  {iN} 第N个参数(有符号)  {eN} 第N个参数作为errno的说明
+ *   {s} 字符串参数  {ctx} "[连接N|UUID]"  {uctx} "[UDP Tunnel|UUID]"
+ */
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+const char BINLOG_MAGIC[] = "DNFBLOG1";
+const size_t BINLOG_MAGIC_SIZE = 8;
+const size_t BINLOG_HEADER_SIZE = 24;
+const size_t BINLOG_MAX_ARGS = 8;
+const size_t BINLOG_MAX_RECORD = 65535;
+
+enum LogEventId {
+    EVT_TEXT = 0,                   // 普通文本日志
+    EVT_SESSION = 1,                // 会话序号 → UUID(字符串)，不输出为文本
+
+    // TCP连接生命周期
+    EVT_CONN_HANDSHAKE = 16,
+    EVT_CONN_KEEPALIVE = 17,
+    EVT_CONN_GAME_CONNECTED = 18,
+    EVT_CONN_CLIENT_EOF = 19,
+    EVT_CONN_CLIENT_ERROR = 20,
+    EVT_CONN_GAME_GONE = 21,
+    EVT_CONN_GAME_FIN = 22,
+    EVT_CONN_GAME_ERROR = 23,
+    EVT_CONN_GAME_RECV_ERROR = 24,
+    EVT_CONN_LAST_RECV = 25,
+    EVT_CONN_HALF_CLOSE = 26,
+    EVT_CONN_GAME_CLOSED = 27,
+
+    // UDP隧道生命周期
+    EVT_UDP_START = 48,
+    EVT_UDP_CLIENT_EOF = 49,
+    EVT_UDP_CLIENT_ERROR = 50,
+    EVT_UDP_CLOSING = 51,
+    EVT_UDP_CLOSED = 52
+};
+
+struct LogEventInfo {
+    uint16_t id;
+    const char* name;      // JSON输出中的事件名
+    const char* format;    // 文本模板
+};
+
+const LogEventInfo log_event_table[] = {
+    {EVT_TEXT, "text", "{s}"},
+    {EVT_SESSION, "session", "{s}"},
+    {EVT_CONN_HANDSHAKE, "conn_handshake", "{ctx} 握手成功: 目标端口={0}, 客户端={s}"},
+    {EVT_CONN_KEEPALIVE, "conn_keepalive", "{ctx} ✓ TCP Keepalive已启用 (idle={0}s, interval={1}s, count={2})"},
+    {EVT_CONN_GAME_CONNECTED, "conn_game_connected", "{ctx} 已连接到游戏服务器 {s}:{0} (TCP_NODELAY)"},
+    {EVT_CONN_CLIENT_EOF, "conn_client_eof", "{ctx} 客户端正常断开 (recv返回0)"},
+    {EVT_CONN_CLIENT_ERROR, "conn_client_error", "{ctx} 客户端连接错误 (recv返回{i0}, errno={1}: {e1})"},
+    {EVT_CONN_GAME_GONE, "conn_game_gone", "{ctx} 连接已关闭 (game_fd={i0})，停止转发"},
+    {EVT_CONN_GAME_FIN, "conn_game_fin", "{ctx} [!!!关键!!!] 游戏服务器发送FIN (recv返回0)"},
+    {EVT_CONN_GAME_ERROR, "conn_game_error", "{ctx} [!!!关键!!!] 游戏服务器连接错误"},
+    {EVT_CONN_GAME_RECV_ERROR, "conn_game_recv_error", "{ctx} recv返回: {i0}, errno={1}: {e1}"},
+    {EVT_CONN_LAST_RECV, "conn_last_recv", "{ctx} 最后一次接收: {0}字节，距今 {1}ms"},
+    {EVT_CONN_HALF_CLOSE, "conn_half_close", "{ctx} 执行半关闭：游戏→客户端方向关闭，客户端→游戏方向保持"},
+    {EVT_CONN_GAME_CLOSED, "conn_game_closed", "{ctx} 已关闭游戏socket fd={0}，客户端下次发送时将关闭连接"},
+    {EVT_UDP_START, "udp_start", "{uctx} 开始处理UDP代理连接"},
+    {EVT_UDP_CLIENT_EOF, "udp_client_eof", "{uctx} 客户端正常断开 (recv返回0)"},
+    {EVT_UDP_CLIENT_ERROR, "udp_client_error", "{uctx} 客户端连接错误 (recv返回{i0}, errno={1}: {e1})"},
+    {EVT_UDP_CLOSING, "udp_closing", "{uctx} 开始清理资源"},
+    {EVT_UDP_CLOSED, "udp_closed", "{uctx} 连接已关闭"},
+};
+
+inline const LogEventInfo* find_log_event(uint16_t id) {
+    for (size_t i = 0; i < sizeof(log_event_table) / sizeof(log_event_table[0]); i++) {
+        if (log_event_table[i].id == id) return &log_event_table[i];
+    }
+    return nullptr;
+}
+
+inline const char* log_level_name(uint8_t level) {
+    static const char* const names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    return level < 4 ? names[level] : "?";
+}
+
+// UTC毫秒时间戳 → 北京时间(UTC+8) "YYYY-MM-DD HH:MM:SS.mmm"，与文本日志一致
+inline std::string binlog_format_time(uint64_t time_ms) {
+    time_t beijing_time = (time_t)(time_ms / 1000 + 8 * 3600);
+    struct tm tm_buf;
+    gmtime_r(&beijing_time, &tm_buf);
+    char text[32];
+    size_t n = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm_buf);
+    snprintf(text + n, sizeof(text) - n, ".%03u", (unsigned)(time_ms % 1000));
+    return text;
+}
+
+// ==================== 编码 ====================
+inline void binlog_store_le(uint8_t* p, uint64_t v, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint64_t binlog_load_le(const uint8_t* p, size_t bytes) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// 追加一条记录到out，字符串超出记录上限时截断
+inline void binlog_append(std::string& out, uint8_t level, uint16_t event, uint64_t time_ms,
+                          uint32_t conn_id, uint32_t session, const uint64_t* args, size_t argc,
+                          const char* str, size_t str_len) {
+    if (argc > BINLOG_MAX_ARGS) argc = BINLOG_MAX_ARGS;
+    uint8_t varints[BINLOG_MAX_ARGS * 10];
+    size_t varint_len = 0;
+    for (size_t i = 0; i < argc; i++) {
+        uint64_t v = args[i];
+        while (v >= 0x80) {
+            varints[varint_len++] = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        varints[varint_len++] = (uint8_t)v;
+    }
+    size_t max_str = BINLOG_MAX_RECORD - BINLOG_HEADER_SIZE - varint_len;
+    if (str_len > max_str) str_len = max_str;
+
+    uint8_t header[BINLOG_HEADER_SIZE];
+    binlog_store_le(header, BINLOG_HEADER_SIZE + varint_len + str_len, 2);
+    header[2] = level;
+    header[3] = (uint8_t)argc;
+    binlog_store_le(header + 4, event, 2);
+    binlog_store_le(header + 6, str_len, 2);
+    binlog_store_le(header + 8, time_ms, 8);
+    binlog_store_le(header + 16, conn_id, 4);
+    binlog_store_le(header + 20, session, 4);
+    out.append((const char*)header, BINLOG_HEADER_SIZE);
+    out.append((const char*)varints, varint_len);
+    out.append(str, str_len);
+}
+
+// ==================== 解码 ====================
+struct BinLogRecord {
+    uint8_t level;
+    uint16_t event;
+    uint64_t time_ms;
+    uint32_t conn_id;
+    uint32_t session;
+    size_t argc;
+    uint64_t args[BINLOG_MAX_ARGS];
+    const char* str;       // 指向输入缓冲
+    size_t str_len;
+};
+
+// 解析p处的一条记录，返回记录字节数；数据不完整返回0，格式错误返回SIZE_MAX
+inline size_t binlog_parse(const uint8_t* p, size_t avail, BinLogRecord& rec) {
+    if (avail < BINLOG_HEADER_SIZE) return 0;
+    size_t size = (size_t)binlog_load_le(p, 2);
+    if (size < BINLOG_HEADER_SIZE) return SIZE_MAX;
+    if (avail < size) return 0;
+
+    rec.level = p[2];
+    rec.argc = p[3];
+    rec.event = (uint16_t)binlog_load_le(p + 4, 2);
+    rec.str_len = (size_t)binlog_load_le(p + 6, 2);
+    rec.time_ms = binlog_load_le(p + 8, 8);
+    rec.conn_id = (uint32_t)binlog_load_le(p + 16, 4);
+    rec.session = (uint32_t)binlog_load_le(p + 20, 4);
+    if (rec.argc > BINLOG_MAX_ARGS || rec.str_len > size - BINLOG_HEADER_SIZE) return SIZE_MAX;
+
+    size_t pos = BINLOG_HEADER_SIZE;
+    size_t args_end = size - rec.str_len;
+    for (size_t i = 0; i < rec.argc; i++) {
+        uint64_t v = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            if (pos >= args_end || shift > 63) return SIZE_MAX;
+            uint8_t b = p[pos++];
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+        }
+        rec.args[i] = v;
+    }
+    if (pos != args_end) return SIZE_MAX;
+    rec.str = (const char*)p + args_end;
+    return size;
+}
+
+// 按事件模板还原日志正文(不含时间和级别)，session_uuid为记录所属会话的UUID
+inline void binlog_render(const BinLogRecord& rec, const std::string& session_uuid, std::string& out) {
+    const LogEventInfo* info = find_log_event(rec.event);
+    if (info == nullptr) {
+        out += "[未知事件" + std::to_string(rec.event) + "]";
+        for (size_t i = 0; i < rec.argc; i++) out += " " + std::to_string(rec.args[i]);
+        if (rec.str_len > 0) out.append(" ").append(rec.str, rec.str_len);
+        return;
+    }
+
+    const char* f = info->format;
+    while (*f) {
+        if (*f != '{') {
+            const char* next = strchr(f, '{');
+            size_t n = next ? (size_t)(next - f) : strlen(f);
+            out.append(f, n);
+            f += n;
+            continue;
+        }
+        const char* close = strchr(f, '}');
+        if (close == nullptr) {
+            out += f;
+            break;
+        }
+        std::string key(f + 1, close - f - 1);
+        f = close + 1;
+
+        if (key == "s") {
+            out.append(rec.str, rec.str_len);
+        } else if (key == "ctx") {
+            out += "[连接" + std::to_string(rec.conn_id);
+            if (!session_uuid.empty()) out += "|" + session_uuid;
+            out += "]";
+        } else if (key == "uctx") {
+            out += session_uuid.empty() ? "[UDP Tunnel]" : "[UDP Tunnel|" + session_uuid + "]";
+        } else {
+            char kind = (key[0] == 'i' || key[0] == 'e') ? key[0] : 'u';
+            size_t index = (size_t)atoi(key.c_str() + (kind == 'u' ? 0 : 1));
+            uint64_t v = index < rec.argc ? rec.args[index] : 0;
+            if (kind == 'i') {
+                out += std::to_string((int64_t)v);
+            } else if (kind == 'e') {
+                out += strerror((int)v);
+            } else {
+                out += std::to_string(v);
+            }
+        }
+    }
+}
+
+#endif // BINARY_LOG_H
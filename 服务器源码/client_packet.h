@@ -0,0 +1,113 @@
+/*
+ * 客户端注入包的构造 (客户端与dnf-microbench共用，仅头文件)
+ *
+ * calculate_checksum: IP/TCP校验和(16位反码和)
+ * ip_str_to_bytes: 点分十进制IPv4转为4字节
+ * build_complete_packet: 游戏服务器→游戏客户端方向的完整IPv4+TCP包(含伪头部校验和)，由WinDivert注入
+ *
+ * - 客户端源码目录的编译脚本通过 /I"..\服务器源码" 引入，g++ -std=c++11 与 MSVC /std:c++14 均可编译
+ */
+
+#ifndef CLIENT_PACKET_H
+#define CLIENT_PACKET_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+inline uint16_t calculate_checksum(const uint8_t* data, int len) {
+    uint32_t sum = 0;
+    for (int i = 0; i < len - 1; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (len % 2 == 1) {
+        sum += data[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+inline void ip_str_to_bytes(const std::string& ip, uint8_t* bytes) {
+    int a, b, c, d;
+    sscanf(ip.c_str(), "%d.%d.%d.%d", &a, &b, &c, &d);
+    bytes[0] = a; bytes[1] = b; bytes[2] = c; bytes[3] = d;
+}
+
+// src_ip/src_port为游戏客户端，dst_ip/dst_port为游戏服务器(与TCPConnection成员同名)；
+// 包的方向为 游戏服务器 → 游戏客户端，ip_id每次加一
+inline std::vector<uint8_t> build_complete_packet(const std::string& src_ip, uint16_t src_port,
+                                                  const std::string& dst_ip, uint16_t dst_port,
+                                                  uint16_t& ip_id, uint8_t flags, uint32_t seq, uint32_t ack,
+                                                  const uint8_t* payload, int payload_len, uint16_t window) {
+    // 构造TCP头部（无校验和）
+    uint8_t tcp_header[20];
+    *(uint16_t*)&tcp_header[0] = htons(dst_port);  // 源端口（游戏服务器）
+    *(uint16_t*)&tcp_header[2] = htons(src_port);  // 目标端口（游戏客户端）
+    *(uint32_t*)&tcp_header[4] = htonl(seq);
+    *(uint32_t*)&tcp_header[8] = htonl(ack);
+    tcp_header[12] = 5 << 4;  // 数据偏移
+    tcp_header[13] = flags;
+    *(uint16_t*)&tcp_header[14] = htons(window);
+    *(uint16_t*)&tcp_header[16] = 0;  // 校验和（稍后计算）
+    *(uint16_t*)&tcp_header[18] = 0;  // 紧急指针
+
+    // 构造伪头部
+    uint8_t src_ip_bytes[4], dst_ip_bytes[4];
+    ip_str_to_bytes(dst_ip, src_ip_bytes);  // 源IP（游戏服务器）
+    ip_str_to_bytes(src_ip, dst_ip_bytes);  // 目标IP（游戏客户端）
+
+    std::vector<uint8_t> pseudo_header(12);
+    memcpy(&pseudo_header[0], src_ip_bytes, 4);
+    memcpy(&pseudo_header[4], dst_ip_bytes, 4);
+    pseudo_header[8] = 0;
+    pseudo_header[9] = 6;  // TCP协议
+    *(uint16_t*)&pseudo_header[10] = htons(20 + payload_len);
+
+    // 计算TCP校验和
+    std::vector<uint8_t> checksum_data = pseudo_header;
+    checksum_data.insert(checksum_data.end(), tcp_header, tcp_header + 20);
+    if (payload_len > 0) {
+        checksum_data.insert(checksum_data.end(), payload, payload + payload_len);
+    }
+
+    uint16_t tcp_checksum = calculate_checksum(checksum_data.data(), (int)checksum_data.size());
+    *(uint16_t*)&tcp_header[16] = tcp_checksum;
+
+    // 构造IP头部（无校验和）
+    uint8_t ip_header[20];
+    ip_header[0] = 0x45;  // 版本4 + 头长度5
+    ip_header[1] = 0;  // TOS
+    *(uint16_t*)&ip_header[2] = htons(20 + 20 + payload_len);  // 总长度
+    *(uint16_t*)&ip_header[4] = htons(ip_id++);
+    *(uint16_t*)&ip_header[6] = 0;  // 标志 + 片偏移
+    ip_header[8] = 64;  // TTL
+    ip_header[9] = 6;  // 协议（TCP）
+    *(uint16_t*)&ip_header[10] = 0;  // 校验和（稍后计算）
+    memcpy(&ip_header[12], src_ip_bytes, 4);
+    memcpy(&ip_header[16], dst_ip_bytes, 4);
+
+    // 计算IP校验和
+    uint16_t ip_checksum = calculate_checksum(ip_header, 20);
+    *(uint16_t*)&ip_header[10] = ip_checksum;
+
+    // 组合完整包
+    std::vector<uint8_t> packet;
+    packet.insert(packet.end(), ip_header, ip_header + 20);
+    packet.insert(packet.end(), tcp_header, tcp_header + 20);
+    if (payload_len > 0) {
+        packet.insert(packet.end(), payload, payload + payload_len);
+    }
+
+    return packet;
+}
+
+#endif // CLIENT_PACKET_H
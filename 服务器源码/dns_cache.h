@@ -0,0 +1,295 @@
+/*
+ * 游戏服务器地址的DNS缓存 (服务器与dnf-microbench共用，仅头文件)
+ *
+ * DnsCache: 按(host, socktype)缓存getaddrinfo结果，热路径不加锁读取，后台线程定期重新解析
+ *
+ * DnsCache的静态成员在本文件中定义，一个程序中只能由一个源文件包含
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "logger.h"
+
+// v6.8: game_server_ip 的解析结果缓存，替代每个UDP包/每条TCP连接一次的getaddrinfo
+//       - 启动时按ServerConfig预解析，热路径只读缓存，不再阻塞在解析器上
+//       - 后台线程每dns_refresh_sec秒重新解析域名(getaddrinfo不返回TTL，以此作为TTL)，
+//         解析失败时保留旧地址；IP字面量只解析一次
+//       - 读取不加互斥锁: 地址列表为shared_ptr，整体替换(std::atomic_load/atomic_store)，
+//         旧列表在最后一个读者释放引用后才销毁
+//       - 按(host, socktype)缓存，端口在读取时填入(端口不影响解析结果)
+struct ResolvedAddrs {
+    std::vector<sockaddr_storage> addrs;
+    std::vector<socklen_t> lens;
+};
+
+class DnsCache {
+public:
+    static const size_t MAX_ENTRIES = 64;
+
+    // 启动时预解析(同步)，start()之前调用
+    static void preresolve(const std::string& host, int socktype) {
+        Entry* e = find_or_add(host, socktype);
+        if (e != nullptr) refresh_entry(e);
+    }
+
+    // refresh_sec: 域名重新解析间隔，0表示不刷新
+    static void start(int refresh_sec) {
+        refresh_interval_ms = refresh_sec > 0 ? (uint64_t)refresh_sec * 1000 : 0;
+        stopping = false;
+        refresh_thread = std::thread(refresh_loop);
+    }
+
+    static void stop() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_cv.notify_all();
+        if (refresh_thread.joinable()) refresh_thread.join();
+        LOG_INFO("DNS缓存统计: 命中=" + std::to_string(hits.load()) +
+                ", 未命中=" + std::to_string(misses.load()) +
+                ", 刷新=" + std::to_string(refreshes.load()) +
+                ", 解析失败=" + std::to_string(failures.load()));
+    }
+
+    // 取出host的全部地址并填入端口，返回地址个数；0表示未命中(已通知后台线程解析，不阻塞)
+    static size_t lookup(const std::string& host, int socktype, uint16_t port,
+                         std::vector<sockaddr_storage>& addrs, std::vector<socklen_t>& lens) {
+        std::shared_ptr<const ResolvedAddrs> list = acquire(host, socktype);
+        if (!list) return 0;
+        for (size_t i = 0; i < list->addrs.size(); i++) {
+            addrs.push_back(list->addrs[i]);
+            set_port(addrs.back(), port);
+            lens.push_back(list->lens[i]);
+        }
+        return list->addrs.size();
+    }
+
+    // 只取第一个地址(UDP发送)
+    static bool lookup_first(const std::string& host, int socktype, uint16_t port,
+                             sockaddr_storage& addr, socklen_t& len) {
+        std::shared_ptr<const ResolvedAddrs> list = acquire(host, socktype);
+        if (!list) return false;
+        addr = list->addrs[0];
+        len = list->lens[0];
+        set_port(addr, port);
+        return true;
+    }
+
+    static uint64_t hit_count() { return hits.load(std::memory_order_relaxed); }
+    static uint64_t miss_count() { return misses.load(std::memory_order_relaxed); }
+    static uint64_t refresh_count() { return refreshes.load(std::memory_order_relaxed); }
+    static uint64_t failure_count() { return failures.load(std::memory_order_relaxed); }
+    static size_t entries_count() { return entry_count.load(std::memory_order_acquire); }
+
+private:
+    struct Entry {
+        std::string host;
+        int socktype;
+        bool numeric;
+        // 只通过std::atomic_load/atomic_store访问
+        std::shared_ptr<const ResolvedAddrs> current;
+        std::atomic<bool> resolve_pending;
+    };
+
+    // 条目只追加不删除，entry_count发布后host/socktype不再修改
+    static Entry entries[MAX_ENTRIES];
+    static std::atomic<size_t> entry_count;
+    static std::mutex add_mutex;
+
+    static std::thread refresh_thread;
+    static std::mutex wake_mutex;
+    static std::condition_variable wake_cv;
+    static bool stopping;
+    static bool wake_requested;
+    static uint64_t refresh_interval_ms;
+
+    static std::atomic<uint64_t> hits;
+    static std::atomic<uint64_t> misses;
+    static std::atomic<uint64_t> refreshes;
+    static std::atomic<uint64_t> failures;
+
+    static uint64_t now_ms() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void set_port(sockaddr_storage& addr, uint16_t port) {
+        if (addr.ss_family == AF_INET) {
+            ((sockaddr_in*)&addr)->sin_port = htons(port);
+        } else if (addr.ss_family == AF_INET6) {
+            ((sockaddr_in6*)&addr)->sin6_port = htons(port);
+        }
+    }
+
+    static Entry* find(const std::string& host, int socktype) {
+        size_t count = entry_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            if (entries[i].socktype == socktype && entries[i].host == host) return &entries[i];
+        }
+        return nullptr;
+    }
+
+    static Entry* find_or_add(const std::string& host, int socktype) {
+        Entry* e = find(host, socktype);
+        if (e != nullptr) return e;
+
+        std::lock_guard<std::mutex> lock(add_mutex);
+        e = find(host, socktype);
+        if (e != nullptr) return e;
+        size_t count = entry_count.load(std::memory_order_relaxed);
+        if (count >= MAX_ENTRIES) {
+            LOG_ERROR("DNS缓存已满，无法缓存: " + host);
+            return nullptr;
+        }
+        e = &entries[count];
+        e->host = host;
+        e->socktype = socktype;
+        in6_addr tmp;
+        e->numeric = inet_pton(AF_INET, host.c_str(), &tmp) == 1 ||
+                     inet_pton(AF_INET6, host.c_str(), &tmp) == 1;
+        std::atomic_store(&e->current, std::shared_ptr<const ResolvedAddrs>());
+        e->resolve_pending.store(false, std::memory_order_relaxed);
+        entry_count.store(count + 1, std::memory_order_release);
+        return e;
+    }
+
+    static std::shared_ptr<const ResolvedAddrs> acquire(const std::string& host, int socktype) {
+        Entry* e = find(host, socktype);
+        std::shared_ptr<const ResolvedAddrs> list;
+        if (e != nullptr) list = std::atomic_load(&e->current);
+        if (list) {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return list;
+        }
+
+        // 未命中: 交给刷新线程解析，当前调用直接失败
+        misses.fetch_add(1, std::memory_order_relaxed);
+        if (e == nullptr) e = find_or_add(host, socktype);
+        if (e != nullptr && !e->resolve_pending.exchange(true)) {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                wake_requested = true;
+            }
+            wake_cv.notify_one();
+        }
+        return nullptr;
+    }
+
+    // 解析一个条目并替换地址列表，返回是否成功
+    static bool refresh_entry(Entry* e) {
+        struct addrinfo hints{}, *result = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = e->socktype;
+        hints.ai_protocol = e->socktype == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP;
+        hints.ai_flags = e->numeric ? AI_NUMERICHOST : 0;
+
+        int ret = getaddrinfo(e->host.c_str(), nullptr, &hints, &result);
+        e->resolve_pending.store(false);
+        refreshes.fetch_add(1, std::memory_order_relaxed);
+        if (ret != 0 || result == nullptr) {
+            failures.fetch_add(1, std::memory_order_relaxed);
+            LOG_ERROR("DNS解析失败: " + e->host + " (错误: " + gai_strerror(ret) + ")" +
+                     (std::atomic_load(&e->current) ? "，继续使用旧地址" : ""));
+            return false;
+        }
+
+        std::shared_ptr<ResolvedAddrs> list = std::make_shared<ResolvedAddrs>();
+        for (struct addrinfo* rp = result; rp != nullptr; rp = rp->ai_next) {
+            sockaddr_storage addr{};
+            memcpy(&addr, rp->ai_addr, rp->ai_addrlen);
+            list->addrs.push_back(addr);
+            list->lens.push_back(rp->ai_addrlen);
+        }
+        freeaddrinfo(result);
+
+        std::shared_ptr<const ResolvedAddrs> old = std::atomic_load(&e->current);
+        if (old && same_addrs(*old, *list)) return true;
+
+        // 旧列表在最后一个读者释放引用时才销毁
+        std::atomic_store(&e->current, std::shared_ptr<const ResolvedAddrs>(list));
+        if (old) {
+            LOG_INFO("DNS地址已更新: " + e->host + " (" + std::to_string(list->addrs.size()) + "个地址)");
+        } else {
+            LOG_DEBUG("DNS解析成功: " + e->host + " (" + std::to_string(list->addrs.size()) + "个地址)");
+        }
+        return true;
+    }
+
+    static bool same_addrs(const ResolvedAddrs& a, const ResolvedAddrs& b) {
+        if (a.addrs.size() != b.addrs.size()) return false;
+        for (size_t i = 0; i < a.addrs.size(); i++) {
+            if (a.lens[i] != b.lens[i] || memcmp(&a.addrs[i], &b.addrs[i], a.lens[i]) != 0) return false;
+        }
+        return true;
+    }
+
+    static void refresh_loop() {
+        pthread_setname_np(pthread_self(), "dns-refresh");
+        // 解析失败的条目重试间隔
+        const uint64_t retry_ms = 5000;
+        uint64_t next_refresh = refresh_interval_ms > 0 ? now_ms() + refresh_interval_ms : 0;
+
+        for (;;) {
+            bool full_refresh = false;
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                uint64_t wait_ms = retry_ms;
+                if (next_refresh > 0) {
+                    uint64_t now = now_ms();
+                    wait_ms = std::min(wait_ms, next_refresh > now ? next_refresh - now : 0);
+                }
+                wake_cv.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                                 [] { return stopping || wake_requested; });
+                if (stopping) break;
+                wake_requested = false;
+                if (next_refresh > 0 && now_ms() >= next_refresh) {
+                    full_refresh = true;
+                    next_refresh = now_ms() + refresh_interval_ms;
+                }
+            }
+
+            // 未解析成功的条目随时重试；已有地址的域名按刷新间隔重新解析
+            size_t count = entry_count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                Entry* e = &entries[i];
+                bool missing = !std::atomic_load(&e->current);
+                if (missing || (full_refresh && !e->numeric)) refresh_entry(e);
+            }
+        }
+    }
+};
+
+// 静态成员初始化
+DnsCache::Entry DnsCache::entries[DnsCache::MAX_ENTRIES];
+std::atomic<size_t> DnsCache::entry_count(0);
+std::mutex DnsCache::add_mutex;
+std::thread DnsCache::refresh_thread;
+std::mutex DnsCache::wake_mutex;
+std::condition_variable DnsCache::wake_cv;
+bool DnsCache::stopping = false;
+bool DnsCache::wake_requested = false;
+uint64_t DnsCache::refresh_interval_ms = 0;
+std::atomic<uint64_t> DnsCache::hits(0);
+std::atomic<uint64_t> DnsCache::misses(0);
+std::atomic<uint64_t> DnsCache::refreshes(0);
+std::atomic<uint64_t> DnsCache::failures(0);
+
+#endif // DNS_CACHE_H
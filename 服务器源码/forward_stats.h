@@ -0,0 +1,53 @@
+/*
+ * 转发计数器 (服务器与dnf-microbench共用，仅头文件)
+ *
+ * StatCounter: 每个会话/分片的计数项，STAT_NAMES为GET_STATS与/metrics中的名称
+ * ForwardStats: 一组计数器，单写者relaxed load+store累加，读取方随时汇总
+ */
+
+#ifndef FORWARD_STATS_H
+#define FORWARD_STATS_H
+
+#include <atomic>
+#include <cstdint>
+
+// v6.18: 每个会话(TunnelConnection/UdpTunnel)一组计数器，只由所属worker线程写入，
+//        用relaxed load+store累加(没有lock前缀的原子加)
+// v6.19: 会话同时累加到所属worker的分片(服务器汇总)，GET_STATS汇总和/metrics只读分片，
+//        不再遍历会话、不持有conn_mutex；会话列表仍在conn_mutex内读取
+enum StatCounter {
+    STAT_FRAMES_TO_GAME,     // 客户端→游戏: TCP数据帧 + UDP数据报
+    STAT_BYTES_TO_GAME,      // 客户端→游戏: payload字节数
+    STAT_FRAMES_TO_CLIENT,   // 游戏→客户端: 0x01/0x03帧
+    STAT_BYTES_TO_CLIENT,    // 游戏→客户端: payload字节数
+    STAT_HEARTBEATS,
+    STAT_REWRITE_HITS,       // payload中替换的IP个数
+    STAT_SEND_FAILURES,      // 发往客户端/游戏服务器失败的次数(UDP按数据报计)
+    STAT_COUNT
+};
+
+static const char* const STAT_NAMES[STAT_COUNT] = {
+    "frames_to_game", "bytes_to_game", "frames_to_client", "bytes_to_client",
+    "heartbeats", "ip_rewrite_hits", "send_failures"
+};
+
+struct ForwardStats {
+    std::atomic<uint64_t> counters[STAT_COUNT];
+
+    ForwardStats() {
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+    }
+
+    // 单写者: 只能在所属worker线程调用
+    void add(StatCounter c, uint64_t n) {
+        counters[c].store(counters[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get(int c) const { return counters[c].load(std::memory_order_relaxed); }
+
+    void sum_into(uint64_t* values) const {
+        for (int i = 0; i < STAT_COUNT; i++) values[i] += get(i);
+    }
+};
+
+#endif // FORWARD_STATS_H
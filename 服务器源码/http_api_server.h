@@ -1,23 +1,23 @@
 /*
  * HTTP API服务器头文件
+ * v6.19: 只提供 GET /metrics (Prometheus文本格式)，服务器列表由TCP配置服务器(GET_SERVERS)提供
  */
 
 #ifndef HTTP_API_SERVER_H
 #define HTTP_API_SERVER_H
 
 #include <pthread.h>
+#include <functional>
+#include <string>
 
-// 启动HTTP API服务器
-// config_file: config.json路径
-// tunnel_server_ip: 隧道服务器IP (返回给客户端)
-// api_port: API服务器监听端口
+// 启动HTTP指标服务器
+// bind_ip: 监听地址 (IPv4)
+// port: 监听端口
+// metrics_provider: 生成/metrics响应内容，在HTTP线程中调用，不能阻塞转发线程
 // 返回: 服务器线程ID,失败返回0
-pthread_t start_http_api_server(const char* config_file, const char* tunnel_server_ip, int api_port);
+pthread_t start_http_api_server(const char* bind_ip, int port, std::function<std::string()> metrics_provider);
 
-// 停止HTTP API服务器
+// 停止HTTP指标服务器(之后pthread_join返回的线程)
 void stop_http_api_server();
 
-// 重新加载配置（热重载）
-bool reload_http_api_config();
-
 #endif // HTTP_API_SERVER_H
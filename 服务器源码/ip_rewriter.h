@@ -0,0 +1,337 @@
+/*
+ * payload中的IP替换 (服务器使用，仅头文件)
+ *
+ * IpRewriter在连接建立时由 旧IP/新IP 字符串构造一次，之后每个数据块只做扫描和替换:
+ *   IPv4: 同时匹配 网络字节序 [a b c d] 与 DNF逐字节反向 [d c b a] 两种格式，替换为新IP的同格式字节
+ *   IPv6: 匹配16字节地址(可选，新旧IP均为IPv6时)
+ *
+ * - 从左到右不重叠匹配，同一位置优先网络字节序，与原 replace_ip_in_payload 结果一致
+ * - 候选位置由SIMD一次比较16/32个起点的前4字节(SSE2/AVX2，运行时按CPU选择)，非x86平台使用标量实现
+ * - 不写日志，不分配内存；需要替换位置时由调用方传入matches数组
+ * - rewrite_stream额外返回末尾可能是被截断的IP的字节数，调用方暂存后与下一块拼接(跨recv的IP)
+ * extract_tcp_source_ip: 从连接地址字符串([ip]:port)取出客户端IP，用于关联UDP隧道上报的真实IPv4
+ */
+
+#ifndef IP_REWRITER_H
+#define IP_REWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IP_REWRITER_X86 1
+#endif
+
+enum IpMatchKind { IP_MATCH_BE = 0, IP_MATCH_DNF = 1, IP_MATCH_V6 = 2 };
+
+struct IpMatch {
+    uint32_t offset;
+    uint8_t kind;    // IpMatchKind
+};
+
+class IpRewriter {
+public:
+    enum Impl { IMPL_SCALAR, IMPL_SSE2, IMPL_AVX2 };
+
+    IpRewriter() : pattern_count(0) {}
+
+    // 解析IP并预编码匹配/替换字节；两者须同为IPv4或同为IPv6，否则返回false(rewrite不做任何替换)
+    bool init(const std::string& old_ip, const std::string& new_ip) {
+        pattern_count = 0;
+        uint8_t old_bytes[16], new_bytes[16];
+        if (inet_pton(AF_INET, old_ip.c_str(), old_bytes) == 1 &&
+            inet_pton(AF_INET, new_ip.c_str(), new_bytes) == 1) {
+            add_pattern(old_bytes, new_bytes, 4, IP_MATCH_BE);
+            uint8_t old_rev[4] = {old_bytes[3], old_bytes[2], old_bytes[1], old_bytes[0]};
+            uint8_t new_rev[4] = {new_bytes[3], new_bytes[2], new_bytes[1], new_bytes[0]};
+            // 回文IP(如 1.2.2.1)两种格式相同，只保留一个
+            if (memcmp(old_rev, old_bytes, 4) != 0) add_pattern(old_rev, new_rev, 4, IP_MATCH_DNF);
+            return true;
+        }
+        if (inet_pton(AF_INET6, old_ip.c_str(), old_bytes) == 1 &&
+            inet_pton(AF_INET6, new_ip.c_str(), new_bytes) == 1) {
+            add_pattern(old_bytes, new_bytes, 16, IP_MATCH_V6);
+            return true;
+        }
+        return false;
+    }
+
+    bool valid() const { return pattern_count > 0; }
+
+    // 最长模式的字节数(IPv4为4，IPv6为16)，未初始化时为0
+    size_t pattern_length() const { return pattern_count > 0 ? patterns[0].len : 0; }
+
+    // 原地替换data中的旧IP，返回替换次数；matches非空时记录前max_matches个替换的位置
+    size_t rewrite(uint8_t* data, size_t len, IpMatch* matches = nullptr, size_t max_matches = 0) const {
+        return rewrite_with(active_impl(), data, len, matches, max_matches);
+    }
+
+    size_t rewrite_with(Impl impl, uint8_t* data, size_t len,
+                        IpMatch* matches = nullptr, size_t max_matches = 0) const {
+        if (pattern_count == 0 || len < 4) return 0;
+        Scan scan(this, data, len, matches, max_matches);
+        run(impl, scan);
+        return scan.count;
+    }
+
+    // 流式替换: 与rewrite相同，另外在tail中返回末尾(最后一次替换之后)与某个模式开头相同的字节数(< pattern_length)
+    // 这些字节可能是被截断的IP，调用方暂存后放在下一块之前，用carry_match拼接匹配
+    size_t rewrite_stream(uint8_t* data, size_t len, size_t& tail,
+                          IpMatch* matches = nullptr, size_t max_matches = 0) const {
+        tail = 0;
+        if (pattern_count == 0) return 0;
+        Scan scan(this, data, len, matches, max_matches);
+        if (len >= 4) run(active_impl(), scan);
+        tail = prefix_tail(data + scan.last_end, len - scan.last_end);
+        return scan.count;
+    }
+
+    // 暂存的carry(carry_len字节)与下一块开头next(next_len字节)拼接后，匹配起点在carry中的IP
+    // 命中时替换carry与next中对应字节，返回next中被该IP占用的字节数(之后从此处继续扫描)，未命中返回0
+    size_t carry_match(uint8_t* carry, size_t carry_len, uint8_t* next, size_t next_len,
+                       IpMatch* match = nullptr) const {
+        if (pattern_count == 0 || carry_len == 0) return 0;
+        uint8_t joined[32];
+        size_t take = pattern_length() - 1;
+        if (take > next_len) take = next_len;
+        if (carry_len + take > sizeof(joined)) return 0;
+        memcpy(joined, carry, carry_len);
+        memcpy(joined + carry_len, next, take);
+
+        IpMatch first;
+        if (rewrite_with(IMPL_SCALAR, joined, carry_len + take, &first, 1) == 0 ||
+            first.offset >= carry_len) {
+            return 0;  // 起点不在carry中的IP由下一块自己的扫描处理
+        }
+        size_t used = first.offset + pattern_len_of(first.kind) - carry_len;
+        memcpy(carry, joined, carry_len);
+        memcpy(next, joined + carry_len, used);
+        if (match != nullptr) *match = first;
+        return used;
+    }
+
+    // data末尾与某个模式开头相同的最长字节数(小于模式长度)
+    size_t prefix_tail(const uint8_t* data, size_t len) const {
+        size_t max_k = pattern_length() > 0 ? pattern_length() - 1 : 0;
+        if (max_k > len) max_k = len;
+        for (size_t k = max_k; k > 0; k--) {
+            for (int i = 0; i < pattern_count; i++) {
+                if (memcmp(data + len - k, patterns[i].match, k) == 0) return k;
+            }
+        }
+        return 0;
+    }
+
+    static Impl active_impl() {
+        static const Impl impl = detect_impl();
+        return impl;
+    }
+
+    static const char* impl_name(Impl impl) {
+        return impl == IMPL_AVX2 ? "avx2" : impl == IMPL_SSE2 ? "sse2" : "scalar";
+    }
+
+private:
+    struct Pattern {
+        uint8_t match[16];
+        uint8_t replace[16];
+        uint32_t head;       // match前4字节(按内存顺序载入)，用于候选比较
+        uint8_t len;
+        uint8_t kind;
+    };
+    Pattern patterns[2];
+    int pattern_count;
+
+    // 一次扫描的状态；pos之前的位置已处理完毕(包括被替换覆盖的字节)
+    struct Scan {
+        const IpRewriter* self;
+        uint8_t* data;
+        size_t len;
+        size_t pos;
+        size_t last_end;     // 最后一次替换的结束位置
+        size_t count;
+        IpMatch* matches;
+        size_t max_matches;
+
+        Scan(const IpRewriter* s, uint8_t* d, size_t n, IpMatch* m, size_t max_m)
+            : self(s), data(d), len(n), pos(0), last_end(0), count(0), matches(m), max_matches(max_m) {}
+    };
+
+    void run(Impl impl, Scan& scan) const {
+#ifdef IP_REWRITER_X86
+        if (impl == IMPL_AVX2) {
+            scan_avx2(scan);
+        } else if (impl == IMPL_SSE2) {
+            scan_sse2(scan);
+        }
+#else
+        (void)impl;
+#endif
+        scan_scalar(scan);
+    }
+
+    size_t pattern_len_of(uint8_t kind) const {
+        for (int k = 0; k < pattern_count; k++) {
+            if (patterns[k].kind == kind) return patterns[k].len;
+        }
+        return 0;
+    }
+
+
+    void add_pattern(const uint8_t* match, const uint8_t* replace, uint8_t len, uint8_t kind) {
+        Pattern& p = patterns[pattern_count++];
+        memset(&p, 0, sizeof(p));
+        memcpy(p.match, match, len);
+        memcpy(p.replace, replace, len);
+        memcpy(&p.head, match, 4);
+        p.len = len;
+        p.kind = kind;
+    }
+
+    static Impl detect_impl() {
+#ifdef IP_REWRITER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return IMPL_AVX2;
+        if (__builtin_cpu_supports("sse2")) return IMPL_SSE2;
+#endif
+        return IMPL_SCALAR;
+    }
+
+    // 位置i的前4字节已与某个模式的head相同：按优先级确认完整匹配并替换，返回是否替换
+    static bool try_replace(Scan& scan, size_t i) {
+        const IpRewriter* self = scan.self;
+        for (int k = 0; k < self->pattern_count; k++) {
+            const Pattern& p = self->patterns[k];
+            if (i + p.len > scan.len) continue;
+            if (memcmp(scan.data + i, p.match, p.len) != 0) continue;
+            memcpy(scan.data + i, p.replace, p.len);
+            if (scan.count < scan.max_matches) {
+                scan.matches[scan.count].offset = (uint32_t)i;
+                scan.matches[scan.count].kind = p.kind;
+            }
+            scan.count++;
+            scan.pos = i + p.len;
+            scan.last_end = scan.pos;
+            return true;
+        }
+        return false;
+    }
+
+    // 处理一个块内的候选位置(bit j 对应 base + j)
+    static void consume_mask(Scan& scan, size_t base, uint32_t mask) {
+        while (mask != 0) {
+            size_t i = base + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+            if (i < scan.pos) continue;
+            try_replace(scan, i);
+        }
+    }
+
+    static void scan_scalar(Scan& scan) {
+        const IpRewriter* self = scan.self;
+        uint32_t head0 = self->patterns[0].head;
+        uint32_t head1 = self->pattern_count > 1 ? self->patterns[1].head : head0;
+        size_t i = scan.pos;
+        while (i + 4 <= scan.len) {
+            uint32_t v;
+            memcpy(&v, scan.data + i, 4);
+            if ((v == head0 || v == head1) && try_replace(scan, i)) {
+                i = scan.pos;
+            } else {
+                i++;
+            }
+        }
+        scan.pos = i;
+    }
+
+#ifdef IP_REWRITER_X86
+    // 每次比较16个起点: 对偏移0..3的四次非对齐载入分别与模式的第0..3字节比较
+    __attribute__((target("sse2")))
+    static void scan_sse2(Scan& scan) {
+        const IpRewriter* self = scan.self;
+        const Pattern& a = self->patterns[0];
+        const Pattern& b = self->patterns[self->pattern_count > 1 ? 1 : 0];
+        __m128i a0 = _mm_set1_epi8((char)a.match[0]), a1 = _mm_set1_epi8((char)a.match[1]);
+        __m128i a2 = _mm_set1_epi8((char)a.match[2]), a3 = _mm_set1_epi8((char)a.match[3]);
+        __m128i b0 = _mm_set1_epi8((char)b.match[0]), b1 = _mm_set1_epi8((char)b.match[1]);
+        __m128i b2 = _mm_set1_epi8((char)b.match[2]), b3 = _mm_set1_epi8((char)b.match[3]);
+
+        size_t base = scan.pos;
+        while (base + 16 + 3 <= scan.len) {
+            const uint8_t* p = scan.data + base;
+            __m128i x0 = _mm_loadu_si128((const __m128i*)p);
+            __m128i x1 = _mm_loadu_si128((const __m128i*)(p + 1));
+            __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 2));
+            __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 3));
+            __m128i ma = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(x0, a0), _mm_cmpeq_epi8(x1, a1)),
+                                       _mm_and_si128(_mm_cmpeq_epi8(x2, a2), _mm_cmpeq_epi8(x3, a3)));
+            __m128i mb = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(x0, b0), _mm_cmpeq_epi8(x1, b1)),
+                                       _mm_and_si128(_mm_cmpeq_epi8(x2, b2), _mm_cmpeq_epi8(x3, b3)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(ma, mb));
+            if (mask != 0) consume_mask(scan, base, mask);
+            base += 16;
+            if (scan.pos > base) base = scan.pos;
+        }
+        if (scan.pos < base) scan.pos = base;
+    }
+
+    __attribute__((target("avx2")))
+    static void scan_avx2(Scan& scan) {
+        const IpRewriter* self = scan.self;
+        const Pattern& a = self->patterns[0];
+        const Pattern& b = self->patterns[self->pattern_count > 1 ? 1 : 0];
+        __m256i a0 = _mm256_set1_epi8((char)a.match[0]), a1 = _mm256_set1_epi8((char)a.match[1]);
+        __m256i a2 = _mm256_set1_epi8((char)a.match[2]), a3 = _mm256_set1_epi8((char)a.match[3]);
+        __m256i b0 = _mm256_set1_epi8((char)b.match[0]), b1 = _mm256_set1_epi8((char)b.match[1]);
+        __m256i b2 = _mm256_set1_epi8((char)b.match[2]), b3 = _mm256_set1_epi8((char)b.match[3]);
+
+        size_t base = scan.pos;
+        while (base + 32 + 3 <= scan.len) {
+            const uint8_t* p = scan.data + base;
+            __m256i x0 = _mm256_loadu_si256((const __m256i*)p);
+            __m256i x1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+            __m256i x2 = _mm256_loadu_si256((const __m256i*)(p + 2));
+            __m256i x3 = _mm256_loadu_si256((const __m256i*)(p + 3));
+            __m256i ma = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(x0, a0), _mm256_cmpeq_epi8(x1, a1)),
+                                          _mm256_and_si256(_mm256_cmpeq_epi8(x2, a2), _mm256_cmpeq_epi8(x3, a3)));
+            __m256i mb = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(x0, b0), _mm256_cmpeq_epi8(x1, b1)),
+                                          _mm256_and_si256(_mm256_cmpeq_epi8(x2, b2), _mm256_cmpeq_epi8(x3, b3)));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(ma, mb));
+            if (mask != 0) consume_mask(scan, base, mask);
+            base += 32;
+            if (scan.pos > base) base = scan.pos;
+        }
+        if (scan.pos < base) scan.pos = base;
+        // 剩余不足一个AVX2块的部分先用SSE2
+        scan_sse2(scan);
+    }
+#endif
+};
+
+// v5.0: 从client_str中提取TCP源IP（不含端口），用于查找该客户端上报的真实IPv4
+// TunnelServer与微基准测试(microbench.cpp)共用
+// 输入: "[::ffff:192.168.2.1]:56601" 或 "[240e:...]:12345"
+// 输出: "192.168.2.1" 或 "240e:..."
+inline std::string extract_tcp_source_ip(const std::string& client_str) {
+    size_t start = client_str.find('[');
+    size_t end = client_str.find(']');
+    if (start == std::string::npos || end == std::string::npos || end <= start) {
+        return "";  // 格式错误
+    }
+
+    std::string ip_part = client_str.substr(start + 1, end - start - 1);  // 提取[...]中的内容
+
+    // 检查是否为IPv4映射IPv6格式: ::ffff:x.x.x.x
+    const std::string ipv4_prefix = "::ffff:";
+    if (ip_part.find(ipv4_prefix) == 0) {
+        return ip_part.substr(ipv4_prefix.length());  // 返回IPv4部分
+    }
+
+    return ip_part;  // 返回完整IP（IPv6或其他格式）
+}
+
+#endif // IP_REWRITER_H
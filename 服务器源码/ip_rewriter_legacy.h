@@ -0,0 +1,149 @@
+/*
+ * v6.12之前的 replace_ip_in_payload 原样副本 (dnf-microbench与rewrite_test对照用，仅头文件，服务器不包含)
+ *
+ * ip_rewrite/.../legacy 用例测量该实现的耗时(含每次调用拼接日志前缀、INFO日志)，
+ * rewrite_test用随机数据检查IpRewriter各实现的替换结果与之相同
+ * 函数体保持原样(未限定std::)，放在单独的命名空间中
+ */
+
+#ifndef IP_REWRITER_LEGACY_H
+#define IP_REWRITER_LEGACY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <arpa/inet.h>
+#include "logger.h"
+
+namespace legacy {
+using namespace std;
+
+// 在payload中查找并替换IP地址(支持大端序和小端序)
+// payload: 数据载荷
+// payload_len: 数据长度
+// old_ip: 要替换的IP地址(如"192.168.2.75")
+// new_ip: 新的IP地址(如"222.187.12.82")
+// conn_id: 连接ID（用于日志）
+// session_uuid: 会话UUID（用于日志）
+// 返回: 替换次数
+inline int replace_ip_in_payload(uint8_t* payload, size_t payload_len,
+                         const string& old_ip, const string& new_ip,
+                         int conn_id = 0, const string& session_uuid = "") {
+    // 生成日志前缀
+    string log_prefix;
+    if (conn_id > 0 && !session_uuid.empty()) {
+        log_prefix = "[连接" + to_string(conn_id) + "|" + session_uuid + "][IP替换] ";
+    } else if (conn_id > 0) {
+        log_prefix = "[连接" + to_string(conn_id) + "][IP替换] ";
+    } else if (!session_uuid.empty()) {
+        log_prefix = "[" + session_uuid + "][IP替换] ";
+    } else {
+        log_prefix = "[IP替换] ";
+    }
+
+    // 检查payload是否足够大(至少4字节才可能包含IP)
+    if (payload_len < 4) {
+        Logger::debug(log_prefix + "payload太小(" + to_string(payload_len) +
+                     "字节),跳过IP替换");
+        return 0;
+    }
+
+    // 将IP字符串转换为字节
+    struct in_addr old_addr, new_addr;
+    if (inet_pton(AF_INET, old_ip.c_str(), &old_addr) != 1 ||
+        inet_pton(AF_INET, new_ip.c_str(), &new_addr) != 1) {
+        Logger::error(log_prefix + "IP地址格式错误: " + old_ip + " -> " + new_ip);
+        return 0;
+    }
+
+    // 提取IP的4个字节(网络字节序,大端序)
+    uint8_t* old_bytes = (uint8_t*)&old_addr.s_addr;
+    uint8_t* new_bytes = (uint8_t*)&new_addr.s_addr;
+
+    // 构造各种格式
+    uint32_t old_ip_be = old_addr.s_addr;  // 大端序(网络字节序)
+    uint32_t new_ip_be = new_addr.s_addr;
+
+    // DNF逐字节反向格式: a.b.c.d -> d c b a
+    // 修复v4.5.4: 字节序列[d c b a]在小端系统读取为uint32_t时，需要按正序组合
+    uint32_t old_ip_reversed = (old_bytes[0] << 24) | (old_bytes[1] << 16) |
+                               (old_bytes[2] << 8) | old_bytes[3];
+    uint32_t new_ip_reversed = (new_bytes[0] << 24) | (new_bytes[1] << 16) |
+                               (new_bytes[2] << 8) | new_bytes[3];
+
+    int replace_count = 0;
+
+    // ===== 详细调试信息 =====
+    char debug_buf[200];
+    sprintf(debug_buf, "调试: old_bytes=[%02x,%02x,%02x,%02x] old_ip_be=0x%08x old_ip_reversed=0x%08x",
+            old_bytes[0], old_bytes[1], old_bytes[2], old_bytes[3],
+            old_ip_be, old_ip_reversed);
+    Logger::debug(log_prefix + string(debug_buf));
+
+    // 打印查找的目标
+    if (payload_len >= 4) {
+        char hex[100];
+        sprintf(hex, "%02x %02x %02x %02x (大端) / %02x %02x %02x %02x (DNF反向)",
+                old_bytes[0], old_bytes[1], old_bytes[2], old_bytes[3],
+                old_bytes[3], old_bytes[2], old_bytes[1], old_bytes[0]);
+        Logger::debug(log_prefix + "查找IP " + old_ip + " 格式: " + string(hex));
+
+        // 打印payload前64字节
+        string payload_hex = "";
+        for (size_t i = 0; i < min((size_t)64, payload_len); i++) {
+            char hbuf[4];
+            sprintf(hbuf, "%02x ", payload[i]);
+            payload_hex += hbuf;
+            if ((i + 1) % 16 == 0) payload_hex += "\n                    ";
+        }
+        Logger::debug(log_prefix + "Payload(" + to_string(payload_len) + "字节):\n                    " + payload_hex);
+    }
+
+    // 扫描payload,查找并替换IP
+    for (size_t i = 0; i + 3 < payload_len; i++) {
+        uint32_t* ip_ptr = (uint32_t*)(payload + i);
+        uint32_t ip_value = *ip_ptr;
+
+        // 详细调试：打印每个位置的扫描结果（只打印前10个位置）
+        if (i < 10 && payload_len <= 20) {
+            char scan_buf[150];
+            sprintf(scan_buf, "扫描位置%zu: [%02x %02x %02x %02x] = 0x%08x (大端匹配:%s DNF匹配:%s)",
+                    i, payload[i], payload[i+1], payload[i+2], payload[i+3], ip_value,
+                    (ip_value == old_ip_be ? "YES" : "no"),
+                    (ip_value == old_ip_reversed ? "YES" : "no"));
+            Logger::debug(log_prefix + string(scan_buf));
+        }
+
+        // 检查大端序(网络字节序)匹配
+        if (ip_value == old_ip_be) {
+            *ip_ptr = new_ip_be;
+            replace_count++;
+            Logger::info(log_prefix + "位置" + to_string(i) + " 大端序: " +
+                         old_ip + " -> " + new_ip);
+            i += 3;
+        }
+        // 检查DNF逐字节反向格式匹配
+        else if (ip_value == old_ip_reversed) {
+            *ip_ptr = new_ip_reversed;
+            replace_count++;
+            Logger::info(log_prefix + "位置" + to_string(i) + " DNF逐字节反向: " +
+                         old_ip + " -> " + new_ip);
+            i += 3;
+        }
+    }
+
+    if (replace_count > 0) {
+        Logger::info(log_prefix + "✓ 完成: " + old_ip + " -> " + new_ip +
+                    " (替换" + to_string(replace_count) + "处)");
+    } else {
+        Logger::info(log_prefix + "✗ 未找到IP " + old_ip + " (payload=" +
+                    to_string(payload_len) + "字节)");
+    }
+
+    return replace_count;
+}
+
+} // namespace legacy
+
+#endif // IP_REWRITER_LEGACY_H
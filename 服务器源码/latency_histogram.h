@@ -0,0 +1,124 @@
+/*
+ * 转发延迟直方图 (服务器与dnf-microbench共用，仅头文件)
+ *
+ * LatencyHistogram: 对数线性分桶(纳秒)，单写者relaxed累加，读取方随时汇总
+ * LatencySnapshot: 直方图的一份拷贝，计算分位数、两次快照相减
+ * monotonic_ns: 每次recv读取的时钟(recv返回时一次、帧写出后一次)
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <time.h>
+
+inline uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// v6.20: 直方图的一份拷贝(读取方汇总/两次快照相减)，分位数取所在桶的上界(不超过max)
+struct LatencySnapshot;
+
+// v6.19: 对数线性分桶的延迟直方图(纳秒)：每个2的幂区间分8个子桶，相对误差<12.5%，上限约2^39ns
+//        单写者(所属worker线程)，读取方relaxed读取各桶
+// v6.20: 同时记录最大值
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = 38 * SUB_COUNT;
+
+    LatencyHistogram() {
+        for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+        sum_ns.store(0, std::memory_order_relaxed);
+        max_ns.store(0, std::memory_order_relaxed);
+    }
+
+    static int bucket_of(uint64_t ns) {
+        if (ns < (uint64_t)SUB_COUNT) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int index = (msb - SUB_BITS + 1) * SUB_COUNT + (int)((ns >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+        return index < BUCKETS ? index : BUCKETS - 1;
+    }
+
+    // 桶的上界(不含)；子桶7的上界正好是2的幂
+    static uint64_t bucket_upper(int index) {
+        if (index < SUB_COUNT) return (uint64_t)index + 1;
+        int group = index / SUB_COUNT;
+        int sub = index % SUB_COUNT;
+        return (uint64_t)(SUB_COUNT + sub + 1) << (group - 1);
+    }
+
+    // 单写者: 只能在所属worker线程调用；count个样本记为同一个值
+    void record(uint64_t ns, uint64_t count) {
+        std::atomic<uint64_t>& b = buckets[bucket_of(ns)];
+        b.store(b.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        sum_ns.store(sum_ns.load(std::memory_order_relaxed) + ns * count, std::memory_order_relaxed);
+        if (ns > max_ns.load(std::memory_order_relaxed)) max_ns.store(ns, std::memory_order_relaxed);
+    }
+
+    void sum_into(LatencySnapshot& snap) const;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> sum_ns;
+    std::atomic<uint64_t> max_ns;
+};
+
+struct LatencySnapshot {
+    uint64_t counts[LatencyHistogram::BUCKETS];
+    uint64_t sum_ns;
+    uint64_t max_ns;
+
+    LatencySnapshot() { clear(); }
+
+    void clear() {
+        memset(counts, 0, sizeof(counts));
+        sum_ns = 0;
+        max_ns = 0;
+    }
+
+    uint64_t total() const {
+        uint64_t n = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) n += counts[i];
+        return n;
+    }
+
+    // q: 0~1，没有样本时返回0
+    uint64_t percentile(double q) const {
+        uint64_t n = total();
+        if (n == 0) return 0;
+        uint64_t rank = (uint64_t)(q * n);
+        if (rank < q * n || rank == 0) rank++;
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(LatencyHistogram::bucket_upper(i), max_ns);
+        }
+        return max_ns;
+    }
+
+    // this - earlier，用于按周期输出；区间最大值取最高非空桶的上界(不超过累计max)
+    void subtract(const LatencySnapshot& earlier) {
+        int highest = -1;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            counts[i] -= earlier.counts[i];
+            if (counts[i] > 0) highest = i;
+        }
+        sum_ns -= earlier.sum_ns;
+        max_ns = highest < 0 ? 0 : std::min(LatencyHistogram::bucket_upper(highest), max_ns);
+    }
+};
+
+inline void LatencyHistogram::sum_into(LatencySnapshot& snap) const {
+    for (int i = 0; i < BUCKETS; i++) snap.counts[i] += buckets[i].load(std::memory_order_relaxed);
+    snap.sum_ns += sum_ns.load(std::memory_order_relaxed);
+    snap.max_ns = std::max(snap.max_ns, max_ns.load(std::memory_order_relaxed));
+}
+
+#endif // LATENCY_HISTOGRAM_H
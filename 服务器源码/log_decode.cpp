@@ -0,0 +1,221 @@
+/*
+ * dnf-log-decode - 二进制日志(log_format=binary)解码工具
+ *
+ * 用法: dnf-log-decode [--json] [--conn ID] [--session UUID] 文件... (文件为 - 时读标准输入)
+ *   默认输出与文本日志相同的格式: "YYYY-MM-DD HH:MM:SS.mmm [LEVEL] 内容"
+ *   --json       每条记录一行JSON(time/time_ms/level/event/conn_id/session/args/str/msg)
+ *   --conn ID    只输出该连接的记录
+ *   --session U  只输出该会话UUID的记录
+ * 普通文本记录(EVT_TEXT)没有结构化的conn_id/会话，按内容中的"[连接ID]"/"[连接ID|"和UUID匹配
+ * 多个文件按参数顺序解码，会话序号→UUID的对应关系跨文件保留；输入可以是多个文件直接拼接(zcat -f)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "binary_log.h"
+
+using namespace std;
+
+struct DecodeOptions {
+    bool json = false;
+    bool filter_conn = false;
+    uint32_t conn_id = 0;
+    string session;
+};
+
+static map<uint32_t, string> sessions;
+
+static void usage() {
+    fprintf(stderr, "用法: dnf-log-decode [--json] [--conn ID] [--session UUID] 文件...\n");
+}
+
+static void append_json_string(string& out, const char* s, size_t len) {
+    out += '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\r') {
+            out += "\\r";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+static bool text_contains(const BinLogRecord& rec, const string& needle) {
+    return string(rec.str, rec.str_len).find(needle) != string::npos;
+}
+
+static bool matches(const BinLogRecord& rec, const string& uuid, const DecodeOptions& opt) {
+    if (opt.filter_conn) {
+        if (rec.event == EVT_TEXT) {
+            string id = "[连接" + to_string(opt.conn_id);
+            if (!text_contains(rec, id + "]") && !text_contains(rec, id + "|")) return false;
+        } else if (rec.conn_id != opt.conn_id) {
+            return false;
+        }
+    }
+    if (!opt.session.empty()) {
+        if (rec.event == EVT_TEXT) {
+            if (!text_contains(rec, opt.session)) return false;
+        } else if (uuid != opt.session) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void output(const BinLogRecord& rec, const string& uuid, const DecodeOptions& opt, string& out) {
+    string msg;
+    binlog_render(rec, uuid, msg);
+    if (!opt.json) {
+        out += binlog_format_time(rec.time_ms);
+        out.append(" [").append(log_level_name(rec.level)).append("] ").append(msg).append(1, '\n');
+        return;
+    }
+
+    const LogEventInfo* info = find_log_event(rec.event);
+    out += "{\"time\":\"" + binlog_format_time(rec.time_ms) + "\",\"time_ms\":" + to_string(rec.time_ms);
+    out += ",\"level\":\"" + string(log_level_name(rec.level)) + "\",\"event\":";
+    if (info != nullptr) {
+        out += "\"" + string(info->name) + "\"";
+    } else {
+        out += to_string(rec.event);
+    }
+    if (rec.conn_id != 0) out += ",\"conn_id\":" + to_string(rec.conn_id);
+    if (!uuid.empty()) {
+        out += ",\"session\":";
+        append_json_string(out, uuid.data(), uuid.size());
+    }
+    if (rec.argc > 0) {
+        out += ",\"args\":[";
+        for (size_t i = 0; i < rec.argc; i++) {
+            if (i > 0) out += ',';
+            out += to_string(rec.args[i]);
+        }
+        out += ']';
+    }
+    if (rec.str_len > 0 && rec.event != EVT_TEXT) {
+        out += ",\"str\":";
+        append_json_string(out, rec.str, rec.str_len);
+    }
+    out += ",\"msg\":";
+    append_json_string(out, msg.data(), msg.size());
+    out += "}\n";
+}
+
+// 解码一个文件，返回false表示文件无法打开或格式错误
+static bool decode_file(const char* path, const DecodeOptions& opt) {
+    bool use_stdin = strcmp(path, "-") == 0;
+    FILE* f = use_stdin ? stdin : fopen(path, "rb");
+    if (f == nullptr) {
+        fprintf(stderr, "无法打开文件: %s\n", path);
+        return false;
+    }
+
+    vector<uint8_t> buf(1 << 20);
+    size_t len = fread(buf.data(), 1, BINLOG_MAGIC_SIZE, f);
+    if (len != BINLOG_MAGIC_SIZE || memcmp(buf.data(), BINLOG_MAGIC, BINLOG_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s: 不是二进制日志文件\n", path);
+        if (!use_stdin) fclose(f);
+        return false;
+    }
+
+    bool ok = true;
+    string out;
+    len = 0;
+    for (;;) {
+        size_t n = fread(buf.data() + len, 1, buf.size() - len, f);
+        len += n;
+
+        size_t pos = 0;
+        BinLogRecord rec;
+        for (;;) {
+            // 拼接的下一个文件的魔数
+            if (len - pos >= BINLOG_MAGIC_SIZE && memcmp(buf.data() + pos, BINLOG_MAGIC, BINLOG_MAGIC_SIZE) == 0) {
+                pos += BINLOG_MAGIC_SIZE;
+                continue;
+            }
+            size_t size = binlog_parse(buf.data() + pos, len - pos, rec);
+            if (size == 0) break;
+            if (size == SIZE_MAX) {
+                fprintf(stderr, "%s: 记录格式错误，停止解码\n", path);
+                ok = false;
+                break;
+            }
+            pos += size;
+
+            if (rec.event == EVT_SESSION) {
+                sessions[rec.session].assign(rec.str, rec.str_len);
+                continue;
+            }
+            static const string none;
+            map<uint32_t, string>::const_iterator it = rec.session != 0 ? sessions.find(rec.session) : sessions.end();
+            const string& uuid = it != sessions.end() ? it->second : none;
+            if (matches(rec, uuid, opt)) output(rec, uuid, opt, out);
+        }
+        if (!out.empty()) {
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+        if (!ok) break;
+
+        memmove(buf.data(), buf.data() + pos, len - pos);
+        len -= pos;
+        if (n == 0) {
+            if (len > 0) fprintf(stderr, "%s: 末尾有%zu字节不完整的记录(写入中或已截断)\n", path, len);
+            break;
+        }
+    }
+
+    if (!use_stdin) fclose(f);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    DecodeOptions opt;
+    vector<const char*> files;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--json") {
+            opt.json = true;
+        } else if (arg == "--conn" && i + 1 < argc) {
+            opt.filter_conn = true;
+            opt.conn_id = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--session" && i + 1 < argc) {
+            opt.session = argv[++i];
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else if (arg.size() > 1 && arg[0] == '-' && arg != "-") {
+            usage();
+            return 2;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 2;
+    }
+
+    int status = 0;
+    for (const char* path : files) {
+        if (!decode_file(path, opt)) status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,760 @@
+/*
+ * 异步日志 (服务器与dnf-microbench共用，仅头文件)
+ *
+ * Logger: 调用线程格式化到无锁环形队列，后台写线程批量写入文件/控制台，支持轮转、压缩和写入预算
+ * LOG_DEBUG/LOG_INFO/LOG_WARN/LOG_ERROR/LOG_EVENT: 先判断级别再求值参数
+ *
+ * Logger的静态成员在本文件中定义，一个程序中只能由一个源文件包含
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "binary_log.h"
+
+// v6.16: 日志中的会话标识。二进制日志只记录conn_id和会话序号，序号与UUID的对应关系在分配时写入一次
+struct LogSession {
+    uint32_t conn_id = 0;
+    uint32_t index = 0;       // 0表示无会话
+    std::string uuid;
+};
+
+// v6.14: 异步日志。调用线程只做级别过滤、格式化到环形队列的槽位(无锁，多生产者)，
+// 后台线程按flush间隔/积压字节数批量写入文件和控制台；队列满时按配置丢弃或等待
+// v6.16: log_format=binary时槽位中是binary_log.h的二进制记录，控制台输出由写线程还原为文本
+// v6.17: 写线程按大小/时间轮转日志文件，旧文件由低I/O优先级的gzip子进程压缩，超出保留个数时删除最旧的；
+//        二进制日志的新文件开头先写入仍在使用的会话表(序号→UUID)；
+//        写入文件的字节数可限制为每秒上限，超出的日志(ERROR和会话记录除外)丢弃并计数
+class Logger {
+public:
+    enum Priority { PRIORITY_DEBUG = 0, PRIORITY_INFO = 1, PRIORITY_WARN = 2, PRIORITY_ERROR = 3 };
+
+private:
+    // 槽位的内部优先级: 会话序号→UUID记录(EVT_SESSION)，不受写入预算限制，队列满时等待而不丢弃
+    // (丢失后该会话的所有二进制日志都无法还原UUID)；记录本身的级别仍为DEBUG
+    static const int PRIORITY_SESSION = PRIORITY_ERROR + 1;
+
+    // 队列槽位: seq为Vyukov有界MPMC队列的序号，line保留容量以便复用
+    struct Slot {
+        std::atomic<size_t> seq;
+        int priority;
+        std::string line;
+    };
+    static const size_t QUEUE_SIZE = 16384;   // 2的幂
+
+    static int log_fd;
+    static std::atomic<int> min_priority;
+    static Slot* slots;
+    static std::atomic<size_t> enqueue_pos;
+    static size_t dequeue_pos;                // 只由写线程访问
+    static std::atomic<size_t> pending_bytes;
+    static std::atomic<uint64_t> dropped;
+
+    static std::thread writer;
+    static std::atomic<bool> running;
+    static std::mutex wake_mutex;
+    static std::condition_variable wake_cv;
+
+    // 运行参数(configure可在运行中修改)
+    static std::atomic<int> flush_interval_ms;
+    static std::atomic<size_t> flush_bytes;
+    static std::atomic<bool> block_when_full;
+    static std::atomic<bool> console_enabled;
+
+    static bool binary_format;                // 只在init时设置
+    static std::atomic<uint32_t> session_counter;
+
+    // 二进制日志中仍可能出现的会话(序号 -> conn_id/UUID)，轮转时先写入新文件，新文件可单独解码
+    // 会话结束(end_session)后，等它之前入队的日志全部写出才移除
+    struct LiveSession {
+        uint32_t conn_id;
+        std::string uuid;
+    };
+    static std::mutex sessions_mutex;
+    static std::map<uint32_t, LiveSession> live_sessions;
+    static std::deque<std::pair<size_t, uint32_t>> ended_sessions;   // (结束时的enqueue_pos, 会话序号)
+    static std::string gzip_path;             // 第一次压缩前在PATH中查找，子进程直接execv
+
+    // v6.17: 文件轮转(以下状态只由写线程访问，init之前/close之后由调用线程访问)
+    static std::string file_prefix;                // 如 "log/server_log_"，文件名再加北京时间和扩展名
+    static std::string file_ext;
+    static std::string current_file;
+    static size_t file_bytes;
+    static size_t file_header_bytes;          // 新文件开头的魔数和会话表，不计入轮转判断
+    static std::chrono::steady_clock::time_point file_opened;
+    static std::vector<std::string> compress_queue;
+    static pid_t compress_pid;
+    static std::string compressing;
+    static int64_t budget_window;             // 当前预算窗口(秒)
+    static size_t budget_used;
+    static std::atomic<uint64_t> budget_dropped;
+
+    static std::atomic<size_t> rotate_bytes;       // 0表示不按大小轮转
+    static std::atomic<int> rotate_sec;            // 0表示不按时间轮转
+    static std::atomic<int> keep_files;            // 0表示不删除
+    static std::atomic<bool> compress_rotated;
+    static std::atomic<size_t> max_bytes_per_sec;  // 0表示不限制
+
+public:
+    static void set_log_level(const std::string& level) {
+        min_priority = parse_priority(level);
+    }
+
+    // v6.15: 该级别的日志是否会输出(LOG_*宏在求值参数前调用)
+    static bool enabled(int priority) {
+        return priority >= min_priority.load(std::memory_order_relaxed);
+    }
+
+    // 日志文件名为 prefix + 北京时间(YYYYMMDD_HHMMSS) + ext，轮转后的新文件同样命名
+    // binary: 写入二进制记录(binary_log.h)，新文件以魔数开头
+    static void init(const std::string& prefix, const std::string& ext, bool binary = false) {
+        binary_format = binary;
+        file_prefix = prefix;
+        file_ext = ext;
+        open_file();
+
+        if (slots == nullptr) slots = new Slot[QUEUE_SIZE];   // close()后再次init时复用
+        for (size_t i = 0; i < QUEUE_SIZE; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+        enqueue_pos = 0;
+        dequeue_pos = 0;
+        running = true;
+        writer = std::thread(writer_loop);
+        pthread_setname_np(writer.native_handle(), "logger");
+
+        info("日志文件已初始化(北京时间): " + current_file);
+    }
+
+    // flush_ms: 写线程最长等待时间；bytes: 积压达到该字节数时立即写入
+    // block: 队列满时等待(否则丢弃并计数)；console: 同时输出到控制台
+    static void configure(int flush_ms, size_t bytes, bool block, bool console) {
+        flush_interval_ms = std::max(1, flush_ms);
+        flush_bytes = std::max((size_t)1, bytes);
+        block_when_full = block;
+        console_enabled = console;
+    }
+
+    // v6.17: 轮转与写入预算
+    // rotate_mb: 文件超过该大小(MB)时轮转；rotate_hours: 文件打开超过该小时数时轮转；0表示不按该条件轮转
+    // keep: 最多保留的日志文件个数(含当前文件，0表示不删除)；compress: gzip压缩轮转出的文件
+    // bytes_per_sec: 每秒最多写入文件的字节数(0表示不限制)
+    static void configure_files(int rotate_mb, int rotate_hours, int keep, bool compress, size_t bytes_per_sec) {
+        rotate_bytes = (size_t)std::max(0, rotate_mb) * 1024 * 1024;
+        rotate_sec = std::max(0, rotate_hours) * 3600;
+        keep_files = std::max(0, keep);
+        compress_rotated = compress;
+        max_bytes_per_sec = bytes_per_sec;
+    }
+
+    // 停止写线程并写出队列中剩余的日志
+    static void close() {
+        if (running.exchange(false)) {
+            wake_cv.notify_one();
+            if (writer.joinable()) writer.join();
+        }
+        if (log_fd >= 0) {
+            ::close(log_fd);
+            log_fd = -1;
+        }
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        for (const auto& e : ended_sessions) live_sessions.erase(e.second);
+        ended_sessions.clear();
+    }
+
+    static void info(const std::string& msg) {
+        log(PRIORITY_INFO, msg);
+    }
+
+    static void error(const std::string& msg) {
+        log(PRIORITY_ERROR, msg);
+    }
+
+    static void warning(const std::string& msg) {
+        log(PRIORITY_WARN, msg);
+    }
+
+    static void debug(const std::string& msg) {
+        log(PRIORITY_DEBUG, msg);
+    }
+
+    // v6.16: 为连接分配会话序号；二进制日志写入一条序号→UUID记录(不受日志级别、写入预算限制，队列满时也不丢弃)
+    static LogSession session(uint32_t conn_id, const std::string& uuid) {
+        LogSession s;
+        s.conn_id = conn_id;
+        s.uuid = uuid;
+        if (uuid.empty()) return s;
+        s.index = session_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (binary_format) {
+            {
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                live_sessions[s.index] = LiveSession{conn_id, uuid};
+            }
+            enqueue(PRIORITY_SESSION, [&](std::string& line) {
+                binlog_append(line, PRIORITY_DEBUG, EVT_SESSION, now_ms(), conn_id, s.index,
+                              nullptr, 0, uuid.data(), uuid.size());
+            });
+        }
+        return s;
+    }
+
+    // v6.17: 会话结束(连接/UDP隧道对象销毁)，之后轮转出的新文件不再带该会话的序号→UUID记录
+    static void end_session(const LogSession& s) {
+        if (s.index == 0 || !binary_format) return;
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        if (!running.load(std::memory_order_acquire)) {
+            live_sessions.erase(s.index);
+            return;
+        }
+        ended_sessions.push_back(std::make_pair(enqueue_pos.load(std::memory_order_relaxed), s.index));
+    }
+
+    // v6.16: 结构化事件(binary_log.h的log_event_table)，二进制日志只记录事件编号和数值参数，
+    // 文本日志按同一模板格式化；通过LOG_EVENT宏调用
+    template <class... Args>
+    static void event(int priority, LogEventId id, const LogSession& session, const std::string& str, Args... args) {
+        uint64_t values[] = {0, (uint64_t)args...};   // 首元素占位，允许没有数值参数
+        emit_event(priority, id, session, str, values + 1, sizeof...(Args));
+    }
+
+
+    static uint64_t dropped_count() { return dropped.load(std::memory_order_relaxed); }
+    static uint64_t budget_dropped_count() { return budget_dropped.load(std::memory_order_relaxed); }
+
+    // 崩溃时由信号处理函数调用: 把队列中尚未写出的日志直接写入文件(只用write，不修改队列状态)
+    static void flush_on_crash() {
+        if (slots == nullptr || log_fd < 0) return;
+        for (size_t pos = dequeue_pos; ; pos++) {
+            Slot* slot = &slots[pos & (QUEUE_SIZE - 1)];
+            if (slot->seq.load(std::memory_order_acquire) != pos + 1) break;
+            ssize_t ret = ::write(log_fd, slot->line.data(), slot->line.size());
+            (void)ret;
+        }
+    }
+
+private:
+    static int parse_priority(const std::string& level) {
+        if (level == "DEBUG") return PRIORITY_DEBUG;
+        if (level == "WARN") return PRIORITY_WARN;
+        if (level == "ERROR") return PRIORITY_ERROR;
+        return PRIORITY_INFO;
+    }
+
+    // 北京时间(UTC+8)时间戳 "YYYY-MM-DD HH:MM:SS.mmm"，每个线程缓存到秒，毫秒部分单独填写
+    static const char* timestamp() {
+        struct Cache {
+            int64_t sec = -1;
+            char text[32];
+        };
+        static thread_local Cache cache;
+
+        auto now = std::chrono::system_clock::now();
+        int64_t ms_total = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+        int64_t sec = ms_total / 1000;
+        if (sec != cache.sec) {
+            time_t beijing_time = (time_t)(sec + 8 * 3600);
+            struct tm tm_buf;
+            gmtime_r(&beijing_time, &tm_buf);
+            strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S.000", &tm_buf);
+            cache.sec = sec;
+        }
+        int ms = (int)(ms_total % 1000);
+        cache.text[20] = (char)('0' + ms / 100);
+        cache.text[21] = (char)('0' + ms / 10 % 10);
+        cache.text[22] = (char)('0' + ms % 10);
+        return cache.text;
+    }
+
+    static uint64_t now_ms() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static void emit_event(int priority, LogEventId id, const LogSession& session, const std::string& str,
+                           const uint64_t* args, size_t argc) {
+        if (priority < min_priority.load(std::memory_order_relaxed)) return;
+        enqueue(priority, [&](std::string& line) {
+            if (binary_format) {
+                binlog_append(line, (uint8_t)priority, id, now_ms(), session.conn_id, session.index,
+                              args, argc, str.data(), str.size());
+                return;
+            }
+            BinLogRecord rec;
+            rec.level = (uint8_t)priority;
+            rec.event = id;
+            rec.time_ms = 0;
+            rec.conn_id = session.conn_id;
+            rec.session = session.index;
+            rec.argc = std::min(argc, BINLOG_MAX_ARGS);
+            std::copy(args, args + rec.argc, rec.args);
+            rec.str = str.data();
+            rec.str_len = str.size();
+            line.append(timestamp(), 23).append(" [").append(log_level_name(rec.level)).append("] ");
+            binlog_render(rec, session.uuid, line);
+            line.append(1, '\n');
+        });
+    }
+
+    static void log(int priority, const std::string& msg) {
+        // 如果当前日志级别低于设定级别，不输出
+        if (priority < min_priority.load(std::memory_order_relaxed)) return;
+        enqueue(priority, [&](std::string& line) { append_text(line, priority, msg); });
+    }
+
+    // 文本日志的一行，或二进制日志的一条EVT_TEXT记录
+    static void append_text(std::string& out, int priority, const std::string& msg) {
+        if (binary_format) {
+            binlog_append(out, (uint8_t)priority, EVT_TEXT, now_ms(), 0, 0, nullptr, 0, msg.data(), msg.size());
+            return;
+        }
+        out.append(timestamp(), 23);
+        out.append(" [").append(log_level_name((uint8_t)priority)).append("] ").append(msg).append(1, '\n');
+    }
+
+    // fill(line)把一条日志写入槽位(line已清空，保留容量)
+    template <class Fill>
+    static void enqueue(int priority, const Fill& fill) {
+        if (!running.load(std::memory_order_acquire)) {
+            // 写线程未启动或已停止: 直接输出
+            std::string line;
+            fill(line);
+            write_batch(line);
+            return;
+        }
+
+        Slot* slot = claim_slot(priority == PRIORITY_SESSION);
+        if (slot == nullptr) return;
+        size_t pos = slot->seq.load(std::memory_order_relaxed);
+        slot->priority = priority;
+        slot->line.clear();
+        fill(slot->line);
+        size_t bytes = slot->line.size();
+        slot->seq.store(pos + 1, std::memory_order_release);
+
+        size_t total = pending_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (priority == PRIORITY_ERROR || (total >= flush_bytes.load(std::memory_order_relaxed) &&
+                                           total - bytes < flush_bytes.load(std::memory_order_relaxed))) {
+            wake_cv.notify_one();
+        }
+    }
+
+    // 取得一个空闲槽位(seq暂存其位置)，队列满且策略为丢弃时返回nullptr
+    // must_keep: 队列满时总是等待(会话记录)
+    static Slot* claim_slot(bool must_keep) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot* slot = &slots[pos & (QUEUE_SIZE - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    // 写入完成前seq保持为pos，写线程不会读取该槽位
+                    return slot;
+                }
+            } else if (diff < 0) {
+                // 队列已满(写线程已停止时不再等待)
+                if ((!must_keep && !block_when_full.load(std::memory_order_relaxed)) ||
+                    !running.load(std::memory_order_acquire)) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                wake_cv.notify_one();
+                std::this_thread::yield();
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static void writer_loop() {
+        std::string batch;
+        batch.reserve(256 * 1024);
+        uint64_t reported_drops = 0;
+        uint64_t budget_unreported = 0;
+        int64_t budget_reported_window = 0;
+        for (;;) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            if (!stopping && pending_bytes.load(std::memory_order_relaxed) < flush_bytes.load(std::memory_order_relaxed)) {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake_cv.wait_for(lock, std::chrono::milliseconds(flush_interval_ms.load(std::memory_order_relaxed)));
+            }
+
+            // 取出所有已写完的槽位
+            uint64_t budget_drops = 0;
+            for (;;) {
+                Slot* slot = &slots[dequeue_pos & (QUEUE_SIZE - 1)];
+                if (slot->seq.load(std::memory_order_acquire) != dequeue_pos + 1) break;
+                if (take_budget(slot->line.size(), slot->priority)) {
+                    batch.append(slot->line);
+                } else {
+                    budget_drops++;
+                }
+                pending_bytes.fetch_sub(slot->line.size(), std::memory_order_relaxed);
+                slot->seq.store(dequeue_pos + QUEUE_SIZE, std::memory_order_release);
+                dequeue_pos++;
+            }
+
+            uint64_t drops = dropped.load(std::memory_order_relaxed);
+            if (drops != reported_drops) {
+                append_text(batch, PRIORITY_WARN, "日志队列已满，已丢弃" + std::to_string(drops - reported_drops) + "条日志");
+                reported_drops = drops;
+            }
+            // 超出写入预算的丢弃数每秒最多报告一次
+            budget_dropped.fetch_add(budget_drops, std::memory_order_relaxed);
+            budget_unreported += budget_drops;
+            if (budget_unreported > 0 && (budget_window != budget_reported_window || stopping)) {
+                append_text(batch, PRIORITY_WARN, "日志写入超出每秒上限(log_max_bytes_per_sec)，已丢弃" +
+                            std::to_string(budget_unreported) + "条日志");
+                budget_unreported = 0;
+                budget_reported_window = budget_window;
+            }
+
+            rotate_if_needed(batch.size());
+            if (!batch.empty()) {
+                write_batch(batch);
+                batch.clear();
+            }
+            forget_ended_sessions();
+            reap_compressor();
+            if (stopping) break;
+        }
+    }
+
+    // 每秒写入预算，ERROR日志和会话记录总是写入(仍计入用量)
+    static bool take_budget(size_t bytes, int priority) {
+        size_t limit = max_bytes_per_sec.load(std::memory_order_relaxed);
+        if (limit == 0) return true;
+        int64_t window = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (window != budget_window) {
+            budget_window = window;
+            budget_used = 0;
+        }
+        if (budget_used + bytes > limit && priority < PRIORITY_ERROR) return false;
+        budget_used += bytes;
+        return true;
+    }
+
+    // 打开新的日志文件，成功后才关闭旧文件
+    static void open_file() {
+        auto now = std::chrono::system_clock::now();
+        time_t beijing_time = std::chrono::system_clock::to_time_t(now + std::chrono::hours(8));
+        struct tm tm_buf;
+        gmtime_r(&beijing_time, &tm_buf);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm_buf);
+
+        // 同一秒内的文件加递增序号(_001...)，文件名排序即创建顺序
+        static std::string last_stamp;
+        static int stamp_seq = 0;
+        stamp_seq = last_stamp == stamp ? stamp_seq + 1 : 0;
+        last_stamp = stamp;
+        std::string name;
+        for (;; stamp_seq++) {
+            char seq[16] = "";
+            if (stamp_seq > 0) snprintf(seq, sizeof(seq), "_%03d", stamp_seq);
+            name = file_prefix + stamp + seq + file_ext;
+            if (access(name.c_str(), F_OK) != 0 && access((name + ".gz").c_str(), F_OK) != 0) break;
+        }
+
+        int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "警告: 无法打开日志文件: " << name << std::endl;
+            return;
+        }
+        file_bytes = 0;
+        if (binary_format) {
+            write_all(fd, BINLOG_MAGIC, BINLOG_MAGIC_SIZE);
+            file_bytes = BINLOG_MAGIC_SIZE + write_session_table(fd);
+        }
+        file_header_bytes = file_bytes;
+        if (log_fd >= 0) ::close(log_fd);
+        log_fd = fd;
+        current_file = name;
+        file_opened = std::chrono::steady_clock::now();
+    }
+
+    // 新的二进制日志文件开头写入所有会话的序号→UUID记录，返回写入的字节数
+    static size_t write_session_table(int fd) {
+        std::string table;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            uint64_t time_ms = now_ms();
+            for (const auto& entry : live_sessions) {
+                const LiveSession& s = entry.second;
+                binlog_append(table, PRIORITY_DEBUG, EVT_SESSION, time_ms, s.conn_id, entry.first,
+                              nullptr, 0, s.uuid.data(), s.uuid.size());
+            }
+        }
+        write_all(fd, table.data(), table.size());
+        return table.size();
+    }
+
+    // 已结束且之前的日志都已写出的会话移出会话表(写线程每批写入后调用)
+    static void forget_ended_sessions() {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        while (!ended_sessions.empty() && ended_sessions.front().first <= dequeue_pos) {
+            live_sessions.erase(ended_sessions.front().second);
+            ended_sessions.pop_front();
+        }
+    }
+
+    // 写入incoming字节前检查是否需要轮转
+    static void rotate_if_needed(size_t incoming) {
+        if (log_fd < 0) return;
+        size_t max_bytes = rotate_bytes.load(std::memory_order_relaxed);
+        int max_sec = rotate_sec.load(std::memory_order_relaxed);
+        bool by_size = max_bytes > 0 && incoming > 0 && file_bytes + incoming > max_bytes &&
+                       file_bytes > file_header_bytes;
+        bool by_age = max_sec > 0 && std::chrono::steady_clock::now() - file_opened >= std::chrono::seconds(max_sec);
+        if (!by_size && !by_age) return;
+
+        std::string old_file = current_file;
+        open_file();
+        if (current_file == old_file) return;   // 新文件打开失败，继续写旧文件
+        if (compress_rotated.load(std::memory_order_relaxed)) compress_queue.push_back(old_file);
+        start_compressor();
+        remove_old_files();
+    }
+
+    // 逐个压缩轮转出的文件: 子进程设为idle I/O优先级和最低CPU优先级后执行gzip
+    static void start_compressor() {
+        if (compress_pid > 0 || compress_queue.empty()) return;
+        if (gzip_path.empty()) gzip_path = find_executable("gzip");
+        if (gzip_path.empty()) {
+            // 找不到gzip时保留未压缩的文件
+            compress_queue.clear();
+            return;
+        }
+        std::string path = compress_queue.front();
+        compress_queue.erase(compress_queue.begin());
+
+        // fork之后子进程只能调用async-signal-safe函数，参数在fork前准备好，不用execlp搜索PATH
+        char* const argv[] = {(char*)"gzip", (char*)"-f", (char*)"-q", (char*)path.c_str(), nullptr};
+        pid_t pid = fork();
+        if (pid == 0) {
+            // 子进程: 只调用async-signal-safe函数；关闭继承的socket等fd，避免连接被gzip进程持有
+            syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, (3 << 13) /* IOPRIO_CLASS_IDLE */);
+            setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_close_range
+            if (syscall(SYS_close_range, 3, ~0U, 0) != 0)
+#endif
+            {
+                for (int fd = 3; fd < 65536; fd++) ::close(fd);
+            }
+            execv(gzip_path.c_str(), argv);
+            _exit(127);
+        }
+        if (pid < 0) return;   // fork失败时保留未压缩的文件
+        compress_pid = pid;
+        compressing = path;
+    }
+
+    // 在PATH(未设置时为/usr/bin:/bin)中查找可执行文件，返回完整路径，找不到时返回空
+    static std::string find_executable(const char* name) {
+        const char* env = getenv("PATH");
+        std::string dirs = env != nullptr && env[0] != '\0' ? env : "/usr/bin:/bin";
+        size_t start = 0;
+        while (start <= dirs.size()) {
+            size_t end = dirs.find(':', start);
+            if (end == std::string::npos) end = dirs.size();
+            std::string dir = end > start ? dirs.substr(start, end - start) : ".";
+            std::string path = dir + "/" + name;
+            if (access(path.c_str(), X_OK) == 0) return path;
+            start = end + 1;
+        }
+        return "";
+    }
+
+    static void reap_compressor() {
+        if (compress_pid <= 0) return;
+        int status = 0;
+        if (waitpid(compress_pid, &status, WNOHANG) != compress_pid) return;
+        compress_pid = 0;
+        compressing.clear();
+        remove_old_files();
+        start_compressor();
+    }
+
+    // 按文件名(时间戳)保留最新的keep_files个日志文件(含当前文件)，正在压缩的文件不删除
+    static void remove_old_files() {
+        int keep = keep_files.load(std::memory_order_relaxed);
+        if (keep <= 0) return;
+        size_t slash = file_prefix.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : file_prefix.substr(0, slash);
+        std::string base = slash == std::string::npos ? file_prefix : file_prefix.substr(slash + 1);
+
+        DIR* d = opendir(dir.c_str());
+        if (d == nullptr) return;
+        std::vector<std::string> files;
+        while (dirent* entry = readdir(d)) {
+            std::string path = dir + "/" + entry->d_name;
+            if (strncmp(entry->d_name, base.c_str(), base.size()) != 0) continue;
+            if (path == current_file || path == compressing || path == compressing + ".gz") continue;
+            files.push_back(path);
+        }
+        closedir(d);
+
+        std::sort(files.begin(), files.end());
+        size_t allowed = (size_t)keep - 1;
+        for (size_t i = 0; i + allowed < files.size(); i++) {
+            // 还在压缩队列中的文件一并移出队列
+            compress_queue.erase(std::remove(compress_queue.begin(), compress_queue.end(), files[i]), compress_queue.end());
+            unlink(files[i].c_str());
+        }
+    }
+
+    // 写入文件和控制台；二进制日志在控制台上还原为文本
+    static void write_batch(const std::string& batch) {
+        if (console_enabled.load(std::memory_order_relaxed)) {
+            if (binary_format) {
+                std::string text = render_console(batch);
+                write_all(STDOUT_FILENO, text.data(), text.size());
+            } else {
+                write_all(STDOUT_FILENO, batch.data(), batch.size());
+            }
+        }
+        if (log_fd >= 0) {
+            write_all(log_fd, batch.data(), batch.size());
+            file_bytes += batch.size();
+        }
+    }
+
+    // 控制台只需要最近的会话: 按序号取模保存UUID，旧会话被覆盖后不再显示UUID
+    static std::string render_console(const std::string& batch) {
+        static std::mutex console_mutex;
+        static std::vector<std::pair<uint32_t, std::string>> sessions(4096);
+        static const std::string none;
+        std::lock_guard<std::mutex> lock(console_mutex);
+
+        std::string text;
+        const uint8_t* p = (const uint8_t*)batch.data();
+        size_t pos = 0;
+        BinLogRecord rec;
+        for (;;) {
+            size_t n = binlog_parse(p + pos, batch.size() - pos, rec);
+            if (n == 0 || n == SIZE_MAX) break;
+            pos += n;
+            std::pair<uint32_t, std::string>& slot = sessions[rec.session % sessions.size()];
+            if (rec.event == EVT_SESSION) {
+                slot.first = rec.session;
+                slot.second.assign(rec.str, rec.str_len);
+                continue;
+            }
+            text.append(binlog_format_time(rec.time_ms)).append(" [").append(log_level_name(rec.level)).append("] ");
+            binlog_render(rec, rec.session != 0 && slot.first == rec.session ? slot.second : none, text);
+            text.append(1, '\n');
+        }
+        return text;
+    }
+
+    static void write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            data += n;
+            len -= (size_t)n;
+        }
+    }
+};
+
+// 静态成员初始化
+int Logger::log_fd = -1;
+std::atomic<int> Logger::min_priority(Logger::PRIORITY_INFO);
+Logger::Slot* Logger::slots = nullptr;
+std::atomic<size_t> Logger::enqueue_pos(0);
+size_t Logger::dequeue_pos = 0;
+std::atomic<size_t> Logger::pending_bytes(0);
+std::atomic<uint64_t> Logger::dropped(0);
+std::thread Logger::writer;
+std::atomic<bool> Logger::running(false);
+std::mutex Logger::wake_mutex;
+std::condition_variable Logger::wake_cv;
+std::atomic<int> Logger::flush_interval_ms(100);
+std::atomic<size_t> Logger::flush_bytes(65536);
+std::atomic<bool> Logger::block_when_full(false);
+std::atomic<bool> Logger::console_enabled(true);
+bool Logger::binary_format = false;
+std::atomic<uint32_t> Logger::session_counter(0);
+std::mutex Logger::sessions_mutex;
+std::map<uint32_t, Logger::LiveSession> Logger::live_sessions;
+std::deque<std::pair<size_t, uint32_t>> Logger::ended_sessions;
+std::string Logger::gzip_path;
+std::string Logger::file_prefix;
+std::string Logger::file_ext;
+std::string Logger::current_file;
+size_t Logger::file_bytes = 0;
+size_t Logger::file_header_bytes = 0;
+std::chrono::steady_clock::time_point Logger::file_opened;
+std::vector<std::string> Logger::compress_queue;
+pid_t Logger::compress_pid = 0;
+std::string Logger::compressing;
+int64_t Logger::budget_window = 0;
+size_t Logger::budget_used = 0;
+std::atomic<uint64_t> Logger::budget_dropped(0);
+std::atomic<size_t> Logger::rotate_bytes(0);
+std::atomic<int> Logger::rotate_sec(0);
+std::atomic<int> Logger::keep_files(0);
+std::atomic<bool> Logger::compress_rotated(false);
+std::atomic<size_t> Logger::max_bytes_per_sec(0);
+
+// v6.15: 日志宏 - 先判断级别再求值参数，未启用的日志不拼接字符串、不格式化hex
+// LOG_MIN_LEVEL为编译期最低级别(0=DEBUG 1=INFO 2=WARN 3=ERROR)，低于它的语句被编译器整体删除
+// 例: make LOG_MIN_LEVEL=1 去掉所有DEBUG日志
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+#define LOG_ENABLED(priority) ((priority) >= LOG_MIN_LEVEL && Logger::enabled(priority))
+#define LOG_AT(priority, method, ...) \
+    do { if (LOG_ENABLED(priority)) Logger::method(__VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) LOG_AT(Logger::PRIORITY_DEBUG, debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(Logger::PRIORITY_INFO, info, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(Logger::PRIORITY_WARN, warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(Logger::PRIORITY_ERROR, error, __VA_ARGS__)
+
+// v6.16: 结构化事件 LOG_EVENT(级别, 事件, LogSession, 字符串参数[, 数值参数...])
+#define LOG_EVENT(priority, id, ...) \
+    do { if (LOG_ENABLED(priority)) Logger::event(priority, id, __VA_ARGS__); } while (0)
+
+// 十六进制预览 "xx xx ..."，只在LOG_*宏的参数中调用，日志未启用时不会执行
+// wrap > 0 时每wrap字节换行，新行以indent开头
+inline std::string hex_dump(const uint8_t* data, size_t len, size_t wrap = 0, const char* indent = "") {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(len * 3);
+    for (size_t i = 0; i < len; i++) {
+        if (wrap > 0 && i > 0 && i % wrap == 0) out.append(1, '\n').append(indent);
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0x0f];
+        out += ' ';
+    }
+    return out;
+}
+
+#endif // LOGGER_H
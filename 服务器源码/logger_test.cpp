@@ -0,0 +1,163 @@
+/*
+ * logger.h 单元测试 (make test)
+ * 二进制日志的会话记录(EVT_SESSION)在写入预算耗尽、队列满时不丢失，轮转后的新文件带有会话表
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include "logger.h"
+#include "test_util.h"
+
+using namespace std;
+
+// 每个用例一个临时目录，日志文件名为 dir/test_<时间戳>.blog
+struct LogDir {
+    string path;
+
+    LogDir() {
+        char tmpl[] = "/tmp/dnf-logger-test-XXXXXX";
+        if (mkdtemp(tmpl) != nullptr) path = tmpl;
+    }
+
+    ~LogDir() {
+        for (const string& f : files()) unlink(f.c_str());
+        rmdir(path.c_str());
+    }
+
+    vector<string> files() const {
+        vector<string> out;
+        DIR* d = opendir(path.c_str());
+        if (d == nullptr) return out;
+        while (dirent* entry = readdir(d)) {
+            if (entry->d_name[0] != '.') out.push_back(path + "/" + entry->d_name);
+        }
+        closedir(d);
+        sort(out.begin(), out.end());
+        return out;
+    }
+};
+
+// 读取一个二进制日志文件，sessions记录 会话序号 -> UUID
+static void read_file_sessions(const string& path, map<uint32_t, string>& sessions, size_t* text_records) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) return;
+    vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    if (data.size() < BINLOG_MAGIC_SIZE || memcmp(data.data(), BINLOG_MAGIC, BINLOG_MAGIC_SIZE) != 0) return;
+
+    size_t pos = BINLOG_MAGIC_SIZE;
+    BinLogRecord rec;
+    for (;;) {
+        size_t used = binlog_parse(data.data() + pos, data.size() - pos, rec);
+        if (used == 0 || used == SIZE_MAX) break;
+        pos += used;
+        if (rec.event == EVT_SESSION) sessions[rec.session].assign(rec.str, rec.str_len);
+        if (rec.event == EVT_TEXT && text_records != nullptr) (*text_records)++;
+    }
+}
+
+// 读取目录中所有二进制日志，返回 会话序号 -> UUID
+static map<uint32_t, string> read_sessions(const LogDir& dir, size_t* text_records = nullptr) {
+    map<uint32_t, string> sessions;
+    for (const string& path : dir.files()) read_file_sessions(path, sessions, text_records);
+    return sessions;
+}
+
+static void start_binary_log(const LogDir& dir, int flush_ms, size_t flush_bytes, size_t bytes_per_sec,
+                             int rotate_mb = 0) {
+    Logger::set_log_level("DEBUG");
+    Logger::configure(flush_ms, flush_bytes, false, false);
+    Logger::configure_files(rotate_mb, 0, 0, false, bytes_per_sec);
+    Logger::init(dir.path + "/test_", ".blog", true);
+}
+
+TEST(session_bypasses_write_budget) {
+    LogDir dir;
+    CHECK(!dir.path.empty());
+    uint64_t budget_before = Logger::budget_dropped_count();
+    start_binary_log(dir, 10, 65536, 512);
+
+    vector<LogSession> created;
+    for (int i = 0; i < 200; i++) {
+        LOG_DEBUG("填满写入预算的调试日志 " + to_string(i));
+        if (i % 20 == 0) created.push_back(Logger::session(100 + i, "uuid-budget-" + to_string(i)));
+    }
+    Logger::close();
+
+    CHECK(Logger::budget_dropped_count() > budget_before);
+    map<uint32_t, string> sessions = read_sessions(dir);
+    for (const LogSession& s : created) {
+        CHECK(sessions.count(s.index) == 1);
+        CHECK(sessions[s.index] == s.uuid);
+    }
+}
+
+TEST(session_waits_when_queue_full) {
+    LogDir dir;
+    CHECK(!dir.path.empty());
+    uint64_t dropped_before = Logger::dropped_count();
+    // 写线程每秒才醒一次，队列(16384条)很快写满，普通日志按drop策略丢弃
+    start_binary_log(dir, 1000, (size_t)1 << 30, 0);
+
+    for (int i = 0; i < 100000 && Logger::dropped_count() == dropped_before; i++) {
+        LOG_INFO("填满队列的日志 " + to_string(i));
+    }
+    CHECK(Logger::dropped_count() > dropped_before);
+    vector<LogSession> created;
+    for (int i = 0; i < 100; i++) created.push_back(Logger::session(1000 + i, "uuid-full-" + to_string(i)));
+    Logger::close();
+
+    size_t text_records = 0;
+    map<uint32_t, string> sessions = read_sessions(dir, &text_records);
+    CHECK(text_records > 0);
+    for (const LogSession& s : created) {
+        CHECK(sessions.count(s.index) == 1);
+        CHECK(sessions[s.index] == s.uuid);
+    }
+}
+
+TEST(rotated_file_starts_with_live_sessions) {
+    LogDir dir;
+    CHECK(!dir.path.empty());
+    start_binary_log(dir, 10, 65536, 0, 1);
+
+    LogSession live = Logger::session(1, "uuid-live");
+    LogSession ended = Logger::session(2, "uuid-ended");
+    LOG_EVENT(Logger::PRIORITY_INFO, EVT_TEXT, ended, "已结束的会话");
+    Logger::end_session(ended);
+    // 等写线程写出ended之前的日志，之后的轮转不再带它
+    usleep(100 * 1000);
+
+    // 写入超过1MB，至少轮转一次
+    string filler(200, 'x');
+    for (int i = 0; i < 8000; i++) {
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_TEXT, live, filler);
+        if (i % 1000 == 999) usleep(20 * 1000);
+    }
+    Logger::close();
+
+    vector<string> files = dir.files();
+    CHECK(files.size() >= 2);
+    for (size_t i = 1; i < files.size(); i++) {
+        map<uint32_t, string> sessions;
+        read_file_sessions(files[i], sessions, nullptr);
+        CHECK(sessions.count(live.index) == 1);
+        CHECK(sessions[live.index] == live.uuid);
+        CHECK(sessions.count(ended.index) == 0);
+    }
+}
+
+int main() {
+    return run_all_tests("logger");
+}
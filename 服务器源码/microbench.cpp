@@ -0,0 +1,1287 @@
+/*
+ * dnf-microbench - 转发热路径函数的微基准测试
+ *
+ * 用法: dnf-microbench [选项]
+ *   --filter STR       只运行名称包含STR的用例(可多次指定，任一匹配即运行)
+ *   --min-time MS      每个用例的测量总时长(默认300)，平均分给各轮
+ *   --warmup MS        每个用例测量前的预热时长(默认50)
+ *   --repeat N         测量轮数(默认5)，结果取中位数，另输出最小值
+ *   --json FILE        结果写入文件(默认标准输出)
+ *   --list             只列出用例名称
+ *
+ * 覆盖范围(输入为固定种子生成的游戏数据，每次运行相同):
+ *   ip_rewrite/...      IpRewriter扫描替换(原replace_ip_in_payload)，分别测scalar/sse2/avx2实现、有无命中，
+ *                       legacy为v6.12之前的replace_ip_in_payload(ip_rewriter_legacy.h，日志级别WARN)
+ *   frame_parse/...     decode_frames批量解析0x01/0x03帧(forward_client_to_game的帧解析)
+ *   frame_decoder/...   FrameDecoder按recv大小分块喂入(包含跨recv拼帧)或每次喂入恰好N帧，
+ *                       /legacy为v6.5之前的vector追加+从头erase解析(见"v6.5之前的帧解析副本")
+ *   extract_ip/...      extract_tcp_source_ip
+ *   udp_flow/...        UdpFlowTable: 每个数据报的流查找、建立流、每秒tick过期(输出容量与最长探测距离)
+ *   dns/...             每个UDP包取游戏服务器地址: DnsCache::lookup_first 与 v6.8之前每包一次的getaddrinfo
+ *   forward/...         游戏→客户端一块数据封装为0x01帧写入/dev/null: 复制到整帧缓冲 / 帧头+payload两个iovec /
+ *                       默认写合并(小帧追加到发送缓冲)，输出每转发1字节在用户态复制的字节数和每GB的CPU时间
+ *   client_checksum/... 客户端calculate_checksum(client_packet.h)
+ *   client_packet/...   客户端build_complete_packet(IP+TCP头、伪头部校验和，client_packet.h)
+ *   clock/...           转发路径上读取的时钟(延迟统计、会话活跃时间)
+ *   latency/record/...  每次recv的延迟统计: 两次monotonic_ns + LatencyHistogram::record(分片，或分片+会话)
+ *   stats/add_stat/...  每转发一帧的计数: 帧数+字节数，会话与分片各一次ForwardStats::add(relaxed load+store)，
+ *                       fetch_add为同样的累加改用带lock前缀的原子加
+ *   log/enqueue/...     1/8/64个线程同时写日志(Logger入队)，输出每秒调用数和队列满丢弃的比例
+ *   log/forward_info/... 1/8个worker转发短连接(解析帧+IP替换)，每条连接建立/关闭各一条INFO日志:
+ *                       none(级别WARN) / async(Logger) / sync(v6.14之前的 互斥锁+每行写入文件)
+ *   log/lifecycle_event/... 一条连接的5个生命周期事件(LOG_EVENT)，文本/二进制日志格式，输出文件中每条事件的字节数
+ *   log/udp_datagram/...  UDP隧道每个游戏→客户端数据报的日志开销: v6.14的INFO日志 / LOG_DEBUG(级别INFO) / LOG_MIN_LEVEL=1
+ *
+ * 客户端的校验和与注入包构造在client_packet.h中(客户端同样包含)，这里直接测量
+ *
+ * 校准: 每轮迭代次数由预热阶段测得的单次耗时计算，使每轮约 min_time/repeat 毫秒
+ * 结果对比: python3 bench_compare.py 基准.json 本次.json [--threshold 百分比]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include "tunnel_protocol.h"
+#include "ip_rewriter.h"
+#include "ip_rewriter_legacy.h"
+#include "logger.h"
+#include "udp_flow_table.h"
+#include "dns_cache.h"
+#include "latency_histogram.h"
+#include "forward_stats.h"
+#include "client_packet.h"
+
+using namespace std;
+
+struct MicrobenchOptions {
+    vector<string> filters;
+    double min_time_ms = 300;
+    double warmup_ms = 50;
+    int repeat = 5;
+    string json_path;
+    bool list_only = false;
+};
+
+// 阻止编译器把被测结果当作无用计算删除
+template <typename T>
+static inline void keep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// 固定种子的伪随机数(xorshift64)，保证每次运行的输入相同
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    uint32_t below(uint32_t n) { return (uint32_t)(next() % n); }
+
+private:
+    uint64_t state;
+};
+
+// ==================== 用例注册与计时 ====================
+// 用例附加输出的计数(名称, 数值)，写入JSON结果的同名字段
+typedef vector<pair<string, double>> BenchCounters;
+
+struct Benchmark {
+    string name;
+    double bytes_per_op;     // 每次操作处理的字节数，0表示不输出吞吐
+    double items_per_op;     // 每次操作处理的帧/包数，0表示不输出
+    function<void(uint64_t)> run;   // 执行iters次操作
+    function<void()> reset;                 // 可选: 测量各轮之前调用(清零计数)
+    function<void(BenchCounters&)> counters; // 可选: 测量结束后读取计数
+};
+
+struct BenchResult {
+    string name;
+    uint64_t iterations;     // 每轮迭代次数
+    double ns_per_op;        // 各轮中位数
+    double ns_per_op_min;
+    double bytes_per_op;
+    double items_per_op;
+    BenchCounters counters;
+};
+
+static vector<Benchmark>& registry() {
+    static vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+static Benchmark& add_benchmark(const string& name, double bytes_per_op, double items_per_op,
+                                function<void(uint64_t)> run) {
+    Benchmark b;
+    b.name = name;
+    b.bytes_per_op = bytes_per_op;
+    b.items_per_op = items_per_op;
+    b.run = run;
+    registry().push_back(b);
+    return registry().back();
+}
+
+static uint64_t time_batch(const Benchmark& b, uint64_t iters) {
+    uint64_t start = monotonic_ns();
+    b.run(iters);
+    return monotonic_ns() - start;
+}
+
+static BenchResult measure(const Benchmark& b, const MicrobenchOptions& opt) {
+    // 预热: 迭代次数翻倍直到单批超过1ms，并持续到预热时长用完，最后一批用于估算单次耗时
+    uint64_t warmup_end = monotonic_ns() + (uint64_t)(opt.warmup_ms * 1e6);
+    uint64_t iters = 1;
+    uint64_t elapsed = time_batch(b, iters);
+    while (elapsed < 1000000 || monotonic_ns() < warmup_end) {
+        if (elapsed < 1000000) iters *= 2;
+        elapsed = time_batch(b, iters);
+    }
+    double estimate = (double)elapsed / iters;
+
+    double round_ns = opt.min_time_ms * 1e6 / opt.repeat;
+    uint64_t round_iters = max((uint64_t)1, (uint64_t)(round_ns / max(estimate, 0.1)));
+    if (b.reset) b.reset();
+    vector<double> samples;
+    for (int r = 0; r < opt.repeat; r++) {
+        samples.push_back((double)time_batch(b, round_iters) / round_iters);
+    }
+    sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.name = b.name;
+    result.iterations = round_iters;
+    result.ns_per_op = samples[samples.size() / 2];
+    result.ns_per_op_min = samples[0];
+    result.bytes_per_op = b.bytes_per_op;
+    result.items_per_op = b.items_per_op;
+    if (b.counters) b.counters(result.counters);
+    return result;
+}
+
+// ==================== 测试数据 ====================
+// 游戏消息: 大量0字节和小整数，夹杂随机字节(包括与IP首字节相同的字节，产生SIMD候选但不命中)
+static vector<uint8_t> make_game_payload(Random& rng, size_t len) {
+    vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) {
+        uint32_t r = rng.below(100);
+        data[i] = r < 50 ? 0 : r < 80 ? (uint8_t)rng.below(16) : (uint8_t)rng.next();
+    }
+    return data;
+}
+
+// 每隔约interval字节放入一个IP，网络字节序与DNF逐字节反向交替
+static void plant_ip(Random& rng, vector<uint8_t>& data, const uint8_t* ip, size_t interval) {
+    if (data.size() < 4) return;
+    bool dnf = false;
+    size_t first = rng.below((uint32_t)min(interval, data.size() - 3));
+    for (size_t pos = first; pos + 4 <= data.size(); pos += interval / 2 + rng.below((uint32_t)interval)) {
+        for (int k = 0; k < 4; k++) data[pos + k] = dnf ? ip[3 - k] : ip[k];
+        dnf = !dnf;
+    }
+}
+
+// 帧大小分布: 一半是小消息(移动/技能)，其余为中等消息，少量接近MSS的大消息
+static size_t game_message_size(Random& rng) {
+    uint32_t r = rng.below(100);
+    if (r < 50) return 20 + rng.below(80);
+    if (r < 90) return 100 + rng.below(500);
+    return 600 + rng.below(800);
+}
+
+// 连续的0x01帧(每8个数据帧夹一个v1心跳)，总长约target字节，结束于帧边界
+static vector<uint8_t> make_tcp_stream(Random& rng, size_t target, size_t& frames) {
+    vector<uint8_t> stream;
+    frames = 0;
+    while (stream.size() < target) {
+        size_t old = stream.size();
+        if (frames % 8 == 7) {
+            stream.resize(old + HEARTBEAT_FRAME_SIZE);
+            encode_heartbeat(stream.data() + old, 1000 + (uint32_t)frames);
+        } else {
+            size_t len = game_message_size(rng);
+            vector<uint8_t> payload = make_game_payload(rng, len);
+            stream.resize(old + TCP_FRAME_HEADER + len);
+            encode_tcp_header(stream.data() + old, 1000 + (uint32_t)frames % 4, (uint16_t)len);
+            memcpy(stream.data() + old + TCP_FRAME_HEADER, payload.data(), len);
+        }
+        frames++;
+    }
+    return stream;
+}
+
+// 连续的0x03帧，UDP数据报较小
+static vector<uint8_t> make_udp_stream(Random& rng, size_t target, size_t& frames) {
+    vector<uint8_t> stream;
+    frames = 0;
+    while (stream.size() < target) {
+        size_t len = 16 + rng.below(180);
+        size_t old = stream.size();
+        vector<uint8_t> payload = make_game_payload(rng, len);
+        stream.resize(old + UDP_FRAME_HEADER + len);
+        encode_udp_header(stream.data() + old, (uint32_t)frames, (uint16_t)(20000 + frames % 4), 10011, (uint16_t)len);
+        memcpy(stream.data() + old + UDP_FRAME_HEADER, payload.data(), len);
+        frames++;
+    }
+    return stream;
+}
+
+// ==================== 用例 ====================
+static const char* CLIENT_IP = "192.168.2.10";
+static const char* PROXY_IP = "10.8.0.1";
+
+static void register_ip_rewrite() {
+    static IpRewriter to_proxy;
+    static IpRewriter to_client;
+    to_proxy.init(CLIENT_IP, PROXY_IP);
+    to_client.init(PROXY_IP, CLIENT_IP);
+    uint8_t client_ip[4];
+    inet_pton(AF_INET, CLIENT_IP, client_ip);
+
+    vector<IpRewriter::Impl> impls;
+    impls.push_back(IpRewriter::IMPL_SCALAR);
+#ifdef IP_REWRITER_X86
+    impls.push_back(IpRewriter::IMPL_SSE2);
+    if (IpRewriter::active_impl() == IpRewriter::IMPL_AVX2) impls.push_back(IpRewriter::IMPL_AVX2);
+#endif
+
+    const size_t sizes[] = {16, 64, 1460, 16384, 65536};
+    for (IpRewriter::Impl impl : impls) {
+        for (size_t size : sizes) {
+            Random rng(size);
+            auto clean = make_shared<vector<uint8_t>>(make_game_payload(rng, size));
+            auto hits = make_shared<vector<uint8_t>>(*clean);
+            plant_ip(rng, *hits, client_ip, 256);
+            string suffix = string(IpRewriter::impl_name(impl)) + "/" + to_string(size);
+
+            add_benchmark("ip_rewrite/miss/" + suffix, (double)size, 0, [=](uint64_t iters) {
+                for (uint64_t i = 0; i < iters; i++) {
+                    size_t n = to_proxy.rewrite_with(impl, clean->data(), clean->size());
+                    keep(n);
+                }
+            });
+            // 交替替换为代理IP、再换回客户端IP，每次操作的命中数相同
+            add_benchmark("ip_rewrite/hit/" + suffix, (double)size, 0, [=](uint64_t iters) {
+                for (uint64_t i = 0; i < iters; i++) {
+                    const IpRewriter& rw = (i & 1) ? to_client : to_proxy;
+                    size_t n = rw.rewrite_with(impl, hits->data(), hits->size());
+                    keep(n);
+                }
+            });
+        }
+    }
+
+    // v6.12之前每个数据块调用一次: 解析两个IP字符串、拼接日志前缀，每次调用一条INFO日志(级别WARN时不写出)
+    for (size_t size : sizes) {
+        Random rng(size);
+        auto clean = make_shared<vector<uint8_t>>(make_game_payload(rng, size));
+        auto hits = make_shared<vector<uint8_t>>(*clean);
+        plant_ip(rng, *hits, client_ip, 256);
+        string suffix = "legacy/" + to_string(size);
+
+        add_benchmark("ip_rewrite/miss/" + suffix, (double)size, 0, [=](uint64_t iters) {
+            Logger::set_log_level("WARN");
+            for (uint64_t i = 0; i < iters; i++) {
+                int n = legacy::replace_ip_in_payload(clean->data(), clean->size(), CLIENT_IP, PROXY_IP, 1, "bench");
+                keep(n);
+            }
+            Logger::set_log_level("INFO");
+        });
+        add_benchmark("ip_rewrite/hit/" + suffix, (double)size, 0, [=](uint64_t iters) {
+            Logger::set_log_level("WARN");
+            for (uint64_t i = 0; i < iters; i++) {
+                int n = (i & 1) ? legacy::replace_ip_in_payload(hits->data(), hits->size(), PROXY_IP, CLIENT_IP, 1, "bench")
+                                : legacy::replace_ip_in_payload(hits->data(), hits->size(), CLIENT_IP, PROXY_IP, 1, "bench");
+                keep(n);
+            }
+            Logger::set_log_level("INFO");
+        });
+    }
+}
+
+// ==================== v6.5之前的帧解析副本 ====================
+// forward_client_to_game(v6.5之前)的解析方式: recv数据追加到vector，每解析一帧复制payload并从头erase，
+// 一次recv含k帧时erase共移动O(k*缓冲长度)字节；只保留解析部分(不转发、不校验conn_id)
+struct LegacyFrameBuffer {
+    vector<uint8_t> buffer;
+
+    size_t feed(const uint8_t* recv_buf, size_t n) {
+        size_t total = 0;
+        buffer.insert(buffer.end(), recv_buf, recv_buf + n);
+        while (buffer.size() >= 5) {
+            uint8_t msg_type = buffer[0];
+            if (msg_type == 0x01) {
+                if (buffer.size() < 7) break;
+                uint16_t data_len = ntohs(*(uint16_t*)&buffer[5]);
+                if (buffer.size() < static_cast<size_t>(7 + data_len)) break;
+                vector<uint8_t> payload(buffer.begin() + 7, buffer.begin() + 7 + data_len);
+                buffer.erase(buffer.begin(), buffer.begin() + 7 + data_len);
+                total += payload.size();
+            } else if (msg_type == 0x02) {
+                if (buffer.size() < 7) break;
+                buffer.erase(buffer.begin(), buffer.begin() + 7);
+            } else if (msg_type == 0x03) {
+                if (buffer.size() < 11) break;
+                uint16_t data_len = ntohs(*(uint16_t*)&buffer[9]);
+                if (buffer.size() < static_cast<size_t>(11 + data_len)) break;
+                vector<uint8_t> payload(buffer.begin() + 11, buffer.begin() + 11 + data_len);
+                buffer.erase(buffer.begin(), buffer.begin() + 11 + data_len);
+                total += payload.size();
+            } else {
+                buffer.erase(buffer.begin(), buffer.begin() + 5);
+            }
+        }
+        return total;
+    }
+};
+
+// bounds: 各次feed的起止位置(bounds[i]~bounds[i+1])，FrameDecoder与v6.5之前的解析(/legacy)各一个用例
+static void add_decoder_cases(const string& name, shared_ptr<vector<uint8_t>> stream,
+                              shared_ptr<vector<size_t>> bounds, size_t frames, unsigned mask) {
+    auto decoder = make_shared<FrameDecoder>(mask);
+    add_benchmark(name, (double)stream->size(), (double)frames, [=](uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+            size_t total = 0;
+            for (size_t k = 0; k + 1 < bounds->size(); k++) {
+                decoder->feed(stream->data() + (*bounds)[k], (*bounds)[k + 1] - (*bounds)[k]);
+                FrameView frame;
+                while (decoder->next(frame) == FRAME_OK) total += frame.length;
+            }
+            keep(total);
+        }
+    });
+
+    auto legacy = make_shared<LegacyFrameBuffer>();
+    add_benchmark(name + "/legacy", (double)stream->size(), (double)frames, [=](uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+            size_t total = 0;
+            for (size_t k = 0; k + 1 < bounds->size(); k++) {
+                total += legacy->feed(stream->data() + (*bounds)[k], (*bounds)[k + 1] - (*bounds)[k]);
+            }
+            keep(total);
+        }
+    });
+}
+
+static void register_frame_parse() {
+    Random rng(42);
+    size_t tcp_frames = 0;
+    size_t udp_frames = 0;
+    auto tcp_stream = make_shared<vector<uint8_t>>(make_tcp_stream(rng, 64 * 1024, tcp_frames));
+    auto udp_stream = make_shared<vector<uint8_t>>(make_udp_stream(rng, 64 * 1024, udp_frames));
+    unsigned tcp_mask = frame_type_bit(FRAME_TCP_DATA) | frame_type_bit(FRAME_HEARTBEAT);
+    unsigned udp_mask = frame_type_bit(FRAME_UDP_DATA);
+
+    // 与服务器一次处理一个recv缓冲相同: 每批最多64帧
+    auto parse_all = [](vector<uint8_t>* stream, unsigned mask) {
+        FrameView frames[64];
+        size_t pos = 0;
+        size_t total = 0;
+        for (;;) {
+            size_t consumed = 0;
+            size_t n = decode_frames(stream->data() + pos, stream->size() - pos, mask, frames, 64, consumed);
+            if (n == 0) break;
+            for (size_t i = 0; i < n; i++) total += frames[i].length;
+            pos += consumed;
+        }
+        keep(total);
+    };
+    add_benchmark("frame_parse/tcp/64k", (double)tcp_stream->size(), (double)tcp_frames, [=](uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) parse_all(tcp_stream.get(), tcp_mask);
+    });
+    add_benchmark("frame_parse/udp/64k", (double)udp_stream->size(), (double)udp_frames, [=](uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) parse_all(udp_stream.get(), udp_mask);
+    });
+
+    // 按recv大小分块，跨块的帧经过拼接缓冲；65536为v6.5之前的recv缓冲大小
+    const size_t chunks[] = {1460, 16384, 65536};
+    for (size_t chunk : chunks) {
+        auto bounds = make_shared<vector<size_t>>();
+        for (size_t pos = 0; pos < tcp_stream->size(); pos += chunk) bounds->push_back(pos);
+        bounds->push_back(tcp_stream->size());
+        add_decoder_cases("frame_decoder/tcp/recv" + to_string(chunk), tcp_stream, bounds, tcp_frames, tcp_mask);
+    }
+
+    // 每次feed()恰好N个完整帧(不跨recv)
+    vector<size_t> frame_ends;
+    for (size_t pos = 0;;) {
+        FrameView frame;
+        size_t consumed = 0;
+        if (decode_frames(tcp_stream->data() + pos, tcp_stream->size() - pos, tcp_mask, &frame, 1, consumed) == 0) break;
+        pos += consumed;
+        frame_ends.push_back(pos);
+    }
+    const size_t per_feed[] = {1, 10, 100};
+    for (size_t n : per_feed) {
+        auto bounds = make_shared<vector<size_t>>(1, 0);
+        for (size_t i = n - 1; i < frame_ends.size(); i += n) bounds->push_back(frame_ends[i]);
+        if (bounds->back() != frame_ends.back()) bounds->push_back(frame_ends.back());
+        add_decoder_cases("frame_decoder/tcp/frames" + to_string(n), tcp_stream, bounds, frame_ends.size(), tcp_mask);
+    }
+}
+
+static void register_extract_ip() {
+    const char* inputs[][2] = {
+        {"ipv4", "[::ffff:192.168.2.1]:56601"},
+        {"ipv6", "[240e:3a1:4c2:8b0:1d2e:3f4a:5b6c:7d8e]:12345"},
+    };
+    for (auto& in : inputs) {
+        string client_str = in[1];
+        add_benchmark(string("extract_ip/") + in[0], (double)client_str.size(), 0, [=](uint64_t iters) {
+            for (uint64_t i = 0; i < iters; i++) {
+                string ip = extract_tcp_source_ip(client_str);
+                keep(ip);
+            }
+        });
+    }
+}
+
+// UDP流表的键: 客户端源端口随机分布，游戏服务器端口集中在少数几个
+static vector<pair<uint16_t, uint16_t>> make_flow_keys(Random& rng, size_t count) {
+    vector<pair<uint16_t, uint16_t>> keys;
+    UdpFlowTable seen;
+    while (keys.size() < count) {
+        uint16_t src = (uint16_t)(1024 + rng.below(64000));
+        uint16_t game = (uint16_t)(10011 + rng.below(8));
+        if (seen.find(src, game) != nullptr) continue;
+        seen.upsert(src, game);
+        keys.push_back(make_pair(src, game));
+    }
+    return keys;
+}
+
+static void add_flow_counters(Benchmark& b, shared_ptr<UdpFlowTable> table) {
+    b.counters = [table](BenchCounters& out) {
+        out.push_back(make_pair("flows", (double)table->size()));
+        out.push_back(make_pair("capacity", (double)table->capacity()));
+        out.push_back(make_pair("max_probe", (double)table->max_probe()));
+    };
+}
+
+// lookup: 每次操作为一个数据报的find(forward_to_game/on_udp_readable)，键按随机顺序轮换
+// insert: 每次操作从空表建立flows个流(包括扩容)
+// expire: 每次操作为一个tick: 建立flows/4个新流，remove_if过期4个tick前的一批(UdpTunnel::on_tick)，
+//         流表中始终约有flows个流，capacity/max_probe反映反复建立与过期后表是否变大、变慢
+static void register_udp_flow() {
+    const size_t flow_counts[] = {64, 4096};
+    for (size_t flows : flow_counts) {
+        Random rng(flows);
+        auto keys = make_shared<vector<pair<uint16_t, uint16_t>>>(make_flow_keys(rng, flows * 5 / 4));
+
+        auto table = make_shared<UdpFlowTable>();
+        for (size_t i = 0; i < flows; i++) table->upsert((*keys)[i].first, (*keys)[i].second);
+        auto order = make_shared<vector<uint32_t>>();
+        for (size_t i = 0; i < 1024; i++) order->push_back(rng.below((uint32_t)flows));
+        Benchmark& lookup = add_benchmark("udp_flow/lookup/" + to_string(flows), 0, 0, [=](uint64_t iters) {
+            for (uint64_t i = 0; i < iters; i++) {
+                const auto& k = (*keys)[(*order)[i & 1023]];
+                UdpFlow* flow = table->find(k.first, k.second);
+                keep(flow);
+            }
+        });
+        add_flow_counters(lookup, table);
+
+        add_benchmark("udp_flow/insert/" + to_string(flows), 0, (double)flows, [=](uint64_t iters) {
+            for (uint64_t i = 0; i < iters; i++) {
+                UdpFlowTable fresh;
+                for (size_t k = 0; k < flows; k++) {
+                    UdpFlow* flow = fresh.upsert((*keys)[k].first, (*keys)[k].second);
+                    flow->last_active_ms = i;
+                }
+                keep(fresh);
+            }
+        });
+
+        // 键分为5批，每个tick重新建立其中一批，活跃的4批约为flows个流
+        size_t batch = flows / 4;
+        auto churn = make_shared<UdpFlowTable>();
+        auto tick = make_shared<uint64_t>(0);
+        Benchmark& expire = add_benchmark("udp_flow/expire/" + to_string(flows), 0, (double)batch,
+                                          [=](uint64_t iters) {
+            for (uint64_t i = 0; i < iters; i++) {
+                uint64_t now = ++*tick;
+                size_t first = (size_t)(now % 5) * batch;
+                for (size_t k = first; k < first + batch; k++) {
+                    churn->upsert((*keys)[k].first, (*keys)[k].second)->last_active_ms = now;
+                }
+                size_t expired = churn->remove_if([now](const UdpFlow& f) { return now - f.last_active_ms >= 4; });
+                keep(expired);
+            }
+        });
+        add_flow_counters(expire, churn);
+    }
+}
+
+// v6.8之前forward_udp_to_game每个包的地址解析
+static bool resolve_per_packet(const string& host, uint16_t port, sockaddr_storage& addr, socklen_t& len) {
+    struct addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    string port_str = to_string(port);
+    if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &result) != 0 || result == nullptr) return false;
+    memcpy(&addr, result->ai_addr, result->ai_addrlen);
+    len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+// 每次操作取一次游戏服务器地址(端口在4个游戏端口间轮换)，另输出 lookups_per_sec
+// ip: game_server_ip为IP字面量；hosts: 域名由/etc/hosts解析(不访问网络，实际DNS查询只会更慢)
+static void register_dns() {
+    const struct {
+        const char* name;
+        const char* host;
+    } hosts[] = {
+        {"ip", "127.0.0.1"},
+        {"hosts", "localhost"},
+    };
+    for (auto& h : hosts) {
+        string host = h.host;
+        for (bool cached : {true, false}) {
+            auto elapsed_ns = make_shared<uint64_t>(0);
+            auto lookups = make_shared<uint64_t>(0);
+            string name = string("dns/") + (cached ? "cache_lookup/" : "getaddrinfo/") + h.name;
+            Benchmark& b = add_benchmark(name, 0, 0, [=](uint64_t iters) {
+                sockaddr_storage addr;
+                socklen_t len = 0;
+                if (cached && !DnsCache::lookup_first(host, SOCK_DGRAM, 10011, addr, len)) {
+                    DnsCache::preresolve(host, SOCK_DGRAM);
+                }
+                uint64_t start = monotonic_ns();
+                for (uint64_t i = 0; i < iters; i++) {
+                    uint16_t port = (uint16_t)(10011 + (i & 3));
+                    bool ok = cached ? DnsCache::lookup_first(host, SOCK_DGRAM, port, addr, len)
+                                     : resolve_per_packet(host, port, addr, len);
+                    keep(ok);
+                    keep(addr);
+                }
+                *elapsed_ns += monotonic_ns() - start;
+                *lookups += iters;
+            });
+            b.reset = [=]() {
+                *elapsed_ns = 0;
+                *lookups = 0;
+            };
+            b.counters = [=](BenchCounters& out) {
+                out.push_back(make_pair("lookups_per_sec", *elapsed_ns > 0 ? *lookups * 1e9 / *elapsed_ns : 0));
+            };
+        }
+    }
+}
+
+// 每次操作转发一块游戏→客户端数据(payload字节，超过65535时拆为多帧)，写入/dev/null只计系统调用本身的开销
+//   copy:      v6.2之前: 每帧分配 vector(7+n)，帧头与payload复制进去后一次write
+//   iovec:     send_data_frames: 帧头在栈上编码，帧头与payload作为两个iovec由一次writev发出，payload不复制
+//   coalesced: 默认coalesce_max_bytes=16384时的coalesce_send: 小于16384字节的帧追加到发送缓冲，
+//              每8块(一轮事件)或缓冲达到16384字节时write；大帧与iovec相同
+// copied_bytes_per_byte: 用户态复制的字节数 / 转发的payload字节数；cpu_ms_per_gb: 每转发1GB payload的线程CPU时间
+enum ForwardMode { FORWARD_COPY, FORWARD_IOVEC, FORWARD_COALESCED };
+
+static const size_t COALESCE_MAX_BYTES = 16384;
+static const uint64_t COALESCE_FRAMES_PER_ROUND = 8;
+
+struct ForwardCounters {
+    uint64_t copied = 0;
+    uint64_t forwarded = 0;
+    uint64_t cpu_ns = 0;
+};
+
+static uint64_t thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void forward_chunk(ForwardMode mode, int fd, vector<uint8_t>& pending, const uint8_t* data, size_t n,
+                          uint64_t& copied) {
+    while (n > 0) {
+        size_t chunk = min(n, MAX_FRAME_PAYLOAD);
+        if (mode == FORWARD_COPY) {
+            vector<uint8_t> response(TCP_FRAME_HEADER + chunk);
+            encode_tcp_header(response.data(), 1000, (uint16_t)chunk);
+            memcpy(response.data() + TCP_FRAME_HEADER, data, chunk);
+            copied += chunk;
+            keep(write(fd, response.data(), response.size()));
+        } else {
+            uint8_t header[TCP_FRAME_HEADER];
+            encode_tcp_header(header, 1000, (uint16_t)chunk);
+            if (mode == FORWARD_COALESCED && TCP_FRAME_HEADER + chunk < COALESCE_MAX_BYTES) {
+                pending.insert(pending.end(), header, header + TCP_FRAME_HEADER);
+                pending.insert(pending.end(), data, data + chunk);
+                copied += TCP_FRAME_HEADER + chunk;
+                if (pending.size() >= COALESCE_MAX_BYTES) {
+                    keep(write(fd, pending.data(), pending.size()));
+                    pending.clear();
+                }
+            } else {
+                // 大帧与已合并的数据由一次writev发出(sendv_after_buffer)
+                iovec iov[3];
+                int iovcnt = 0;
+                if (!pending.empty()) iov[iovcnt++] = iovec{pending.data(), pending.size()};
+                iov[iovcnt++] = iovec{header, sizeof(header)};
+                iov[iovcnt++] = iovec{(void*)data, chunk};
+                keep(writev(fd, iov, iovcnt));
+                pending.clear();
+            }
+        }
+        data += chunk;
+        n -= chunk;
+    }
+}
+
+static void register_forward() {
+    const struct {
+        const char* name;
+        ForwardMode mode;
+    } modes[] = {
+        {"copy", FORWARD_COPY},
+        {"iovec", FORWARD_IOVEC},
+        {"coalesced", FORWARD_COALESCED},
+    };
+    const size_t sizes[] = {64, 1460, 16384, 131072};
+    for (size_t size : sizes) {
+        Random rng(size + 7);
+        auto payload = make_shared<vector<uint8_t>>(make_game_payload(rng, size));
+        for (auto& m : modes) {
+            ForwardMode mode = m.mode;
+            auto counters = make_shared<ForwardCounters>();
+            Benchmark& b = add_benchmark(string("forward/") + m.name + "/" + to_string(size), (double)size, 0,
+                                         [=](uint64_t iters) {
+                static int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+                vector<uint8_t> pending;
+                pending.reserve(COALESCE_MAX_BYTES * 2);
+                uint64_t cpu_start = thread_cpu_ns();
+                for (uint64_t i = 0; i < iters; i++) {
+                    forward_chunk(mode, null_fd, pending, payload->data(), payload->size(), counters->copied);
+                    // 一轮事件结束: on_flush发出合并的数据
+                    if (!pending.empty() && (i + 1) % COALESCE_FRAMES_PER_ROUND == 0) {
+                        keep(write(null_fd, pending.data(), pending.size()));
+                        pending.clear();
+                    }
+                }
+                if (!pending.empty()) keep(write(null_fd, pending.data(), pending.size()));
+                counters->cpu_ns += thread_cpu_ns() - cpu_start;
+                counters->forwarded += iters * payload->size();
+            });
+            b.reset = [=]() { *counters = ForwardCounters(); };
+            b.counters = [=](BenchCounters& out) {
+                double forwarded = (double)counters->forwarded;
+                out.push_back(make_pair("copied_bytes_per_byte", forwarded > 0 ? counters->copied / forwarded : 0));
+                out.push_back(make_pair("cpu_ms_per_gb", forwarded > 0 ? counters->cpu_ns / 1e6 / (forwarded / 1e9) : 0));
+            };
+        }
+    }
+}
+
+static void register_client() {
+    const int sizes[] = {20, 60, 1500};
+    for (int size : sizes) {
+        Random rng(size);
+        auto data = make_shared<vector<uint8_t>>(make_game_payload(rng, size));
+        add_benchmark("client_checksum/" + to_string(size), (double)size, 0, [=](uint64_t iters) {
+            for (uint64_t i = 0; i < iters; i++) {
+                uint16_t sum = calculate_checksum(data->data(), (int)data->size());
+                keep(sum);
+            }
+        });
+    }
+
+    // 0字节为ACK，其余为注入的数据段(PSH+ACK)，1460为一个满MSS的分段
+    const int payloads[] = {0, 64, 1460};
+    for (int size : payloads) {
+        Random rng(size + 1);
+        auto payload = make_shared<vector<uint8_t>>(make_game_payload(rng, size));
+        uint8_t flags = size == 0 ? 0x10 : 0x18;
+        add_benchmark("client_packet/" + to_string(size), (double)(40 + size), 0, [=](uint64_t iters) {
+            // 游戏客户端192.168.2.10:52001 ← 游戏服务器10.20.30.40:10011(客户端传入TCPConnection的成员)
+            const string client_ip = "192.168.2.10", server_ip = "10.20.30.40";
+            uint16_t ip_id = 1;
+            for (uint64_t i = 0; i < iters; i++) {
+                vector<uint8_t> packet = build_complete_packet(client_ip, 52001, server_ip, 10011, ip_id,
+                                                               flags, 1000 + (uint32_t)i, 2000, payload->data(),
+                                                               size, 65535);
+                keep(packet);
+            }
+        });
+    }
+}
+
+static void register_clock() {
+    const struct {
+        const char* name;
+        clockid_t id;
+    } clocks[] = {
+        {"clock/monotonic", CLOCK_MONOTONIC},
+        {"clock/monotonic_coarse", CLOCK_MONOTONIC_COARSE},
+        {"clock/realtime", CLOCK_REALTIME},
+    };
+    for (auto& c : clocks) {
+        clockid_t id = c.id;
+        add_benchmark(c.name, 0, 0, [=](uint64_t iters) {
+            for (uint64_t i = 0; i < iters; i++) {
+                timespec ts;
+                clock_gettime(id, &ts);
+                keep(ts);
+            }
+        });
+    }
+}
+
+// 与TunnelConnection::record_latency相同: recv返回时读一次时钟，帧发出后再读一次并记入直方图，
+// 同一次recv的frames个帧记同一个值；session为latency_per_session时另外记入会话的直方图
+static void register_latency() {
+    static LatencyHistogram shard_hist;
+    static LatencyHistogram session_hist;
+    const uint64_t frame_counts[] = {1, 10};
+    for (uint64_t frames : frame_counts) {
+        for (int session = 0; session < 2; session++) {
+            string name = string("latency/record/") + (session ? "shard+session" : "shard") +
+                          "/frames" + to_string(frames);
+            add_benchmark(name, 0, (double)frames, [frames, session](uint64_t iters) {
+                for (uint64_t i = 0; i < iters; i++) {
+                    uint64_t recv_ns = monotonic_ns();
+                    keep(recv_ns);
+                    uint64_t ns = monotonic_ns() - recv_ns;
+                    shard_hist.record(ns, frames);
+                    if (session) session_hist.record(ns, frames);
+                }
+            });
+        }
+    }
+}
+
+// 与TunnelConnection::add_stat相同: 每帧frames_to_game+1、bytes_to_game+len，会话和所属worker分片各累加一次
+static void register_stats() {
+    static ForwardStats session_stats;
+    static ForwardStats shard_stats;
+    add_benchmark("stats/add_stat/session+shard", 0, 1, [](uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+            uint64_t len = 64 + (i & 511);
+            session_stats.add(STAT_FRAMES_TO_GAME, 1);
+            shard_stats.add(STAT_FRAMES_TO_GAME, 1);
+            session_stats.add(STAT_BYTES_TO_GAME, len);
+            shard_stats.add(STAT_BYTES_TO_GAME, len);
+        }
+        keep(shard_stats.get(STAT_BYTES_TO_GAME));
+    });
+    add_benchmark("stats/add_stat/fetch_add", 0, 1, [](uint64_t iters) {
+        for (uint64_t i = 0; i < iters; i++) {
+            uint64_t len = 64 + (i & 511);
+            session_stats.counters[STAT_FRAMES_TO_GAME].fetch_add(1, memory_order_relaxed);
+            shard_stats.counters[STAT_FRAMES_TO_GAME].fetch_add(1, memory_order_relaxed);
+            session_stats.counters[STAT_BYTES_TO_GAME].fetch_add(len, memory_order_relaxed);
+            shard_stats.counters[STAT_BYTES_TO_GAME].fetch_add(len, memory_order_relaxed);
+        }
+        keep(shard_stats.get(STAT_BYTES_TO_GAME));
+    });
+}
+
+// Logger写入临时目录(不输出到控制台)，文件按64MB轮转、最多保留2个，只在运行log/用例时初始化
+// binary: 二进制日志格式(只能在init时指定，格式不同时重新初始化)
+static string log_dir;
+static bool log_binary = false;
+
+static void stop_logger();
+
+static void start_logger(bool binary = false) {
+    if (!log_dir.empty() && log_binary == binary) return;
+    stop_logger();
+    char tmpl[] = "/tmp/dnf-microbench-XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        fprintf(stderr, "无法创建日志临时目录: %s\n", strerror(errno));
+        exit(1);
+    }
+    log_dir = tmpl;
+    Logger::set_log_level("INFO");
+    Logger::configure(100, 65536, false, false);
+    Logger::configure_files(64, 0, 2, false, 0);
+    Logger::init(log_dir + "/bench_", binary ? ".bin" : ".log", binary);
+    log_binary = binary;
+}
+
+static void stop_logger() {
+    if (log_dir.empty()) return;
+    Logger::close();
+    DIR* d = opendir(log_dir.c_str());
+    if (d != nullptr) {
+        while (dirent* entry = readdir(d)) {
+            if (entry->d_name[0] != '.') unlink((log_dir + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(log_dir.c_str());
+    log_dir.clear();
+}
+
+// 日志目录中所有文件的总字节数
+static uint64_t log_dir_bytes() {
+    uint64_t total = 0;
+    DIR* d = opendir(log_dir.c_str());
+    if (d == nullptr) return 0;
+    while (dirent* entry = readdir(d)) {
+        struct stat st;
+        if (entry->d_name[0] != '.' && stat((log_dir + "/" + entry->d_name).c_str(), &st) == 0) total += st.st_size;
+    }
+    closedir(d);
+    return total;
+}
+
+// 每次操作: threads个线程同时各调用LOG_INFO(与连接日志相同的前缀+数值拼接)LOG_CALLS_PER_THREAD次，
+// ns_per_item为平均每次调用的耗时；队列满时按默认的drop策略丢弃，drop_rate为测量各轮中被丢弃的比例
+static const uint64_t LOG_CALLS_PER_THREAD = 4096;
+
+static void register_logger() {
+    const int thread_counts[] = {1, 8, 64};
+    for (int threads : thread_counts) {
+        auto calls = make_shared<atomic<uint64_t>>(0);
+        auto drops_before = make_shared<uint64_t>(0);
+        auto elapsed_ns = make_shared<uint64_t>(0);
+        double calls_per_op = (double)(threads * LOG_CALLS_PER_THREAD);
+        Benchmark& b = add_benchmark("log/enqueue/threads" + to_string(threads), 0, calls_per_op,
+                                     [=](uint64_t iters) {
+            start_logger();
+            uint64_t start = monotonic_ns();
+            for (uint64_t i = 0; i < iters; i++) {
+                vector<thread> workers;
+                for (int t = 0; t < threads; t++) {
+                    workers.emplace_back([=]() {
+                        string prefix = "[连接" + to_string(1000 + t) + "|3f2a9c1e-5b7d-4e8a-9f01-" + to_string(t) + "] ";
+                        for (uint64_t n = 0; n < LOG_CALLS_PER_THREAD; n++) {
+                            LOG_INFO(prefix + "游戏->客户端 " + to_string(n) + "字节");
+                        }
+                    });
+                }
+                for (thread& w : workers) w.join();
+            }
+            calls->fetch_add(iters * (uint64_t)calls_per_op, memory_order_relaxed);
+            *elapsed_ns += monotonic_ns() - start;
+        });
+        b.reset = [=]() {
+            calls->store(0);
+            *drops_before = Logger::dropped_count();
+            *elapsed_ns = 0;
+        };
+        b.counters = [=](BenchCounters& out) {
+            double total = (double)calls->load();
+            double dropped = (double)(Logger::dropped_count() - *drops_before);
+            out.push_back(make_pair("calls_per_sec", *elapsed_ns > 0 ? total * 1e9 / *elapsed_ns : 0));
+            out.push_back(make_pair("drop_rate", total > 0 ? dropped / total : 0));
+        };
+    }
+}
+
+// v6.14之前的同步日志: 格式化一行后在互斥锁内写入文件并立即刷新(每行一次write)
+struct SyncFileLogger {
+    mutex log_mutex;
+    int fd;
+
+    SyncFileLogger() : fd(-1) {}
+
+    void info(const string& msg) {
+        char ts[32];
+        time_t now = time(nullptr);
+        tm parts;
+        localtime_r(&now, &parts);
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &parts);
+        string line = string(ts) + " [INFO] " + msg + "\n";
+        lock_guard<mutex> lock(log_mutex);
+        ssize_t ret = ::write(fd, line.data(), line.size());
+        (void)ret;
+    }
+};
+
+enum ForwardLogMode { FORWARD_LOG_NONE, FORWARD_LOG_ASYNC, FORWARD_LOG_SYNC };
+
+// 每次操作: threads个worker各转发FORWARD_LOG_CONNS条连接，每条连接为一段约4KB的0x01/0x02帧流
+// (FrameDecoder解析 + IpRewriter替换)，建立和关闭时各写一条INFO日志；ns_per_item为均摊到每帧的耗时
+static const int FORWARD_LOG_CONNS = 64;
+
+static void register_forward_logs() {
+    static IpRewriter rewriter;
+    rewriter.init(CLIENT_IP, PROXY_IP);
+    Random rng(4096);
+    size_t frames = 0;
+    auto stream = make_shared<vector<uint8_t>>(make_tcp_stream(rng, 4096, frames));
+    unsigned mask = frame_type_bit(FRAME_TCP_DATA) | frame_type_bit(FRAME_HEARTBEAT);
+    auto sync_logger = make_shared<SyncFileLogger>();
+
+    const struct {
+        const char* name;
+        ForwardLogMode mode;
+    } modes[] = {
+        {"none", FORWARD_LOG_NONE},
+        {"async", FORWARD_LOG_ASYNC},
+        {"sync", FORWARD_LOG_SYNC},
+    };
+    const int thread_counts[] = {1, 8};
+    for (auto& m : modes) {
+        for (int threads : thread_counts) {
+            ForwardLogMode mode = m.mode;
+            double frames_per_op = (double)(threads * FORWARD_LOG_CONNS) * frames;
+            string name = string("log/forward_info/") + m.name + "/threads" + to_string(threads);
+            Benchmark& b = add_benchmark(name, (double)(threads * FORWARD_LOG_CONNS) * stream->size(), frames_per_op,
+                                         [=](uint64_t iters) {
+                start_logger();
+                if (mode == FORWARD_LOG_SYNC) {
+                    sync_logger->fd = open((log_dir + "/sync.log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+                }
+                Logger::set_log_level(mode == FORWARD_LOG_NONE ? "WARN" : "INFO");
+                for (uint64_t i = 0; i < iters; i++) {
+                    vector<thread> workers;
+                    for (int t = 0; t < threads; t++) {
+                        workers.emplace_back([=]() {
+                            vector<uint8_t> data(*stream);
+                            FrameDecoder decoder(mask);
+                            for (int c = 0; c < FORWARD_LOG_CONNS; c++) {
+                                string prefix = "[连接" + to_string(t * FORWARD_LOG_CONNS + c) +
+                                                "|3f2a9c1e-5b7d-4e8a-9f01-" + to_string(t) + "] ";
+                                if (mode == FORWARD_LOG_SYNC) {
+                                    sync_logger->info(prefix + "新连接: [::ffff:192.168.2.10]:56601");
+                                } else {
+                                    LOG_INFO(prefix + "新连接: [::ffff:192.168.2.10]:56601");
+                                }
+                                size_t replaced = 0;
+                                decoder.reset();
+                                decoder.feed(data.data(), data.size());
+                                FrameView frame;
+                                while (decoder.next(frame) == FRAME_OK) {
+                                    if (frame.type == FRAME_TCP_DATA) {
+                                        replaced += rewriter.rewrite(frame.payload, frame.length);
+                                    }
+                                }
+                                if (mode == FORWARD_LOG_SYNC) {
+                                    sync_logger->info(prefix + "连接关闭 (替换" + to_string(replaced) + "处)");
+                                } else {
+                                    LOG_INFO(prefix + "连接关闭 (替换" + to_string(replaced) + "处)");
+                                }
+                            }
+                        });
+                    }
+                    for (thread& w : workers) w.join();
+                }
+                Logger::set_log_level("INFO");
+                if (sync_logger->fd >= 0) {
+                    close(sync_logger->fd);
+                    sync_logger->fd = -1;
+                }
+            });
+            b.counters = [=](BenchCounters& out) {
+                out.push_back(make_pair("frames_per_connection", (double)frames));
+            };
+        }
+    }
+}
+
+// 一条TCP连接的生命周期事件(与TunnelConnection相同的LOG_EVENT): 握手、keepalive、连接游戏服务器、
+// 客户端断开、关闭游戏socket
+static const int LIFECYCLE_EVENTS = 5;
+
+static void lifecycle_events(const LogSession& session, uint64_t i) {
+    LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_HANDSHAKE, session, "[::ffff:192.168.2.10]:56601", 10011);
+    LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_KEEPALIVE, session, "", 60, 10, 6);
+    LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_GAME_CONNECTED, session, "127.0.0.1", 10011);
+    LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_CLIENT_EOF, session, "");
+    LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_GAME_CLOSED, session, "", 100 + (i & 1023));
+}
+
+// 文件中每条事件的字节数: 队列满时等待(不丢弃)写入n条，关闭后与只初始化、不写事件的文件大小相减
+static double lifecycle_bytes_per_event(bool binary) {
+    const uint64_t n = 4096;
+    uint64_t sizes[2];
+    for (int with_events = 0; with_events < 2; with_events++) {
+        stop_logger();
+        start_logger(binary);
+        Logger::configure(100, 65536, true, false);
+        LogSession session = Logger::session(1000, "3f2a9c1e-5b7d-4e8a-9f01-000000000000");
+        if (with_events) {
+            for (uint64_t i = 0; i < n / LIFECYCLE_EVENTS; i++) lifecycle_events(session, i);
+        }
+        Logger::end_session(session);
+        Logger::close();
+        sizes[with_events] = log_dir_bytes();
+    }
+    stop_logger();
+    Logger::configure(100, 65536, false, false);
+    return (double)(sizes[1] - sizes[0]) / (double)(n / LIFECYCLE_EVENTS * LIFECYCLE_EVENTS);
+}
+
+// 每次操作为一条连接的5个生命周期事件(默认INFO级别，队列满时丢弃)，ns_per_item为每条事件的耗时
+static void register_lifecycle_events() {
+    for (int binary = 0; binary < 2; binary++) {
+        Benchmark& b = add_benchmark(string("log/lifecycle_event/") + (binary ? "binary" : "text"), 0,
+                                     LIFECYCLE_EVENTS, [binary](uint64_t iters) {
+            start_logger(binary != 0);
+            LogSession session = Logger::session(1000, "3f2a9c1e-5b7d-4e8a-9f01-000000000000");
+            for (uint64_t i = 0; i < iters; i++) lifecycle_events(session, i);
+            Logger::end_session(session);
+        });
+        b.counters = [binary](BenchCounters& out) {
+            out.push_back(make_pair("bytes_per_event", lifecycle_bytes_per_event(binary != 0)));
+        };
+    }
+}
+
+// UDP隧道encode_udp_response中每个数据报的4条日志
+// v6.14: INFO级别，hex先由sprintf逐字节拼接，默认级别下全部格式化并写入日志
+static void udp_datagram_logs_v614(uint16_t src_port, uint16_t game_port, uint32_t conn_id, uint16_t client_port,
+                                   const uint8_t* data, int n, const uint8_t* header) {
+    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                 "] ←[游戏服务器] 接收到UDP数据: " + to_string(n) + "字节");
+    string payload_hex = "";
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && i % 16 == 0) {
+            payload_hex += "\n                    ";
+        }
+        char hex_buf[4];
+        sprintf(hex_buf, "%02x ", data[i]);
+        payload_hex += hex_buf;
+    }
+    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                 "] UDP Payload(" + to_string(n) + "字节):\n                    " + payload_hex);
+    size_t response_size = UDP_FRAME_HEADER + n;
+    string response_hex = "";
+    int dump_len = min(28, (int)response_size);
+    for (int i = 0; i < dump_len; i++) {
+        if (i > 0 && i % 16 == 0) {
+            response_hex += "\n                    ";
+        }
+        char hex_buf[4];
+        sprintf(hex_buf, "%02x ", i < 11 ? header[i] : data[i - 11]);
+        response_hex += hex_buf;
+    }
+    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                 "] 封装后数据包(前" + to_string(dump_len) + "字节):\n                    " + response_hex);
+    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                 "] →[客户端] 准备发送: " + to_string(response_size) + "字节 (conn_id=" + to_string(conn_id) + ")");
+}
+
+// 现在的写法: DEBUG级别的LOG_*宏；MinLevel相当于编译时的LOG_MIN_LEVEL
+#define BENCH_LOG_DEBUG(min_level, ...) \
+    do { if (Logger::PRIORITY_DEBUG >= (min_level) && Logger::enabled(Logger::PRIORITY_DEBUG)) Logger::debug(__VA_ARGS__); } while (0)
+
+template <int MinLevel>
+static void udp_datagram_logs(uint16_t src_port, uint16_t game_port, uint32_t conn_id, uint16_t client_port,
+                              const uint8_t* data, int n, const uint8_t* header) {
+    BENCH_LOG_DEBUG(MinLevel, "[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                    "] ←[游戏服务器] 接收到UDP数据: " + to_string(n) + "字节");
+    BENCH_LOG_DEBUG(MinLevel, "[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                    "] UDP Payload(" + to_string(n) + "字节):\n                    " +
+                    hex_dump(data, n, 16, "                    "));
+    BENCH_LOG_DEBUG(MinLevel, "[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                    "] 封装后数据包(前" + to_string(UDP_FRAME_HEADER + min(n, 17)) + "字节):\n                    " +
+                    hex_dump(header, UDP_FRAME_HEADER) + "| " + hex_dump(data, (size_t)min(n, 17)));
+    BENCH_LOG_DEBUG(MinLevel, "[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_port) +
+                    "] →[客户端] 准备发送: " + to_string(UDP_FRAME_HEADER + n) +
+                    "字节 (conn_id=" + to_string(conn_id) + ")");
+}
+
+// 每次操作为一个64字节数据报的编码(encode_udp_header)加上各版本的日志语句，日志级别为默认的INFO
+static void register_udp_datagram_logs() {
+    typedef void (*LogFn)(uint16_t, uint16_t, uint32_t, uint16_t, const uint8_t*, int, const uint8_t*);
+    const struct {
+        const char* name;
+        LogFn fn;
+    } variants[] = {
+        {"log/udp_datagram/v6.14_info", udp_datagram_logs_v614},
+        {"log/udp_datagram/debug_level_info", udp_datagram_logs<0>},
+        {"log/udp_datagram/debug_compiled_out", udp_datagram_logs<1>},
+    };
+    Random rng(64);
+    auto payload = make_shared<vector<uint8_t>>(make_game_payload(rng, 64));
+    for (auto& v : variants) {
+        LogFn fn = v.fn;
+        add_benchmark(v.name, 0, 0, [=](uint64_t iters) {
+            start_logger();
+            uint8_t header[UDP_FRAME_HEADER];
+            for (uint64_t i = 0; i < iters; i++) {
+                uint16_t src_port = (uint16_t)(20000 + (i & 3));
+                encode_udp_header(header, 1000, 10011, src_port, (uint16_t)payload->size());
+                fn(src_port, 10011, 1000, src_port, payload->data(), (int)payload->size(), header);
+                keep(header);
+            }
+        });
+    }
+}
+
+// ==================== 参数与结果 ====================
+static void usage() {
+    fprintf(stderr,
+            "用法: dnf-microbench [--filter STR]... [--min-time MS] [--warmup MS] [--repeat N]\n"
+            "                     [--json FILE] [--list]\n");
+}
+
+static bool parse_options(int argc, char* argv[], MicrobenchOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--list") {
+            opt.list_only = true;
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            exit(0);
+        } else if (!has_value) {
+            return false;
+        } else if (arg == "--filter") {
+            opt.filters.push_back(argv[++i]);
+        } else if (arg == "--min-time") {
+            opt.min_time_ms = atof(argv[++i]);
+        } else if (arg == "--warmup") {
+            opt.warmup_ms = atof(argv[++i]);
+        } else if (arg == "--repeat") {
+            opt.repeat = atoi(argv[++i]);
+        } else if (arg == "--json") {
+            opt.json_path = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return opt.min_time_ms > 0 && opt.warmup_ms >= 0 && opt.repeat >= 1;
+}
+
+static bool selected(const MicrobenchOptions& opt, const string& name) {
+    if (opt.filters.empty()) return true;
+    for (const string& f : opt.filters) {
+        if (name.find(f) != string::npos) return true;
+    }
+    return false;
+}
+
+static string cpu_model() {
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f == nullptr) return "";
+    char line[512];
+    string model;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (strncmp(line, "model name", 10) == 0) {
+            const char* colon = strchr(line, ':');
+            if (colon != nullptr) {
+                model = colon + 1;
+                model.erase(0, model.find_first_not_of(" \t"));
+                model.erase(model.find_last_not_of(" \t\r\n") + 1);
+            }
+            break;
+        }
+    }
+    fclose(f);
+    // JSON字符串中不允许出现的字符
+    for (char& c : model) {
+        if (c == '"' || c == '\\' || (unsigned char)c < 0x20) c = ' ';
+    }
+    return model;
+}
+
+static string format_double(double v) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.3f", v);
+    return buf;
+}
+
+static string build_result_json(const MicrobenchOptions& opt, const vector<BenchResult>& results) {
+    string out = "{\n";
+    out += "  \"tool\": \"dnf-microbench\",\n";
+    out += "  \"cpu\": \"" + cpu_model() + "\",\n";
+    out += string("  \"ip_rewriter_impl\": \"") + IpRewriter::impl_name(IpRewriter::active_impl()) + "\",\n";
+    out += "  \"config\": {\"min_time_ms\":" + format_double(opt.min_time_ms) + ",\"warmup_ms\":" +
+           format_double(opt.warmup_ms) + ",\"repeat\":" + to_string(opt.repeat) + "},\n";
+    out += "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out += i == 0 ? "\n" : ",\n";
+        out += "    {\"name\":\"" + r.name + "\",\"iterations\":" + to_string(r.iterations) +
+               ",\"ns_per_op\":" + format_double(r.ns_per_op) + ",\"ns_per_op_min\":" + format_double(r.ns_per_op_min);
+        if (r.bytes_per_op > 0) {
+            out += ",\"bytes_per_op\":" + format_double(r.bytes_per_op) +
+                   ",\"mbytes_per_sec\":" + format_double(r.bytes_per_op / r.ns_per_op * 1e3);
+        }
+        if (r.items_per_op > 0) {
+            out += ",\"items_per_op\":" + format_double(r.items_per_op) +
+                   ",\"ns_per_item\":" + format_double(r.ns_per_op / r.items_per_op);
+        }
+        for (const auto& c : r.counters) {
+            out += ",\"" + c.first + "\":" + format_double(c.second);
+        }
+        out += "}";
+    }
+    out += "\n  ]\n}\n";
+    return out;
+}
+
+int main(int argc, char* argv[]) {
+    MicrobenchOptions opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+
+    register_ip_rewrite();
+    register_frame_parse();
+    register_forward();
+    register_extract_ip();
+    register_udp_flow();
+    register_dns();
+    register_client();
+    register_clock();
+    register_latency();
+    register_stats();
+    register_logger();
+    register_forward_logs();
+    register_lifecycle_events();
+    register_udp_datagram_logs();
+
+    vector<BenchResult> results;
+    for (const Benchmark& b : registry()) {
+        if (!selected(opt, b.name)) continue;
+        if (opt.list_only) {
+            printf("%s\n", b.name.c_str());
+            continue;
+        }
+        BenchResult r = measure(b, opt);
+        // 进度输出到stderr，标准输出只有JSON
+        fprintf(stderr, "%-36s %12.1f ns/op", r.name.c_str(), r.ns_per_op);
+        if (r.bytes_per_op > 0) fprintf(stderr, " %10.1f MB/s", r.bytes_per_op / r.ns_per_op * 1e3);
+        if (r.items_per_op > 0) fprintf(stderr, " %8.2f ns/帧", r.ns_per_op / r.items_per_op);
+        for (const auto& c : r.counters) fprintf(stderr, " %s=%.3f", c.first.c_str(), c.second);
+        fprintf(stderr, "\n");
+        results.push_back(r);
+    }
+    stop_logger();
+    if (opt.list_only) return 0;
+    if (results.empty()) {
+        fprintf(stderr, "没有匹配的用例\n");
+        return 1;
+    }
+
+    string json = build_result_json(opt, results);
+    if (opt.json_path.empty()) {
+        fputs(json.c_str(), stdout);
+        return 0;
+    }
+    FILE* f = fopen(opt.json_path.c_str(), "w");
+    if (f == nullptr) {
+        fprintf(stderr, "无法写入 %s: %s\n", opt.json_path.c_str(), strerror(errno));
+        return 1;
+    }
+    fputs(json.c_str(), f);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * tunnel_protocol.h 单元测试 (make test)
+ * 编码/解码往返、parse_frame边界、FrameDecoder拼帧与conn_id过滤、心跳data_len
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "tunnel_protocol.h"
+#include "test_util.h"
+
+using namespace std;
+
+static const unsigned TCP_MASK = (1u << FRAME_TCP_DATA) | (1u << FRAME_HEARTBEAT);
+static const unsigned UDP_MASK = 1u << FRAME_UDP_DATA;
+
+// 一帧的预期内容
+struct Expected {
+    uint8_t type;
+    uint32_t conn_id;
+    uint16_t src_port;
+    uint16_t dst_port;
+    vector<uint8_t> payload;
+};
+
+static vector<uint8_t> make_payload(size_t len, uint8_t seed) {
+    vector<uint8_t> p(len);
+    for (size_t i = 0; i < len; i++) p[i] = (uint8_t)(seed + i * 7);
+    return p;
+}
+
+static void append_tcp(vector<uint8_t>& out, vector<Expected>& exp, uint32_t conn_id, size_t len) {
+    Expected e = {FRAME_TCP_DATA, conn_id, 0, 0, make_payload(len, (uint8_t)exp.size())};
+    size_t old = out.size();
+    out.resize(old + TCP_FRAME_HEADER + len);
+    encode_tcp_header(out.data() + old, conn_id, (uint16_t)len);
+    if (len > 0) memcpy(out.data() + old + TCP_FRAME_HEADER, e.payload.data(), len);
+    exp.push_back(e);
+}
+
+static void append_heartbeat_v2(vector<uint8_t>& out, vector<Expected>& exp, uint32_t conn_id) {
+    size_t old = out.size();
+    out.resize(old + HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REQUEST_LEN);
+    encode_heartbeat_v2(out.data() + old, conn_id, 9, 0x0102030405060708ULL, 1234);
+    Expected e = {FRAME_HEARTBEAT, conn_id, 0, 0,
+                  vector<uint8_t>(out.begin() + old + HEARTBEAT_FRAME_SIZE, out.end())};
+    exp.push_back(e);
+}
+
+static void append_heartbeat_v1(vector<uint8_t>& out, vector<Expected>& exp, uint32_t conn_id) {
+    size_t old = out.size();
+    out.resize(old + HEARTBEAT_FRAME_SIZE);
+    encode_heartbeat(out.data() + old, conn_id);
+    exp.push_back(Expected{FRAME_HEARTBEAT, conn_id, 0, 0, vector<uint8_t>()});
+}
+
+// 帧流: 数据帧(含0长度和最大长度附近)夹杂v1/v2心跳
+static vector<uint8_t> make_tcp_stream(vector<Expected>& exp) {
+    vector<uint8_t> out;
+    const size_t lens[] = {1, 0, 30, 7, 1500, 3, 300, 65535, 12};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        append_tcp(out, exp, 42, lens[i]);
+        if (i % 3 == 1) append_heartbeat_v1(out, exp, 42);
+        if (i % 3 == 2) append_heartbeat_v2(out, exp, 42);
+    }
+    return out;
+}
+
+static bool frame_matches(const FrameView& f, const Expected& e) {
+    return f.type == e.type && f.conn_id == e.conn_id && f.src_port == e.src_port && f.dst_port == e.dst_port &&
+           f.length == e.payload.size() && (f.length == 0 || memcmp(f.payload, e.payload.data(), f.length) == 0);
+}
+
+// 按chunks给出的分块依次feed，返回解出的帧是否与预期完全一致
+static bool decode_in_chunks(const vector<uint8_t>& stream, const vector<size_t>& chunks,
+                             const vector<Expected>& exp, unsigned mask) {
+    FrameDecoder decoder(mask);
+    vector<uint8_t> buf(stream);
+    size_t pos = 0;
+    size_t index = 0;
+    for (size_t chunk : chunks) {
+        decoder.feed(buf.data() + pos, chunk);
+        pos += chunk;
+        FrameView f;
+        FrameResult r;
+        while ((r = decoder.next(f)) == FRAME_OK) {
+            if (index >= exp.size() || !frame_matches(f, exp[index])) return false;
+            index++;
+        }
+        if (r != FRAME_INCOMPLETE) return false;
+    }
+    return pos == stream.size() && index == exp.size();
+}
+
+// ==================== 字节序与编码 ====================
+TEST(byte_order_round_trip) {
+    uint8_t b[8];
+    store_be16(b, 0xA1B2);
+    CHECK_EQ(b[0], 0xA1);
+    CHECK_EQ(load_be16(b), 0xA1B2);
+    store_be32(b, 0xDEADBEEF);
+    CHECK_EQ(b[0], 0xDE);
+    CHECK_EQ(b[3], 0xEF);
+    CHECK(load_be32(b) == 0xDEADBEEFu);
+    store_be64(b, 0x0102030405060708ULL);
+    CHECK_EQ(b[0], 1);
+    CHECK_EQ(b[7], 8);
+    CHECK(load_be64(b) == 0x0102030405060708ULL);
+}
+
+TEST(tcp_frame_round_trip) {
+    uint8_t buf[TCP_FRAME_HEADER + 5];
+    CHECK_EQ(encode_tcp_header(buf, 0x11223344, 5), TCP_FRAME_HEADER);
+    memcpy(buf + TCP_FRAME_HEADER, "hello", 5);
+    FrameView f;
+    size_t need = 0;
+    CHECK_EQ(parse_frame(buf, sizeof(buf), TCP_MASK, f, need), FRAME_OK);
+    CHECK_EQ(need, sizeof(buf));
+    CHECK_EQ(f.type, FRAME_TCP_DATA);
+    CHECK(f.conn_id == 0x11223344u);
+    CHECK_EQ(f.length, 5);
+    CHECK(f.payload == buf + TCP_FRAME_HEADER);
+    CHECK_EQ(f.src_port, 0);
+    CHECK_EQ(f.dst_port, 0);
+}
+
+TEST(udp_frame_round_trip) {
+    uint8_t buf[UDP_FRAME_HEADER + 3] = {0};
+    CHECK_EQ(encode_udp_header(buf, 7, 20001, 10011, 3), UDP_FRAME_HEADER);
+    FrameView f;
+    size_t need = 0;
+    CHECK_EQ(parse_frame(buf, sizeof(buf), UDP_MASK, f, need), FRAME_OK);
+    CHECK_EQ(need, sizeof(buf));
+    CHECK_EQ(f.type, FRAME_UDP_DATA);
+    CHECK_EQ(f.conn_id, 7);
+    CHECK_EQ(f.src_port, 20001);
+    CHECK_EQ(f.dst_port, 10011);
+    CHECK_EQ(f.length, 3);
+    CHECK(f.payload == buf + UDP_FRAME_HEADER);
+}
+
+TEST(handshake_round_trip) {
+    uint8_t buf[HANDSHAKE_HEADER + 255];
+    const char* uuid = "0123456789abcdef";
+    size_t n = encode_handshake(buf, UDP_TUNNEL_CONN_ID, 10011, uuid, (uint8_t)strlen(uuid));
+    CHECK_EQ(n, HANDSHAKE_HEADER + strlen(uuid));
+    HandshakeHeader h = decode_handshake_header(buf);
+    CHECK(h.conn_id == UDP_TUNNEL_CONN_ID);
+    CHECK_EQ(h.dst_port, 10011);
+    CHECK_EQ(h.uuid_len, strlen(uuid));
+    CHECK(memcmp(buf + HANDSHAKE_HEADER, uuid, strlen(uuid)) == 0);
+
+    CHECK_EQ(encode_handshake(buf, 5, 80, nullptr, 0), HANDSHAKE_HEADER);
+    CHECK_EQ(decode_handshake_header(buf).uuid_len, 0);
+
+    uint8_t ack[HANDSHAKE_ACK_SIZE];
+    CHECK_EQ(encode_handshake_ack(ack, 5, 10011), HANDSHAKE_ACK_SIZE);
+    CHECK_EQ(load_be32(ack), 5);
+    CHECK_EQ(load_be16(ack + 4), 10011);
+}
+
+// ==================== 心跳data_len ====================
+TEST(heartbeat_v1_zero_length) {
+    uint8_t buf[HEARTBEAT_FRAME_SIZE];
+    CHECK_EQ(encode_heartbeat(buf, 99), HEARTBEAT_FRAME_SIZE);
+    FrameView f;
+    size_t need = 0;
+    CHECK_EQ(parse_frame(buf, sizeof(buf), TCP_MASK, f, need), FRAME_OK);
+    CHECK_EQ(f.type, FRAME_HEARTBEAT);
+    CHECK_EQ(f.length, 0);
+    CHECK_EQ(need, HEARTBEAT_FRAME_SIZE);
+    HeartbeatV2 hb;
+    CHECK(!decode_heartbeat_v2_request(f.payload, f.length, hb));
+    CHECK(!decode_heartbeat_v2_reply(f.payload, f.length, hb));
+}
+
+TEST(heartbeat_v2_request_and_reply) {
+    uint8_t buf[HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REPLY_LEN];
+    size_t n = encode_heartbeat_v2(buf, 99, 17, 0x1122334455667788ULL, 4321);
+    CHECK_EQ(n, HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REQUEST_LEN);
+    FrameView f;
+    size_t need = 0;
+    // data_len=16: 只有头部时仍不完整
+    CHECK_EQ(parse_frame(buf, HEARTBEAT_FRAME_SIZE, TCP_MASK, f, need), FRAME_INCOMPLETE);
+    CHECK_EQ(need, n);
+    CHECK_EQ(parse_frame(buf, n, TCP_MASK, f, need), FRAME_OK);
+    CHECK_EQ(f.length, HEARTBEAT_V2_REQUEST_LEN);
+    HeartbeatV2 hb;
+    CHECK(decode_heartbeat_v2_request(f.payload, f.length, hb));
+    CHECK_EQ(hb.seq, 17);
+    CHECK(hb.client_send_us == 0x1122334455667788ULL);
+    CHECK_EQ(hb.last_rtt_us, 4321);
+
+    n = encode_heartbeat_v2_reply(buf, 99, 17, 0x1122334455667788ULL, 0x0A0B0C0D0E0F1011ULL);
+    CHECK_EQ(n, HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REPLY_LEN);
+    CHECK_EQ(parse_frame(buf, n, TCP_MASK, f, need), FRAME_OK);
+    CHECK_EQ(f.length, HEARTBEAT_V2_REPLY_LEN);
+    CHECK(decode_heartbeat_v2_reply(f.payload, f.length, hb));
+    CHECK_EQ(hb.seq, 17);
+    CHECK(hb.client_send_us == 0x1122334455667788ULL);
+    CHECK(hb.server_recv_us == 0x0A0B0C0D0E0F1011ULL);
+    // 请求长度不足以解析回复
+    CHECK(!decode_heartbeat_v2_reply(f.payload, HEARTBEAT_V2_REQUEST_LEN, hb));
+}
+
+// ==================== parse_frame / decode_frames ====================
+TEST(parse_frame_incomplete_needs) {
+    vector<Expected> exp;
+    vector<uint8_t> buf;
+    append_tcp(buf, exp, 1, 10);
+    FrameView f;
+    size_t need = 0;
+    for (size_t avail = 0; avail < buf.size(); avail++) {
+        CHECK_EQ(parse_frame(buf.data(), avail, TCP_MASK, f, need), FRAME_INCOMPLETE);
+        size_t expected_need = avail < 5 ? 5 : avail < TCP_FRAME_HEADER ? TCP_FRAME_HEADER : buf.size();
+        CHECK_EQ(need, expected_need);
+    }
+    CHECK_EQ(parse_frame(buf.data(), buf.size(), TCP_MASK, f, need), FRAME_OK);
+}
+
+TEST(parse_frame_unknown_type) {
+    uint8_t buf[UDP_FRAME_HEADER] = {0};
+    encode_udp_header(buf, 0x01020304, 1, 2, 0);
+    FrameView f;
+    size_t need = 0;
+    // TCP掩码不接受0x03: 5字节即可判定，type和conn_id已填
+    CHECK_EQ(parse_frame(buf, 5, TCP_MASK, f, need), FRAME_UNKNOWN);
+    CHECK_EQ(f.type, FRAME_UDP_DATA);
+    CHECK(f.conn_id == 0x01020304u);
+    buf[0] = 0x7F;
+    CHECK_EQ(parse_frame(buf, sizeof(buf), TCP_MASK | UDP_MASK, f, need), FRAME_UNKNOWN);
+    CHECK_EQ(frame_type_bit(200), 0);
+}
+
+TEST(decode_frames_batch) {
+    vector<Expected> exp;
+    vector<uint8_t> stream = make_tcp_stream(exp);
+    vector<FrameView> frames(exp.size());
+
+    size_t consumed = 0;
+    size_t n = decode_frames(stream.data(), stream.size(), TCP_MASK, frames.data(), 3, consumed);
+    CHECK_EQ(n, 3);
+    size_t pos = consumed;
+    n += decode_frames(stream.data() + pos, stream.size() - pos, TCP_MASK, frames.data() + 3, frames.size() - 3,
+                       consumed);
+    pos += consumed;
+    CHECK_EQ(n, exp.size());
+    CHECK_EQ(pos, stream.size());
+    for (size_t i = 0; i < n && i < exp.size(); i++) CHECK(frame_matches(frames[i], exp[i]));
+
+    // 末尾不完整的帧不计入consumed
+    n = decode_frames(stream.data(), stream.size() - 1, TCP_MASK, frames.data(), frames.size(), consumed);
+    CHECK_EQ(n, exp.size() - 1);
+    CHECK_EQ(consumed, stream.size() - TCP_FRAME_HEADER - exp.back().payload.size());
+}
+
+// ==================== FrameDecoder ====================
+TEST(decoder_every_two_way_split) {
+    vector<Expected> exp;
+    vector<uint8_t> stream;
+    append_tcp(stream, exp, 42, 20);
+    append_heartbeat_v2(stream, exp, 42);
+    append_tcp(stream, exp, 42, 0);
+    append_heartbeat_v1(stream, exp, 42);
+    append_tcp(stream, exp, 42, 9);
+    for (size_t cut = 0; cut <= stream.size(); cut++) {
+        vector<size_t> chunks;
+        chunks.push_back(cut);
+        chunks.push_back(stream.size() - cut);
+        if (!decode_in_chunks(stream, chunks, exp, TCP_MASK)) {
+            fprintf(stderr, "  切分位置 %zu 解码结果不一致\n", cut);
+            CHECK(false);
+        }
+    }
+}
+
+TEST(decoder_byte_by_byte) {
+    vector<Expected> exp;
+    vector<uint8_t> stream = make_tcp_stream(exp);
+    CHECK(decode_in_chunks(stream, vector<size_t>(stream.size(), 1), exp, TCP_MASK));
+}
+
+TEST(decoder_random_chunks) {
+    vector<Expected> exp;
+    vector<uint8_t> stream = make_tcp_stream(exp);
+    uint64_t state = 88172645463325252ULL;
+    for (int round = 0; round < 200; round++) {
+        vector<size_t> chunks;
+        size_t left = stream.size();
+        while (left > 0) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            size_t c = 1 + state % (round % 2 ? 64 : 4096);
+            if (c > left) c = left;
+            chunks.push_back(c);
+            left -= c;
+        }
+        CHECK(decode_in_chunks(stream, chunks, exp, TCP_MASK));
+    }
+}
+
+TEST(decoder_udp_frames) {
+    vector<uint8_t> stream;
+    vector<Expected> exp;
+    for (uint16_t i = 0; i < 20; i++) {
+        Expected e = {FRAME_UDP_DATA, 100u + i, (uint16_t)(20000 + i), 10011, make_payload(i * 13, (uint8_t)i)};
+        size_t old = stream.size();
+        stream.resize(old + UDP_FRAME_HEADER + e.payload.size());
+        encode_udp_header(stream.data() + old, e.conn_id, e.src_port, e.dst_port, (uint16_t)e.payload.size());
+        if (!e.payload.empty()) memcpy(stream.data() + old + UDP_FRAME_HEADER, e.payload.data(), e.payload.size());
+        exp.push_back(e);
+    }
+    CHECK(decode_in_chunks(stream, vector<size_t>(stream.size(), 1), exp, UDP_MASK));
+}
+
+TEST(decoder_stash_flag) {
+    vector<Expected> exp;
+    vector<uint8_t> stream;
+    append_tcp(stream, exp, 42, 10);
+    append_tcp(stream, exp, 42, 10);
+    FrameDecoder decoder(TCP_MASK);
+    FrameView f;
+    // 第一帧完整、第二帧被截断
+    decoder.feed(stream.data(), 20);
+    CHECK_EQ(decoder.next(f), FRAME_OK);
+    CHECK(!decoder.frame_in_stash());
+    CHECK_EQ(decoder.next(f), FRAME_INCOMPLETE);
+    decoder.feed(stream.data() + 20, stream.size() - 20);
+    CHECK_EQ(decoder.next(f), FRAME_OK);
+    CHECK(decoder.frame_in_stash());
+    CHECK(frame_matches(f, exp[1]));
+    CHECK_EQ(decoder.next(f), FRAME_INCOMPLETE);
+    CHECK(!decoder.frame_in_stash());
+}
+
+TEST(decoder_reset_drops_partial) {
+    vector<Expected> exp;
+    vector<uint8_t> stream;
+    append_tcp(stream, exp, 42, 10);
+    FrameDecoder decoder(TCP_MASK);
+    FrameView f;
+    decoder.feed(stream.data(), 9);
+    CHECK_EQ(decoder.next(f), FRAME_INCOMPLETE);
+    decoder.reset();
+    decoder.feed(stream.data(), stream.size());
+    CHECK_EQ(decoder.next(f), FRAME_OK);
+    CHECK(frame_matches(f, exp[0]));
+}
+
+// ==================== conn_id过滤与skip ====================
+TEST(expect_conn_id_rejects_after_five_bytes) {
+    vector<Expected> exp;
+    vector<uint8_t> stream;
+    append_tcp(stream, exp, 43, 1000);
+    FrameDecoder decoder(TCP_MASK);
+    decoder.expect_conn_id(42);
+    FrameView f;
+    // 只收到4字节时还无法判定
+    decoder.feed(stream.data(), 4);
+    CHECK_EQ(decoder.next(f), FRAME_INCOMPLETE);
+    // 第5字节到达即判定为错误conn_id，不等待1000字节payload
+    decoder.feed(stream.data() + 4, 1);
+    CHECK_EQ(decoder.next(f), FRAME_UNKNOWN);
+    CHECK_EQ(f.conn_id, 43);
+
+    FrameDecoder direct(TCP_MASK);
+    direct.expect_conn_id(42);
+    direct.feed(stream.data(), 5);
+    CHECK_EQ(direct.next(f), FRAME_UNKNOWN);
+}
+
+TEST(expect_conn_id_accepts_matching) {
+    vector<Expected> exp;
+    vector<uint8_t> stream = make_tcp_stream(exp);
+    FrameDecoder decoder(TCP_MASK);
+    decoder.expect_conn_id(42);
+    size_t index = 0;
+    FrameView f;
+    for (size_t pos = 0; pos < stream.size(); pos += 100) {
+        decoder.feed(stream.data() + pos, min((size_t)100, stream.size() - pos));
+        while (decoder.next(f) == FRAME_OK) {
+            CHECK(index < exp.size() && frame_matches(f, exp[index]));
+            index++;
+        }
+    }
+    CHECK_EQ(index, exp.size());
+}
+
+TEST(skip_across_feeds) {
+    vector<Expected> exp;
+    vector<uint8_t> stream;
+    // 一个未知类型的7字节"帧"后接正常帧
+    stream.resize(7, 0);
+    stream[0] = 0x09;
+    append_tcp(stream, exp, 42, 5);
+    FrameDecoder decoder(TCP_MASK);
+    FrameView f;
+    decoder.feed(stream.data(), 5);
+    CHECK_EQ(decoder.next(f), FRAME_UNKNOWN);
+    CHECK_EQ(f.type, 0x09);
+    decoder.skip(7);    // 当前只有5字节，剩余2字节从下一次feed中跳过
+    CHECK_EQ(decoder.next(f), FRAME_INCOMPLETE);
+    decoder.feed(stream.data() + 5, stream.size() - 5);
+    CHECK_EQ(decoder.next(f), FRAME_OK);
+    CHECK(frame_matches(f, exp[0]));
+}
+
+int main() {
+    return run_all_tests("protocol");
+}
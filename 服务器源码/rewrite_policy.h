@@ -0,0 +1,505 @@
+/*
+ * IP替换规则 (服务器与单元测试共用，仅头文件)
+ *
+ * RewritePolicy: 每个服务器一条规则(ip_rewrite/game_msg_format)及每条规则的统计
+ * RewriteStream: TCP单方向的规则执行状态，跨recv跟踪游戏消息分帧并暂存可能被截断的IP
+ */
+
+#ifndef REWRITE_POLICY_H
+#define REWRITE_POLICY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ip_rewriter.h"
+#include "logger.h"
+
+// v6.13: 每个服务器一条规则(ServerConfig::ip_rewrite)，限定payload中需要扫描的范围:
+//   scan                   扫描全部数据(默认)
+//   off                    不替换
+//   head:N                 只扫描每条游戏消息的前N字节
+//   offsets:OP@A,B;OP2@C   只检查指定opcode消息中偏移A、B…处的IP(偏移从消息开头计算，不小于消息头长度)
+// 游戏消息: TCP按game_msg_format描述的长度前缀分帧，UDP每个数据报为一条消息
+// game_msg_format示例: "len_offset=0,len_size=2,len_adjust=0,opcode_offset=2,opcode_size=2,endian=little"
+//   消息总长 = 长度字段值 + len_adjust；未配置长度字段时TCP按scan处理，UDP仍按规则处理
+
+enum RewriteMode { REWRITE_SCAN, REWRITE_OFF, REWRITE_HEAD, REWRITE_OFFSETS };
+
+struct GameMsgFormat {
+    int len_offset = -1;       // <0 表示不分帧
+    int len_size = 2;          // 1/2/4
+    int len_adjust = 0;
+    int opcode_offset = -1;    // <0 表示没有opcode
+    int opcode_size = 2;       // 1/2/4
+    bool little_endian = true;
+
+    bool has_length() const { return len_offset >= 0; }
+    bool has_opcode() const { return opcode_offset >= 0; }
+
+    // 读取长度和opcode所需的字节数
+    size_t header_size() const {
+        size_t size = 0;
+        if (has_length()) size = std::max(size, (size_t)(len_offset + len_size));
+        if (has_opcode()) size = std::max(size, (size_t)(opcode_offset + opcode_size));
+        return size;
+    }
+
+    uint32_t read_field(const uint8_t* p, int size) const {
+        uint32_t v = 0;
+        for (int i = 0; i < size; i++) {
+            int shift = little_endian ? i * 8 : (size - 1 - i) * 8;
+            v |= (uint32_t)p[i] << shift;
+        }
+        return v;
+    }
+};
+
+// 需要扫描的区间[begin, end)，rule为统计所属的规则
+struct RewriteWindow {
+    size_t begin;
+    size_t end;
+    int rule;
+};
+
+class RewritePolicy {
+public:
+    struct OpcodeRule {
+        uint32_t opcode;
+        std::vector<uint32_t> offsets;
+    };
+    // 每条规则的统计: hits=替换次数, scanned=扫描的字节, skipped=按规则跳过的字节
+    struct RuleStats {
+        std::string name;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> scanned;
+        std::atomic<uint64_t> skipped;
+        explicit RuleStats(const std::string& n) : name(n), hits(0), scanned(0), skipped(0) {}
+    };
+
+    RewriteMode mode;
+    size_t head_bytes;
+    GameMsgFormat format;
+    std::vector<OpcodeRule> opcode_rules;
+    // stats[0]: scan/off/head规则(offsets模式下为未列出的opcode)，stats[1+i]: opcode_rules[i]
+    std::vector<std::unique_ptr<RuleStats>> stats;
+
+    RewritePolicy() : mode(REWRITE_SCAN), head_bytes(0) {}
+
+    // 解析规则与消息格式，失败时返回false并填写error
+    bool parse(const std::string& rule, const std::string& format_str, std::string& error) {
+        if (!parse_format(format_str, error)) return false;
+
+        if (rule.empty() || rule == "scan") {
+            mode = REWRITE_SCAN;
+        } else if (rule == "off") {
+            mode = REWRITE_OFF;
+        } else if (rule.compare(0, 5, "head:") == 0) {
+            mode = REWRITE_HEAD;
+            head_bytes = strtoul(rule.c_str() + 5, nullptr, 10);
+            if (head_bytes == 0) {
+                error = "head:N 中N必须大于0";
+                return false;
+            }
+        } else if (rule.compare(0, 8, "offsets:") == 0) {
+            mode = REWRITE_OFFSETS;
+            if (!parse_offsets(rule.substr(8), error)) return false;
+        } else {
+            error = "未知规则: " + rule;
+            return false;
+        }
+
+        stats.clear();
+        stats.emplace_back(new RuleStats(mode == REWRITE_OFFSETS ? "offsets(未列出的opcode)" : rule.empty() ? "scan" : rule));
+        for (const OpcodeRule& r : opcode_rules) {
+            char name[32];
+            snprintf(name, sizeof(name), "offsets(opcode=0x%x)", r.opcode);
+            stats.emplace_back(new RuleStats(name));
+        }
+        return true;
+    }
+
+    // TCP是否按消息分帧执行规则(否则scan/off作用于整个字节流)
+    bool tcp_framed() const {
+        return (mode == REWRITE_HEAD || mode == REWRITE_OFFSETS) && format.has_length();
+    }
+
+    int find_opcode_rule(uint32_t opcode) const {
+        for (size_t i = 0; i < opcode_rules.size(); i++) {
+            if (opcode_rules[i].opcode == opcode) return (int)i;
+        }
+        return -1;
+    }
+
+    // 一条消息[0, msg_len)中需要扫描的区间(相对消息开头)，op_rule为opcode规则下标(-1为无)
+    // pattern_len: IpRewriter::pattern_length()，offsets区间只容纳一个IP
+    template <typename F>
+    void for_each_window(size_t msg_len, int op_rule, size_t pattern_len, F emit) const {
+        if (mode == REWRITE_HEAD) {
+            emit(0, std::min(head_bytes, msg_len), 0);
+        } else if (mode == REWRITE_OFFSETS && op_rule >= 0) {
+            for (uint32_t off : opcode_rules[op_rule].offsets) {
+                if (off + pattern_len <= msg_len) emit(off, off + pattern_len, 1 + op_rule);
+            }
+        }
+    }
+
+    // 一个UDP数据报作为一条消息替换，返回替换次数
+    size_t rewrite_datagram(const IpRewriter& rewriter, uint8_t* data, size_t len,
+                            IpMatch* matches, size_t max_matches) const {
+        if (mode == REWRITE_SCAN) {
+            size_t count = rewriter.rewrite(data, len, matches, max_matches);
+            add_stats(0, count, len, 0);
+            return count;
+        }
+        int op_rule = -1;
+        if (mode == REWRITE_OFFSETS && format.has_opcode() && len >= format.header_size()) {
+            op_rule = find_opcode_rule(format.read_field(data + format.opcode_offset, format.opcode_size));
+        }
+        size_t count = 0;
+        size_t scanned = 0;
+        for_each_window(len, op_rule, rewriter.pattern_length(),
+                        [&](size_t begin, size_t end, int rule) {
+            size_t got = std::min(count, max_matches);
+            size_t c = rewriter.rewrite(data + begin, end - begin, matches + got, max_matches - got);
+            for (size_t i = got; i < std::min(count + c, max_matches); i++) matches[i].offset += begin;
+            add_stats(rule, c, end - begin, 0);
+            count += c;
+            scanned += end - begin;
+        });
+        add_stats(op_rule >= 0 ? 1 + op_rule : 0, 0, 0, len - scanned);
+        return count;
+    }
+
+    void add_stats(int rule, uint64_t hits, uint64_t scanned, uint64_t skipped) const {
+        RuleStats& s = *stats[rule];
+        if (hits > 0) s.hits.fetch_add(hits, std::memory_order_relaxed);
+        if (scanned > 0) s.scanned.fetch_add(scanned, std::memory_order_relaxed);
+        if (skipped > 0) s.skipped.fetch_add(skipped, std::memory_order_relaxed);
+    }
+
+    void log_stats(const std::string& prefix) const {
+        for (const auto& s : stats) {
+            LOG_INFO(prefix + "IP替换规则 " + s->name + ": 替换=" + std::to_string(s->hits.load()) +
+                    ", 扫描=" + std::to_string(s->scanned.load()) + "字节, 跳过=" +
+                    std::to_string(s->skipped.load()) + "字节");
+        }
+    }
+
+private:
+    bool parse_format(const std::string& text, std::string& error) {
+        format = GameMsgFormat();
+        std::stringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            size_t eq = item.find('=');
+            if (item.empty()) continue;
+            if (eq == std::string::npos) {
+                error = "game_msg_format格式错误: " + item;
+                return false;
+            }
+            std::string key = item.substr(0, eq);
+            std::string value = item.substr(eq + 1);
+            int num = atoi(value.c_str());
+            if (key == "len_offset") format.len_offset = num;
+            else if (key == "len_size") format.len_size = num;
+            else if (key == "len_adjust") format.len_adjust = num;
+            else if (key == "opcode_offset") format.opcode_offset = num;
+            else if (key == "opcode_size") format.opcode_size = num;
+            else if (key == "endian") format.little_endian = value != "big";
+            else {
+                error = "game_msg_format未知字段: " + key;
+                return false;
+            }
+        }
+        for (int size : {format.len_size, format.opcode_size}) {
+            if (size != 1 && size != 2 && size != 4) {
+                error = "game_msg_format字段长度只能是1/2/4";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // "OP@A,B;OP2@C"，OP可为十进制或0x十六进制
+    bool parse_offsets(const std::string& text, std::string& error) {
+        opcode_rules.clear();
+        if (!format.has_opcode()) {
+            error = "offsets规则需要在game_msg_format中配置opcode_offset";
+            return false;
+        }
+        std::stringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ';')) {
+            if (item.empty()) continue;
+            size_t at = item.find('@');
+            if (at == std::string::npos) {
+                error = "offsets格式错误: " + item;
+                return false;
+            }
+            OpcodeRule r;
+            r.opcode = (uint32_t)strtoul(item.substr(0, at).c_str(), nullptr, 0);
+            std::stringstream offs(item.substr(at + 1));
+            std::string off;
+            while (std::getline(offs, off, ',')) {
+                if (off.empty()) continue;
+                uint32_t value = (uint32_t)strtoul(off.c_str(), nullptr, 0);
+                if (value < format.header_size()) {
+                    error = "offsets偏移" + off + "位于消息头内";
+                    return false;
+                }
+                r.offsets.push_back(value);
+            }
+            std::sort(r.offsets.begin(), r.offsets.end());
+            opcode_rules.push_back(r);
+        }
+        if (opcode_rules.empty()) {
+            error = "offsets规则为空";
+            return false;
+        }
+        return true;
+    }
+};
+
+// TCP单方向的规则执行状态: 消息分帧位置 + 跨recv暂存的末尾字节(可能是被截断的IP)
+// 每块数据: process()替换后返回可立即发出的字节数，先发出prefix()(上一块暂存的字节)再发出data前ready字节；
+// 暂存的字节在下一块到来时拼接匹配，或由release()取出直接发出
+// 调用方在一轮事件结束时用can_hold()决定是否继续等待下一块: 暂存的字节位于按game_msg_format分帧、
+// 尚未结束的游戏消息中时，对端收到整条消息之前用不到这些字节，等待不增加延迟，最多等待HOLD_MAX_US
+class RewriteStream {
+public:
+    RewriteStream()
+        : policy(nullptr), rewriter(nullptr), framed(false), stream_pos(0), msg_start(0), msg_end(0),
+          hdr_len(0), op_rule(-1), carry_len(0), carry_open(false), prefix_len(0), hold_deadline_us(0),
+          last_window_end(0) {}
+
+    void init(const RewritePolicy* p, const IpRewriter* rw) {
+        policy = p;
+        rewriter = rw;
+        framed = p->tcp_framed();
+        pending.assign(p->stats.size(), PendingStats());
+    }
+
+    size_t process(uint8_t* data, size_t len, IpMatch* matches, size_t max_matches, size_t& replaced) {
+        replaced = 0;
+        prefix_len = carry_len;
+        memcpy(prefix_buf, carry, carry_len);
+        carry_len = 0;
+        hold_deadline_us = 0;
+
+        if (policy->mode == REWRITE_OFF || !rewriter->valid()) {
+            stream_pos += len;
+            policy->add_stats(0, 0, 0, len);
+            return len;
+        }
+
+        bool last_open = collect_windows(data, len);
+
+        // done: 已处理到的位置(拼接命中的IP占用的字节、重叠的区间不再扫描)
+        size_t done = 0;
+        if (prefix_len > 0 && carry_open && !windows.empty() && windows[0].begin == 0) {
+            IpMatch m;
+            done = rewriter->carry_match(prefix_buf, prefix_len, data, windows[0].end, &m);
+            if (done > 0) {
+                if (max_matches > 0) {
+                    matches[0].offset = 0;
+                    matches[0].kind = m.kind;
+                }
+                replaced++;
+                pending[windows[0].rule].hits++;
+            }
+        }
+
+        size_t ready = len;
+        for (size_t w = 0; w < windows.size(); w++) {
+            const RewriteWindow& win = windows[w];
+            size_t begin = std::max(win.begin, done);
+            if (begin >= win.end) continue;
+            done = win.end;
+            size_t got = std::min(replaced, max_matches);
+            size_t tail = 0;
+            size_t c = rewriter->rewrite_stream(data + begin, win.end - begin, tail,
+                                                matches + got, max_matches - got);
+            for (size_t i = got; i < std::min(replaced + c, max_matches); i++) matches[i].offset += begin;
+            replaced += c;
+            pending[win.rule].hits += c;
+            // 区间延续到下一块: 末尾可能是被截断的IP，暂存
+            if (last_open && w + 1 == windows.size() && win.end == len && tail > 0) {
+                ready = len - tail;
+                memcpy(carry, data + ready, tail);
+                carry_len = tail;
+            }
+        }
+        // 本块很短且没有替换: 暂存的前缀可能跨过本块延续到上一块的carry中
+        if (last_open && replaced == 0 && prefix_len > 0 && carry_open && len < CARRY_MAX &&
+            windows.size() == 1 && windows[0].begin == 0) {
+            uint8_t joined[CARRY_MAX * 2];
+            memcpy(joined, prefix_buf, prefix_len);
+            memcpy(joined + prefix_len, data, len);
+            size_t tail = rewriter->prefix_tail(joined, prefix_len + len);
+            if (tail > len) {
+                memcpy(carry, joined + prefix_len + len - tail, tail);
+                carry_len = tail;
+                prefix_len = prefix_len + len - tail;
+                ready = 0;
+            }
+        }
+        carry_open = last_open;
+        stream_pos += len;
+        flush_stats();
+        return ready;
+    }
+
+    const uint8_t* prefix() const { return prefix_buf; }
+    size_t prefix_size() const { return prefix_len; }
+
+    bool holding() const { return carry_len > 0; }
+    size_t held_size() const { return carry_len; }
+
+    // 暂存的字节是否继续等待下一块(now_us: monotonic微秒)。位于未结束的分帧消息中、且从第一次询问起
+    // 未超过HOLD_MAX_US时返回true，wait_us为剩余时间；不分帧(scan)时不知道消息边界，返回false
+    bool can_hold(uint64_t now_us, uint64_t& wait_us) {
+        if (carry_len == 0 || !framed || !carry_open) return false;
+        if (hold_deadline_us == 0) hold_deadline_us = now_us + HOLD_MAX_US;
+        if (now_us >= hold_deadline_us) return false;
+        wait_us = hold_deadline_us - now_us;
+        return true;
+    }
+
+    // 取出暂存字节(不再等待下一块)，返回字节数
+    size_t release(uint8_t* out) {
+        size_t n = carry_len;
+        memcpy(out, carry, n);
+        carry_len = 0;
+        carry_open = false;
+        hold_deadline_us = 0;
+        return n;
+    }
+
+    static const size_t CARRY_MAX = 16;
+    // 消息剩余部分迟迟不到(对端停顿或分帧配置错误)时，暂存字节最多等待的时间
+    static const uint64_t HOLD_MAX_US = 200000;
+
+private:
+    struct PendingStats {
+        uint64_t hits;
+        uint64_t scanned;
+        uint64_t skipped;
+        PendingStats() : hits(0), scanned(0), skipped(0) {}
+    };
+
+    const RewritePolicy* policy;
+    const IpRewriter* rewriter;
+    bool framed;
+    uint64_t stream_pos;     // 本块第一个字节在流中的位置
+    // 当前消息(framed时)
+    uint64_t msg_start;
+    uint64_t msg_end;        // 消息头完整后有效
+    uint8_t hdr[16];
+    size_t hdr_len;
+    int op_rule;
+
+    uint8_t carry[CARRY_MAX];
+    size_t carry_len;
+    bool carry_open;         // carry所在的区间延续到下一块
+    uint8_t prefix_buf[CARRY_MAX];
+    size_t prefix_len;
+    uint64_t hold_deadline_us;   // can_hold()第一次询问时设置，0表示未开始计时
+
+    std::vector<RewriteWindow> windows;
+    uint64_t last_window_end;    // windows最后一个区间在流中的结束位置(截断前)
+    std::vector<PendingStats> pending;
+
+    // 计算本块[0, len)中需要扫描的区间(按位置排序)，返回最后一个区间是否延续到下一块
+    bool collect_windows(uint8_t* data, size_t len) {
+        windows.clear();
+        uint64_t chunk_end = stream_pos + len;
+        if (!framed) {
+            add_window(stream_pos, UINT64_MAX, 0, stream_pos, chunk_end);
+            return true;
+        }
+
+        size_t header = policy->format.header_size();
+        uint64_t pos = stream_pos;
+        last_window_end = 0;
+        while (pos < chunk_end) {
+            uint64_t seg_begin = std::max(msg_start, stream_pos);
+            if (hdr_len < header) {
+                size_t take = (size_t)std::min((uint64_t)(header - hdr_len), chunk_end - pos);
+                memcpy(hdr + hdr_len, data + (pos - stream_pos), take);
+                hdr_len += take;
+                if (hdr_len < header) {
+                    // 消息头被截断: head区间从消息开头开始，长度未知时先按N字节计算
+                    size_t scanned = 0;
+                    if (policy->mode == REWRITE_HEAD) {
+                        scanned = add_window(msg_start, msg_start + policy->head_bytes, 0, seg_begin, chunk_end);
+                    }
+                    pending[0].skipped += (chunk_end - seg_begin) - scanned;
+                    break;
+                }
+                if (!parse_header()) {
+                    // 长度小于消息头说明分帧已错位，该方向之后按scan处理
+                    LOG_WARN("[IP替换] 游戏消息长度无效，该连接方向改为扫描全部数据");
+                    framed = false;
+                    add_window(seg_begin, UINT64_MAX, 0, seg_begin, chunk_end);
+                    break;
+                }
+            }
+
+            uint64_t seg_end = std::min(msg_end, chunk_end);
+            size_t scanned = 0;
+            policy->for_each_window((size_t)(msg_end - msg_start), op_rule, rewriter->pattern_length(),
+                                    [&](size_t begin, size_t end, int rule) {
+                scanned += add_window(msg_start + begin, msg_start + end, rule, seg_begin, seg_end);
+            });
+            pending[op_rule >= 0 ? 1 + op_rule : 0].skipped += (seg_end - seg_begin) - scanned;
+            pos = seg_end;
+            if (seg_end == msg_end) {
+                msg_start = msg_end;
+                hdr_len = 0;
+                op_rule = -1;
+            }
+        }
+        return !windows.empty() && windows.back().end == len && last_window_end > chunk_end;
+    }
+
+    bool parse_header() {
+        const GameMsgFormat& f = policy->format;
+        int64_t msg_len = (int64_t)f.read_field(hdr + f.len_offset, f.len_size) + f.len_adjust;
+        if (msg_len < (int64_t)f.header_size()) return false;
+        msg_end = msg_start + (uint64_t)msg_len;
+        op_rule = -1;
+        if (policy->mode == REWRITE_OFFSETS) {
+            op_rule = policy->find_opcode_rule(f.read_field(hdr + f.opcode_offset, f.opcode_size));
+        }
+        return true;
+    }
+
+    // 流中区间[begin, end)与[seg_begin, seg_end)的交集加入windows，返回加入的字节数
+    size_t add_window(uint64_t begin, uint64_t end, int rule, uint64_t seg_begin, uint64_t seg_end) {
+        uint64_t b = std::max(begin, seg_begin);
+        uint64_t e = std::min(end, seg_end);
+        if (b >= e) return 0;
+        windows.push_back(RewriteWindow{(size_t)(b - stream_pos), (size_t)(e - stream_pos), rule});
+        last_window_end = end;
+        pending[rule].scanned += e - b;
+        return (size_t)(e - b);
+    }
+
+    void flush_stats() {
+        for (size_t i = 0; i < pending.size(); i++) {
+            PendingStats& p = pending[i];
+            if (p.hits == 0 && p.scanned == 0 && p.skipped == 0) continue;
+            policy->add_stats((int)i, p.hits, p.scanned, p.skipped);
+            p = PendingStats();
+        }
+    }
+};
+
+#endif // REWRITE_POLICY_H
@@ -0,0 +1,213 @@
+/*
+ * rewrite_policy.h 单元测试 (make test)
+ * RewriteStream跨recv的IP替换: 被截断的IP在一轮事件结束(flush)时是否继续暂存，暂存的超时与释放
+ * IpRewriter各实现与v6.12之前的replace_ip_in_payload(ip_rewriter_legacy.h)在随机数据上结果相同
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "ip_rewriter_legacy.h"
+#include "rewrite_policy.h"
+#include "test_util.h"
+
+using namespace std;
+
+static const char* OLD_IP = "192.168.1.10";
+static const char* NEW_IP = "10.0.0.5";
+static const uint8_t OLD_BYTES[4] = {192, 168, 1, 10};
+static const uint8_t NEW_BYTES[4] = {10, 0, 0, 5};
+
+// 按服务器转发的顺序拼出对端收到的字节: 每块先发prefix()再发ready字节，flush时按can_hold()决定是否释放暂存
+struct Forwarder {
+    RewritePolicy policy;
+    IpRewriter rewriter;
+    RewriteStream stream;
+    vector<uint8_t> out;
+
+    Forwarder(const string& rule, const string& format) {
+        string error;
+        bool ok = policy.parse(rule, format, error) && rewriter.init(OLD_IP, NEW_IP);
+        CHECK(ok);
+        stream.init(&policy, &rewriter);
+    }
+
+    void feed(vector<uint8_t> chunk) {
+        IpMatch matches[8];
+        size_t replaced = 0;
+        size_t ready = stream.process(chunk.data(), chunk.size(), matches, 8, replaced);
+        out.insert(out.end(), stream.prefix(), stream.prefix() + stream.prefix_size());
+        out.insert(out.end(), chunk.begin(), chunk.begin() + ready);
+    }
+
+    // 一轮事件结束，返回暂存字节是否继续等待
+    bool flush(uint64_t now_us) {
+        uint64_t wait_us = 0;
+        if (stream.can_hold(now_us, wait_us)) return true;
+        uint8_t held[RewriteStream::CARRY_MAX];
+        size_t n = stream.release(held);
+        out.insert(out.end(), held, held + n);
+        return false;
+    }
+};
+
+// 一条游戏消息: 2字节小端长度(含消息头) + 0填充，ip_offset处为旧IP
+static vector<uint8_t> make_message(size_t len, size_t ip_offset) {
+    vector<uint8_t> msg(len, 0);
+    msg[0] = (uint8_t)(len & 0xff);
+    msg[1] = (uint8_t)(len >> 8);
+    memcpy(msg.data() + ip_offset, OLD_BYTES, 4);
+    return msg;
+}
+
+static vector<uint8_t> slice(const vector<uint8_t>& v, size_t begin, size_t end) {
+    return vector<uint8_t>(v.begin() + begin, v.begin() + end);
+}
+
+static const char* LEN_FORMAT = "len_offset=0,len_size=2";
+
+TEST(framed_split_ip_held_across_flush) {
+    Forwarder f("head:64", LEN_FORMAT);
+    vector<uint8_t> msg = make_message(32, 10);
+    // IP的前两个字节在第一块末尾，两块之间有一次flush
+    f.feed(slice(msg, 0, 12));
+    CHECK(f.stream.holding());
+    CHECK(f.flush(1000));
+    f.feed(slice(msg, 12, msg.size()));
+    CHECK(!f.stream.holding());
+    f.flush(2000);
+
+    CHECK_EQ(f.out.size(), msg.size());
+    CHECK(memcmp(f.out.data() + 10, NEW_BYTES, 4) == 0);
+    CHECK_EQ(f.policy.stats[0]->hits.load(), 1);
+}
+
+TEST(framed_split_ip_held_across_several_flushes) {
+    Forwarder f("head:64", LEN_FORMAT);
+    vector<uint8_t> msg = make_message(40, 20);
+    // 每块一个字节地送入IP，每块之后都flush一次
+    f.feed(slice(msg, 0, 21));
+    CHECK(f.flush(1000));
+    f.feed(slice(msg, 21, 22));
+    CHECK(f.flush(2000));
+    f.feed(slice(msg, 22, 23));
+    CHECK(f.flush(3000));
+    f.feed(slice(msg, 23, msg.size()));
+    f.flush(4000);
+
+    CHECK_EQ(f.out.size(), msg.size());
+    CHECK(memcmp(f.out.data() + 20, NEW_BYTES, 4) == 0);
+}
+
+TEST(message_end_is_not_held) {
+    Forwarder f("head:64", LEN_FORMAT);
+    // 消息在本块末尾结束，末尾与IP开头相同的字节不属于被截断的IP
+    vector<uint8_t> msg = make_message(16, 4);
+    msg[14] = OLD_BYTES[0];
+    msg[15] = OLD_BYTES[1];
+    f.feed(msg);
+    CHECK(!f.flush(1000));
+    CHECK_EQ(f.out.size(), msg.size());
+}
+
+TEST(scan_mode_releases_at_flush) {
+    // 不分帧时不知道消息边界，暂存字节在本轮结束时发出
+    Forwarder f("scan", "");
+    vector<uint8_t> data(24, 0);
+    data[22] = OLD_BYTES[0];
+    data[23] = OLD_BYTES[1];
+    f.feed(data);
+    CHECK(f.stream.holding());
+    CHECK(!f.flush(1000));
+    CHECK(!f.stream.holding());
+    CHECK_EQ(f.out.size(), data.size());
+    CHECK(f.out == data);
+}
+
+TEST(hold_expires_after_max_wait) {
+    Forwarder f("head:64", LEN_FORMAT);
+    vector<uint8_t> msg = make_message(32, 10);
+    f.feed(slice(msg, 0, 12));
+
+    uint64_t wait_us = 0;
+    CHECK(f.stream.can_hold(1000, wait_us));
+    CHECK_EQ(wait_us, RewriteStream::HOLD_MAX_US);
+    CHECK(f.stream.can_hold(1000 + RewriteStream::HOLD_MAX_US / 2, wait_us));
+    CHECK_EQ(wait_us, RewriteStream::HOLD_MAX_US / 2);
+    // 到期后释放，消息剩余部分照常转发(IP不再替换，但字节不丢)
+    CHECK(!f.flush(1000 + RewriteStream::HOLD_MAX_US));
+    CHECK_EQ(f.out.size(), (size_t)12);
+    f.feed(slice(msg, 12, msg.size()));
+    CHECK(f.out == msg);
+}
+
+TEST(new_chunk_restarts_hold_timer) {
+    Forwarder f("head:64", LEN_FORMAT);
+    vector<uint8_t> msg = make_message(48, 30);
+    f.feed(slice(msg, 0, 31));
+    CHECK(f.flush(1000));
+    f.feed(slice(msg, 31, 32));
+    uint64_t wait_us = 0;
+    // 新的一块到来后重新计时
+    CHECK(f.stream.can_hold(1000 + RewriteStream::HOLD_MAX_US, wait_us));
+    CHECK_EQ(wait_us, RewriteStream::HOLD_MAX_US);
+    f.feed(slice(msg, 32, msg.size()));
+    f.flush(2000 + RewriteStream::HOLD_MAX_US);
+    CHECK_EQ(f.out.size(), msg.size());
+    CHECK(memcmp(f.out.data() + 30, NEW_BYTES, 4) == 0);
+}
+
+// 随机payload(字节取自少数几个值，使IP两种格式、相邻/重叠的IP频繁出现)，与原函数逐字节比较
+TEST(rewriter_matches_legacy_on_random_payloads) {
+    Logger::set_log_level("ERROR");   // 原函数每次调用写INFO日志
+    const char* pairs[][2] = {
+        {"192.168.1.10", "10.0.0.5"},
+        {"1.2.2.1", "10.0.0.5"},        // 回文IP，两种格式相同
+        {"10.10.10.10", "10.10.10.11"},
+        {"10.0.0.5", "192.168.1.10"},
+    };
+    vector<IpRewriter::Impl> impls;
+    impls.push_back(IpRewriter::IMPL_SCALAR);
+#ifdef IP_REWRITER_X86
+    impls.push_back(IpRewriter::IMPL_SSE2);
+    if (IpRewriter::active_impl() == IpRewriter::IMPL_AVX2) impls.push_back(IpRewriter::IMPL_AVX2);
+#endif
+
+    uint32_t seed = 12345;
+    auto next = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+    for (auto& pair : pairs) {
+        IpRewriter rewriter;
+        CHECK(rewriter.init(pair[0], pair[1]));
+        uint8_t ip[4];
+        inet_pton(AF_INET, pair[0], ip);
+        const uint8_t alphabet[] = {ip[0], ip[1], ip[2], ip[3], 0, 0xff};
+        for (int round = 0; round < 2000; round++) {
+            vector<uint8_t> data(next() % 200);
+            for (size_t i = 0; i < data.size(); i++) data[i] = alphabet[next() % sizeof(alphabet)];
+            for (size_t i = 0; i + 4 <= data.size(); i += 4 + next() % 24) {
+                bool dnf = next() & 1;
+                for (int k = 0; k < 4; k++) data[i + k] = dnf ? ip[3 - k] : ip[k];
+            }
+
+            vector<uint8_t> expected = data;
+            int expected_count = legacy::replace_ip_in_payload(expected.data(), expected.size(), pair[0], pair[1]);
+            for (IpRewriter::Impl impl : impls) {
+                vector<uint8_t> got = data;
+                size_t count = rewriter.rewrite_with(impl, got.data(), got.size());
+                CHECK_EQ(count, (size_t)expected_count);
+                CHECK(got == expected);
+            }
+        }
+    }
+    Logger::set_log_level("INFO");
+}
+
+int main() {
+    return run_all_tests("rewrite");
+}
@@ -2,6 +2,7 @@
  * TCP配置服务器
  * 提供服务器列表查询接口
  * 协议: 接收 "GET_SERVERS\n", 返回JSON字符串
+ *       接收 "GET_STATS\n" 或 "GET_STATS <服务器名称>\n", 返回转发统计JSON
  * 替代HTTP API，绕过备案限制
  */
 
@@ -20,6 +21,7 @@
 #include <string>
 #include <fstream>
 #include <mutex>
+#include <functional>
 #include <sys/inotify.h>
 #include <sys/select.h>
 
@@ -72,6 +74,7 @@ static string g_config_file;  // 配置文件路径
 static string g_tunnel_server_ip;  // 隧道服务器IP
 static bool g_auto_reload = true;  // 自动重载开关
 static pthread_t g_monitor_thread = 0;  // 配置监控线程ID
+static function<string(const string&)> g_stats_provider;  // GET_STATS数据来源
 
 // 简单的JSON字符串提取函数
 string extract_json_string(const string& json, const string& key) {
@@ -290,7 +293,8 @@ string generate_server_list_json() {
                  << "\"game_server_ip\":\"" << s.game_server_ip << "\","
                  << "\"tunnel_server_ip\":\"" << s.tunnel_server_ip << "\","
                  << "\"tunnel_port\":" << s.tunnel_port << ","
-                 << "\"download_url\":\"" << s.download_url << "\""
+                 << "\"download_url\":\"" << s.download_url << "\","
+                 << "\"heartbeat_v2\":true"   // v6.21: 服务器支持带时间戳的v2心跳
                  << "}";
         }
     }
@@ -299,6 +303,18 @@ string generate_server_list_json() {
     return json.str();
 }
 
+// 发送全部数据(统计JSON带会话列表时可能超过一次send的大小)
+static bool send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
 // 处理TCP请求
 void handle_tcp_request(int client_fd) {
     char buffer[1024];
@@ -312,6 +328,8 @@ void handle_tcp_request(int client_fd) {
     // 去除末尾的换行符
     char* newline = strchr(buffer, '\n');
     if (newline) *newline = '\0';
+    char* cr = strchr(buffer, '\r');
+    if (cr) *cr = '\0';
 
     printf("[TCP] 收到请求: %s\n", buffer);
 
@@ -320,6 +338,15 @@ void handle_tcp_request(int client_fd) {
         string json_response = generate_server_list_json();
         send(client_fd, json_response.c_str(), json_response.length(), 0);
         printf("[TCP] 已发送服务器列表 (%zu 字节)\n", json_response.length());
+    } else if (strncmp(buffer, "GET_STATS", 9) == 0 && (buffer[9] == '\0' || buffer[9] == ' ')) {
+        // 处理 GET_STATS [服务器名称] 请求
+        string server_name = buffer[9] == ' ' ? string(buffer + 10) : string();
+        string json_response = g_stats_provider ? g_stats_provider(server_name) : string();
+        if (json_response.empty()) {
+            json_response = g_stats_provider ? "{\"error\":\"Unknown server\"}" : "{\"error\":\"Stats unavailable\"}";
+        }
+        send_all(client_fd, json_response.c_str(), json_response.length());
+        printf("[TCP] 已发送统计信息 (%zu 字节)\n", json_response.length());
     } else {
         // 未知请求
         const char* error_msg = "{\"error\":\"Unknown request\"}";
@@ -361,7 +388,7 @@ void* tcp_server_thread(void* arg) {
     }
 
     printf("TCP配置服务器启动在端口 %d\n", g_api_port);
-    printf("协议: 接收 'GET_SERVERS\\n', 返回JSON\n");
+    printf("协议: 接收 'GET_SERVERS\\n' 或 'GET_STATS [服务器名称]\\n', 返回JSON\n");
 
     while (g_running) {
         struct sockaddr_in client_addr;
@@ -431,6 +458,11 @@ pthread_t start_tcp_config_server(const char* config_file, const char* tunnel_se
     return tid;
 }
 
+// 设置GET_STATS的数据来源
+void set_tcp_config_stats_provider(function<string(const string&)> provider) {
+    g_stats_provider = provider;
+}
+
 // 停止TCP配置服务器
 void stop_tcp_config_server() {
     g_running = false;
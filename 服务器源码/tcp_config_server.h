@@ -7,6 +7,8 @@
 #define TCP_CONFIG_SERVER_H
 
 #include <pthread.h>
+#include <functional>
+#include <string>
 
 // 启动TCP配置服务器
 // config_file: config.json路径
@@ -21,4 +23,8 @@ void stop_tcp_config_server();
 // 重新加载配置（热重载）
 bool reload_tcp_config();
 
+// 设置GET_STATS的数据来源(在start_tcp_config_server之前调用)
+// provider参数为服务器名称(空字符串表示全部)，返回JSON；服务器不存在时返回空字符串
+void set_tcp_config_stats_provider(std::function<std::string(const std::string&)> provider);
+
 #endif // TCP_CONFIG_SERVER_H
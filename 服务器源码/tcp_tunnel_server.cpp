@@ -1,5 +1,80 @@
 /*
- * DNF 隧道服务器 - C++ 版本 v5.3
+ * DNF 隧道服务器 - C++ 版本 v6.21
+ * v6.21更新: v2心跳 - 客户端在心跳中携带序号和发送时间戳，服务器回显并附带接收时间，客户端在下一次心跳中上报测得的RTT
+ *          - 每个会话记录客户端RTT/抖动，收到心跳时读取game_fd的TCP_INFO得到到游戏服务器的RTT，GET_STATS会话条目输出"rtt"
+ *          - 延迟直方图新增client_rtt/game_rtt；旧版0长度心跳照旧回复，配置端口服务器列表带"heartbeat_v2":true供客户端协商
+ * v6.20更新: 延迟直方图 - 直方图增加最大值，GET_STATS输出 p50/p99/p999/max(纳秒)
+ *          - 新增client_blocked: 客户端socket发送缓冲满(数据滞留等待EPOLLOUT)到写完的时间
+ *          - latency_per_session为每个会话另外记录一份；latency_log_interval_sec周期在日志中输出本周期分位数
+ *          - 记录开销: 每次recv读两次时钟，每批帧一次分桶(clz+移位)和最多三次relaxed store
+ *          - to_client在帧写入客户端socket之后记录: 写合并或socket缓冲满时recv时间随发送缓冲记下，写出后记录
+ *          - 0x01帧的to_game同样在写入游戏服务器socket之后记录，包括游戏服务器背压时缓冲的帧和IP替换暂存的末尾字节
+ * v6.19更新: Prometheus指标 - metrics_port启用HTTP GET /metrics (http_api_server.cpp编入主程序)
+ *          - 连接数、帧数/字节数、心跳/IP替换/发送失败计数、双向转发延迟直方图、DNS缓存统计
+ *          - 会话计数同时写入所属worker的分片，GET_STATS汇总与指标抓取只读分片原子计数，不加锁
+ * v6.18更新: 转发统计 - 配置端口新增 GET_STATS / GET_STATS <服务器名称>，返回JSON
+ *          - 每个服务器: TCP连接数、UDP隧道数、双向帧数/字节数、心跳数、IP替换次数、发送失败次数
+ *          - 指定服务器名称时附带每个会话的计数；计数由所属worker线程单写者累加，会话关闭时并入该线程的分片
+ * v6.17更新: 日志文件轮转(log_rotate_mb/log_rotate_hours)与保留个数(log_keep_files)
+ *          - 轮转出的文件由gzip子进程压缩(idle I/O优先级、nice 19)，log_compress可关闭
+ *          - 二进制日志轮转后的新文件先写入仍在使用的会话表(序号→UUID)，每个文件可单独解码
+ *          - log_max_bytes_per_sec限制每秒写入文件的字节数，超出的日志丢弃并计数(ERROR与二进制日志的会话记录除外)
+ * v6.16更新: 二进制日志(log_format=binary)，记录时间戳、级别、事件编号、conn_id、会话序号和原始数值参数
+ *          - 格式定义在binary_log.h，dnf-log-decode还原为文本或JSON，可按会话/conn_id过滤
+ *          - 连接与UDP隧道生命周期日志改为结构化事件(LOG_EVENT)，文本模式下输出不变
+ * v6.15更新: 日志宏LOG_DEBUG/LOG_INFO/LOG_WARN/LOG_ERROR，先判断级别再拼接参数，未启用的日志不再格式化
+ *          - 编译期最低级别(make LOG_MIN_LEVEL=1)可从发布版本中整体去掉DEBUG日志
+ *          - hex预览改为hex_dump()，只在日志启用时执行；UDP逐包的收发/hex日志改为DEBUG级别
+ * v6.14更新: 异步日志 - 调用线程写入无锁环形队列，后台线程批量写文件/控制台
+ *          - 不再每行加锁、endl、flush；时间戳按线程缓存，只在秒变化时格式化
+ *          - log_flush_interval_ms/log_flush_bytes控制写入时机，log_queue_full选择丢弃或等待，log_console可关闭控制台输出
+ * v6.13更新: 按服务器配置的IP替换规则(ip_rewrite/game_msg_format)
+ *          - scan(默认)/off/head:N(每条游戏消息前N字节)/offsets:OP@A,B(指定opcode的固定偏移)
+ *          - TCP按长度前缀分帧跨recv跟踪消息；末尾可能被截断的IP暂存，与下一块拼接后替换
+ *          - 暂存字节所在的分帧消息未结束时跨事件轮等待下一块(最多200ms)，不分帧时本轮结束即发出
+ *          - 每条规则统计替换次数、扫描/跳过字节数，退出时输出
+ * v6.12更新: payload IP替换改为每条连接预编译的IpRewriter(ip_rewriter.h)
+ *          - 旧/新IP的网络字节序与DNF反向字节在连接建立时编码一次，不再每个包inet_pton、拼接日志前缀
+ *          - 候选位置由SSE2/AVX2一次比较16/32个起点(运行时按CPU选择，非x86为标量)，支持IPv6 16字节地址
+ *          - 替换位置由调用方记录日志，未命中时不再输出日志
+ * v6.11更新: UDP隧道流元数据改为开放寻址表(UdpFlowTable)，key为打包的(源端口, 游戏端口)
+ *          - 游戏→客户端每个响应不再拼接字符串key、查map、sscanf客户端IP
+ *          - 握手响应还原字节在建立流时编码；空闲流随udp_idle_timeout_sec过期
+ * v6.10更新: 按端口创建的UDP socket空闲回收(udp_idle_timeout_sec)
+ *          - 组队/多地图会话不再累积UDP socket到隧道关闭；所有UDP socket仍由固定数量的worker线程驱动
+ *          - EventLoop新增每秒tick(add_ticker/on_tick)
+ * v6.9更新: UDP批量收发(udp_batch)
+ *          - 游戏→客户端: recvmmsg一次取出多个数据报，编码为多个0x03帧后一次写入隧道
+ *          - 客户端→游戏: 同一次recv解析出的0x03帧按目标socket由sendmmsg批量发出
+ * v6.8更新: game_server_ip解析结果缓存(DnsCache)，UDP每个包/TCP每条连接不再调用getaddrinfo
+ *          - 启动时预解析，后台线程按dns_refresh_sec重新解析域名，热路径无锁读取
+ * v6.7更新: 发往客户端的帧写合并(coalesce_max_bytes / coalesce_max_delay_us)
+ *          - 同一轮事件中产生的小帧(0x01/0x02回复/0x03)先进入发送缓冲，本轮结束时一次send发出
+ *          - 大帧不复制，与已合并的数据由一次sendmsg发出；默认不增加延迟
+ * v6.6更新: 协议编解码移到tunnel_protocol.h(仅头文件)，与客户端共用
+ *          - 按字节读写网络字节序，去掉 *(uint32_t*) 非对齐强转
+ *          - FrameDecoder流式解码 + decode_frames批量解码
+ * v6.5更新: 客户端→服务器的帧解析改用FrameDecoder，TCP连接与UDP隧道共用
+ *          - 完整帧在接收缓冲中原地解析，不再 vector::erase 搬移剩余数据，也不再每帧复制payload
+ *          - 只有跨两次recv的半帧才复制到拼接缓冲；UDP隧道每次recv改为整个接收缓冲(原4096字节)
+ * v6.4更新: fd关闭统一走EventLoop::close_watch，按fd统计io_uring在途操作数，
+ *          最后一个在途操作结束时才close，连接对象在关闭所在的事件批次结束时立即释放
+ * v6.3更新: 监听socket支持SO_REUSEPORT分片(acceptor_shards)，每个分片注册到不同worker
+ *          - accept4 + TCP_DEFER_ACCEPT，握手数据到达后才唤醒，accept后立即读取握手
+ *          - 可选classic BPF按客户端IP选择分片(reuseport_bpf)
+ *          - 地址格式化移到处理连接的worker，accept路径只做accept
+ * v6.2更新: 转发帧改为 帧头+payload 两段iovec 由sendmsg发出，payload直接从接收缓冲发送，
+ *          不再memcpy到临时buffer；游戏→客户端超过65535字节时拆分为多帧
+ * v6.1更新: 新增io_uring I/O后端(config.json: "io_backend": "io_uring")
+ *          - TCP数据使用多发recv + provided buffer ring，一次io_uring_enter收取多个连接的数据
+ *          - 其余fd使用POLL_ADD，内核不支持时自动回退epoll
+ * v6.0更新: 🚀转发模型改为epoll事件循环(Reactor)
+ *          问题描述: 每个客户端1个握手线程 + 每条TCP连接2个转发线程 + 每个UDP端口1个接收线程
+ *                   上千连接时线程数过多，上下文切换和栈内存开销明显
+ *          解决方案: - 所有socket非阻塞，由固定数量的worker线程(worker_threads，默认CPU核数)的epoll驱动
+ *                   - 每个连接固定归属一个worker，连接内部无锁
+ *                   - 发送不完的数据进入发送缓冲，等待EPOLLOUT；缓冲超过256KB时暂停读取对端(背压)
+ *                   - 连接关闭由所属worker统一完成，不再依赖detach/sleep等待线程退出
  * v5.3更新: 🔥修复游戏服务器连接空闲超时问题 - 启用TCP Keepalive
  *          问题描述: 游戏服务器在运行约9分钟后发送RST断开连接(errno=104: Connection reset by peer)
  *                   分析发现用户正在游戏中,但如果一段时间没操作(看剧情、挂机等)
@@ -205,9 +280,13 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
+#include <deque>
+#include <algorithm>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <memory>
 #include <cstring>
@@ -217,6 +296,7 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <fcntl.h>
@@ -229,13 +309,33 @@
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <execinfo.h>
+#include <functional>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include <linux/filter.h>
 #include "tcp_config_server.h"
+#include "http_api_server.h"
+#include "tunnel_protocol.h"
+#include "ip_rewriter.h"
+#include "binary_log.h"
+#include "logger.h"
+#include "rewrite_policy.h"
+#include "udp_flow_table.h"
+#include "dns_cache.h"
+#include "latency_histogram.h"
+#include "forward_stats.h"
 
 using namespace std;
 
-// 前向声明Logger类
-class Logger;
-
 // ==================== 配置 ====================
 // 单个服务器配置
 struct ServerConfig {
@@ -243,6 +343,10 @@ struct ServerConfig {
     int listen_port = 33223;
     string game_server_ip = "192.168.2.110";
     int max_connections = 100;
+    int acceptor_shards = 1;      // v6.3: SO_REUSEPORT监听分片数
+    bool reuseport_bpf = false;   // v6.3: 按客户端IP选择分片(classic BPF)
+    string ip_rewrite = "scan";   // v6.13: IP替换规则 scan/off/head:N/offsets:OP@A,B;...
+    string game_msg_format;       // v6.13: 游戏消息头格式(长度前缀分帧)，见RewritePolicy
 };
 
 // 全局配置
@@ -256,242 +360,48 @@ struct ApiConfig {
 struct GlobalConfig {
     vector<ServerConfig> servers;
     string log_level = "INFO";
+    int worker_threads = 0;  // v6.0: 事件循环线程数，0表示使用CPU核数
+    string io_backend = "epoll";  // v6.1: epoll 或 io_uring
+    int coalesce_max_bytes = 16384;  // v6.7: 发往客户端的小帧合并上限，0表示不合并
+    int coalesce_max_delay_us = 0;   // v6.7: 合并最多等待的微秒数，0表示只合并同一轮事件中的帧
+    int dns_refresh_sec = 60;        // v6.8: 域名重新解析间隔(秒)，0表示只在启动时解析
+    int udp_batch = 32;              // v6.9: 每次recvmmsg/sendmmsg最多处理的数据报个数(1-128)
+    int udp_idle_timeout_sec = 300;  // v6.10: UDP socket空闲超过该秒数后关闭，0表示不回收
+    int log_flush_interval_ms = 100; // v6.14: 日志写线程最长等待时间(毫秒)
+    int log_flush_bytes = 65536;     // v6.14: 积压日志达到该字节数时立即写入
+    string log_queue_full = "drop";  // v6.14: 日志队列满时 drop(丢弃并计数) 或 block(等待)
+    bool log_console = true;         // v6.14: 日志同时输出到控制台
+    string log_format = "text";      // v6.16: 日志文件格式 text 或 binary(用dnf-log-decode查看)
+    int log_rotate_mb = 100;         // v6.17: 日志文件超过该大小(MB)时轮转，0表示不按大小轮转
+    int log_rotate_hours = 24;       // v6.17: 日志文件打开超过该小时数时轮转，0表示不按时间轮转
+    int log_keep_files = 0;          // v6.17: 最多保留的日志文件个数(含当前文件)，0表示全部保留
+    bool log_compress = true;        // v6.17: 轮转出的文件用gzip压缩(低I/O优先级)
+    int log_max_bytes_per_sec = 0;   // v6.17: 每秒最多写入日志文件的字节数，超出丢弃并计数，0表示不限制
+    int metrics_port = 0;            // v6.19: Prometheus指标(HTTP GET /metrics)监听端口，0表示不启用
+    string metrics_bind = "127.0.0.1"; // v6.19: 指标端口的监听地址
+    bool latency_per_session = false;  // v6.20: 每个会话另外记录延迟直方图(GET_STATS <服务器名称>中输出)
+    int latency_log_interval_sec = 60; // v6.20: 每隔该秒数在日志中输出延迟分位数，0表示不输出
     ApiConfig api_config;
 };
 
-// ==================== 日志工具 ====================
-class Logger {
-private:
-    static ofstream log_file;
-    static mutex log_mutex;
-    static bool file_enabled;
-    static string current_log_level;
-
-public:
-    static void set_log_level(const string& level) {
-        current_log_level = level;
-    }
-
-    static void init(const string& filename) {
-        log_file.open(filename, ios::out | ios::app);
-        if (log_file.is_open()) {
-            file_enabled = true;
-            // 不能在这里调用log()因为会死锁，直接输出
-            auto now = chrono::system_clock::now();
-            // 强制使用北京时间(UTC+8)
-            auto beijing_time = chrono::system_clock::to_time_t(now + chrono::hours(8));
-            auto ms = chrono::duration_cast<chrono::milliseconds>(
-                now.time_since_epoch()) % 1000;
-
-            stringstream ss;
-            ss << put_time(gmtime(&beijing_time), "%Y-%m-%d %H:%M:%S")
-               << "." << setfill('0') << setw(3) << ms.count()
-               << " [INFO] 日志文件已初始化(北京时间): " << filename;
-
-            string log_line = ss.str();
-            cout << log_line << endl;
-            log_file << log_line << endl;
-            log_file.flush();
-        } else {
-            cerr << "警告: 无法打开日志文件: " << filename << endl;
-        }
-    }
-
-    static void close() {
-        lock_guard<mutex> lock(log_mutex);
-        if (log_file.is_open()) {
-            log_file.close();
-            file_enabled = false;
-        }
-    }
-
-    static void info(const string& msg) {
-        log("INFO", msg);
-    }
-
-    static void error(const string& msg) {
-        log("ERROR", msg);
-    }
-
-    static void warning(const string& msg) {
-        log("WARN", msg);
-    }
-
-    static void debug(const string& msg) {
-        log("DEBUG", msg);
-    }
-
-private:
-    static void log(const string& level, const string& msg) {
-        // 日志级别过滤: ERROR(3) > WARN(2) > INFO(1) > DEBUG(0)
-        int level_priority = 0;
-        if (level == "DEBUG") level_priority = 0;
-        else if (level == "INFO") level_priority = 1;
-        else if (level == "WARN") level_priority = 2;
-        else if (level == "ERROR") level_priority = 3;
-
-        int current_priority = 0;
-        if (current_log_level == "DEBUG") current_priority = 0;
-        else if (current_log_level == "INFO") current_priority = 1;
-        else if (current_log_level == "WARN") current_priority = 2;
-        else if (current_log_level == "ERROR") current_priority = 3;
-
-        // 如果当前日志级别低于设定级别，不输出
-        if (level_priority < current_priority) return;
-
-        auto now = chrono::system_clock::now();
-        // 强制使用北京时间(UTC+8)
-        auto beijing_time = chrono::system_clock::to_time_t(now + chrono::hours(8));
-        auto ms = chrono::duration_cast<chrono::milliseconds>(
-            now.time_since_epoch()) % 1000;
-
-        stringstream ss;
-        ss << put_time(gmtime(&beijing_time), "%Y-%m-%d %H:%M:%S")
-           << "." << setfill('0') << setw(3) << ms.count()
-           << " [" << level << "] " << msg;
-
-        string log_line = ss.str();
-
-        // 输出到控制台和文件
-        lock_guard<mutex> lock(log_mutex);
-        cout << log_line << endl;
-        if (file_enabled && log_file.is_open()) {
-            log_file << log_line << endl;
-            log_file.flush();  // 立即刷新，确保日志写入
-        }
-    }
-};
-
-// 静态成员初始化
-ofstream Logger::log_file;
-mutex Logger::log_mutex;
-bool Logger::file_enabled = false;
-string Logger::current_log_level = "INFO";
-
 // ==================== IP替换辅助函数 ====================
-// 在payload中查找并替换IP地址(支持大端序和小端序)
-// payload: 数据载荷
-// payload_len: 数据长度
-// old_ip: 要替换的IP地址(如"192.168.2.75")
-// new_ip: 新的IP地址(如"222.187.12.82")
-// conn_id: 连接ID（用于日志）
-// session_uuid: 会话UUID（用于日志）
-// 返回: 替换次数
-int replace_ip_in_payload(uint8_t* payload, size_t payload_len,
-                         const string& old_ip, const string& new_ip,
-                         int conn_id = 0, const string& session_uuid = "") {
-    // 生成日志前缀
-    string log_prefix;
-    if (conn_id > 0 && !session_uuid.empty()) {
-        log_prefix = "[连接" + to_string(conn_id) + "|" + session_uuid + "][IP替换] ";
-    } else if (conn_id > 0) {
-        log_prefix = "[连接" + to_string(conn_id) + "][IP替换] ";
-    } else if (!session_uuid.empty()) {
-        log_prefix = "[" + session_uuid + "][IP替换] ";
-    } else {
-        log_prefix = "[IP替换] ";
-    }
-
-    // 检查payload是否足够大(至少4字节才可能包含IP)
-    if (payload_len < 4) {
-        Logger::debug(log_prefix + "payload太小(" + to_string(payload_len) +
-                     "字节),跳过IP替换");
-        return 0;
+// v6.12: 扫描与替换由IpRewriter完成(ip_rewriter.h)，每条连接构造一次，热路径不再解析IP字符串、不写日志
+// 单次payload最多记录的替换位置(仅用于日志)
+const size_t IP_MATCH_LOG_MAX = 8;
+
+// 输出一次替换的结果: 每个位置一条info(与原replace_ip_in_payload一致)
+// 调用方先用LOG_ENABLED(PRIORITY_INFO)判断，避免拼接日志前缀
+void log_ip_matches(const string& log_prefix, const IpMatch* matches, size_t count,
+                    const string& old_ip, const string& new_ip) {
+    size_t logged = min(count, IP_MATCH_LOG_MAX);
+    for (size_t i = 0; i < logged; i++) {
+        const char* kind = matches[i].kind == IP_MATCH_BE ? " 大端序: " :
+                           matches[i].kind == IP_MATCH_DNF ? " DNF逐字节反向: " : " IPv6: ";
+        LOG_INFO(log_prefix + "位置" + to_string(matches[i].offset) + kind + old_ip + " -> " + new_ip);
     }
-
-    // 将IP字符串转换为字节
-    struct in_addr old_addr, new_addr;
-    if (inet_pton(AF_INET, old_ip.c_str(), &old_addr) != 1 ||
-        inet_pton(AF_INET, new_ip.c_str(), &new_addr) != 1) {
-        Logger::error(log_prefix + "IP地址格式错误: " + old_ip + " -> " + new_ip);
-        return 0;
-    }
-
-    // 提取IP的4个字节(网络字节序,大端序)
-    uint8_t* old_bytes = (uint8_t*)&old_addr.s_addr;
-    uint8_t* new_bytes = (uint8_t*)&new_addr.s_addr;
-
-    // 构造各种格式
-    uint32_t old_ip_be = old_addr.s_addr;  // 大端序(网络字节序)
-    uint32_t new_ip_be = new_addr.s_addr;
-
-    // DNF逐字节反向格式: a.b.c.d -> d c b a
-    // 修复v4.5.4: 字节序列[d c b a]在小端系统读取为uint32_t时，需要按正序组合
-    uint32_t old_ip_reversed = (old_bytes[0] << 24) | (old_bytes[1] << 16) |
-                               (old_bytes[2] << 8) | old_bytes[3];
-    uint32_t new_ip_reversed = (new_bytes[0] << 24) | (new_bytes[1] << 16) |
-                               (new_bytes[2] << 8) | new_bytes[3];
-
-    int replace_count = 0;
-
-    // ===== 详细调试信息 =====
-    char debug_buf[200];
-    sprintf(debug_buf, "调试: old_bytes=[%02x,%02x,%02x,%02x] old_ip_be=0x%08x old_ip_reversed=0x%08x",
-            old_bytes[0], old_bytes[1], old_bytes[2], old_bytes[3],
-            old_ip_be, old_ip_reversed);
-    Logger::debug(log_prefix + string(debug_buf));
-
-    // 打印查找的目标
-    if (payload_len >= 4) {
-        char hex[100];
-        sprintf(hex, "%02x %02x %02x %02x (大端) / %02x %02x %02x %02x (DNF反向)",
-                old_bytes[0], old_bytes[1], old_bytes[2], old_bytes[3],
-                old_bytes[3], old_bytes[2], old_bytes[1], old_bytes[0]);
-        Logger::debug(log_prefix + "查找IP " + old_ip + " 格式: " + string(hex));
-
-        // 打印payload前64字节
-        string payload_hex = "";
-        for (size_t i = 0; i < min((size_t)64, payload_len); i++) {
-            char hbuf[4];
-            sprintf(hbuf, "%02x ", payload[i]);
-            payload_hex += hbuf;
-            if ((i + 1) % 16 == 0) payload_hex += "\n                    ";
-        }
-        Logger::debug(log_prefix + "Payload(" + to_string(payload_len) + "字节):\n                    " + payload_hex);
-    }
-
-    // 扫描payload,查找并替换IP
-    for (size_t i = 0; i + 3 < payload_len; i++) {
-        uint32_t* ip_ptr = (uint32_t*)(payload + i);
-        uint32_t ip_value = *ip_ptr;
-
-        // 详细调试：打印每个位置的扫描结果（只打印前10个位置）
-        if (i < 10 && payload_len <= 20) {
-            char scan_buf[150];
-            sprintf(scan_buf, "扫描位置%zu: [%02x %02x %02x %02x] = 0x%08x (大端匹配:%s DNF匹配:%s)",
-                    i, payload[i], payload[i+1], payload[i+2], payload[i+3], ip_value,
-                    (ip_value == old_ip_be ? "YES" : "no"),
-                    (ip_value == old_ip_reversed ? "YES" : "no"));
-            Logger::debug(log_prefix + string(scan_buf));
-        }
-
-        // 检查大端序(网络字节序)匹配
-        if (ip_value == old_ip_be) {
-            *ip_ptr = new_ip_be;
-            replace_count++;
-            Logger::info(log_prefix + "位置" + to_string(i) + " 大端序: " +
-                         old_ip + " -> " + new_ip);
-            i += 3;
-        }
-        // 检查DNF逐字节反向格式匹配
-        else if (ip_value == old_ip_reversed) {
-            *ip_ptr = new_ip_reversed;
-            replace_count++;
-            Logger::info(log_prefix + "位置" + to_string(i) + " DNF逐字节反向: " +
-                         old_ip + " -> " + new_ip);
-            i += 3;
-        }
-    }
-
-    if (replace_count > 0) {
-        Logger::info(log_prefix + "✓ 完成: " + old_ip + " -> " + new_ip +
-                    " (替换" + to_string(replace_count) + "处)");
-    } else {
-        Logger::info(log_prefix + "✗ 未找到IP " + old_ip + " (payload=" +
-                    to_string(payload_len) + "字节)");
+    if (count > logged) {
+        LOG_INFO(log_prefix + "另有" + to_string(count - logged) + "处替换未列出");
     }
-
-    return replace_count;
 }
 
 // 获取本机在指定网络上的本地IP地址
@@ -535,1610 +445,3776 @@ string get_local_ip(const string& target_ip) {
     }
 }
 
-// ==================== TCP 连接管理 ====================
-class TunnelConnection : public enable_shared_from_this<TunnelConnection> {
+// ==================== io_uring 后端 ====================
+// v6.1: 可选的io_uring后端(io_backend: "io_uring")，通过原始系统调用使用，不依赖liburing
+//       TCP数据: 多发recv(IORING_RECV_MULTISHOT) + provided buffer ring，内核直接把数据写入缓冲池，
+//                一次io_uring_enter即可取回多个连接的数据，不再需要 epoll_wait + recv 两次系统调用
+//       其他fd(监听/握手/UDP/等待可写): 单次POLL_ADD，事件处理后重新提交，语义与epoll水平触发一致
+class IoUring {
 private:
-    int conn_id;
-    int client_fd;
-    int game_fd;
-    string game_server_ip;
-    int game_port;
-    atomic<bool> running;
-    string session_uuid;  // 客户端会话UUID，用于唯一标识客户端
+    int ring_fd;
+
+    void* sq_ptr;
+    size_t sq_map_size;
+    void* cq_ptr;
+    size_t cq_map_size;
+    io_uring_sqe* sqes;
+    size_t sqes_map_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    // provided buffer ring: 内核收到数据时从中取一块缓冲，CQE中返回缓冲编号
+    io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    unsigned buf_count;
+    unsigned buf_size;
+    uint16_t buf_tail;
+    vector<uint8_t> buf_pool;
 
-    // 线程 - 使用智能指针自动管理
-    shared_ptr<thread> client_to_game_thread;
-    shared_ptr<thread> game_to_client_thread;
-    map<int, shared_ptr<thread>> udp_threads;
-
-    // v5.0: IP替换相关 (必须在线程之后声明，匹配构造函数初始化顺序)
-    string client_real_ip;     // 客户端真实IP（从payload提取）
-    string proxy_local_ip;     // 代理服务器本地IP
-    string tcp_source_ip;      // TCP连接源IP（用于动态查询映射）
-    map<string, string>* client_ip_map_ptr;  // 指向TunnelServer的IP映射
-    mutex* ip_map_mutex_ptr;   // 指向TunnelServer的IP映射互斥锁
+public:
+    static const uint16_t BUF_GROUP = 0;
+
+    IoUring()
+        : ring_fd(-1), sq_ptr(MAP_FAILED), sq_map_size(0), cq_ptr(MAP_FAILED), cq_map_size(0),
+          sqes((io_uring_sqe*)MAP_FAILED), sqes_map_size(0), sq_head(nullptr), sq_tail(nullptr),
+          sq_mask(nullptr), sq_array(nullptr), sq_entries(0), sq_local_tail(0), to_submit(0),
+          cq_head(nullptr), cq_tail(nullptr), cq_mask(nullptr), cqes(nullptr),
+          buf_ring((io_uring_buf_ring*)MAP_FAILED), buf_ring_size(0), buf_count(0), buf_size(0),
+          buf_tail(0) {}
+
+    ~IoUring() {
+        if (ring_fd >= 0) close(ring_fd);  // 关闭ring时内核自动注销buffer ring
+        if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_size);
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_map_size);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_map_size);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_map_size);
+    }
 
-    // UDP相关
-    map<int, int> udp_sockets;  // dst_port -> udp_socket
-    mutex udp_mutex;
+    // buffers必须是2的幂，buffer_bytes不超过65535(协议data_len上限)
+    bool init(unsigned entries, unsigned buffers, unsigned buffer_bytes, string& error) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
 
-    // v5.0: 动态获取客户端真实IP（从映射中查询）
-    string get_client_real_ip() {
-        if (!client_real_ip.empty()) {
-            return client_real_ip;  // 已有缓存
-        }
-        if (tcp_source_ip.empty() || !client_ip_map_ptr || !ip_map_mutex_ptr) {
-            return "";  // 无法查询
+        ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0) {
+            error = string("io_uring_setup失败: ") + strerror(errno);
+            return false;
         }
 
-        lock_guard<mutex> lock(*ip_map_mutex_ptr);
-        auto it = client_ip_map_ptr->find(tcp_source_ip);
-        if (it != client_ip_map_ptr->end()) {
-            client_real_ip = it->second;  // 缓存结果
-            Logger::debug("[连接" + to_string(conn_id) + "|" + session_uuid + "] 动态获取客户端真实IP: " + client_real_ip);
-            return client_real_ip;
+        sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_map_size = max(sq_map_size, cq_map_size);
+            cq_map_size = sq_map_size;
         }
-        return "";
-    }
 
-    // 格式化连接标识符（包含conn_id和session_uuid）
-    string conn_id_str() const {
-        if (session_uuid.empty()) {
-            return "[连接" + to_string(conn_id) + "]";
+        sq_ptr = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            error = string("mmap SQ失败: ") + strerror(errno);
+            return false;
         }
-        return "[连接" + to_string(conn_id) + "|" + session_uuid + "]";
-    }
-
-public:
-    TunnelConnection(int cid, int cfd, const string& game_ip, int gport,
-                     const string& client_ip = "", const string& proxy_ip = "",
-                     const string& tcp_src_ip = "",
-                     map<string, string>* ip_map = nullptr,
-                     mutex* ip_mutex = nullptr,
-                     const string& sess_uuid = "")
-        : conn_id(cid), client_fd(cfd), game_fd(-1),
-          game_server_ip(game_ip), game_port(gport),
-          running(false), session_uuid(sess_uuid), client_to_game_thread(nullptr),
-          game_to_client_thread(nullptr),
-          client_real_ip(client_ip), proxy_local_ip(proxy_ip),
-          tcp_source_ip(tcp_src_ip), client_ip_map_ptr(ip_map),
-          ip_map_mutex_ptr(ip_mutex) {
-        Logger::debug("[连接" + to_string(conn_id) + "|" + session_uuid + "] TunnelConnection对象已创建");
-    }
-
-    ~TunnelConnection() {
-        Logger::debug(conn_id_str() + " 开始销毁TunnelConnection对象");
-        stop();
-
-        // **关键修复v3.5.3**: 先shutdown所有sockets(TCP+UDP),让所有阻塞的recv()调用返回
-        Logger::debug(conn_id_str() + " shutdown所有sockets以唤醒阻塞线程");
-
-        // 1. shutdown TCP sockets (游戏和客户端)
-        if (game_fd >= 0) {
-            Logger::debug(conn_id_str() + " shutdown游戏服务器socket");
-            shutdown(game_fd, SHUT_RDWR);  // 唤醒阻塞在game_fd上的recv()
+        if (single_mmap) {
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) {
+                error = string("mmap CQ失败: ") + strerror(errno);
+                return false;
+            }
         }
-        if (client_fd >= 0) {
-            Logger::debug(conn_id_str() + " shutdown客户端socket");
-            shutdown(client_fd, SHUT_RDWR);  // 唤醒阻塞在client_fd上的recv()
+        sqes_map_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_map_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            error = string("mmap SQE失败: ") + strerror(errno);
+            return false;
         }
 
-        // 2. shutdown UDP sockets
-        {
-            lock_guard<mutex> lock(udp_mutex);
-            for (auto& pair : udp_sockets) {
-                if (pair.second >= 0) {
-                    Logger::debug(conn_id_str() + "|UDP:" + to_string(pair.first) + " shutdown UDP socket");
-                    shutdown(pair.second, SHUT_RDWR);  // 唤醒阻塞的recvfrom()
-                }
-            }
+        uint8_t* sq = (uint8_t*)sq_ptr;
+        sq_head = (unsigned*)(sq + params.sq_off.head);
+        sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        sq_local_tail = *sq_tail;
+
+        uint8_t* cq = (uint8_t*)cq_ptr;
+        cq_head = (unsigned*)(cq + params.cq_off.head);
+        cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // 注册provided buffer ring (内核5.19+)
+        buf_count = buffers;
+        buf_size = buffer_bytes;
+        buf_ring_size = buf_count * sizeof(io_uring_buf);
+        buf_ring = (io_uring_buf_ring*)mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                                            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (buf_ring == MAP_FAILED) {
+            error = string("mmap buffer ring失败: ") + strerror(errno);
+            return false;
         }
 
-        // 3. **v3.8.0**: 不等待线程，直接detach
-        // 因为线程只持有原始指针，不会触发析构，可以安全detach
-        // running=false + shutdown确保线程会很快退出
-        Logger::debug(conn_id_str() + " detach所有线程...");
-
-        if (client_to_game_thread && client_to_game_thread->joinable()) {
-            client_to_game_thread->detach();
-            Logger::debug(conn_id_str() + " 已detach客户端→游戏线程");
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+        reg.ring_entries = buf_count;
+        reg.bgid = BUF_GROUP;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            error = string("注册provided buffer ring失败: ") + strerror(errno);
+            return false;
         }
 
-        if (game_to_client_thread && game_to_client_thread->joinable()) {
-            game_to_client_thread->detach();
-            Logger::debug(conn_id_str() + " 已detach游戏→客户端线程");
+        buf_pool.resize((size_t)buf_count * buf_size);
+        for (unsigned i = 0; i < buf_count; i++) {
+            recycle_buffer((uint16_t)i);
         }
+        return true;
+    }
 
-        for (auto& pair : udp_threads) {
-            if (pair.second && pair.second->joinable()) {
-                pair.second->detach();
-                Logger::debug(conn_id_str() + "|UDP:" + to_string(pair.first) + " 已detach UDP线程");
-            }
+    // 获取一个空闲SQE，SQ已满时先提交
+    io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sq_local_tail - head >= sq_entries) {
+            submit(0);
+            head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            if (sq_local_tail - head >= sq_entries) return nullptr;
         }
+        unsigned index = sq_local_tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        sq_local_tail++;
+        to_submit++;
+        return sqe;
+    }
 
-        // **v3.8.0关键**: 等待一段时间确保线程完全退出后再关闭socket
-        // 这样避免僵尸线程访问已关闭的fd
-        Logger::debug(conn_id_str() + " 等待200ms确保detached线程退出...");
-        this_thread::sleep_for(chrono::milliseconds(200));
-
-        // 4. 所有线程已退出,现在close所有socket文件描述符
-        Logger::debug(conn_id_str() + " 关闭所有socket文件描述符");
+    // 提交所有SQE，wait_nr>0时等待至少wait_nr个完成事件；返回负的errno表示失败
+    int submit(unsigned wait_nr) {
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int ret = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags, nullptr, 0);
+        if (ret < 0) return -errno;
+        to_submit -= min((unsigned)ret, to_submit);
+        return ret;
+    }
 
-        {
-            lock_guard<mutex> lock(udp_mutex);
-            for (auto& pair : udp_sockets) {
-                if (pair.second >= 0) {
-                    Logger::debug(conn_id_str() + "|UDP:" + to_string(pair.first) + " close UDP socket fd=" + to_string(pair.second));
-                    close(pair.second);
-                    pair.second = -1;
-                }
-            }
-        }
+    io_uring_cqe* peek_cqe() {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) return nullptr;
+        return &cqes[head & *cq_mask];
+    }
 
-        if (game_fd >= 0) {
-            Logger::debug(conn_id_str() + " close游戏服务器socket fd=" + to_string(game_fd));
-            close(game_fd);
-            game_fd = -1;
-        }
-        if (client_fd >= 0) {
-            Logger::debug(conn_id_str() + " close客户端socket fd=" + to_string(client_fd));
-            close(client_fd);
-            client_fd = -1;
-        }
+    void cqe_seen() {
+        __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+    }
 
-        Logger::debug(conn_id_str() + " TunnelConnection对象已销毁");
+    uint8_t* buffer(uint16_t bid) {
+        return buf_pool.data() + (size_t)bid * buf_size;
     }
 
-    bool start() {
-        try {
-            Logger::debug(conn_id_str() + " 开始启动连接");
-
-            // 使用 getaddrinfo() 解析游戏服务器地址（支持域名/IPv4/IPv6）
-            struct addrinfo hints{}, *result = nullptr, *rp = nullptr;
-            hints.ai_family = AF_UNSPEC;      // 允许IPv4或IPv6
-            hints.ai_socktype = SOCK_STREAM;  // TCP socket
-            hints.ai_flags = 0;
-            hints.ai_protocol = IPPROTO_TCP;
-
-            string port_str = to_string(game_port);
-            int ret = getaddrinfo(game_server_ip.c_str(), port_str.c_str(), &hints, &result);
-            if (ret != 0) {
-                Logger::error(conn_id_str() + " DNS解析失败: " +
-                             game_server_ip + " (错误: " + gai_strerror(ret) + ")");
-                return false;
-            }
+    // 处理完数据后把缓冲还给内核
+    void recycle_buffer(uint16_t bid) {
+        // 注意: C++下内核头文件中bufs[]前的空结构体占1字节，偏移与内核不一致，必须按数组直接寻址
+        io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring) + (buf_tail & (buf_count - 1));
+        buf->addr = (uint64_t)(uintptr_t)buffer(bid);
+        buf->len = buf_size;
+        buf->bid = bid;
+        buf_tail++;
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+};
 
-            Logger::debug(conn_id_str() + " DNS解析成功: " + game_server_ip);
+// ==================== 事件循环 (epoll Reactor) ====================
+// v6.0: 所有socket设置为非阻塞，注册到少量worker线程的epoll中
+//       每个连接固定归属一个EventLoop，其全部fd(客户端/游戏服务器/UDP)都在同一线程处理，
+//       连接内部无需加锁；跨线程只通过post()投递任务
+class EventHandler;
+
+// 每个被监听的fd对应一个IoWatch，epoll_event.data.ptr指向它
+struct IoWatch {
+    EventHandler* owner;   // nullptr表示已失效(所属对象已关闭，等待本轮事件处理结束后释放)
+    int fd;
+    int kind;              // fd类型，由owner自行定义
+    uint16_t port;         // UDP socket对应的端口
+    uint32_t events;       // 当前已注册的epoll事件
+    bool registered;
+    bool loop_recv;        // v6.1: 允许EventLoop代为recv(io_uring多发recv)，数据经on_recv交付
+
+    // io_uring后端: 当前提交的操作
+    uint64_t poll_token;
+    uint32_t poll_events;
+    uint64_t recv_token;
+    uint64_t stale_recv_token;  // 已取消但尚未结束的多发recv，结束前其数据仍需交付
+
+    IoWatch() : owner(nullptr), fd(-1), kind(0), port(0), events(0), registered(false),
+                loop_recv(false), poll_token(0), poll_events(0), recv_token(0),
+                stale_recv_token(0) {}
+};
 
-            // 尝试连接所有解析结果
-            int flag = 1;  // TCP_NODELAY标志
-            for (rp = result; rp != nullptr; rp = rp->ai_next) {
-                game_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-                if (game_fd < 0) {
-                    continue;
-                }
+class EventHandler {
+public:
+    bool flush_scheduled;  // v6.7: 已登记在EventLoop的待flush列表中(写合并)
+    bool tick_registered;  // v6.10: 已登记EventLoop的周期tick
 
-                Logger::debug(conn_id_str() + " 游戏服务器socket已创建 fd=" +
-                             to_string(game_fd) + " (协议: " +
-                             (rp->ai_family == AF_INET ? "IPv4" : "IPv6") + ")");
+    EventHandler() : flush_scheduled(false), tick_registered(false) {}
+    virtual ~EventHandler() {}
+    virtual void on_io(IoWatch* watch, uint32_t events) = 0;
 
-                // 禁用Nagle算法
-                setsockopt(game_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    // v6.1: loop_recv的watch由EventLoop接收数据后调用(仅io_uring后端)
+    // n>0为数据，n==0表示对端关闭，n<0表示出错(err为errno)
+    virtual void on_recv(IoWatch* watch, uint8_t* data, int n, int err) {
+        (void)watch; (void)data; (void)n; (void)err;
+    }
 
-                // v12.2.0: 增大socket缓冲区，配合客户端流式转发
-                int buf_size = 262144;  // 256KB
-                setsockopt(game_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
-                setsockopt(game_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    // v6.7: defer_flush登记后，由EventLoop在本轮事件处理结束时调用，发出合并的数据
+    virtual void on_flush() {}
 
-                Logger::debug(conn_id_str() + " 已设置TCP_NODELAY + 256KB缓冲区");
+    // v6.10: add_ticker登记后，EventLoop每秒调用一次(空闲资源回收等)，now_ms为单调时钟毫秒
+    virtual void on_tick(uint64_t now_ms) { (void)now_ms; }
+};
 
-                Logger::debug(conn_id_str() + " 正在连接游戏服务器 " +
-                             game_server_ip + ":" + to_string(game_port));
+// ==================== UDP批量收发 ====================
+// v6.9: 每个EventLoop一份，供该线程上所有连接共用
+//       接收: recvmmsg一次取出socket上最多udp_batch个数据报，编码后合并为一次隧道写入
+//       发送: 客户端→游戏的0x03帧先登记，连续发往同一socket的数据报由一次sendmmsg发出
+const size_t UDP_BATCH_MAX = 128;
+const size_t UDP_DATAGRAM_MAX = 65536;
 
-                if (connect(game_fd, rp->ai_addr, rp->ai_addrlen) == 0) {
-                    // 连接成功
-                    Logger::debug(conn_id_str() + " 成功连接到游戏服务器");
+class UdpRecvBatch {
+public:
+    UdpRecvBatch() : capacity(1) {}
 
-                    // v5.3: 启用TCP Keepalive，防止游戏服务器因空闲超时断开连接
-                    int keepalive = 1;
-                    if (setsockopt(game_fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive)) < 0) {
-                        Logger::warning(conn_id_str() + " 设置SO_KEEPALIVE失败: " +
-                                      string(strerror(errno)));
-                    }
+    void set_capacity(size_t n) {
+        capacity = max((size_t)1, min(n, UDP_BATCH_MAX));
+        // 每个数据报一个64KB槽位；不初始化，只有实际写入的页才占用物理内存
+        slots.reset(new uint8_t[capacity * UDP_DATAGRAM_MAX]);
+    }
 
-                    // 设置keepalive参数
-                    int keepidle = 60;     // 60秒无数据后开始探测
-                    int keepinterval = 10; // 每10秒探测一次
-                    int keepcount = 3;     // 3次探测失败后断开
+    // 返回收到的数据报个数，0表示暂无数据，-1表示出错(errno)
+    int recv(int fd) {
+        for (size_t i = 0; i < capacity; i++) {
+            iovs[i].iov_base = payload(i);
+            iovs[i].iov_len = UDP_DATAGRAM_MAX;
+            msgs[i].msg_hdr = msghdr();
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_len = 0;
+        }
+        int n;
+        do {
+            n = recvmmsg(fd, msgs, capacity, MSG_DONTWAIT, nullptr);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return n;
+    }
 
-                    setsockopt(game_fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
-                    setsockopt(game_fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepinterval, sizeof(keepinterval));
-                    setsockopt(game_fd, IPPROTO_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
+    uint8_t* payload(size_t i) { return slots.get() + i * UDP_DATAGRAM_MAX; }
+    size_t length(size_t i) const { return msgs[i].msg_len; }
+    const sockaddr_storage& from(size_t i) const { return addrs[i]; }
 
-                    Logger::info(conn_id_str() + " ✓ TCP Keepalive已启用 " +
-                               "(idle=" + to_string(keepidle) + "s, " +
-                               "interval=" + to_string(keepinterval) + "s, " +
-                               "count=" + to_string(keepcount) + ")");
+private:
+    size_t capacity;
+    unique_ptr<uint8_t[]> slots;
+    mmsghdr msgs[UDP_BATCH_MAX];
+    iovec iovs[UDP_BATCH_MAX];
+    sockaddr_storage addrs[UDP_BATCH_MAX];
+};
 
-                    break;
-                }
+class UdpSendBatch {
+public:
+    UdpSendBatch() : capacity(1), batch_fd(-1), count(0) {}
 
-                // 连接失败，关闭socket并尝试下一个地址
-                Logger::debug(conn_id_str() + " 连接尝试失败 (errno=" +
-                             to_string(errno) + ": " + strerror(errno) + ")，尝试下一个地址");
-                close(game_fd);
-                game_fd = -1;
-            }
+    void set_capacity(size_t n) {
+        capacity = max((size_t)1, min(n, UDP_BATCH_MAX));
+    }
 
-            freeaddrinfo(result);
+    // 登记一个数据报，data在flush()之前必须保持有效；目标socket变化或批次已满时先发出已登记的
+    // 返回其中发送失败的个数
+    size_t add(int fd, const uint8_t* data, size_t len, const sockaddr_storage& addr, socklen_t addr_len) {
+        size_t failed = 0;
+        if (count > 0 && (fd != batch_fd || count == capacity)) failed = flush();
+        batch_fd = fd;
+        iovs[count].iov_base = (void*)data;
+        iovs[count].iov_len = len;
+        addrs[count] = addr;
+        msgs[count].msg_hdr = msghdr();
+        msgs[count].msg_hdr.msg_name = &addrs[count];
+        msgs[count].msg_hdr.msg_namelen = addr_len;
+        msgs[count].msg_hdr.msg_iov = &iovs[count];
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        count++;
+        return failed;
+    }
 
-            if (game_fd < 0 || rp == nullptr) {
-                Logger::error(conn_id_str() + " 连接游戏服务器失败: " +
-                             game_server_ip + ":" + to_string(game_port) + " (所有地址均失败)");
-                return false;
+    // 发出已登记的数据报；单个数据报失败时跳过继续发送(与逐个sendto一致)，返回失败个数
+    size_t flush() {
+        size_t index = 0;
+        size_t failed = 0;
+        int last_err = 0;
+        while (index < count) {
+            int n = sendmmsg(batch_fd, msgs + index, count - index, 0);
+            if (n > 0) {
+                index += n;
+                continue;
             }
+            if (n < 0 && errno == EINTR) continue;
+            last_err = errno;
+            failed++;
+            index++;
+        }
+        if (failed > 0) {
+            LOG_WARN("UDP批量发送: " + to_string(failed) + "/" + to_string(count) +
+                 "个数据报发送失败 (errno=" + to_string(last_err) + ": " + strerror(last_err) + ")");
+        }
+        count = 0;
+        batch_fd = -1;
+        return failed;
+    }
 
-            // 客户端socket也禁用Nagle并增大缓冲区
-            setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-            int buf_size = 262144;  // 256KB
-            setsockopt(client_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
-            setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+private:
+    size_t capacity;
+    int batch_fd;
+    size_t count;
+    mmsghdr msgs[UDP_BATCH_MAX];
+    iovec iovs[UDP_BATCH_MAX];
+    sockaddr_storage addrs[UDP_BATCH_MAX];
+};
 
-            Logger::info(conn_id_str() + " 已连接到游戏服务器 " +
-                        game_server_ip + ":" + to_string(game_port) + " (TCP_NODELAY)");
+enum IoBackend { BACKEND_EPOLL, BACKEND_IO_URING };
 
-            running = true;
+class EventLoop {
+private:
+    int index;
+    IoBackend backend;
+    int epoll_fd;
+    int wake_fd;
+    atomic<bool> running;
+    thread loop_thread;
+
+    mutex task_mutex;
+    vector<function<void()>> pending_tasks;
+
+    // 本线程持有的handler；关闭时移入retired，本轮事件全部处理完后才真正释放，
+    // 保证同一批epoll事件中指向它的IoWatch仍然有效
+    map<EventHandler*, shared_ptr<EventHandler>> handlers;
+    vector<shared_ptr<EventHandler>> retired;
+
+    // 本线程所有连接共用的接收缓冲区(取代每个线程64KB的栈缓冲)
+    vector<uint8_t> recv_buf;
+
+    // io_uring后端状态: user_data(token) -> 操作
+    struct UringOp {
+        IoWatch* watch;   // nullptr表示watch已注销，完成事件直接丢弃
+        bool recv;
+        int fd;
+    };
+    unique_ptr<IoUring> uring;
+    map<uint64_t, UringOp> uring_ops;
+    // v6.4: 每个fd在途操作数；close_watch时仍有在途操作的fd推迟到计数归零再close
+    map<int, int> fd_inflight;
+    set<int> deferred_close;
+    uint64_t next_token;
+    bool multishot_recv;
+    static const uint64_t WAKE_TOKEN = 1;
+    static const uint64_t TIMER_TOKEN = 2;
+    static const uint64_t TICK_TOKEN = 3;
+
+    // v6.7: 写合并。登记的handler在本轮事件处理结束时(coalesce_delay_us>0时最迟延迟到期时)调用on_flush
+    struct DeferredFlush {
+        EventHandler* handler;   // nullptr表示handler已关闭
+        uint64_t deadline_us;
+    };
+    vector<DeferredFlush> deferred_flushes;
+    vector<DeferredFlush> flushing;
+    bool timed_flushes;        // deferred_flushes中有deadline_us>0的项
+    size_t coalesce_bytes;
+    uint64_t coalesce_delay_us;
+    int timer_fd;              // 唤醒到期的flush(合并延迟、IP替换暂存字节的等待时间)
+    IoWatch timer_watch;
+
+    // v6.9: UDP批量收发
+    UdpRecvBatch udp_recv;
+    UdpSendBatch udp_send;
+
+    // v6.10: 周期tick(每秒)，驱动空闲UDP socket回收等低频任务
+    int tick_fd;
+    IoWatch tick_watch;
+    uint64_t tick_now_ms;                 // 最近一次tick的时间，供热路径记录活跃时间(秒级精度足够)
+    uint64_t udp_idle_ms;                 // UDP socket空闲超过该时间后关闭，0表示不回收
+    vector<EventHandler*> tickers;        // nullptr表示handler已关闭，下次tick时移除
 
-            // 启动双向转发线程（与Python版本完全一致）
-            // **v3.8.0终极方案**: 使用原始指针，避免shared_ptr的生命周期问题
-            // 线程不持有对象所有权，只是借用指针
-            Logger::debug(conn_id_str() + " 启动客户端→游戏转发线程");
-            TunnelConnection* raw_ptr = this;
-            client_to_game_thread = make_shared<thread>([raw_ptr]() {
-                raw_ptr->forward_client_to_game();
-            });
+public:
+    explicit EventLoop(int idx)
+        : index(idx), backend(BACKEND_EPOLL), epoll_fd(-1), wake_fd(-1), running(false),
+          recv_buf(65536), next_token(TICK_TOKEN + 1), multishot_recv(true), timed_flushes(false),
+          coalesce_bytes(0), coalesce_delay_us(0), timer_fd(-1), tick_fd(-1), tick_now_ms(0), udp_idle_ms(0) {}
 
-            Logger::debug(conn_id_str() + " 启动游戏→客户端转发线程");
-            game_to_client_thread = make_shared<thread>([raw_ptr]() {
-                raw_ptr->forward_game_to_client();
-            });
+    ~EventLoop() {
+        stop();
+        join();
+        if (timer_fd >= 0) close(timer_fd);
+        if (tick_fd >= 0) close(tick_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
 
-            Logger::debug(conn_id_str() + " 连接启动完成，双向转发已开始");
-            return true;
+    // 请求io_uring但初始化失败时回退到epoll
+    bool init(IoBackend requested) {
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] eventfd失败: " + strerror(errno));
+            return false;
+        }
 
-        } catch (exception& e) {
-            Logger::error(conn_id_str() + " 启动失败: " + string(e.what()));
+        if (requested == BACKEND_IO_URING) {
+            string error;
+            unique_ptr<IoUring> ring(new IoUring());
+            if (ring->init(1024, 128, 32768, error)) {
+                uring = std::move(ring);
+                backend = BACKEND_IO_URING;
+                return true;
+            }
+            LOG_WARN("[Reactor-" + to_string(index) + "] io_uring不可用(" + error + ")，回退到epoll");
+        }
+
+        backend = BACKEND_EPOLL;
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] epoll_create1失败: " + strerror(errno));
+            return false;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;  // data.ptr为空表示唤醒fd
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] 注册唤醒fd失败: " + strerror(errno));
             return false;
         }
+        return true;
     }
 
-    void stop() {
-        running = false;
-    }
+    // v6.7: 写合并参数，在start()之前调用；max_bytes=0表示不合并
+    // 同时创建延迟flush使用的timerfd(defer_flush指定了等待时间时才设置)
+    bool set_coalesce(size_t max_bytes, uint64_t max_delay_us) {
+        coalesce_bytes = max_bytes;
+        coalesce_delay_us = max_bytes > 0 ? max_delay_us : 0;
 
-    bool is_running() const {
-        return running;
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] timerfd_create失败: " + strerror(errno));
+            return false;
+        }
+        timer_watch.fd = timer_fd;
+        if (backend == BACKEND_EPOLL) {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &timer_watch;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+                LOG_ERROR("[Reactor-" + to_string(index) + "] 注册timerfd失败: " + strerror(errno));
+                return false;
+            }
+        }
+        return true;
     }
 
-private:
-    // 完整实现sendall（确保所有数据发送完成）
-    bool sendall(int fd, const uint8_t* data, int len) {
-        // v5.1: 检查fd有效性，防止向已关闭的socket发送数据导致崩溃
-        if (fd < 0) {
-            Logger::error(conn_id_str() + " sendall失败: fd=" + to_string(fd) + " 无效");
+    // v6.10: 创建每秒触发的tick定时器，在start()之前调用
+    bool init_tick() {
+        tick_now_ms = monotonic_us() / 1000;
+        tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (tick_fd < 0) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] timerfd_create失败: " + strerror(errno));
             return false;
         }
-
-        int sent = 0;
-        while (sent < len) {
-            int ret = send(fd, data + sent, len - sent, 0);
-            if (ret <= 0) {
+        itimerspec spec{};
+        spec.it_value.tv_sec = 1;
+        spec.it_interval.tv_sec = 1;
+        timerfd_settime(tick_fd, 0, &spec, nullptr);
+        tick_watch.fd = tick_fd;
+        if (backend == BACKEND_EPOLL) {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &tick_watch;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tick_fd, &ev) < 0) {
+                LOG_ERROR("[Reactor-" + to_string(index) + "] 注册tick定时器失败: " + strerror(errno));
                 return false;
             }
-            sent += ret;
         }
         return true;
     }
 
-    // 线程1：转发客户端→游戏服务器（完全按照Python版本）
-    void forward_client_to_game() {
-        vector<uint8_t> buffer;
-        uint8_t recv_buf[65536];  // v12.2.0: 增大到64KB，配合流式转发
-
-        Logger::debug(conn_id_str() + " 客户端→游戏转发线程已启动");
-
-        try {
-            while (running) {
-                // recv(4096) - 与Python版本一致
-                int n = recv(client_fd, recv_buf, sizeof(recv_buf), 0);
-                if (n <= 0) {
-                    if (n == 0) {
-                        Logger::info(conn_id_str() + " 客户端正常断开 (recv返回0)");
-                    } else {
-                        int err = errno;
-                        Logger::info(conn_id_str() + " 客户端连接错误 (recv返回" + to_string(n) +
-                                   ", errno=" + to_string(err) + ": " + strerror(err) + ")");
-                    }
-                    running = false;
-                    break;
-                }
-
-                Logger::debug(conn_id_str() + " 从客户端收到隧道数据 " + to_string(n) + "字节");
-
-                // 添加到缓冲区
-                buffer.insert(buffer.end(), recv_buf, recv_buf + n);
-
-                // 解析协议：msg_type(1) + conn_id(4) + ...
-                while (buffer.size() >= 5 && running) {
-                    uint8_t msg_type = buffer[0];
-                    uint32_t msg_conn_id = ntohl(*(uint32_t*)&buffer[1]);
-
-                    if (msg_conn_id != (uint32_t)conn_id) {
-                        Logger::warning(conn_id_str() + " 收到错误的连接ID: " +
-                                      to_string(msg_conn_id));
-                        running = false;
-                        break;
-                    }
-
-                    if (msg_type == 0x01) {  // TCP数据消息
-                        if (buffer.size() < 7) break;
-
-                        uint16_t data_len = ntohs(*(uint16_t*)&buffer[5]);
-                        if (buffer.size() < static_cast<size_t>(7 + data_len)) break;
-
-                        // 提取payload
-                        vector<uint8_t> payload(buffer.begin() + 7, buffer.begin() + 7 + data_len);
-                        buffer.erase(buffer.begin(), buffer.begin() + 7 + data_len);
-
-                        // v5.0: TCP payload IP替换（客户端IP → 代理IP）
-                        // 动态获取客户端真实IP（可能在UDP tunnel之后才可用）
-                        string real_ip = get_client_real_ip();
-                        if (!real_ip.empty() && !proxy_local_ip.empty()) {
-                            int replaced = replace_ip_in_payload(
-                                const_cast<uint8_t*>(payload.data()),
-                                payload.size(),
-                                real_ip,
-                                proxy_local_ip,
-                                conn_id,
-                                session_uuid
-                            );
-                            if (replaced > 0) {
-                                Logger::debug(conn_id_str() + " TCP已替换IP: " +
-                                            real_ip + " -> " + proxy_local_ip +
-                                            " (替换" + to_string(replaced) + "处)");
-                            }
-                        }
+    // v6.9: 每次recvmmsg/sendmmsg最多处理的数据报个数，在start()之前调用
+    void set_udp_batch(size_t max_datagrams) {
+        udp_recv.set_capacity(max_datagrams);
+        udp_send.set_capacity(max_datagrams);
+    }
 
-                        // v5.1: 转发前检查连接状态和socket有效性
-                        if (!running || game_fd < 0) {
-                            Logger::info(conn_id_str() + " 连接已关闭 (running=" +
-                                       string(running ? "true" : "false") + ", game_fd=" +
-                                       to_string(game_fd) + ")，停止转发");
-                            running = false;
-                            break;
-                        }
+    // v6.10: 空闲UDP socket回收时间，在start()之前调用
+    void set_udp_idle_timeout(uint64_t idle_ms) { udp_idle_ms = idle_ms; }
 
-                        // 转发到游戏服务器 - sendall
-                        if (!sendall(game_fd, payload.data(), payload.size())) {
-                            int err = errno;
-                            Logger::error(conn_id_str() + " 发送到游戏服务器失败 (errno=" +
-                                        to_string(err) + ": " + strerror(err) + ")");
-
-                            // 如果是EPIPE(32)或连接被重置，说明游戏socket已关闭
-                            if (err == EPIPE || err == ECONNRESET || err == ENOTCONN) {
-                                Logger::info(conn_id_str() + " 游戏socket已关闭，停止转发");
-                                running = false;
-                            }
-                            break;
-                        }
+    void start() {
+        running = true;
+        loop_thread = thread([this]() {
+            string name = "dnf-worker-" + to_string(index);
+            pthread_setname_np(pthread_self(), name.c_str());
+            if (backend == BACKEND_IO_URING) {
+                run_uring();
+            } else {
+                run();
+            }
+        });
+    }
 
-                        // 打印载荷预览（前16字节）
-                        string hex_preview = "";
-                        for (size_t i = 0; i < min((size_t)16, payload.size()); i++) {
-                            char buf[4];
-                            sprintf(buf, "%02x ", payload[i]);
-                            hex_preview += buf;
-                        }
+    void stop() {
+        if (!running.exchange(false)) return;
+        wakeup();
+    }
 
-                        Logger::debug(conn_id_str() + " 客户端→游戏: " +
-                                    to_string(payload.size()) + "字节 载荷:" + hex_preview);
-                    }
-                    else if (msg_type == 0x02) {  // v12.3.9: 心跳消息
-                        if (buffer.size() < 7) break;
+    void join() {
+        if (loop_thread.joinable() && loop_thread.get_id() != this_thread::get_id()) {
+            loop_thread.join();
+        }
+    }
 
-                        Logger::debug(conn_id_str() + " 💓 收到心跳包");
+    int id() const { return index; }
+    IoBackend io_backend() const { return backend; }
+    bool is_running() const { return running; }
 
-                        // 回复心跳包(保持连接双向活跃)
-                        uint8_t heartbeat_reply[7];
-                        heartbeat_reply[0] = 0x02;
-                        *(uint32_t*)&heartbeat_reply[1] = htonl(conn_id);
-                        *(uint16_t*)&heartbeat_reply[5] = htons(0);
-                        send(client_fd, (char*)heartbeat_reply, 7, 0);
+    uint8_t* buffer() { return recv_buf.data(); }
+    size_t buffer_size() const { return recv_buf.size(); }
+    size_t coalesce_max_bytes() const { return coalesce_bytes; }
+    uint64_t now_ms() const { return tick_now_ms; }
+    uint64_t udp_idle_timeout_ms() const { return udp_idle_ms; }
+    UdpRecvBatch& udp_recv_batch() { return udp_recv; }
+    UdpSendBatch& udp_send_batch() { return udp_send; }
 
-                        buffer.erase(buffer.begin(), buffer.begin() + 7);
-                    }
-                    else if (msg_type == 0x03) {  // UDP消息
-                        if (buffer.size() < 11) break;
+    // 跨线程投递任务，在本EventLoop线程中执行
+    void post(function<void()> task) {
+        {
+            lock_guard<mutex> lock(task_mutex);
+            pending_tasks.push_back(std::move(task));
+        }
+        wakeup();
+    }
 
-                        uint16_t src_port = ntohs(*(uint16_t*)&buffer[5]);
-                        uint16_t dst_port = ntohs(*(uint16_t*)&buffer[7]);
-                        uint16_t data_len = ntohs(*(uint16_t*)&buffer[9]);
+    // 以下函数只能在本EventLoop线程中调用
+    void adopt(const shared_ptr<EventHandler>& handler) {
+        handlers[handler.get()] = handler;
+    }
 
-                        if (buffer.size() < static_cast<size_t>(11 + data_len)) break;
+    void retire(EventHandler* handler) {
+        if (handler->tick_registered) {
+            handler->tick_registered = false;
+            for (auto& t : tickers) {
+                if (t == handler) t = nullptr;
+            }
+        }
+        if (handler->flush_scheduled) {
+            handler->flush_scheduled = false;
+            for (auto& f : deferred_flushes) {
+                if (f.handler == handler) f.handler = nullptr;
+            }
+            for (auto& f : flushing) {
+                if (f.handler == handler) f.handler = nullptr;
+            }
+        }
+        auto it = handlers.find(handler);
+        if (it != handlers.end()) {
+            retired.push_back(it->second);
+            handlers.erase(it);
+        }
+    }
 
-                        vector<uint8_t> payload(buffer.begin() + 11, buffer.begin() + 11 + data_len);
-                        buffer.erase(buffer.begin(), buffer.begin() + 11 + data_len);
+    static uint64_t monotonic_us() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
 
-                        // 转发UDP数据
-                        forward_udp_to_game(src_port, dst_port, payload);
-                    }
-                    else {
-                        Logger::warning(conn_id_str() + " 未知消息类型: " +
-                                      to_string((int)msg_type));
-                        buffer.erase(buffer.begin(), buffer.begin() + 5);
-                    }
+    // v6.7: 登记handler，本轮事件处理结束时调用其on_flush()
+    // delay_us>0: 最早在delay_us微秒后调用(不早于本轮结束)；已登记时取较早的时间
+    void defer_flush(EventHandler* handler, uint64_t delay_us = 0) {
+        uint64_t delay = delay_us > 0 ? delay_us : coalesce_delay_us;
+        uint64_t deadline = delay > 0 ? monotonic_us() + delay : 0;
+        if (handler->flush_scheduled) {
+            for (vector<DeferredFlush>* list : {&deferred_flushes, &flushing}) {
+                for (auto& f : *list) {
+                    if (f.handler == handler) f.deadline_us = min(f.deadline_us, deadline);
                 }
             }
-        } catch (exception& e) {
-            if (running) {
-                Logger::error(conn_id_str() + " 客户端→游戏转发失败: " +
-                            string(e.what()));
-            }
-            running = false;
+            return;
         }
+        handler->flush_scheduled = true;
+        if (deadline > 0) timed_flushes = true;
+        deferred_flushes.push_back(DeferredFlush{handler, deadline});
     }
 
-    // 线程2：转发游戏服务器→客户端（完全按照Python版本）
-    void forward_game_to_client() {
-        uint8_t buffer[65536];  // v12.2.0: 增大到64KB，配合流式转发
-        const int MAX_RECV_SIZE = 65535;  // v12.3.6: 限制recv大小，防止uint16_t溢出
+    // v6.10: 登记handler，每秒调用一次其on_tick()，handler关闭(retire)时自动注销
+    void add_ticker(EventHandler* handler) {
+        if (handler->tick_registered) return;
+        handler->tick_registered = true;
+        tickers.push_back(handler);
+    }
 
-        Logger::debug(conn_id_str() + " 游戏→客户端转发线程已启动");
+    bool watch(IoWatch* w, uint32_t events) {
+        if (backend == BACKEND_IO_URING) {
+            w->events = events;
+            w->registered = true;
+            uring_arm(w);
+            return true;
+        }
 
-        int last_recv_size = 0;
-        auto last_recv_time = chrono::system_clock::now();
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = w;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w->fd, &ev) < 0) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] 注册fd=" + to_string(w->fd) +
+                     "失败: " + strerror(errno));
+            return false;
+        }
+        w->events = events;
+        w->registered = true;
+        return true;
+    }
 
-        try {
-            while (running) {
-                // **v12.3.6修复: 限制recv大小为65535，防止data_len字段溢出**
-                // 协议data_len是uint16_t(2字节)，最大65535
-                int n = recv(game_fd, buffer, MAX_RECV_SIZE, 0);
-
-                // ===== 关键诊断点：游戏服务器断开 =====
-                if (n <= 0) {
-                    auto now = chrono::system_clock::now();
-                    auto time_since_last = chrono::duration_cast<chrono::milliseconds>(now - last_recv_time).count();
-
-                    if (n == 0) {
-                        Logger::info(conn_id_str() + " [!!!关键!!!] 游戏服务器发送FIN (recv返回0)");
-                        Logger::info(conn_id_str() + " 最后一次接收: " + to_string(last_recv_size) +
-                                   "字节，距今 " + to_string(time_since_last) + "ms");
-                        Logger::info(conn_id_str() + " 执行半关闭：游戏→客户端方向关闭，客户端→游戏方向保持");
-                    } else {
-                        int err = errno;
-                        Logger::error(conn_id_str() + " [!!!关键!!!] 游戏服务器连接错误");
-                        Logger::error(conn_id_str() + " recv返回: " + to_string(n) +
-                                    ", errno=" + to_string(err) + ": " + strerror(err));
-                        Logger::error(conn_id_str() + " 最后一次接收: " + to_string(last_recv_size) +
-                                    "字节，距今 " + to_string(time_since_last) + "ms");
-                    }
+    void update(IoWatch* w, uint32_t events) {
+        if (!w->registered || w->events == events) return;
+        if (backend == BACKEND_IO_URING) {
+            w->events = events;
+            uring_arm(w);
+            return;
+        }
 
-                    // v5.1: 游戏服务器关闭后，完全关闭game_fd防止继续发送数据
-                    // 之前的半关闭方案(SHUT_RD)会导致client_to_game继续向已关闭的socket发送数据
-                    // 从而在析构时触发sendall(-1)崩溃
-                    shutdown(game_fd, SHUT_RDWR);
-                    Logger::debug(conn_id_str() + " shutdown游戏socket (SHUT_RDWR)");
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = w;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, w->fd, &ev) == 0) {
+            w->events = events;
+        }
+    }
 
-                    close(game_fd);
-                    int closed_fd = game_fd;
-                    game_fd = -1;  // 设置为-1，让client_to_game线程的检查能够发现
-                    Logger::info(conn_id_str() + " 已关闭游戏socket fd=" + to_string(closed_fd) +
-                               "，client_to_game线程将在下次发送时检测到并停止");
+    // v6.4: 注销并关闭fd，fd的唯一关闭入口
+    // io_uring仍有该fd的操作在途时推迟到最后一个操作结束再close，避免fd编号在内核仍使用时被新连接复用
+    void close_watch(IoWatch* w) {
+        if (w->fd < 0) return;
+        unwatch(w);
+        w->owner = nullptr;
+        if (fd_inflight.count(w->fd)) {
+            deferred_close.insert(w->fd);
+        } else {
+            close(w->fd);
+        }
+        w->fd = -1;
+    }
 
-                    break;  // 退出game_to_client线程
-                }
+    void unwatch(IoWatch* w) {
+        if (!w->registered) return;
+        if (backend == BACKEND_IO_URING) {
+            uring_cancel(w->poll_token, true);
+            uring_cancel(w->recv_token, true);
+            uring_cancel(w->stale_recv_token, true);
+            w->poll_token = w->recv_token = w->stale_recv_token = 0;
+        } else {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, nullptr);
+        }
+        w->registered = false;
+        w->events = 0;
+    }
 
-                // 记录接收时间和大小
-                last_recv_time = chrono::system_clock::now();
-                last_recv_size = n;
-
-                // **v12.3.6修复: 防止uint16_t溢出**
-                // 协议data_len字段是uint16_t(2字节)，最大值65535
-                // 但buffer大小是65536，recv可能返回65536导致溢出为0！
-                if (n > 65535) {
-                    Logger::warning(conn_id_str() + " ⚠ recv返回" + to_string(n) +
-                                  "字节，超过uint16_t最大值65535，需要分包发送");
-                    // 先发送65535字节
-                    int first_part = 65535;
-                    int second_part = n - 65535;
-
-                    // 发送第一部分
-                    uint8_t response1[65535 + 7];
-                    memset(response1, 0, sizeof(response1));
-                    response1[0] = 0x01;
-                    *(uint32_t*)(response1 + 1) = htonl(conn_id);
-                    *(uint16_t*)(response1 + 5) = htons(first_part);
-                    memcpy(response1 + 7, buffer, first_part);
-
-                    if (!sendall(client_fd, response1, 7 + first_part)) {
-                        Logger::error(conn_id_str() + " 发送第一部分失败");
-                        running = false;
-                        break;
-                    }
-                    Logger::debug(conn_id_str() + " 已发送第一部分: 65535字节");
-
-                    // 发送第二部分
-                    uint8_t response2[second_part + 7];
-                    memset(response2, 0, sizeof(response2));
-                    response2[0] = 0x01;
-                    *(uint32_t*)(response2 + 1) = htonl(conn_id);
-                    *(uint16_t*)(response2 + 5) = htons(second_part);
-                    memcpy(response2 + 7, buffer + first_part, second_part);
-
-                    if (!sendall(client_fd, response2, 7 + second_part)) {
-                        Logger::error(conn_id_str() + " 发送第二部分失败");
-                        running = false;
-                        break;
-                    }
-                    Logger::debug(conn_id_str() + " 已发送第二部分: " + to_string(second_part) + "字节");
+private:
+    void wakeup() {
+        uint64_t one = 1;
+        ssize_t ret = write(wake_fd, &one, sizeof(one));
+        (void)ret;
+    }
 
-                    continue;  // 跳过后面的正常发送流程
-                }
+    void run_pending_tasks() {
+        uint64_t value;
+        while (read(wake_fd, &value, sizeof(value)) > 0) {}
 
-                Logger::debug(conn_id_str() + " [CHECKPOINT-1] 准备打印hex preview, n=" + to_string(n));
+        vector<function<void()>> tasks;
+        {
+            lock_guard<mutex> lock(task_mutex);
+            tasks.swap(pending_tasks);
+        }
+        for (auto& task : tasks) {
+            try {
+                task();
+            } catch (exception& e) {
+                LOG_ERROR("[Reactor-" + to_string(index) + "] 任务异常: " + string(e.what()));
+            }
+        }
+    }
 
-                // 打印载荷预览（前16字节）
-                string hex_preview = "";
-                for (int i = 0; i < min(16, n); i++) {
-                    char buf[4];
-                    sprintf(buf, "%02x ", buffer[i]);
-                    hex_preview += buf;
+    // 每轮事件处理结束时调用：flush已到期的登记，未到期的(coalesce_delay_us>0)由timerfd唤醒
+    void run_deferred_flushes() {
+        if (deferred_flushes.empty()) return;
+
+        uint64_t now = timed_flushes ? monotonic_us() : 0;
+        flushing.swap(deferred_flushes);
+        for (size_t i = 0; i < flushing.size(); i++) {
+            EventHandler* handler = flushing[i].handler;
+            if (handler == nullptr) continue;
+            if (flushing[i].deadline_us > now) {
+                deferred_flushes.push_back(flushing[i]);
+                continue;
+            }
+            handler->flush_scheduled = false;
+            try {
+                handler->on_flush();
+            } catch (exception& e) {
+                LOG_ERROR("[Reactor-" + to_string(index) + "] 事件处理异常: " + string(e.what()));
+            }
+        }
+        flushing.clear();
+
+        timed_flushes = false;
+        if (!deferred_flushes.empty() && timer_fd >= 0) {
+            uint64_t earliest = UINT64_MAX;
+            for (auto& f : deferred_flushes) {
+                if (f.handler != nullptr) earliest = min(earliest, f.deadline_us);
+                if (f.deadline_us > 0) timed_flushes = true;
+            }
+            if (earliest != UINT64_MAX) {
+                // on_flush中登记的立即flush(deadline为0)由下一轮处理，1微秒后唤醒
+                if (now == 0 && earliest > 0) now = monotonic_us();
+                uint64_t wait_us = earliest > now ? earliest - now : 1;
+                itimerspec spec{};
+                spec.it_value.tv_sec = wait_us / 1000000;
+                spec.it_value.tv_nsec = (wait_us % 1000000) * 1000;
+                timerfd_settime(timer_fd, 0, &spec, nullptr);
+            }
+        }
+    }
+
+    void drain_timer() {
+        uint64_t expirations;
+        while (read(timer_fd, &expirations, sizeof(expirations)) > 0) {}
+    }
+
+    void run_tickers() {
+        uint64_t expirations;
+        while (read(tick_fd, &expirations, sizeof(expirations)) > 0) {}
+        tick_now_ms = monotonic_us() / 1000;
+
+        // on_tick中可能关闭handler(retire会把对应项置空)或登记新的ticker，按下标遍历
+        size_t count = tickers.size();
+        for (size_t i = 0; i < count; i++) {
+            EventHandler* handler = tickers[i];
+            if (handler == nullptr) continue;
+            try {
+                handler->on_tick(tick_now_ms);
+            } catch (exception& e) {
+                LOG_ERROR("[Reactor-" + to_string(index) + "] 事件处理异常: " + string(e.what()));
+            }
+        }
+        tickers.erase(remove(tickers.begin(), tickers.end(), (EventHandler*)nullptr), tickers.end());
+    }
+
+    void run() {
+        const int MAX_EVENTS = 256;
+        epoll_event events[MAX_EVENTS];
+
+        LOG_DEBUG("[Reactor-" + to_string(index) + "] 事件循环已启动");
+
+        while (running) {
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                LOG_ERROR("[Reactor-" + to_string(index) + "] epoll_wait失败: " + strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < n; i++) {
+                IoWatch* w = static_cast<IoWatch*>(events[i].data.ptr);
+                if (w == nullptr) {
+                    run_pending_tasks();
+                    continue;
+                }
+                if (w == &timer_watch) {
+                    drain_timer();  // 到期的flush由run_deferred_flushes处理
+                    continue;
+                }
+                if (w == &tick_watch) {
+                    run_tickers();
+                    continue;
+                }
+                if (w->owner == nullptr) continue;  // 本轮中已关闭
+                try {
+                    w->owner->on_io(w, events[i].events);
+                } catch (exception& e) {
+                    LOG_ERROR("[Reactor-" + to_string(index) + "] 事件处理异常: " + string(e.what()));
                 }
+            }
+
+            run_deferred_flushes();
+            retired.clear();
+        }
+
+        LOG_DEBUG("[Reactor-" + to_string(index) + "] 事件循环已退出");
+    }
+
+    // ===== io_uring后端 =====
+
+    io_uring_sqe* uring_sqe() {
+        io_uring_sqe* sqe = uring->get_sqe();
+        if (sqe == nullptr) {
+            // 提交失败导致SQ持续满，只能等待下一轮
+            LOG_ERROR("[Reactor-" + to_string(index) + "] io_uring提交队列已满");
+        }
+        return sqe;
+    }
+
+    void uring_poll_wake() {
+        io_uring_sqe* sqe = uring_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = wake_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = WAKE_TOKEN;
+    }
+
+    void uring_poll_timer() {
+        if (timer_fd < 0) return;
+        io_uring_sqe* sqe = uring_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = timer_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = TIMER_TOKEN;
+    }
+
+    void uring_poll_tick() {
+        if (tick_fd < 0) return;
+        io_uring_sqe* sqe = uring_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = tick_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = TICK_TOKEN;
+    }
+
+    // 取消一个已提交的操作。forget=true时之后的完成事件直接丢弃
+    void uring_cancel(uint64_t token, bool forget) {
+        if (token == 0) return;
+        auto it = uring_ops.find(token);
+        if (it == uring_ops.end()) return;
+        if (forget) {
+            it->second.watch = nullptr;
+        }
+        io_uring_sqe* sqe = uring_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = token;
+        sqe->user_data = 0;  // 取消操作本身的完成事件忽略
+    }
+
+    // 根据w->events提交/取消操作，使内核中的操作与当前关注的事件一致
+    void uring_arm(IoWatch* w) {
+        bool want_recv = w->loop_recv && multishot_recv && (w->events & EPOLLIN);
+        uint32_t poll_events = w->events & ~(want_recv ? (uint32_t)EPOLLIN : 0u);
+
+        if (want_recv) {
+            // 上一个被取消的多发recv结束后才重新提交，保证数据顺序
+            if (w->recv_token == 0 && w->stale_recv_token == 0) {
+                io_uring_sqe* sqe = uring_sqe();
+                if (sqe) {
+                    uint64_t token = next_token++;
+                    sqe->opcode = IORING_OP_RECV;
+                    sqe->fd = w->fd;
+                    sqe->ioprio = IORING_RECV_MULTISHOT;
+                    sqe->flags = IOSQE_BUFFER_SELECT;
+                    sqe->buf_group = IoUring::BUF_GROUP;
+                    sqe->user_data = token;
+                    uring_ops[token] = UringOp{w, true, w->fd};
+                    fd_inflight[w->fd]++;
+                    w->recv_token = token;
+                }
+            }
+        } else if (w->recv_token != 0) {
+            // 暂停读取(背压)：取消多发recv，已在途的数据仍会交付
+            uring_cancel(w->recv_token, false);
+            w->stale_recv_token = w->recv_token;
+            w->recv_token = 0;
+        }
+
+        if (w->poll_token != 0) {
+            if (w->poll_events == poll_events) return;
+            uring_cancel(w->poll_token, true);
+            w->poll_token = 0;
+        }
+        if (poll_events == 0) return;
+
+        io_uring_sqe* sqe = uring_sqe();
+        if (!sqe) return;
+        uint64_t token = next_token++;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = w->fd;
+        sqe->poll32_events = poll_events;
+        sqe->user_data = token;
+        uring_ops[token] = UringOp{w, false, w->fd};
+        fd_inflight[w->fd]++;
+        w->poll_token = token;
+        w->poll_events = poll_events;
+    }
+
+    void uring_complete(uint64_t token, int res, uint32_t flags) {
+        if (token == 0) return;  // 取消操作
+        if (token == WAKE_TOKEN) {
+            run_pending_tasks();
+            uring_poll_wake();
+            return;
+        }
+        if (token == TIMER_TOKEN) {
+            drain_timer();
+            uring_poll_timer();
+            return;
+        }
+        if (token == TICK_TOKEN) {
+            run_tickers();
+            uring_poll_tick();
+            return;
+        }
+
+        bool has_buffer = (flags & IORING_CQE_F_BUFFER) != 0;
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+        auto it = uring_ops.find(token);
+        if (it == uring_ops.end()) {
+            if (has_buffer) uring->recycle_buffer(bid);
+            return;
+        }
+        IoWatch* w = it->second.watch;
+        bool is_recv = it->second.recv;
+        bool more = (flags & IORING_CQE_F_MORE) != 0;
+
+        if (!is_recv) {
+            // 单次poll：每次完成后按当前关注事件重新提交
+            release_fd(it->second.fd);
+            uring_ops.erase(it);
+            if (w == nullptr || w->poll_token != token) return;
+            w->poll_token = 0;
+            uint32_t events = res < 0 ? (uint32_t)EPOLLERR : (uint32_t)res;
+            if (w->recv_token != 0 || w->stale_recv_token != 0) {
+                // 挂断/错误由多发recv报告，避免handler自行recv打乱数据顺序
+                events &= ~(uint32_t)(EPOLLHUP | EPOLLERR | EPOLLRDHUP);
+            }
+            if (w->owner != nullptr && events != 0) {
+                dispatch_io(w, events);
+            }
+            if (w->registered && w->poll_token == 0) uring_arm(w);
+            return;
+        }
+
+        if (!more) {
+            release_fd(it->second.fd);
+            uring_ops.erase(it);
+            if (w != nullptr) {
+                if (w->recv_token == token) w->recv_token = 0;
+                if (w->stale_recv_token == token) w->stale_recv_token = 0;
+            }
+        }
+
+        if (w != nullptr && w->owner != nullptr) {
+            if (res > 0 && has_buffer) {
+                dispatch_recv(w, uring->buffer(bid), res, 0);
+            } else if (res == 0) {
+                dispatch_recv(w, nullptr, 0, 0);
+            } else if (res == -EINVAL && multishot_recv) {
+                // 内核不支持多发recv(6.0以下)，改为poll + 由handler自行recv
+                multishot_recv = false;
+                LOG_WARN("[Reactor-" + to_string(index) + "] 内核不支持多发recv，改用POLL_ADD");
+            } else if (res < 0 && res != -ECANCELED && res != -ENOBUFS) {
+                dispatch_recv(w, nullptr, -1, -res);
+            }
+        }
+        if (has_buffer) uring->recycle_buffer(bid);
+
+        // 多发recv被内核结束(缓冲耗尽等)时重新提交
+        if (!more && w != nullptr && w->registered && w->recv_token == 0) uring_arm(w);
+    }
+
+    // 操作结束，fd在途计数减一；已被close_watch的fd在最后一个操作结束时关闭
+    void release_fd(int fd) {
+        auto it = fd_inflight.find(fd);
+        if (it == fd_inflight.end()) return;
+        if (--it->second > 0) return;
+        fd_inflight.erase(it);
+        if (deferred_close.erase(fd)) {
+            close(fd);
+        }
+    }
+
+    void dispatch_io(IoWatch* w, uint32_t events) {
+        try {
+            w->owner->on_io(w, events);
+        } catch (exception& e) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] 事件处理异常: " + string(e.what()));
+        }
+    }
+
+    void dispatch_recv(IoWatch* w, uint8_t* data, int n, int err) {
+        try {
+            w->owner->on_recv(w, data, n, err);
+        } catch (exception& e) {
+            LOG_ERROR("[Reactor-" + to_string(index) + "] 事件处理异常: " + string(e.what()));
+        }
+    }
+
+    void run_uring() {
+        LOG_DEBUG("[Reactor-" + to_string(index) + "] 事件循环已启动 (io_uring)");
+
+        uring_poll_wake();
+        uring_poll_timer();
+        uring_poll_tick();
+        while (running) {
+            // 提交本轮产生的所有SQE并等待至少一个完成事件，一次系统调用
+            int ret = uring->submit(1);
+            if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -EAGAIN) {
+                LOG_ERROR("[Reactor-" + to_string(index) + "] io_uring_enter失败: " + strerror(-ret));
+                break;
+            }
+
+            io_uring_cqe* cqe;
+            while ((cqe = uring->peek_cqe()) != nullptr) {
+                uint64_t token = cqe->user_data;
+                int res = cqe->res;
+                uint32_t flags = cqe->flags;
+                uring->cqe_seen();
+                uring_complete(token, res, flags);
+            }
+
+            run_deferred_flushes();
+            retired.clear();
+        }
+
+        LOG_DEBUG("[Reactor-" + to_string(index) + "] 事件循环已退出");
+    }
+};
+
+// 固定数量的EventLoop，新连接按轮询分配
+class ReactorPool {
+private:
+    vector<unique_ptr<EventLoop>> loops;
+    atomic<unsigned int> next_index;
+
+public:
+    ReactorPool() : next_index(0) {}
+
+    bool start(int thread_count, IoBackend backend, size_t coalesce_max_bytes, uint64_t coalesce_max_delay_us,
+               size_t udp_batch, uint64_t udp_idle_timeout_ms) {
+        if (thread_count <= 0) {
+            thread_count = (int)thread::hardware_concurrency();
+            if (thread_count <= 0) thread_count = 1;
+        }
+        for (int i = 0; i < thread_count; i++) {
+            unique_ptr<EventLoop> loop(new EventLoop(i));
+            if (!loop->init(backend)) return false;
+            if (!loop->set_coalesce(coalesce_max_bytes, coalesce_max_delay_us)) return false;
+            if (!loop->init_tick()) return false;
+            loop->set_udp_batch(udp_batch);
+            loop->set_udp_idle_timeout(udp_idle_timeout_ms);
+            loops.push_back(std::move(loop));
+        }
+        for (auto& loop : loops) {
+            loop->start();
+        }
+        string backend_name = loops[0]->io_backend() == BACKEND_IO_URING ? "io_uring" : "epoll";
+        LOG_INFO("Reactor已启动: " + to_string(thread_count) + " 个worker线程 (" + backend_name + ")");
+        return true;
+    }
+
+    EventLoop* next_loop() {
+        return loops[next_index++ % loops.size()].get();
+    }
+
+    size_t size() const { return loops.size(); }
+
+    void stop() {
+        for (auto& loop : loops) loop->stop();
+    }
+
+    void join() {
+        for (auto& loop : loops) loop->join();
+    }
+};
+
+// 非阻塞发送缓冲：send()未能一次写完的数据暂存于此，等待EPOLLOUT后继续发送
+// v6.20: 帧的recv时间随缓冲记下(mark)，写入socket到该位置后由take_sent()取出，延迟在真正写出后记录
+//        sent_total为经过本缓冲(直接发送或先入缓冲)写入socket的全部字节数
+struct OutBuffer {
+    struct SentMark {
+        uint64_t end;        // 这批帧在流中的结束位置
+        uint64_t recv_ns;
+        uint64_t frames;
+    };
+    // 客户端长时间不读时合并到最后一条，记录的延迟按最早的recv时间计算
+    static const size_t MARKS_MAX = 1024;
+
+    vector<uint8_t> data;
+    size_t offset;
+    uint64_t sent_total;     // 已写入socket的字节数(流中位置)
+    deque<SentMark> marks;
+
+    OutBuffer() : offset(0), sent_total(0) {}
+
+    size_t pending() const { return data.size() - offset; }
+    bool empty() const { return offset == data.size(); }
+
+    // 缓冲末尾在流中的位置
+    uint64_t end_position() const { return sent_total + pending(); }
+
+    // 缓冲末尾(刚发送或追加)的一批帧，写入socket后由take_sent()取出
+    // held: 这批帧中尚未交给本缓冲的末尾字节数(IP替换暂存，之后按原长度发出)
+    void mark(uint64_t recv_ns, uint64_t frames, size_t held = 0) {
+        if (marks.size() >= MARKS_MAX) {
+            marks.back().end = end_position() + held;
+            marks.back().frames += frames;
+            return;
+        }
+        marks.push_back(SentMark{end_position() + held, recv_ns, frames});
+    }
+
+    // 取出已全部写入socket的帧: record(recv_ns, frames)
+    template <typename F>
+    void take_sent(F record) {
+        while (!marks.empty() && marks.front().end <= sent_total) {
+            record(marks.front().recv_ns, marks.front().frames);
+            marks.pop_front();
+        }
+    }
+
+    void append(const uint8_t* p, size_t n) {
+        if (offset > 0 && offset == data.size()) {
+            data.clear();
+            offset = 0;
+        }
+        data.insert(data.end(), p, p + n);
+    }
+
+    // 尽可能发送缓冲中的数据，返回false表示socket出错
+    bool flush(int fd) {
+        while (offset < data.size()) {
+            ssize_t ret = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+            if (ret > 0) {
+                offset += ret;
+                sent_total += ret;
+                continue;
+            }
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        if (offset == data.size()) {
+            data.clear();
+            offset = 0;
+        } else if (offset > 65536 && offset * 2 > data.size()) {
+            data.erase(data.begin(), data.begin() + offset);
+            offset = 0;
+        }
+        return true;
+    }
+};
+
+// 发送缓冲中的数据和iov用一次sendmsg发出，未发送的部分追加到缓冲；返回false表示socket出错
+// v6.9: UDP批量接收时iov为每个数据报的帧头+payload，最多2*UDP_BATCH_MAX个
+const int SENDV_MAX_IOV = 2 * UDP_BATCH_MAX + 1;
+
+bool sendv_after_buffer(int fd, OutBuffer& out, iovec* iov, int iovcnt) {
+    iovec all[SENDV_MAX_IOV];
+    int buffered = out.empty() ? 0 : 1;
+    if (buffered) {
+        all[0].iov_base = out.data.data() + out.offset;
+        all[0].iov_len = out.pending();
+    }
+    int count = buffered;
+    for (int i = 0; i < iovcnt && count < SENDV_MAX_IOV; i++) {
+        all[count++] = iov[i];
+    }
+
+    int index = 0;
+    while (index < count) {
+        msghdr msg{};
+        msg.msg_iov = all + index;
+        msg.msg_iovlen = count - index;
+        ssize_t ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        out.sent_total += ret;
+        // 跳过已发送的部分
+        size_t sent = ret;
+        while (index < count && sent >= all[index].iov_len) {
+            sent -= all[index].iov_len;
+            index++;
+        }
+        if (index < count) {
+            all[index].iov_base = (uint8_t*)all[index].iov_base + sent;
+            all[index].iov_len -= sent;
+        }
+    }
+
+    // 缓冲中已发出的部分出队，未发送的iov只能复制到发送缓冲
+    if (buffered) {
+        if (index == 0) {
+            out.offset = out.data.size() - all[0].iov_len;
+        } else {
+            out.data.clear();
+            out.offset = 0;
+        }
+    }
+    for (int i = max(index, buffered); i < count; i++) {
+        out.append((const uint8_t*)all[i].iov_base, all[i].iov_len);
+    }
+    return true;
+}
+
+// 发送数据：缓冲为空时直接sendmsg，剩余部分(或缓冲非空时全部)追加到缓冲等待EPOLLOUT
+// v6.2: 帧头和payload作为iovec一起发送，payload直接从接收缓冲发出，不再拼接到临时buffer
+// 返回false表示socket出错
+bool sendv_or_queue(int fd, OutBuffer& out, iovec* iov, int iovcnt) {
+    if (out.empty()) return sendv_after_buffer(fd, out, iov, iovcnt);
+    for (int i = 0; i < iovcnt; i++) {
+        out.append((const uint8_t*)iov[i].iov_base, iov[i].iov_len);
+    }
+    return true;
+}
+
+// v6.7: 写合并。小帧追加到发送缓冲并登记到EventLoop，本轮事件处理结束时由owner->on_flush()一次发出，
+//       同一轮中发往同一socket的多个帧只需一次send；合并的数据达到coalesce_max_bytes时立即发送
+//       大帧(>=coalesce_max_bytes)不复制，与已合并的数据一起由一次sendmsg发出
+bool coalesce_send(EventLoop* loop, EventHandler* owner, int fd, OutBuffer& out, iovec* iov, int iovcnt) {
+    size_t max_bytes = loop->coalesce_max_bytes();
+    // 缓冲非空但未登记flush: socket发送缓冲已满，正在等待EPOLLOUT
+    if (max_bytes == 0 || (!out.empty() && !owner->flush_scheduled)) {
+        return sendv_or_queue(fd, out, iov, iovcnt);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (total >= max_bytes) {
+        return sendv_after_buffer(fd, out, iov, iovcnt);
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        out.append((const uint8_t*)iov[i].iov_base, iov[i].iov_len);
+    }
+    loop->defer_flush(owner);
+    if (out.pending() >= max_bytes) return out.flush(fd);
+    return true;
+}
+
+bool send_or_queue(int fd, OutBuffer& out, const uint8_t* data, size_t len) {
+    iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+    return sendv_or_queue(fd, out, &iov, 1);
+}
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// 发送缓冲超过该值时暂停读取对端，形成背压(与socket缓冲区256KB一致)
+const size_t OUTBUF_HIGH_WATERMARK = 262144;
+
+// ==================== 转发统计 ====================
+// v6.18/v6.19: 计数器定义(StatCounter、ForwardStats)见forward_stats.h
+
+// 追加 ,"frames_to_game":N,... (调用方负责外层的{})
+void append_stats_json(string& out, const uint64_t* values) {
+    for (int i = 0; i < STAT_COUNT; i++) {
+        out.append(",\"").append(STAT_NAMES[i]).append("\":").append(to_string(values[i]));
+    }
+}
+
+// 日志中的时长: 850ns / 12.3us / 4.56ms / 1.20s
+string format_duration_ns(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) {
+        snprintf(buf, sizeof(buf), "%uns", (unsigned)ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+    } else {
+        snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    }
+    return buf;
+}
+
+// v6.20: LAT_CLIENT_BLOCKED为客户端socket发送缓冲满(数据滞留在to_client等待EPOLLOUT)到写完的时间，
+//        每次阻塞一个样本
+// v6.21: LAT_CLIENT_RTT为v2心跳中客户端上报的往返时间，LAT_GAME_RTT为收到心跳时game_fd的TCP_INFO平滑RTT，
+//        每次心跳一个样本
+enum LatencyMetric { LAT_TO_GAME, LAT_TO_CLIENT, LAT_CLIENT_BLOCKED, LAT_CLIENT_RTT, LAT_GAME_RTT, LAT_COUNT };
+static const char* const LAT_NAMES[LAT_COUNT] = {"to_game", "to_client", "client_blocked", "client_rtt", "game_rtt"};
+
+// v6.21: v2心跳回复中的服务器接收时间(Unix时间，微秒)
+inline uint64_t realtime_us() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// 每个TunnelServer每个worker线程一个分片，只由该worker写入；末尾填充一个缓存行，
+// 不同worker的计数器不会落在同一缓存行
+struct StatsShard {
+    ForwardStats stats;
+    atomic<uint64_t> tcp_opened;
+    atomic<uint64_t> tcp_closed;
+    atomic<uint64_t> udp_opened;
+    atomic<uint64_t> udp_closed;
+    // v6.19: recv返回到对应帧发出(send返回或进入发送缓冲)的时间，同一次recv的帧记同一个值
+    LatencyHistogram latency[LAT_COUNT];
+    char pad[64];
+
+    StatsShard() : tcp_opened(0), tcp_closed(0), udp_opened(0), udp_closed(0) {}
+
+    static void bump(atomic<uint64_t>& c) {
+        c.store(c.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+};
+
+// v6.20: latency_per_session启用时每个会话额外一组直方图(约12KB)，GET_STATS <服务器名称>中输出
+struct SessionLatency {
+    LatencyHistogram latency[LAT_COUNT];
+};
+
+// v6.21: 心跳测得的往返时间(微秒)，所属worker写入，GET_STATS读取
+struct SessionRtt {
+    atomic<bool> heartbeat_v2;          // 客户端发送的是v2心跳
+    atomic<uint32_t> client_rtt_us;     // 客户端上报的最近一次心跳RTT
+    atomic<uint32_t> client_jitter_us;  // 相邻两次RTT之差的平滑值: J += (|D| - J) / 16 (RFC 3550)
+    atomic<uint32_t> client_samples;
+    atomic<uint32_t> game_rtt_us;       // 最近一次心跳时game_fd的tcpi_rtt
+    atomic<uint32_t> game_rttvar_us;
+
+    SessionRtt() : heartbeat_v2(false), client_rtt_us(0), client_jitter_us(0), client_samples(0),
+                   game_rtt_us(0), game_rttvar_us(0) {}
+
+    // 单写者: 只能在所属worker线程调用
+    void add_client_sample(uint32_t rtt_us) {
+        uint32_t n = client_samples.load(memory_order_relaxed);
+        if (n > 0) {
+            uint32_t prev = client_rtt_us.load(memory_order_relaxed);
+            int64_t d = (int64_t)rtt_us - prev;
+            int64_t j = client_jitter_us.load(memory_order_relaxed);
+            j += ((d < 0 ? -d : d) - j) / 16;
+            client_jitter_us.store((uint32_t)j, memory_order_relaxed);
+        }
+        client_rtt_us.store(rtt_us, memory_order_relaxed);
+        client_samples.store(n + 1, memory_order_relaxed);
+    }
+
+    // ,"rtt":{"heartbeat":"v2","client_rtt_us":..,"client_jitter_us":..,"client_samples":..,"game_rtt_us":..,"game_rttvar_us":..}
+    void append_json(string& out) const {
+        out.append(",\"rtt\":{\"heartbeat\":\"").append(heartbeat_v2.load(memory_order_relaxed) ? "v2" : "v1");
+        out.append("\",\"client_rtt_us\":").append(to_string(client_rtt_us.load(memory_order_relaxed)));
+        out.append(",\"client_jitter_us\":").append(to_string(client_jitter_us.load(memory_order_relaxed)));
+        out.append(",\"client_samples\":").append(to_string(client_samples.load(memory_order_relaxed)));
+        out.append(",\"game_rtt_us\":").append(to_string(game_rtt_us.load(memory_order_relaxed)));
+        out.append(",\"game_rttvar_us\":").append(to_string(game_rttvar_us.load(memory_order_relaxed)));
+        out += '}';
+    }
+};
+
+// v6.20: "latency":{"to_game":{"count":N,"p50_ns":..,"p99_ns":..,"p999_ns":..,"max_ns":..},...}
+void append_latency_json(string& out, const LatencySnapshot* latency) {
+    out += ",\"latency\":{";
+    for (int d = 0; d < LAT_COUNT; d++) {
+        const LatencySnapshot& l = latency[d];
+        if (d > 0) out += ',';
+        out.append(1, '"').append(LAT_NAMES[d]).append("\":{\"count\":").append(to_string(l.total()));
+        out.append(",\"p50_ns\":").append(to_string(l.percentile(0.5)));
+        out.append(",\"p99_ns\":").append(to_string(l.percentile(0.99)));
+        out.append(",\"p999_ns\":").append(to_string(l.percentile(0.999)));
+        out.append(",\"max_ns\":").append(to_string(l.max_ns)).append(1, '}');
+    }
+    out += '}';
+}
+
+void append_session_latency_json(string& out, const SessionLatency* session) {
+    if (session == nullptr) return;
+    LatencySnapshot latency[LAT_COUNT];
+    for (int d = 0; d < LAT_COUNT; d++) session->latency[d].sum_into(latency[d]);
+    append_latency_json(out, latency);
+}
+
+// v6.19: 一个服务器所有分片的汇总(GET_STATS/metrics)
+struct ServerStatsSnapshot {
+    uint64_t tcp_connections;
+    uint64_t udp_tunnels;
+    uint64_t tcp_total;       // 累计建立的TCP连接
+    uint64_t udp_total;       // 累计建立的UDP隧道
+    uint64_t counters[STAT_COUNT];
+    LatencySnapshot latency[LAT_COUNT];
+};
+
+string json_escape(const string& s) {
+    string out;
+    out.reserve(s.size() + 2);
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out;
+}
+
+// ==================== TCP 连接管理 ====================
+// v6.0: 状态机 CONNECTING → FORWARDING → CLOSED，由所属EventLoop驱动，不再占用转发线程
+class TunnelConnection : public EventHandler, public enable_shared_from_this<TunnelConnection> {
+private:
+    enum WatchKind { WATCH_CLIENT = 1, WATCH_GAME = 2, WATCH_UDP = 3 };
+    enum State { STATE_INIT, STATE_CONNECTING, STATE_FORWARDING, STATE_CLOSED };
+
+    int conn_id;
+    int client_fd;
+    int game_fd;
+    string game_server_ip;
+    int game_port;
+    State state;
+    string session_uuid;  // 客户端会话UUID，用于唯一标识客户端
+    LogSession log_session;  // v6.16: 结构化日志事件的conn_id和会话序号
+
+    EventLoop* loop;
+    IoWatch client_watch;
+    IoWatch game_watch;
+
+    // v5.0: IP替换相关
+    string client_real_ip;     // 客户端真实IP（从payload提取）
+    string proxy_local_ip;     // 代理服务器本地IP
+    string tcp_source_ip;      // TCP连接源IP（用于动态查询映射）
+    map<string, string>* client_ip_map_ptr;  // 指向TunnelServer的IP映射
+    mutex* ip_map_mutex_ptr;   // 指向TunnelServer的IP映射互斥锁
+    // v6.12: 客户端真实IP可用后构造一次
+    bool rewriters_ready;
+    IpRewriter to_game_rewriter;    // 客户端IP → 代理IP
+    IpRewriter to_client_rewriter;  // 代理IP → 客户端IP
+    // v6.13: 按服务器规则执行替换，跨recv暂存可能被截断的IP
+    shared_ptr<const RewritePolicy> rewrite_policy;
+    RewriteStream to_game_stream;
+    RewriteStream to_client_stream;
+
+    // 游戏服务器地址(依次尝试)
+    vector<sockaddr_storage> game_addrs;
+    vector<socklen_t> game_addr_lens;
+    size_t game_addr_index;
+
+    FrameDecoder decoder;      // 客户端→游戏 协议解析
+    OutBuffer to_client;
+    OutBuffer to_game;
+    bool draining;             // 客户端已断开，等待发往游戏服务器的数据发完再关闭
+    ForwardStats stats;        // v6.18: 本连接的转发计数
+    StatsShard* shard;         // v6.19: 所属TunnelServer在本worker的分片
+    unique_ptr<SessionLatency> session_latency;  // v6.20: latency_per_session时分配
+    uint64_t client_blocked_ns;  // v6.20: to_client开始等待EPOLLOUT的时间，0表示未阻塞
+    SessionRtt rtt;              // v6.21: 心跳RTT
+
+    // UDP相关: dst_port -> UDP socket
+    struct UdpLeg {
+        IoWatch watch;
+        int client_port;
+        uint64_t last_active_ms;   // v6.10: 最近收发时间(EventLoop::now_ms)
+    };
+    map<int, unique_ptr<UdpLeg>> udp_sockets;
+    // v6.10: 空闲回收的UDP socket，本轮事件中可能仍有指向其watch的事件，下次tick时释放
+    vector<unique_ptr<UdpLeg>> idle_legs;
+
+    function<void()> on_closed;
+
+    int last_recv_size;
+    chrono::system_clock::time_point last_recv_time;
+
+    // v5.0: 动态获取客户端真实IP（从映射中查询）
+    string get_client_real_ip() {
+        if (!client_real_ip.empty()) {
+            return client_real_ip;  // 已有缓存
+        }
+        if (tcp_source_ip.empty() || !client_ip_map_ptr || !ip_map_mutex_ptr) {
+            return "";  // 无法查询
+        }
+
+        lock_guard<mutex> lock(*ip_map_mutex_ptr);
+        auto it = client_ip_map_ptr->find(tcp_source_ip);
+        if (it != client_ip_map_ptr->end()) {
+            client_real_ip = it->second;  // 缓存结果
+            LOG_DEBUG("[连接" + to_string(conn_id) + "|" + session_uuid + "] 动态获取客户端真实IP: " + client_real_ip);
+            return client_real_ip;
+        }
+        return "";
+    }
+
+    // v6.12: 客户端真实IP可用(可能在UDP tunnel之后)时构造两个方向的IpRewriter
+    bool prepare_rewriters() {
+        if (rewriters_ready) return true;
+        string real_ip = get_client_real_ip();
+        if (real_ip.empty() || proxy_local_ip.empty()) return false;
+        if (!to_game_rewriter.init(real_ip, proxy_local_ip) ||
+            !to_client_rewriter.init(proxy_local_ip, real_ip)) {
+            LOG_ERROR(conn_id_str() + "[IP替换] IP地址格式错误: " + real_ip + " <-> " + proxy_local_ip);
+        }
+        to_game_stream.init(rewrite_policy.get(), &to_game_rewriter);
+        to_client_stream.init(rewrite_policy.get(), &to_client_rewriter);
+        rewriters_ready = true;
+        return true;
+    }
+
+    // v6.13: 发出IP替换暂存的末尾字节。位于未结束的分帧消息中的暂存字节继续等待下一块
+    // (RewriteStream::can_hold)，到等待时间再登记一次flush；force(关闭连接)时全部发出
+    bool send_held_bytes(bool force) {
+        uint8_t held[RewriteStream::CARRY_MAX];
+        uint64_t now = 0;
+        uint64_t wait_us = UINT64_MAX;
+        RewriteStream* streams[] = {&to_client_stream, &to_game_stream};
+        for (RewriteStream* stream : streams) {
+            if (!stream->holding()) continue;
+            if (!force) {
+                if (now == 0) now = EventLoop::monotonic_us();
+                uint64_t remaining = 0;
+                if (stream->can_hold(now, remaining)) {
+                    wait_us = min(wait_us, remaining);
+                    continue;
+                }
+            }
+            size_t n = stream->release(held);
+            if (stream == &to_client_stream) {
+                if (client_fd >= 0 && !send_data_frames(held, n)) return false;
+            } else if (game_fd >= 0) {
+                if (!send_or_queue(game_fd, to_game, held, n)) return false;
+                record_game_sent();
+            }
+        }
+        if (wait_us != UINT64_MAX) loop->defer_flush(this, wait_us);
+        return true;
+    }
+
+    // 格式化连接标识符（包含conn_id和session_uuid）
+    string conn_id_str() const {
+        if (session_uuid.empty()) {
+            return "[连接" + to_string(conn_id) + "]";
+        }
+        return "[连接" + to_string(conn_id) + "|" + session_uuid + "]";
+    }
+
+    // v6.19: 会话计数与服务器分片同时累加
+    void add_stat(StatCounter c, uint64_t n) {
+        stats.add(c, n);
+        shard->stats.add(c, n);
+    }
+
+    // v6.19: 本次recv的帧已发出，记录recv返回到现在的时间
+    void record_latency(LatencyMetric metric, uint64_t recv_ns, uint64_t frames) {
+        if (frames == 0) return;
+        uint64_t ns = monotonic_ns() - recv_ns;
+        shard->latency[metric].record(ns, frames);
+        if (session_latency) session_latency->latency[metric].record(ns, frames);
+    }
+
+    // v6.20: 发往客户端的帧写入socket后才记录to_client: 仍在发送缓冲中(写合并或socket缓冲满)的帧
+    //        随缓冲记下recv时间，由on_flush/EPOLLOUT写出后record_client_sent()记录
+    void record_to_client(uint64_t recv_ns, uint64_t frames) {
+        if (frames == 0) return;
+        to_client.mark(recv_ns, frames);
+        record_client_sent();
+    }
+
+    void record_client_sent() {
+        to_client.take_sent([this](uint64_t recv_ns, uint64_t frames) {
+            record_latency(LAT_TO_CLIENT, recv_ns, frames);
+        });
+    }
+
+    // v6.20: 0x01帧的to_game同样在写入游戏服务器socket后记录: 仍在to_game缓冲中(游戏服务器背压)或
+    //        末尾字节被IP替换暂存的帧，由EPOLLOUT/send_held_bytes写出后record_game_sent()记录
+    void record_to_game(uint64_t recv_ns, uint64_t frames) {
+        if (frames == 0) return;
+        to_game.mark(recv_ns, frames, to_game_stream.held_size());
+        record_game_sent();
+    }
+
+    void record_game_sent() {
+        to_game.take_sent([this](uint64_t recv_ns, uint64_t frames) {
+            record_latency(LAT_TO_GAME, recv_ns, frames);
+        });
+    }
+
+    // v6.20: 客户端socket发送缓冲满的时长，只在开始/结束阻塞时读取时钟
+    void record_client_blocked(bool blocked) {
+        if (blocked == (client_blocked_ns != 0)) return;
+        if (blocked) {
+            client_blocked_ns = monotonic_ns();
+            return;
+        }
+        record_latency(LAT_CLIENT_BLOCKED, client_blocked_ns, 1);
+        client_blocked_ns = 0;
+    }
+
+    // v6.21: 直接记录一个测得的时长
+    void record_sample(LatencyMetric metric, uint64_t ns) {
+        shard->latency[metric].record(ns, 1);
+        if (session_latency) session_latency->latency[metric].record(ns, 1);
+    }
+
+    // v6.21: 收到心跳时读取到游戏服务器的TCP RTT(内核平滑值)，连接尚未建立或还没有RTT样本时跳过
+    void sample_game_rtt() {
+        if (game_fd < 0 || state != STATE_FORWARDING) return;
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        if (getsockopt(game_fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0 || info.tcpi_rtt == 0) return;
+        rtt.game_rtt_us.store(info.tcpi_rtt, memory_order_relaxed);
+        rtt.game_rttvar_us.store(info.tcpi_rttvar, memory_order_relaxed);
+        record_sample(LAT_GAME_RTT, (uint64_t)info.tcpi_rtt * 1000);
+    }
+
+public:
+    TunnelConnection(EventLoop* ev_loop, int cid, int cfd, const string& game_ip, int gport,
+                     const string& client_ip = "", const string& proxy_ip = "",
+                     const string& tcp_src_ip = "",
+                     map<string, string>* ip_map = nullptr,
+                     mutex* ip_mutex = nullptr,
+                     const LogSession& log_sess = LogSession())
+        : conn_id(cid), client_fd(cfd), game_fd(-1),
+          game_server_ip(game_ip), game_port(gport), state(STATE_INIT),
+          session_uuid(log_sess.uuid), log_session(log_sess), loop(ev_loop),
+          client_real_ip(client_ip), proxy_local_ip(proxy_ip),
+          tcp_source_ip(tcp_src_ip), client_ip_map_ptr(ip_map),
+          ip_map_mutex_ptr(ip_mutex), rewriters_ready(false), game_addr_index(0),
+          decoder(frame_type_bit(FRAME_TCP_DATA) | frame_type_bit(FRAME_HEARTBEAT) | frame_type_bit(FRAME_UDP_DATA)),
+          draining(false), shard(nullptr), client_blocked_ns(0),
+          last_recv_size(0), last_recv_time(chrono::system_clock::now()) {
+        client_watch.owner = this;
+        client_watch.fd = client_fd;
+        client_watch.kind = WATCH_CLIENT;
+        client_watch.loop_recv = true;
+        decoder.expect_conn_id((uint32_t)conn_id);
+        game_watch.owner = this;
+        game_watch.kind = WATCH_GAME;
+        game_watch.loop_recv = true;
+        LOG_DEBUG("[连接" + to_string(conn_id) + "|" + session_uuid + "] TunnelConnection对象已创建");
+    }
+
+    ~TunnelConnection() {
+        // 正常情况下close()已释放所有fd，这里只兜底
+        close_all_fds();
+        LOG_DEBUG(conn_id_str() + " TunnelConnection对象已销毁");
+        Logger::end_session(log_session);
+    }
+
+    void set_on_closed(function<void()> callback) {
+        on_closed = callback;
+    }
+
+    void set_rewrite_policy(shared_ptr<const RewritePolicy> policy) {
+        rewrite_policy = policy;
+    }
+
+    // v6.19: 在start()之前由TunnelServer设置
+    // v6.20: per_session_latency时本会话另外记录一份延迟直方图
+    void set_stats_shard(StatsShard* s, bool per_session_latency) {
+        shard = s;
+        if (per_session_latency) session_latency.reset(new SessionLatency());
+    }
+
+    // v6.18: GET_STATS中的会话条目，只读取构造后不再变化的字段，可在其他线程调用
+    void session_json(string& out, const string& client) const {
+        uint64_t values[STAT_COUNT] = {};
+        stats.sum_into(values);
+        out += "{\"type\":\"tcp\",\"client\":\"" + json_escape(client) + "\",\"conn_id\":" +
+               to_string((uint32_t)conn_id) + ",\"session\":\"" + json_escape(session_uuid) +
+               "\",\"game_port\":" + to_string(game_port);
+        append_stats_json(out, values);
+        rtt.append_json(out);
+        append_session_latency_json(out, session_latency.get());
+        out += '}';
+    }
+
+    // 在所属EventLoop线程中调用：解析游戏服务器地址并发起非阻塞连接
+    // 失败时自动close()
+    void start() {
+        LOG_DEBUG(conn_id_str() + " 开始启动连接");
+
+        // v6.8: 从DNS缓存取游戏服务器地址（支持域名/IPv4/IPv6），不再每次连接调用getaddrinfo
+        if (DnsCache::lookup(game_server_ip, SOCK_STREAM, game_port, game_addrs, game_addr_lens) == 0) {
+            LOG_ERROR(conn_id_str() + " DNS解析失败: " + game_server_ip);
+            close_connection();
+            return;
+        }
+
+        // 客户端socket在连接游戏服务器期间只注册错误事件，连接成功后再读取
+        if (!loop->watch(&client_watch, 0)) {
+            close_connection();
+            return;
+        }
+
+        connect_next_address();
+    }
+
+    void on_io(IoWatch* watch, uint32_t events) override {
+        if (state == STATE_CLOSED) return;
+
+        if (watch->kind == WATCH_GAME) {
+            if (state == STATE_CONNECTING) {
+                on_game_connect_result();
+                return;
+            }
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                on_game_readable();
+            }
+            if (state != STATE_CLOSED && game_fd >= 0 && (events & EPOLLOUT)) {
+                if (!to_game.flush(game_fd)) {
+                    int err = errno;
+                    add_stat(STAT_SEND_FAILURES, 1);
+                    LOG_ERROR(conn_id_str() + " 发送到游戏服务器失败 (errno=" +
+                            to_string(err) + ": " + strerror(err) + ")");
+                    close_connection();
+                    return;
+                }
+                record_game_sent();
+                if (draining && to_game.empty()) {
+                    close_connection();
+                    return;
+                }
+                update_interest();
+            }
+        } else if (watch->kind == WATCH_CLIENT) {
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                on_client_readable();
+            }
+            if (state != STATE_CLOSED && (events & EPOLLOUT)) {
+                if (!to_client.flush(client_fd)) {
+                    int err = errno;
+                    add_stat(STAT_SEND_FAILURES, 1);
+                    LOG_ERROR(conn_id_str() + " 发送到客户端失败 (errno=" +
+                            to_string(err) + ": " + strerror(err) + ")");
+                    close_connection();
+                    return;
+                }
+                record_client_sent();
+                update_interest();
+            }
+        } else if (watch->kind == WATCH_UDP) {
+            recv_udp_from_game(watch);
+        }
+    }
+
+    // io_uring后端：EventLoop已完成recv
+    void on_recv(IoWatch* watch, uint8_t* data, int n, int err) override {
+        if (state == STATE_CLOSED) return;
+        if (watch->kind == WATCH_CLIENT) {
+            on_client_data(data, n, err);
+        } else if (watch->kind == WATCH_GAME && game_fd >= 0) {
+            on_game_data(data, n, err);
+        }
+    }
+
+    // v6.7: 本轮合并的发往客户端的帧一次发出
+    // v6.13: 同时发出IP替换暂存的末尾字节(本轮没有等到下一块，且不属于未结束的分帧消息)
+    void on_flush() override {
+        if (state == STATE_CLOSED || client_fd < 0) return;
+        if (!send_held_bytes(false)) {
+            int err = errno;
+            add_stat(STAT_SEND_FAILURES, 1);
+            LOG_ERROR(conn_id_str() + " 发送暂存数据失败 (errno=" +
+                    to_string(err) + ": " + strerror(err) + ")");
+            close_connection();
+            return;
+        }
+        if (!to_client.flush(client_fd)) {
+            int err = errno;
+            add_stat(STAT_SEND_FAILURES, 1);
+            LOG_ERROR(conn_id_str() + " 发送到客户端失败 (errno=" +
+                    to_string(err) + ": " + strerror(err) + ")");
+            close_connection();
+            return;
+        }
+        record_client_sent();
+        update_interest();
+    }
+
+    // v6.10: 关闭空闲的UDP socket，之后该端口再有数据时由forward_udp_to_game重新创建
+    void on_tick(uint64_t now_ms) override {
+        idle_legs.clear();
+        if (state == STATE_CLOSED) return;
+        uint64_t idle_ms = loop->udp_idle_timeout_ms();
+        for (auto it = udp_sockets.begin(); it != udp_sockets.end();) {
+            if (now_ms - it->second->last_active_ms < idle_ms) {
+                ++it;
+                continue;
+            }
+            LOG_INFO(conn_id_str() + "|UDP:" + to_string(it->first) + " 空闲超过" +
+                   to_string(idle_ms / 1000) + "秒，关闭UDP socket");
+            loop->close_watch(&it->second->watch);
+            idle_legs.push_back(std::move(it->second));
+            it = udp_sockets.erase(it);
+        }
+    }
+
+    // 关闭连接：注销并关闭所有fd，通知TunnelServer，对象在本轮事件处理结束后释放
+    void close_connection() {
+        if (state == STATE_CLOSED) return;
+        state = STATE_CLOSED;
+
+        // 尚在合并中的数据尽量发出(与不合并时的行为一致)
+        send_held_bytes(true);
+        if (flush_scheduled && client_fd >= 0) to_client.flush(client_fd);
+        // 已登记但未发出的UDP数据报在关闭UDP socket之前发出
+        loop->udp_send_batch().flush();
+
+        LOG_DEBUG(conn_id_str() + " 关闭连接，释放所有socket");
+        close_all_fds();
+
+        if (on_closed) {
+            function<void()> callback = on_closed;
+            on_closed = nullptr;
+            callback();
+        }
+        loop->retire(this);
+    }
+
+private:
+    void close_all_fds() {
+        for (auto& pair : udp_sockets) {
+            IoWatch& w = pair.second->watch;
+            if (w.fd >= 0) {
+                LOG_DEBUG(conn_id_str() + "|UDP:" + to_string(pair.first) + " close UDP socket fd=" + to_string(w.fd));
+                loop->close_watch(&w);
+            }
+        }
+        close_game_fd();
+        if (client_fd >= 0) {
+            LOG_DEBUG(conn_id_str() + " close客户端socket fd=" + to_string(client_fd));
+            loop->close_watch(&client_watch);
+            client_fd = -1;
+        }
+    }
+
+    void close_game_fd() {
+        if (game_fd >= 0) {
+            loop->close_watch(&game_watch);
+            game_fd = -1;
+        }
+    }
+
+    bool send_to_client(iovec* iov, int iovcnt) {
+        return coalesce_send(loop, this, client_fd, to_client, iov, iovcnt);
+    }
+
+    // 根据缓冲状态重新计算各fd关注的事件(背压：对端发送缓冲过大时暂停读取)
+    void update_interest() {
+        if (state != STATE_FORWARDING) return;
+
+        uint32_t client_events = 0;
+        if (!draining && to_game.pending() < OUTBUF_HIGH_WATERMARK) client_events |= EPOLLIN;
+        // 合并中的数据由on_flush发送，不需要EPOLLOUT
+        bool client_blocked = !to_client.empty() && !flush_scheduled;
+        if (client_blocked) client_events |= EPOLLOUT;
+        loop->update(&client_watch, client_events);
+        record_client_blocked(client_blocked);
+
+        bool client_writable = to_client.pending() < OUTBUF_HIGH_WATERMARK;
+        if (game_fd >= 0) {
+            uint32_t game_events = 0;
+            if (client_writable && !draining) game_events |= EPOLLIN;
+            if (!to_game.empty()) game_events |= EPOLLOUT;
+            loop->update(&game_watch, game_events);
+        }
+
+        for (auto& pair : udp_sockets) {
+            if (pair.second->watch.fd >= 0) {
+                loop->update(&pair.second->watch, client_writable ? EPOLLIN : 0);
+            }
+        }
+    }
+
+    void connect_next_address() {
+        int flag = 1;  // TCP_NODELAY标志
+        while (game_addr_index < game_addrs.size()) {
+            sockaddr_storage& addr = game_addrs[game_addr_index];
+            socklen_t addr_len = game_addr_lens[game_addr_index];
+            game_addr_index++;
+
+            game_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+            if (game_fd < 0) {
+                continue;
+            }
+
+            LOG_DEBUG(conn_id_str() + " 游戏服务器socket已创建 fd=" +
+                     to_string(game_fd) + " (协议: " +
+                     (addr.ss_family == AF_INET ? "IPv4" : "IPv6") + ")");
+
+            // 禁用Nagle算法
+            setsockopt(game_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+            // v12.2.0: 增大socket缓冲区，配合客户端流式转发
+            int buf_size = 262144;  // 256KB
+            setsockopt(game_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+            setsockopt(game_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+
+            LOG_DEBUG(conn_id_str() + " 已设置TCP_NODELAY + 256KB缓冲区");
+
+            LOG_DEBUG(conn_id_str() + " 正在连接游戏服务器 " +
+                     game_server_ip + ":" + to_string(game_port));
+
+            game_watch.fd = game_fd;
+            if (connect(game_fd, (sockaddr*)&addr, addr_len) == 0) {
+                if (!loop->watch(&game_watch, 0)) {
+                    close_connection();
+                    return;
+                }
+                on_game_connected();
+                return;
+            }
+            if (errno == EINPROGRESS) {
+                state = STATE_CONNECTING;
+                if (!loop->watch(&game_watch, EPOLLOUT)) {
+                    close_connection();
+                }
+                return;
+            }
+
+            // 连接失败，关闭socket并尝试下一个地址
+            LOG_DEBUG(conn_id_str() + " 连接尝试失败 (errno=" +
+                     to_string(errno) + ": " + strerror(errno) + ")，尝试下一个地址");
+            close(game_fd);
+            game_fd = -1;
+        }
+
+        LOG_ERROR(conn_id_str() + " 连接游戏服务器失败: " +
+                 game_server_ip + ":" + to_string(game_port) + " (所有地址均失败)");
+        close_connection();
+    }
+
+    void on_game_connect_result() {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(game_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+            err = errno;
+        }
+        if (err != 0) {
+            LOG_DEBUG(conn_id_str() + " 连接尝试失败 (errno=" +
+                     to_string(err) + ": " + strerror(err) + ")，尝试下一个地址");
+            close_game_fd();
+            game_watch.owner = this;
+            connect_next_address();
+            return;
+        }
+        on_game_connected();
+    }
+
+    void on_game_connected() {
+        // 连接成功
+        LOG_DEBUG(conn_id_str() + " 成功连接到游戏服务器");
+
+        // v5.3: 启用TCP Keepalive，防止游戏服务器因空闲超时断开连接
+        int keepalive = 1;
+        if (setsockopt(game_fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive)) < 0) {
+            LOG_WARN(conn_id_str() + " 设置SO_KEEPALIVE失败: " +
+                   string(strerror(errno)));
+        }
+
+        // 设置keepalive参数
+        int keepidle = 60;     // 60秒无数据后开始探测
+        int keepinterval = 10; // 每10秒探测一次
+        int keepcount = 3;     // 3次探测失败后断开
+
+        setsockopt(game_fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
+        setsockopt(game_fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepinterval, sizeof(keepinterval));
+        setsockopt(game_fd, IPPROTO_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
+
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_KEEPALIVE, log_session, "", keepidle, keepinterval, keepcount);
+
+        // 客户端socket也禁用Nagle并增大缓冲区
+        int flag = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        int buf_size = 262144;  // 256KB
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
 
-                Logger::debug(conn_id_str() + " [CHECKPOINT-2] hex preview生成完毕");
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_GAME_CONNECTED, log_session, game_server_ip, game_port);
 
-                Logger::debug(conn_id_str() + " 从游戏收到 " + to_string(n) +
-                            "字节 载荷:" + hex_preview);
+        state = STATE_FORWARDING;
+        update_interest();
+        LOG_DEBUG(conn_id_str() + " 连接启动完成，双向转发已开始");
+    }
+
+    void on_client_readable() {
+        for (;;) {
+            int n = recv(client_fd, loop->buffer(), loop->buffer_size(), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+            on_client_data(loop->buffer(), n, n < 0 ? errno : 0);
+            // v6.13: 同on_game_readable，读满缓冲且有暂存字节时接着读
+            if (n < (int)loop->buffer_size() || !to_game_stream.holding() ||
+                state != STATE_FORWARDING || draining ||
+                to_game.pending() >= OUTBUF_HIGH_WATERMARK) {
+                return;
+            }
+        }
+    }
+
+    // 客户端→游戏服务器（协议解析与Python版本一致）
+    void on_client_data(uint8_t* recv_buf, int n, int err) {
+        if (n <= 0) {
+            if (n == 0) {
+                LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_CLIENT_EOF, log_session, "");
+            } else {
+                LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_CLIENT_ERROR, log_session, "", n, err);
+            }
+            // 已读取的数据必须先送达游戏服务器再关闭
+            if (game_fd >= 0 && !to_game.empty()) {
+                draining = true;
+                loop->update(&client_watch, 0);
+                update_interest();
+                return;
+            }
+            close_connection();
+            return;
+        }
+
+        LOG_DEBUG(conn_id_str() + " 从客户端收到隧道数据 " + to_string(n) + "字节");
+        uint64_t recv_ns = monotonic_ns();
+        uint64_t frames_before = stats.get(STAT_FRAMES_TO_GAME);
+        uint64_t tcp_frames = 0;
+
+        // 解析协议：msg_type(1) + conn_id(4) + ...
+        // v6.5: 帧直接在接收缓冲中解析，payload不再复制
+        decoder.feed(recv_buf, n);
+        FrameView frame;
+        while (state != STATE_CLOSED) {
+            FrameResult result = decoder.next(frame);
+            if (result == FRAME_INCOMPLETE) break;
+
+            if (frame.conn_id != (uint32_t)conn_id) {
+                LOG_WARN(conn_id_str() + " 收到错误的连接ID: " +
+                       to_string(frame.conn_id));
+                close_connection();
+                return;
+            }
+
+            if (result == FRAME_UNKNOWN) {
+                LOG_WARN(conn_id_str() + " 未知消息类型: " +
+                       to_string((int)frame.type));
+                decoder.skip(5);
+                continue;
+            }
 
-                // v5.0: TCP payload IP替换（代理IP → 客户端IP）
-                // 游戏服务器返回的数据中如果包含代理IP,需要替换回客户端真实IP
+            if (frame.type == FRAME_TCP_DATA) {  // TCP数据消息
+                // v5.0: TCP payload IP替换（客户端IP → 代理IP）
                 // 动态获取客户端真实IP（可能在UDP tunnel之后才可用）
-                string real_ip = get_client_real_ip();
-                if (!real_ip.empty() && !proxy_local_ip.empty()) {
-                    int replaced = replace_ip_in_payload(
-                        buffer,
-                        n,
-                        proxy_local_ip,
-                        real_ip,
-                        conn_id,
-                        session_uuid
-                    );
+                // v6.13: 按服务器规则替换，末尾可能被截断的IP暂存到下一帧
+                size_t ready = frame.length;
+                if (prepare_rewriters()) {
+                    IpMatch matches[IP_MATCH_LOG_MAX];
+                    size_t replaced = 0;
+                    ready = to_game_stream.process(frame.payload, frame.length,
+                                                   matches, IP_MATCH_LOG_MAX, replaced);
                     if (replaced > 0) {
-                        Logger::debug(conn_id_str() + " TCP已替换IP: " +
-                                    proxy_local_ip + " -> " + real_ip +
-                                    " (替换" + to_string(replaced) + "处)");
+                        add_stat(STAT_REWRITE_HITS, replaced);
+                        if (LOG_ENABLED(Logger::PRIORITY_INFO)) {
+                            log_ip_matches(conn_id_str() + "[IP替换] ", matches, replaced,
+                                           client_real_ip, proxy_local_ip);
+                        }
+                        LOG_DEBUG(conn_id_str() + " TCP已替换IP: " +
+                                client_real_ip + " -> " + proxy_local_ip +
+                                " (替换" + to_string(replaced) + "处)");
                     }
                 }
 
-                Logger::debug(conn_id_str() + " [CHECKPOINT-3] 准备封装协议, n=" + to_string(n) +
-                            ", client_fd=" + to_string(client_fd) + ", running=" + (running ? "true" : "false"));
-
-                // **v3.5.5: 关键修复 - 在发送前检查running状态**
-                // 如果client_to_game线程已经设置running=false,说明客户端已断开
-                // 此时client_fd可能已被析构函数关闭,不能再调用sendall()
-                if (!running) {
-                    Logger::info(conn_id_str() + " [!!!修复v3.5.5!!!] 检测到running=false,客户端已断开,跳过sendall()避免崩溃");
-                    break;
+                // v5.1: 游戏服务器已断开时停止转发
+                if (game_fd < 0) {
+                    LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_GAME_GONE, log_session, "", game_fd);
+                    close_connection();
+                    return;
                 }
 
-                // 封装协议：msg_type(1) + conn_id(4) + data_len(2) + payload
-                uint8_t response[65536 + 7];  // v12.2.0: 配合更大的缓冲区
-
-                // **v12.3.6修复: 清零response数组，防止栈上垃圾数据被发送**
-                // 问题：response是栈上未初始化数组，残留数据可能导致客户端解析错误
-                memset(response, 0, 7 + n);  // 只清零需要发送的部分，提高效率
-
-                response[0] = 0x01;
-                *(uint32_t*)(response + 1) = htonl(conn_id);
-                *(uint16_t*)(response + 5) = htons(n);
-                if (n > 0) {
-                    memcpy(response + 7, buffer, n);
+                // 转发到游戏服务器(先发出上一帧暂存的字节)
+                if ((to_game_stream.prefix_size() > 0 &&
+                     !send_or_queue(game_fd, to_game, to_game_stream.prefix(), to_game_stream.prefix_size())) ||
+                    !send_or_queue(game_fd, to_game, frame.payload, ready)) {
+                    int err = errno;
+                    add_stat(STAT_SEND_FAILURES, 1);
+                    LOG_ERROR(conn_id_str() + " 发送到游戏服务器失败 (errno=" +
+                            to_string(err) + ": " + strerror(err) + ")");
+                    if (err == EPIPE || err == ECONNRESET || err == ENOTCONN) {
+                        LOG_INFO(conn_id_str() + " 游戏socket已关闭，停止转发");
+                    }
+                    close_connection();
+                    return;
                 }
+                add_stat(STAT_FRAMES_TO_GAME, 1);
+                add_stat(STAT_BYTES_TO_GAME, frame.length);
+                tcp_frames++;
 
-                // **v12.3.6: 添加诊断日志，检测异常的n值**
-                // 注意：n=0的情况已经在前面的 if (n <= 0) 中处理了，这里不会到达
-                if (n > 60000 && n <= 65535) {
-                    Logger::debug(conn_id_str() + " 大数据包: " + to_string(n) + "字节");
+                // 打印载荷预览（前16字节）
+                LOG_DEBUG(conn_id_str() + " 客户端→游戏: " + to_string(frame.length) +
+                          "字节 载荷:" + hex_dump(frame.payload, min((size_t)16, frame.length)));
+            }
+            else if (frame.type == FRAME_HEARTBEAT) {  // v12.3.9: 心跳消息
+                LOG_DEBUG(conn_id_str() + " 💓 收到心跳包");
+                add_stat(STAT_HEARTBEATS, 1);
+                sample_game_rtt();
+
+                // 回复心跳包(保持连接双向活跃)
+                // v6.21: v2心跳回显序号和客户端时间戳并附带服务器接收时间，旧版0长度心跳照旧回复7字节
+                uint8_t heartbeat_reply[HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REPLY_LEN];
+                size_t reply_len;
+                HeartbeatV2 hb;
+                if (decode_heartbeat_v2_request(frame.payload, frame.length, hb)) {
+                    rtt.heartbeat_v2.store(true, memory_order_relaxed);
+                    if (hb.last_rtt_us > 0) {
+                        rtt.add_client_sample(hb.last_rtt_us);
+                        record_sample(LAT_CLIENT_RTT, (uint64_t)hb.last_rtt_us * 1000);
+                    }
+                    reply_len = encode_heartbeat_v2_reply(heartbeat_reply, conn_id, hb.seq,
+                                                          hb.client_send_us, realtime_us());
+                } else {
+                    reply_len = encode_heartbeat(heartbeat_reply, conn_id);
+                }
+                iovec iov;
+                iov.iov_base = heartbeat_reply;
+                iov.iov_len = reply_len;
+                if (!send_to_client(&iov, 1)) {
+                    add_stat(STAT_SEND_FAILURES, 1);
+                    close_connection();
+                    return;
                 }
+            }
+            else {  // UDP消息
+                forward_udp_to_game(frame.src_port, frame.dst_port, frame.payload, frame.length);
+                // v6.9: 拼接缓冲中的payload在下一帧解析后失效，必须立即发出
+                if (decoder.frame_in_stash()) add_stat(STAT_SEND_FAILURES, loop->udp_send_batch().flush());
+            }
+        }
 
-                Logger::debug(conn_id_str() + " [CHECKPOINT-4] 协议封装完成,准备调用sendall(), 总大小=" +
-                            to_string(7 + n));
+        // v6.9: 本次recv解析出的UDP数据报批量发出
+        add_stat(STAT_SEND_FAILURES, loop->udp_send_batch().flush());
+        record_latency(LAT_TO_GAME, recv_ns, stats.get(STAT_FRAMES_TO_GAME) - frames_before - tcp_frames);
+        record_to_game(recv_ns, tcp_frames);
+        if (to_game_stream.holding() && state != STATE_CLOSED) loop->defer_flush(this);
+        update_interest();
+    }
 
-                // sendall - 确保完全发送
-                if (!sendall(client_fd, response, 7 + n)) {
-                    int err = errno;
-                    Logger::error(conn_id_str() + " 发送到客户端失败 (errno=" +
-                                to_string(err) + ": " + strerror(err) + ")");
-                    running = false;
-                    break;
-                }
+    void on_game_readable() {
+        // v6.2: 超过65535字节的数据由send_data_frames拆分为多帧，recv不再受data_len限制
+        for (;;) {
+            int n = recv(game_fd, loop->buffer(), loop->buffer_size(), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+            on_game_data(loop->buffer(), n, n < 0 ? errno : 0);
+            // v6.13: 读满缓冲且末尾有暂存字节时接着读，让IP的后半部分在本轮flush之前到达
+            if (n < (int)loop->buffer_size() || !to_client_stream.holding() ||
+                state != STATE_FORWARDING || game_fd < 0 ||
+                to_client.pending() >= OUTBUF_HIGH_WATERMARK) {
+                return;
+            }
+        }
+    }
 
-                Logger::debug(conn_id_str() + " [CHECKPOINT-5] sendall()成功返回");
+    // 游戏服务器→客户端
+    void on_game_data(uint8_t* data, int n, int err) {
+        // ===== 关键诊断点：游戏服务器断开 =====
+        if (n <= 0) {
+            auto now = chrono::system_clock::now();
+            auto time_since_last = chrono::duration_cast<chrono::milliseconds>(now - last_recv_time).count();
 
-                Logger::debug(conn_id_str() + " 游戏→客户端: 已转发 " +
-                            to_string(n) + "字节");
+            if (n == 0) {
+                LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_GAME_FIN, log_session, "");
+                LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_LAST_RECV, log_session, "", last_recv_size, time_since_last);
+                LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_HALF_CLOSE, log_session, "");
+            } else {
+                LOG_EVENT(Logger::PRIORITY_ERROR, EVT_CONN_GAME_ERROR, log_session, "");
+                LOG_EVENT(Logger::PRIORITY_ERROR, EVT_CONN_GAME_RECV_ERROR, log_session, "", n, err);
+                LOG_EVENT(Logger::PRIORITY_ERROR, EVT_CONN_LAST_RECV, log_session, "", last_recv_size, time_since_last);
             }
 
-            Logger::debug(conn_id_str() + " 游戏→客户端转发线程正常退出");
+            // v5.1: 游戏服务器关闭后，完全关闭game_fd防止继续发送数据
+            // 客户端下次发送TCP数据时检测到game_fd<0并关闭整个连接
+            int closed_fd = game_fd;
+            close_game_fd();
+            to_game.data.clear();
+            to_game.offset = 0;
+            LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_GAME_CLOSED, log_session, "", closed_fd);
+            if (draining) {
+                close_connection();
+            }
+            return;
+        }
 
-        } catch (exception& e) {
-            if (running) {
-                Logger::error(conn_id_str() + " 游戏→客户端转发异常: " +
-                            string(e.what()));
+        // 记录接收时间和大小
+        last_recv_time = chrono::system_clock::now();
+        last_recv_size = n;
+        uint64_t recv_ns = monotonic_ns();
+        uint64_t frames_before = stats.get(STAT_FRAMES_TO_CLIENT);
+
+        // 打印载荷预览（前16字节）
+        LOG_DEBUG(conn_id_str() + " 从游戏收到 " + to_string(n) +
+                  "字节 载荷:" + hex_dump(data, (size_t)min(16, n)));
+
+        // v5.0: TCP payload IP替换（代理IP → 客户端IP）
+        // 游戏服务器返回的数据中如果包含代理IP,需要替换回客户端真实IP
+        // 动态获取客户端真实IP（可能在UDP tunnel之后才可用）
+        // v6.13: 按服务器规则替换，末尾可能被截断的IP暂存到下一次recv
+        size_t ready = n;
+        if (prepare_rewriters()) {
+            IpMatch matches[IP_MATCH_LOG_MAX];
+            size_t replaced = 0;
+            ready = to_client_stream.process(data, n, matches, IP_MATCH_LOG_MAX, replaced);
+            if (replaced > 0) {
+                add_stat(STAT_REWRITE_HITS, replaced);
+                if (LOG_ENABLED(Logger::PRIORITY_INFO)) {
+                    log_ip_matches(conn_id_str() + "[IP替换] ", matches, replaced,
+                                   proxy_local_ip, client_real_ip);
+                }
+                LOG_DEBUG(conn_id_str() + " TCP已替换IP: " +
+                        proxy_local_ip + " -> " + client_real_ip +
+                        " (替换" + to_string(replaced) + "处)");
             }
-            running = false;
         }
+
+        if ((to_client_stream.prefix_size() > 0 &&
+             !send_data_frames((uint8_t*)to_client_stream.prefix(), to_client_stream.prefix_size())) ||
+            !send_data_frames(data, ready)) {
+            int err = errno;
+            add_stat(STAT_SEND_FAILURES, 1);
+            LOG_ERROR(conn_id_str() + " 发送到客户端失败 (errno=" +
+                    to_string(err) + ": " + strerror(err) + ")");
+            close_connection();
+            return;
+        }
+
+        record_to_client(recv_ns, stats.get(STAT_FRAMES_TO_CLIENT) - frames_before);
+        if (to_client_stream.holding()) loop->defer_flush(this);
+
+        LOG_DEBUG(conn_id_str() + " 游戏→客户端: 已转发 " +
+                to_string(n) + "字节");
+        update_interest();
+    }
+
+    // 封装0x01帧发送到客户端：msg_type(1) + conn_id(4) + data_len(2) + payload
+    // payload超过65535字节时拆分为多帧；帧头与payload以iovec发送，payload不复制
+    bool send_data_frames(uint8_t* data, size_t n) {
+        while (n > 0) {
+            size_t chunk = min(n, MAX_FRAME_PAYLOAD);
+            uint8_t header[TCP_FRAME_HEADER];
+            encode_tcp_header(header, conn_id, (uint16_t)chunk);
+
+            iovec iov[2];
+            iov[0].iov_base = header;
+            iov[0].iov_len = sizeof(header);
+            iov[1].iov_base = data;
+            iov[1].iov_len = chunk;
+            if (!send_to_client(iov, 2)) return false;
+            add_stat(STAT_FRAMES_TO_CLIENT, 1);
+            add_stat(STAT_BYTES_TO_CLIENT, chunk);
+
+            data += chunk;
+            n -= chunk;
+        }
+        return true;
     }
 
     // UDP转发到游戏服务器
-    void forward_udp_to_game(uint16_t src_port, uint16_t dst_port, const vector<uint8_t>& data) {
-        try {
-            lock_guard<mutex> lock(udp_mutex);
-
-            // 获取或创建UDP socket
-            if (udp_sockets.find(dst_port) == udp_sockets.end()) {
-                // 使用getaddrinfo解析游戏服务器地址
-                struct addrinfo hints{}, *result = nullptr;
-                hints.ai_family = AF_UNSPEC;
-                hints.ai_socktype = SOCK_DGRAM;
-                hints.ai_protocol = IPPROTO_UDP;
-
-                string port_str = to_string(dst_port);
-                int ret = getaddrinfo(game_server_ip.c_str(), port_str.c_str(), &hints, &result);
-                if (ret != 0 || result == nullptr) {
-                    Logger::error(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                                " DNS解析失败: " + game_server_ip);
-                    return;
+    void forward_udp_to_game(uint16_t src_port, uint16_t dst_port, const uint8_t* data, size_t len) {
+        // v6.8: 地址从DNS缓存读取，不再每个包调用getaddrinfo
+        sockaddr_storage game_addr{};
+        socklen_t game_addr_len = 0;
+        if (!DnsCache::lookup_first(game_server_ip, SOCK_DGRAM, dst_port, game_addr, game_addr_len)) {
+            LOG_ERROR(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                    " DNS解析失败: " + game_server_ip);
+            return;
+        }
+
+        // 获取或创建UDP socket
+        if (udp_sockets.find(dst_port) == udp_sockets.end()) {
+            int udp_fd = socket(game_addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                IPPROTO_UDP);
+            if (udp_fd < 0) {
+                LOG_ERROR(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                        " 创建UDP socket失败");
+                return;
+            }
+
+            unique_ptr<UdpLeg> leg(new UdpLeg());
+            leg->watch.owner = this;
+            leg->watch.fd = udp_fd;
+            leg->watch.kind = WATCH_UDP;
+            leg->watch.port = dst_port;
+            leg->client_port = src_port;
+            if (!loop->watch(&leg->watch, EPOLLIN)) {
+                close(udp_fd);
+                return;
+            }
+            udp_sockets[dst_port] = std::move(leg);
+            if (loop->udp_idle_timeout_ms() > 0) loop->add_ticker(this);
+
+            LOG_INFO(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                   " 创建UDP socket");
+        }
+
+        // v6.9: 登记到本线程的发送批次，由on_client_data结束时一次sendmmsg发出
+        UdpLeg* leg = udp_sockets[dst_port].get();
+        leg->last_active_ms = loop->now_ms();
+        add_stat(STAT_SEND_FAILURES, loop->udp_send_batch().add(leg->watch.fd, data, len, game_addr, game_addr_len));
+        add_stat(STAT_FRAMES_TO_GAME, 1);
+        add_stat(STAT_BYTES_TO_GAME, len);
+
+        LOG_DEBUG(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                " 客户端→游戏: " + to_string(len) + "字节");
+    }
+
+    // UDP从游戏服务器接收
+    // v6.9: recvmmsg一次取出多个数据报，全部封装为0x03帧后一次写入客户端
+    void recv_udp_from_game(IoWatch* watch) {
+        int dst_port = watch->port;
+        auto it = udp_sockets.find(dst_port);
+        if (it == udp_sockets.end()) return;
+        int client_port = it->second->client_port;
+        it->second->last_active_ms = loop->now_ms();
+
+        UdpRecvBatch& batch = loop->udp_recv_batch();
+        int count = batch.recv(watch->fd);
+        if (count <= 0) {
+            if (count == 0) return;
+            LOG_ERROR(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                    " 接收失败: " + strerror(errno));
+            loop->update(watch, 0);
+            return;
+        }
+        uint64_t recv_ns = monotonic_ns();
+
+        // 封装协议：msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
+        uint8_t headers[UDP_BATCH_MAX][UDP_FRAME_HEADER];
+        iovec iov[2 * UDP_BATCH_MAX];
+        size_t total = 0;
+        for (int i = 0; i < count; i++) {
+            size_t n = batch.length(i);
+            // src_port=游戏服务器端口，dst_port=游戏客户端端口
+            encode_udp_header(headers[i], conn_id, dst_port, client_port, (uint16_t)n);
+            iov[2 * i].iov_base = headers[i];
+            iov[2 * i].iov_len = UDP_FRAME_HEADER;
+            iov[2 * i + 1].iov_base = batch.payload(i);
+            iov[2 * i + 1].iov_len = n;
+            total += n;
+        }
+        if (!send_to_client(iov, 2 * count)) {
+            add_stat(STAT_SEND_FAILURES, 1);
+            LOG_ERROR(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                    " 发送失败");
+            close_connection();
+            return;
+        }
+        add_stat(STAT_FRAMES_TO_CLIENT, count);
+        add_stat(STAT_BYTES_TO_CLIENT, total);
+        record_to_client(recv_ns, count);
+
+        LOG_DEBUG(conn_id_str() + "|UDP:" + to_string(dst_port) +
+                " 游戏→客户端: " + to_string(count) + "个数据报 " + to_string(total) + "字节");
+        update_interest();
+    }
+};
+
+// ==================== UDP Tunnel ====================
+// 客户端以conn_id=0xFFFFFFFF握手建立的UDP隧道
+// v4.7.0: 按客户端源端口创建UDP socket，通过recvfrom的来源端口区分游戏服务器端口
+// v6.0: 由事件循环驱动，所有UDP socket与客户端socket注册在同一EventLoop上，不再为每个源端口创建接收线程
+class UdpTunnel : public EventHandler, public enable_shared_from_this<UdpTunnel> {
+private:
+    enum WatchKind { WATCH_CLIENT = 1, WATCH_UDP = 2 };
+
+    EventLoop* loop;
+    int client_fd;
+    string client_str;
+    string real_client_ip;      // 客户端公网IP(TCP源IP)
+    string client_ipv4;         // 客户端私网IP(payload中)
+    string client_private_ip;   // 写回客户端的IP: client_ipv4，为空时用real_client_ip
+    bool client_ip_valid;       // v6.11: client_private_ip为IPv4时有效
+    uint8_t client_ip_dnf[4];   // v6.11: client_private_ip的DNF字节序(d,c,b,a)
+    string game_server_ip;
+    string proxy_local_ip;
+    IpRewriter to_game_rewriter;  // v6.12: client_private_ip → proxy_local_ip，start()时构造
+    shared_ptr<const RewritePolicy> rewrite_policy;  // v6.13: 每个数据报按一条游戏消息执行规则
+    string session_uuid;
+    string uuid_prefix;
+    LogSession log_session;     // v6.16: conn_id固定为0xFFFFFFFF
+    bool closed;
+
+    IoWatch client_watch;
+    // v5.1: 按 "client_str:src_port" 管理socket
+    struct UdpSocket {
+        IoWatch watch;
+        uint64_t last_active_ms;   // v6.10: 最近收发时间(EventLoop::now_ms)
+    };
+    map<string, unique_ptr<UdpSocket>> udp_sockets;
+    // v6.10: 空闲回收的socket，本轮事件中可能仍有指向其watch的事件，下次tick时释放
+    vector<unique_ptr<UdpSocket>> idle_sockets;
+    // v4.7.0: 每个数据流(src_port, dst_port)的元数据
+    // v6.11: 改为打包整数key的开放寻址表(原 map<"client_str:src_port:dst_port", FlowMetadata>)
+    UdpFlowTable flows;
+
+    FrameDecoder decoder;       // 客户端→游戏 协议解析
+    OutBuffer to_client;
+    ForwardStats stats;         // v6.18: 本隧道的转发计数
+    StatsShard* shard;          // v6.19: 所属TunnelServer在本worker的分片
+    unique_ptr<SessionLatency> session_latency;  // v6.20: latency_per_session时分配
+
+    function<void()> on_closed;
+
+public:
+    UdpTunnel(EventLoop* ev_loop, int cfd, const string& cstr,
+              const string& client_ipv4_from_payload, const string& game_ip,
+              const string& sess_uuid)
+        : loop(ev_loop), client_fd(cfd), client_str(cstr), client_ipv4(client_ipv4_from_payload),
+          game_server_ip(game_ip), session_uuid(sess_uuid),
+          log_session(Logger::session(UDP_TUNNEL_CONN_ID, sess_uuid)), closed(false),
+          decoder(frame_type_bit(FRAME_UDP_DATA)), shard(nullptr) {
+        client_watch.owner = this;
+        client_watch.fd = client_fd;
+        client_watch.kind = WATCH_CLIENT;
+
+        // 提取客户端真实IP地址(TCP连接源IP,客户端公网IP)
+        // 处理IPv6格式: [xxxx]:port 或 IPv4格式: x.x.x.x:port
+        if (client_str.front() == '[') {
+            size_t bracket_end = client_str.find(']');
+            if (bracket_end != string::npos) {
+                real_client_ip = client_str.substr(1, bracket_end - 1);
+                // 检查是否是IPv6映射的IPv4地址 (::ffff:x.x.x.x)
+                if (real_client_ip.find("::ffff:") == 0) {
+                    real_client_ip = real_client_ip.substr(7);  // 去掉"::ffff:"前缀
                 }
+            } else {
+                real_client_ip = client_str;
+            }
+        } else {
+            size_t colon_pos = client_str.find(":");
+            if (colon_pos != string::npos) {
+                real_client_ip = client_str.substr(0, colon_pos);
+            } else {
+                real_client_ip = client_str;
+            }
+        }
+
+        uuid_prefix = session_uuid.empty() ? "[UDP Tunnel]" : "[UDP Tunnel|" + session_uuid + "]";
+
+        // v6.11: 握手响应要写回的客户端IP只解析一次
+        client_private_ip = client_ipv4.empty() ? real_client_ip : client_ipv4;
+        in_addr addr{};
+        client_ip_valid = inet_pton(AF_INET, client_private_ip.c_str(), &addr) == 1;
+        const uint8_t* ip = (const uint8_t*)&addr.s_addr;
+        for (int i = 0; i < 4; i++) client_ip_dnf[i] = ip[3 - i];
+    }
+
+    ~UdpTunnel() {
+        close_all_fds();
+        Logger::end_session(log_session);
+    }
+
+    void set_on_closed(function<void()> callback) {
+        on_closed = callback;
+    }
+
+    void set_rewrite_policy(shared_ptr<const RewritePolicy> policy) {
+        rewrite_policy = policy;
+    }
+
+    // v6.19: 在start()之前由TunnelServer设置
+    // v6.20: per_session_latency时本会话另外记录一份延迟直方图
+    void set_stats_shard(StatsShard* s, bool per_session_latency) {
+        shard = s;
+        if (per_session_latency) session_latency.reset(new SessionLatency());
+    }
+
+    // v6.18: GET_STATS中的会话条目，只读取构造后不再变化的字段，可在其他线程调用
+    void session_json(string& out) const {
+        uint64_t values[STAT_COUNT] = {};
+        stats.sum_into(values);
+        out += "{\"type\":\"udp\",\"client\":\"" + json_escape(client_str) + "\",\"session\":\"" +
+               json_escape(session_uuid) + "\",\"client_ipv4\":\"" + json_escape(client_ipv4) + "\"";
+        append_stats_json(out, values);
+        append_session_latency_json(out, session_latency.get());
+        out += '}';
+    }
+
+    void start() {
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_UDP_START, log_session, "");
+        LOG_INFO(uuid_prefix + " 客户端字符串: " + client_str);
+        LOG_INFO(uuid_prefix + " 客户端公网IP(TCP源): " + real_client_ip);
+        LOG_INFO(uuid_prefix + " 客户端私网IP(payload): " + client_ipv4);
+
+        // ===== v4.5.0关键: 获取代理服务器本地IP =====
+        proxy_local_ip = get_local_ip(game_server_ip);
+        if (proxy_local_ip.empty()) {
+            LOG_ERROR(uuid_prefix + " 无法获取代理服务器本地IP,使用默认值");
+            proxy_local_ip = "192.168.2.75";  // 回退默认值
+        }
+        LOG_INFO(uuid_prefix + " 代理服务器本地IP: " + proxy_local_ip);
+        if (!to_game_rewriter.init(client_private_ip, proxy_local_ip)) {
+            LOG_ERROR(uuid_prefix + "[IP替换] IP地址格式错误: " + client_private_ip + " -> " + proxy_local_ip);
+        }
+        LOG_INFO(uuid_prefix + " v5.0策略: 客户端→服务器(客户端IP→代理IP), 服务器→客户端(代理IP→客户端IP)");
 
-                int udp_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-                freeaddrinfo(result);
+        if (!loop->watch(&client_watch, EPOLLIN)) {
+            close_tunnel();
+            return;
+        }
+        LOG_INFO(uuid_prefix + " 进入UDP转发循环 (client_fd=" + to_string(client_fd) + ")");
+    }
 
-                if (udp_fd < 0) {
-                    Logger::error(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                                " 创建UDP socket失败");
+    void on_io(IoWatch* watch, uint32_t events) override {
+        if (closed) return;
+
+        if (watch->kind == WATCH_CLIENT) {
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                on_client_readable();
+            }
+            if (!closed && (events & EPOLLOUT)) {
+                if (!to_client.flush(client_fd)) {
+                    int err = errno;
+                    add_stat(STAT_SEND_FAILURES, 1);
+                    LOG_ERROR(uuid_prefix + " send()失败: errno=" + to_string(err) +
+                            " (" + strerror(err) + ")");
+                    close_tunnel();
                     return;
                 }
-                udp_sockets[dst_port] = udp_fd;
+                record_client_sent();
+                update_interest();
+            }
+        } else if (watch->kind == WATCH_UDP) {
+            on_udp_readable(watch);
+        }
+    }
 
-                Logger::info(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                           " 创建UDP socket");
+    // v6.7: 本轮合并的发往客户端的帧一次发出
+    void on_flush() override {
+        if (closed || client_fd < 0) return;
+        if (!to_client.flush(client_fd)) {
+            int err = errno;
+            add_stat(STAT_SEND_FAILURES, 1);
+            LOG_ERROR(uuid_prefix + " send()失败: errno=" + to_string(err) +
+                    " (" + strerror(err) + ")");
+            close_tunnel();
+            return;
+        }
+        record_client_sent();
+        update_interest();
+    }
 
-                // 启动UDP接收线程 - **关键修复**: 必须捕获shared_from_this()防止Use-After-Free
-                // UDP线程也需要持有shared_ptr引用,否则对象可能在线程运行时被销毁
-                auto self = shared_from_this();
-                auto t = make_shared<thread>([self, dst_port, src_port]() {
-                    self->recv_udp_from_game(dst_port, src_port);
-                });
-                udp_threads[dst_port] = t;
+    // v6.10: 关闭空闲的源端口socket及其流元数据，之后该端口再有数据时由forward_to_game重新创建
+    // v6.11: 空闲的流单独过期
+    void on_tick(uint64_t now_ms) override {
+        idle_sockets.clear();
+        if (closed) return;
+        uint64_t idle_ms = loop->udp_idle_timeout_ms();
+        size_t expired = flows.remove_if([now_ms, idle_ms](const UdpFlow& flow) {
+            return now_ms - flow.last_active_ms >= idle_ms;
+        });
+        if (expired > 0) {
+            LOG_DEBUG(uuid_prefix + " 过期UDP流" + to_string(expired) + "个，剩余" + to_string(flows.size()));
+        }
+        for (auto it = udp_sockets.begin(); it != udp_sockets.end();) {
+            if (now_ms - it->second->last_active_ms < idle_ms) {
+                ++it;
+                continue;
             }
+            LOG_INFO("[UDP Tunnel|" + it->first + "] 空闲超过" + to_string(idle_ms / 1000) +
+                   "秒，关闭UDP socket");
+            uint16_t src_port = it->second->watch.port;
+            flows.remove_if([src_port](const UdpFlow& flow) { return flow.client_port == src_port; });
+            loop->close_watch(&it->second->watch);
+            idle_sockets.push_back(std::move(it->second));
+            it = udp_sockets.erase(it);
+        }
+    }
 
-            // 发送到游戏服务器 - 使用getaddrinfo解析地址
-            int udp_fd = udp_sockets[dst_port];
+    void close_tunnel() {
+        if (closed) return;
+        closed = true;
 
-            struct addrinfo hints{}, *result = nullptr;
-            hints.ai_family = AF_UNSPEC;
-            hints.ai_socktype = SOCK_DGRAM;
-            hints.ai_protocol = IPPROTO_UDP;
+        // 尚在合并中的数据尽量发出(与不合并时的行为一致)
+        if (flush_scheduled && client_fd >= 0) to_client.flush(client_fd);
+        // 已登记但未发出的UDP数据报在关闭UDP socket之前发出
+        loop->udp_send_batch().flush();
 
-            string port_str = to_string(dst_port);
-            int ret = getaddrinfo(game_server_ip.c_str(), port_str.c_str(), &hints, &result);
-            if (ret != 0 || result == nullptr) {
-                Logger::error(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                            " DNS解析失败");
-                return;
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_UDP_CLOSING, log_session, "");
+        close_all_fds();
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_UDP_CLOSED, log_session, "");
+
+        if (on_closed) {
+            function<void()> callback = on_closed;
+            on_closed = nullptr;
+            callback();
+        }
+        loop->retire(this);
+    }
+
+private:
+    // v6.19: 会话计数与服务器分片同时累加
+    void add_stat(StatCounter c, uint64_t n) {
+        stats.add(c, n);
+        shard->stats.add(c, n);
+    }
+
+    // v6.19: 本次recv的帧已发出，记录recv返回到现在的时间
+    void record_latency(LatencyMetric metric, uint64_t recv_ns, uint64_t frames) {
+        if (frames == 0) return;
+        uint64_t ns = monotonic_ns() - recv_ns;
+        shard->latency[metric].record(ns, frames);
+        if (session_latency) session_latency->latency[metric].record(ns, frames);
+    }
+
+    // v6.20: 发往客户端的帧写入socket后才记录to_client: 仍在发送缓冲中(写合并或socket缓冲满)的帧
+    //        随缓冲记下recv时间，由on_flush/EPOLLOUT写出后record_client_sent()记录
+    void record_to_client(uint64_t recv_ns, uint64_t frames) {
+        if (frames == 0) return;
+        to_client.mark(recv_ns, frames);
+        record_client_sent();
+    }
+
+    void record_client_sent() {
+        to_client.take_sent([this](uint64_t recv_ns, uint64_t frames) {
+            record_latency(LAT_TO_CLIENT, recv_ns, frames);
+        });
+    }
+
+    void close_all_fds() {
+        for (auto& pair : udp_sockets) {
+            IoWatch* w = &pair.second->watch;
+            if (w->fd >= 0) {
+                LOG_DEBUG("[UDP Tunnel|" + pair.first + "] 关闭UDP socket");
+                loop->close_watch(w);
+            }
+        }
+        if (client_fd >= 0) {
+            loop->close_watch(&client_watch);
+            client_fd = -1;
+        }
+    }
+
+    void update_interest() {
+        uint32_t client_events = EPOLLIN;
+        if (!to_client.empty() && !flush_scheduled) client_events |= EPOLLOUT;
+        loop->update(&client_watch, client_events);
+
+        // 发往客户端的数据积压时暂停接收游戏服务器UDP(由内核丢弃多余数据报)
+        uint32_t udp_events = to_client.pending() < OUTBUF_HIGH_WATERMARK ? EPOLLIN : 0;
+        for (auto& pair : udp_sockets) {
+            if (pair.second->watch.fd >= 0) loop->update(&pair.second->watch, udp_events);
+        }
+    }
+
+    // 主循环：接收客户端的UDP数据
+    void on_client_readable() {
+        int n = recv(client_fd, loop->buffer(), loop->buffer_size(), 0);
+
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+            int err = errno;
+            if (n == 0) {
+                LOG_EVENT(Logger::PRIORITY_INFO, EVT_UDP_CLIENT_EOF, log_session, "");
+            } else {
+                LOG_EVENT(Logger::PRIORITY_ERROR, EVT_UDP_CLIENT_ERROR, log_session, "", n, err);
             }
+            close_tunnel();
+            return;
+        }
 
-            sendto(udp_fd, data.data(), data.size(), 0, result->ai_addr, result->ai_addrlen);
-            freeaddrinfo(result);
+        LOG_DEBUG(uuid_prefix + " ←[客户端] 收到 " + to_string(n) + "字节");
+        uint64_t recv_ns = monotonic_ns();
+        uint64_t frames_before = stats.get(STAT_FRAMES_TO_GAME);
+
+        // 解析协议：msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
+        // v6.5: 帧直接在接收缓冲中解析，payload不再复制
+        decoder.feed(loop->buffer(), n);
+        FrameView frame;
+        while (!closed) {
+            FrameResult result = decoder.next(frame);
+            if (result == FRAME_INCOMPLETE) break;
+
+            if (result == FRAME_UNKNOWN) {
+                LOG_WARN("[UDP Tunnel] 未知消息类型: " + to_string((int)frame.type));
+                decoder.skip(1);
+                continue;
+            }
 
-            Logger::debug(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                        " 客户端→游戏: " + to_string(data.size()) + "字节");
+            LOG_DEBUG("[UDP Tunnel] 解析: conn_id=" + to_string(frame.conn_id) +
+                    ", src=" + to_string(frame.src_port) + ", dst=" + to_string(frame.dst_port) +
+                    ", len=" + to_string(frame.length));
 
-        } catch (exception& e) {
-            Logger::error(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                        " 转发失败: " + string(e.what()));
+            forward_to_game(frame.conn_id, frame.src_port, frame.dst_port,
+                            frame.payload, frame.length);
+            // v6.9: 拼接缓冲中的payload在下一帧解析后失效，必须立即发出
+            if (decoder.frame_in_stash()) add_stat(STAT_SEND_FAILURES, loop->udp_send_batch().flush());
         }
+
+        // v6.9: 本次recv解析出的数据报批量发出
+        add_stat(STAT_SEND_FAILURES, loop->udp_send_batch().flush());
+        record_latency(LAT_TO_GAME, recv_ns, stats.get(STAT_FRAMES_TO_GAME) - frames_before);
+        update_interest();
     }
 
-    // UDP从游戏服务器接收
-    void recv_udp_from_game(int dst_port, int client_port) {
-        try {
-            int udp_fd;
-            {
-                lock_guard<mutex> lock(udp_mutex);
-                if (udp_sockets.find(dst_port) == udp_sockets.end())
+    void forward_to_game(uint32_t msg_conn_id, uint16_t src_port, uint16_t dst_port,
+                         uint8_t* payload, size_t payload_len) {
+        // v4.7.0: 按源端口获取或创建UDP socket
+        // v5.1修复: 使用client_str:src_port作为key支持多用户
+        string socket_key = client_str + ":" + to_string(src_port);
+
+        auto sock_it = udp_sockets.find(socket_key);
+        if (sock_it == udp_sockets.end()) {
+            // 首次遇到此源端口，创建socket并bind
+            int udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+            if (udp_fd < 0) {
+                LOG_ERROR("[UDP Tunnel|src=" + to_string(src_port) +
+                        "] 创建UDP socket失败");
+                return;
+            }
+
+            // v4.9.0: 普通bind到源端口（不做源IP欺骗）
+            // v5.1修复: bind失败时允许系统自动分配（支持多用户共享端口）
+            // v5.2修复: bind到proxy_local_ip而不是INADDR_ANY，解决多网卡环境下UDP路由问题
+            struct sockaddr_in local_addr{};
+            local_addr.sin_family = AF_INET;
+            if (inet_pton(AF_INET, proxy_local_ip.c_str(), &local_addr.sin_addr) != 1) {
+                LOG_WARN("[UDP Tunnel|" + socket_key +
+                       "] proxy_local_ip无效(" + proxy_local_ip +
+                       ")，回退到INADDR_ANY");
+                local_addr.sin_addr.s_addr = INADDR_ANY;
+            }
+            local_addr.sin_port = htons(src_port);
+
+            bool bind_success = true;
+            if (bind(udp_fd, (struct sockaddr*)&local_addr, sizeof(local_addr)) < 0) {
+                int bind_err = errno;
+                if (bind_err == EADDRINUSE) {
+                    // v5.1: 端口被占用（多用户场景），允许系统自动分配
+                    LOG_INFO("[UDP Tunnel|" + socket_key +
+                            "] 端口" + to_string(src_port) + "已被占用，使用系统自动分配");
+                    bind_success = false;  // 不bind，系统会自动分配端口
+                } else {
+                    LOG_ERROR("[UDP Tunnel|" + socket_key +
+                            "] bind失败: " + strerror(bind_err));
+                    close(udp_fd);
                     return;
-                udp_fd = udp_sockets[dst_port];
-            }
-
-            uint8_t buffer[65535];
-            sockaddr_in from_addr{};
-            socklen_t from_len = sizeof(from_addr);
-
-            while (running) {
-                int n = recvfrom(udp_fd, buffer, sizeof(buffer), 0,
-                               (sockaddr*)&from_addr, &from_len);
-                if (n <= 0) break;
-
-                // 封装协议：msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
-                uint8_t response[65535 + 11];
-                response[0] = 0x03;
-                *(uint32_t*)(response + 1) = htonl(conn_id);
-                *(uint16_t*)(response + 5) = htons(dst_port);      // src_port（游戏服务器）
-                *(uint16_t*)(response + 7) = htons(client_port);   // dst_port（游戏客户端）
-                *(uint16_t*)(response + 9) = htons(n);            // data_len
-                memcpy(response + 11, buffer, n);
-
-                // sendall
-                if (!sendall(client_fd, response, 11 + n)) {
-                    Logger::error(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                                " 发送失败");
-                    break;
                 }
+            }
 
-                Logger::debug(conn_id_str() + "|UDP:" + to_string(dst_port) +
-                            " 游戏→客户端: " + to_string(n) + "字节");
+            unique_ptr<UdpSocket> sock(new UdpSocket());
+            sock->watch.owner = this;
+            sock->watch.fd = udp_fd;
+            sock->watch.kind = WATCH_UDP;
+            sock->watch.port = src_port;
+            if (!loop->watch(&sock->watch, EPOLLIN)) {
+                close(udp_fd);
+                return;
+            }
+            sock_it = udp_sockets.insert(make_pair(socket_key, std::move(sock))).first;
+            if (loop->udp_idle_timeout_ms() > 0) loop->add_ticker(this);
+
+            if (bind_success) {
+                LOG_INFO("[UDP Tunnel|" + socket_key +
+                       "] ✓ 创建UDP socket并bind到 " + proxy_local_ip +
+                       ":" + to_string(src_port));
+            } else {
+                LOG_INFO("[UDP Tunnel|" + socket_key +
+                       "] ✓ 创建UDP socket（系统自动分配端口）");
+            }
+        } else {
+            LOG_DEBUG("[UDP Tunnel|" + socket_key + "] UDP socket已存在，复用");
+        }
+
+        // 保存或更新流元数据，握手响应的还原字节(IP + 小端序端口)在这里编码好
+        UdpFlow* flow = flows.upsert(src_port, dst_port);
+        flow->conn_id = msg_conn_id;
+        flow->client_port = src_port;
+        flow->last_active_ms = loop->now_ms();
+        flow->rewrite_valid = client_ip_valid;
+        memcpy(flow->rewrite, client_ip_dnf, 4);
+        flow->rewrite[4] = (uint8_t)(src_port & 0xFF);
+        flow->rewrite[5] = (uint8_t)(src_port >> 8);
+
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
+                "] 流元数据已保存 (conn_id=" + to_string(msg_conn_id) +
+                ", private_ip=" + client_private_ip + ")");
+
+        // ===== v5.0关键修改: 发送前替换payload中的客户端IP为代理IP =====
+        // 让游戏服务器认为所有流量来自代理服务器
+        const string& private_ip = client_private_ip;
+
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
+                 "] 准备替换payload: " + private_ip + " -> " + proxy_local_ip);
+
+        IpMatch matches[IP_MATCH_LOG_MAX];
+        size_t replaced_send = rewrite_policy->rewrite_datagram(to_game_rewriter, payload, payload_len,
+                                                                matches, IP_MATCH_LOG_MAX);
+
+        if (replaced_send > 0) {
+            add_stat(STAT_REWRITE_HITS, replaced_send);
+            if (LOG_ENABLED(Logger::PRIORITY_INFO)) {
+                log_ip_matches("[" + session_uuid + "][IP替换] ", matches, replaced_send,
+                               private_ip, proxy_local_ip);
+            }
+            LOG_INFO("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
+                   "] ✓ 已替换发送payload中的IP: " + private_ip + " -> " +
+                   proxy_local_ip + " (替换" + to_string(replaced_send) + "处)");
+        }
+
+        // v4.7.0: 使用源端口的socket发送到目标端口
+        int udp_fd = sock_it->second->watch.fd;
+        sock_it->second->last_active_ms = loop->now_ms();
+
+        // v6.8: 游戏服务器地址从DNS缓存读取，不再每个包调用getaddrinfo
+        sockaddr_storage game_addr{};
+        socklen_t game_addr_len = 0;
+        if (!DnsCache::lookup_first(game_server_ip, SOCK_DGRAM, dst_port, game_addr, game_addr_len)) {
+            LOG_ERROR("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
+                     "] DNS解析失败: " + game_server_ip);
+            return;
+        }
+
+        // v6.9: 登记到本线程的发送批次，on_client_readable结束时由sendmmsg批量发出
+        add_stat(STAT_SEND_FAILURES, loop->udp_send_batch().add(udp_fd, payload, payload_len, game_addr, game_addr_len));
+        add_stat(STAT_FRAMES_TO_GAME, 1);
+        add_stat(STAT_BYTES_TO_GAME, payload_len);
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
+                 "] → 发送UDP数据: " + game_server_ip + ":" +
+                 to_string(dst_port) + " (" + to_string(payload_len) + "字节)");
+    }
+
+    // 游戏服务器→客户端 (每个源端口socket的接收事件)
+    // v6.9: recvmmsg一次取出多个数据报，逐个还原后一次写入客户端
+    void on_udp_readable(IoWatch* watch) {
+        uint16_t src_port = watch->port;
+        string socket_key = client_str + ":" + to_string(src_port);
+
+        auto sock_it = udp_sockets.find(socket_key);
+        if (sock_it != udp_sockets.end()) sock_it->second->last_active_ms = loop->now_ms();
+
+        UdpRecvBatch& batch = loop->udp_recv_batch();
+        int count = batch.recv(watch->fd);
+        if (count <= 0) {
+            if (count == 0) return;
+            int err = errno;
+            LOG_INFO("[UDP Tunnel|src=" + to_string(src_port) +
+                   "] recvmmsg返回: n=" + to_string(count) +
+                   ", errno=" + to_string(err) + " (" + strerror(err) + ")");
+            return;
+        }
+        uint64_t recv_ns = monotonic_ns();
+
+        uint8_t headers[UDP_BATCH_MAX][UDP_FRAME_HEADER];
+        iovec iov[2 * UDP_BATCH_MAX];
+        int iovcnt = 0;
+        size_t total = 0;
+        size_t payload_bytes = 0;
+        for (int i = 0; i < count; i++) {
+            uint8_t* data = batch.payload(i);
+            int n = (int)batch.length(i);
+            if (!encode_udp_response(src_port, socket_key, batch.from(i), data, n, headers[i])) continue;
+            iov[iovcnt].iov_base = headers[i];
+            iov[iovcnt].iov_len = UDP_FRAME_HEADER;
+            iov[iovcnt + 1].iov_base = data;
+            iov[iovcnt + 1].iov_len = n;
+            iovcnt += 2;
+            total += UDP_FRAME_HEADER + n;
+            payload_bytes += n;
+        }
+        if (iovcnt == 0) return;
+
+        // 发送到客户端(同一EventLoop线程内顺序写入，无需send_mutex)
+        if (!coalesce_send(loop, this, client_fd, to_client, iov, iovcnt)) {
+            int err = errno;
+            add_stat(STAT_SEND_FAILURES, 1);
+            LOG_ERROR("[UDP Tunnel|src=" + to_string(src_port) +
+                    "] send()失败: errno=" + to_string(err) + " (" + strerror(err) + ")");
+            close_tunnel();
+            return;
+        }
+
+        add_stat(STAT_FRAMES_TO_CLIENT, iovcnt / 2);
+        add_stat(STAT_BYTES_TO_CLIENT, payload_bytes);
+        record_to_client(recv_ns, iovcnt / 2);
+
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) +
+                 "] ✓ 成功发送到客户端: " + to_string(iovcnt / 2) + "个数据报 " +
+                 to_string(total) + "字节 (client_fd=" + to_string(client_fd) + ")");
+        update_interest();
+    }
+
+    // 单个游戏服务器数据报: 查找流元数据、还原握手响应中的IP/端口并编码0x03帧头
+    // 返回false表示丢弃该数据报
+    bool encode_udp_response(uint16_t src_port, const string& socket_key, const sockaddr_storage& from_addr,
+                             uint8_t* data, int n, uint8_t* header) {
+        // v4.7.0: 获取游戏服务器的端口（响应来自哪个目标端口）
+        uint16_t game_server_port = 0;
+        if (from_addr.ss_family == AF_INET) {
+            sockaddr_in* addr_in = (sockaddr_in*)&from_addr;
+            game_server_port = ntohs(addr_in->sin_port);
+        } else if (from_addr.ss_family == AF_INET6) {
+            sockaddr_in6* addr_in6 = (sockaddr_in6*)&from_addr;
+            game_server_port = ntohs(addr_in6->sin6_port);
+        }
+
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                 "] ←[游戏服务器] 接收到UDP数据: " + to_string(n) + "字节");
+
+        // v4.7.0: 根据(src_port, game_server_port)查找流元数据
+        UdpFlow* flow = flows.find(src_port, game_server_port);
+        if (flow == nullptr) {
+            LOG_WARN("[UDP Tunnel|" + socket_key + "|dst=" +
+                   to_string(game_server_port) + "] 未找到流元数据，可能是延迟响应");
+            return false;
+        }
+        flow->last_active_ms = loop->now_ms();
+        uint32_t conn_id = flow->conn_id;
+        uint16_t client_port = flow->client_port;
+
+        // 打印接收到的UDP payload hex dump
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                  "] UDP Payload(" + to_string(n) + "字节):\n                    " +
+                  hex_dump(data, n, 16, "                    "));
+
+        // ===== v4.9.1关键修复: UDP握手响应 - 替换IP字段和端口字段 =====
+        // 握手响应格式: 02 + IP(4字节,DNF字节序) + Port(2字节,小端序)
+        // 游戏服务器基于收到的UDP包源地址(代理IP:Port)计算响应，必须还原为客户端真实值
+        if (n >= 7 && data[0] == 0x02) {
+            // 读取服务器返回的IP字段（DNF字节序 [d,c,b,a] 表示 a.b.c.d）
+            char server_ip_str[20];
+            sprintf(server_ip_str, "%d.%d.%d.%d", data[4], data[3], data[2], data[1]);
+
+            // 读取服务器返回的端口字段（小端序）
+            uint16_t server_port_le = ((uint16_t)data[6] << 8) | data[5];
+
+            LOG_INFO("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                   "] 检测到UDP握手响应，服务器返回: IP=" + string(server_ip_str) +
+                   ", Port=" + to_string(server_port_le) + " (0x" +
+                   [](uint16_t v){ char buf[8]; sprintf(buf, "%04x", v); return string(buf); }(server_port_le) + ")");
+
+            // v5.0关键修复: 替换为客户端真实IP（从payload提取）
+            // v6.11: IP(DNF字节序)和端口(小端序)在建立流时已编码，直接写回
+            if (flow->rewrite_valid) {
+                LOG_INFO("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                       "] 替换为客户端真实IP: " + client_private_ip + ", Port=" + to_string(client_port));
+
+                memcpy(data + 1, flow->rewrite, sizeof(flow->rewrite));
+
+                LOG_INFO("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                       "] ✓ 已替换IP字段和端口字段");
+
+                // 打印替换后的payload
+                LOG_INFO("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                         "] 替换后payload: " + hex_dump(data, 7));
+            } else if (!client_private_ip.empty()) {
+                LOG_WARN("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                       "] 客户端IP格式错误: " + client_private_ip);
+            } else {
+                LOG_WARN("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                       "] 客户端真实IP为空，无法替换");
             }
-        } catch (exception& e) {
-            Logger::error(conn_id_str() + "|UDP 接收线程异常: " +
-                        string(e.what()));
         }
+
+        // 封装协议：msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
+        // src_port=游戏服务器端口，dst_port=客户端端口
+        encode_udp_header(header, conn_id, game_server_port, client_port, n);
+        size_t response_size = UDP_FRAME_HEADER + n;
+
+        // 打印封装后的完整response数据包: 协议头11字节 + payload前17字节
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                  "] 封装后数据包(前" + to_string(UDP_FRAME_HEADER + min(n, 17)) + "字节):\n                    " +
+                  hex_dump(header, UDP_FRAME_HEADER) + "| " + hex_dump(data, (size_t)min(n, 17)));
+
+        LOG_DEBUG("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
+                "] →[客户端] 准备发送: " + to_string(response_size) +
+                "字节 (conn_id=" + to_string(conn_id) + ")");
+        return true;
     }
 };
 
 // ==================== 隧道服务器 ====================
-class TunnelServer : public enable_shared_from_this<TunnelServer> {
+class TunnelServer : public EventHandler, public enable_shared_from_this<TunnelServer> {
 private:
     ServerConfig config;
     string server_name;
-    int listen_fd;
+    ReactorPool* reactor;
+    shared_ptr<RewritePolicy> rewrite_policy;  // v6.13: 本服务器所有连接共用的IP替换规则及统计
+
+    // v6.3: 每个监听分片一个socket(SO_REUSEPORT)，分别注册到不同的worker线程
+    struct Acceptor {
+        int fd;
+        EventLoop* loop;
+        IoWatch watch;
+    };
+    vector<shared_ptr<Acceptor>> acceptors;   // 关闭任务投递到worker时持有引用
     map<string, shared_ptr<TunnelConnection>> connections;  // key: "client_addr:conn_id" - 使用智能指针
+    map<string, shared_ptr<UdpTunnel>> udp_tunnels;         // key: "client_addr"
     mutex conn_mutex;
     atomic<bool> running;
+    // v6.18: 转发计数按worker线程分片(下标为EventLoop::id)
+    // v6.19: 会话直接累加到所属worker的分片，读取汇总不需要conn_mutex
+    vector<unique_ptr<StatsShard>> stats_shards;
+    bool latency_per_session;  // v6.20: 每个会话另外记录延迟直方图
+    LatencySnapshot latency_logged[LAT_COUNT];  // v6.20: 上次周期输出时的直方图，只由LatencyReporter线程访问
 
     // v5.0: 存储TCP连接源IP到客户端真实IPv4的映射
     map<string, string> client_ip_map;  // TCP源IP(不含端口) -> 客户端真实IPv4
     mutex ip_map_mutex;
 
-    // v5.0: 从client_str中提取TCP源IP（不含端口）
-    // 输入: "[::ffff:192.168.2.1]:56601" 或 "[240e:...]:12345"
-    // 输出: "192.168.2.1" 或 "240e:..."
-    string extract_tcp_source_ip(const string& client_str) {
-        size_t start = client_str.find('[');
-        size_t end = client_str.find(']');
-        if (start == string::npos || end == string::npos || end <= start) {
-            return "";  // 格式错误
+    // 握手阶段的客户端：conn_id(4) + dst_port(2) + session_uuid_len(1) + session_uuid(N)
+    // UDP tunnel(conn_id=0xFFFFFFFF)额外携带客户端IPv4(4字节)
+    class PendingClient : public EventHandler {
+    public:
+        enum Stage { STAGE_HEADER, STAGE_UUID, STAGE_IPV4 };
+
+        TunnelServer* server;
+        EventLoop* loop;
+        int client_fd;
+        string client_str;
+        IoWatch watch;
+        Stage stage;
+        uint8_t handshake[7];
+        vector<char> uuid_buf;
+        uint8_t ipv4_bytes[4];
+        size_t received;
+
+        PendingClient(TunnelServer* srv, EventLoop* ev_loop, int fd, const string& cstr)
+            : server(srv), loop(ev_loop), client_fd(fd), client_str(cstr),
+              stage(STAGE_HEADER), received(0) {
+            watch.owner = this;
+            watch.fd = fd;
         }
 
-        string ip_part = client_str.substr(start + 1, end - start - 1);  // 提取[...]中的内容
+        // 当前阶段需要读取的字节数
+        size_t stage_size() const {
+            if (stage == STAGE_HEADER) return 7;
+            if (stage == STAGE_UUID) return uuid_buf.size();
+            return 4;
+        }
 
-        // 检查是否为IPv4映射IPv6格式: ::ffff:x.x.x.x
-        const string ipv4_prefix = "::ffff:";
-        if (ip_part.find(ipv4_prefix) == 0) {
-            return ip_part.substr(ipv4_prefix.length());  // 返回IPv4部分
+        uint8_t* stage_buffer() {
+            if (stage == STAGE_HEADER) return handshake;
+            if (stage == STAGE_UUID) return (uint8_t*)uuid_buf.data();
+            return ipv4_bytes;
         }
 
-        return ip_part;  // 返回完整IP（IPv6或其他格式）
-    }
+        void on_io(IoWatch* w, uint32_t events) override {
+            (void)w;
+            (void)events;
+            server->on_handshake_readable(this);
+        }
+    };
 
 public:
-    TunnelServer(const ServerConfig& cfg)
-        : config(cfg), server_name(cfg.name), listen_fd(-1), running(false) {}
+    TunnelServer(const ServerConfig& cfg, ReactorPool* pool, bool per_session_latency = false)
+        : config(cfg), server_name(cfg.name), reactor(pool), rewrite_policy(new RewritePolicy()),
+          running(false), latency_per_session(per_session_latency) {
+        for (size_t i = 0; i < reactor->size(); i++) {
+            stats_shards.emplace_back(new StatsShard());
+        }
+        string error;
+        if (!rewrite_policy->parse(config.ip_rewrite, config.game_msg_format, error)) {
+            LOG_ERROR("[" + server_name + "] ip_rewrite配置错误: " + error + "，使用scan");
+            rewrite_policy.reset(new RewritePolicy());
+            rewrite_policy->parse("scan", "", error);
+        } else if ((rewrite_policy->mode == REWRITE_HEAD || rewrite_policy->mode == REWRITE_OFFSETS) &&
+                   !rewrite_policy->format.has_length()) {
+            LOG_WARN("[" + server_name + "] game_msg_format未配置len_offset，TCP数据按scan处理");
+        }
+    }
+
+    void log_rewrite_stats() const {
+        rewrite_policy->log_stats("[" + server_name + "] ");
+    }
+
+    const string& name() const { return server_name; }
+
+    int listen_port() const { return config.listen_port; }
+
+    // v6.19: 汇总所有worker分片，只读原子变量，不持有任何锁
+    void snapshot(ServerStatsSnapshot& snap) const {
+        snap = ServerStatsSnapshot();
+        uint64_t tcp_closed = 0, udp_closed = 0;
+        for (const auto& shard : stats_shards) {
+            // 先读closed再读opened，同一分片内opened >= closed
+            tcp_closed += shard->tcp_closed.load(memory_order_relaxed);
+            udp_closed += shard->udp_closed.load(memory_order_relaxed);
+            snap.tcp_total += shard->tcp_opened.load(memory_order_relaxed);
+            snap.udp_total += shard->udp_opened.load(memory_order_relaxed);
+            shard->stats.sum_into(snap.counters);
+            for (int d = 0; d < LAT_COUNT; d++) {
+                shard->latency[d].sum_into(snap.latency[d]);
+            }
+        }
+        snap.tcp_connections = snap.tcp_total - tcp_closed;
+        snap.udp_tunnels = snap.udp_total - udp_closed;
+    }
+
+    // v6.18: GET_STATS中的服务器条目；with_sessions时附带每个存活会话的计数
+    // v6.19: 汇总只读分片；只有会话列表在conn_mutex内读取
+    void stats_json(string& out, bool with_sessions) {
+        unique_ptr<ServerStatsSnapshot> snap(new ServerStatsSnapshot());
+        snapshot(*snap);
+        out += "{\"name\":\"" + json_escape(server_name) + "\",\"listen_port\":" +
+               to_string(config.listen_port) + ",\"tcp_connections\":" + to_string(snap->tcp_connections) +
+               ",\"udp_tunnels\":" + to_string(snap->udp_tunnels);
+        append_stats_json(out, snap->counters);
+        append_latency_json(out, snap->latency);
+        if (with_sessions) {
+            string sessions;
+            lock_guard<mutex> lock(conn_mutex);
+            for (const auto& pair : connections) {
+                if (!sessions.empty()) sessions += ',';
+                // key: "client_addr:conn_id"
+                pair.second->session_json(sessions, pair.first.substr(0, pair.first.rfind(':')));
+            }
+            for (const auto& pair : udp_tunnels) {
+                if (!sessions.empty()) sessions += ',';
+                pair.second->session_json(sessions);
+            }
+            out += ",\"sessions\":[" + sessions + "]";
+        }
+        out += '}';
+    }
+
+    // v6.20: 输出上次调用以来的延迟分布，本周期没有样本时不输出
+    void log_latency(int interval_sec) {
+        unique_ptr<ServerStatsSnapshot> snap(new ServerStatsSnapshot());
+        snapshot(*snap);
+        string line;
+        for (int d = 0; d < LAT_COUNT; d++) {
+            LatencySnapshot delta = snap->latency[d];
+            delta.subtract(latency_logged[d]);
+            latency_logged[d] = snap->latency[d];
+            uint64_t n = delta.total();
+            if (n == 0) continue;
+            line += string(line.empty() ? "" : ", ") + LAT_NAMES[d] + " n=" + to_string(n) +
+                    " p50=" + format_duration_ns(delta.percentile(0.5)) +
+                    " p99=" + format_duration_ns(delta.percentile(0.99)) +
+                    " p999=" + format_duration_ns(delta.percentile(0.999)) +
+                    " max=" + format_duration_ns(delta.max_ns);
+        }
+        if (!line.empty()) {
+            LOG_INFO("[" + server_name + "] 延迟(" + to_string(interval_sec) + "秒): " + line);
+        }
+    }
 
     ~TunnelServer() {
         stop();
         // 智能指针自动释放，无需手动delete
         connections.clear();
+        udp_tunnels.clear();
+    }
+
+    bool start() {
+        int shards = max(1, config.acceptor_shards);
+
+        for (int i = 0; i < shards; i++) {
+            int fd = create_listen_socket(shards > 1);
+            if (fd < 0) {
+                stop();
+                return false;
+            }
+            auto acceptor = make_shared<Acceptor>();
+            acceptor->fd = fd;
+            acceptor->loop = reactor->next_loop();
+            acceptor->watch.owner = this;
+            acceptor->watch.fd = fd;
+            acceptors.push_back(std::move(acceptor));
+        }
+
+        // 可选: 按客户端IP哈希选择分片，同一客户端的连接固定落在同一worker
+        if (shards > 1 && config.reuseport_bpf) {
+            attach_reuseport_bpf(acceptors[0]->fd, shards);
+        }
+
+        running = true;
+
+        // 监听socket分别注册到不同worker线程
+        auto self = shared_from_this();
+        for (auto& acceptor : acceptors) {
+            Acceptor* a = acceptor.get();
+            a->loop->post([self, a]() {
+                a->loop->watch(&a->watch, EPOLLIN);
+            });
+        }
+
+        LOG_INFO("[" + server_name + "] 服务器启动成功，监听端口: " + to_string(config.listen_port) +
+                " (IPv4/IPv6双栈, " + to_string(shards) + "个accept分片)");
+        LOG_INFO("[" + server_name + "] 游戏服务器: " + config.game_server_ip);
+        return true;
+    }
+
+    // 监听socket与其他fd一样在所属worker中经close_watch关闭(注销watch，io_uring仍有在途操作时推迟close)；
+    // worker已停止(进程退出时析构)时在当前线程关闭
+    void stop() {
+        running = false;
+        for (auto& acceptor : acceptors) {
+            if (acceptor->fd < 0) continue;
+            acceptor->fd = -1;
+            shared_ptr<Acceptor> a = acceptor;
+            if (a->loop->is_running()) {
+                a->loop->post([a]() {
+                    a->loop->close_watch(&a->watch);
+                });
+            } else {
+                a->loop->close_watch(&a->watch);
+            }
+        }
+    }
+
+    // 监听socket可读：接受所有已完成握手的新连接
+    void on_io(IoWatch* watch, uint32_t events) override {
+        (void)events;
+
+        // 多分片时由内核在分片间分配连接，直接在本worker处理；单分片时轮询分配到各worker
+        EventLoop* accept_loop = nullptr;
+        for (auto& acceptor : acceptors) {
+            if (&acceptor->watch == watch) accept_loop = acceptor->loop;
+        }
+        bool local = acceptors.size() > 1;
+
+        for (int i = 0; i < 64 && running; i++) {
+            sockaddr_storage client_addr{};  // 使用sockaddr_storage支持IPv4/IPv6
+            socklen_t addr_len = sizeof(client_addr);
+
+            int client_fd = accept4(watch->fd, (sockaddr*)&client_addr, &addr_len,
+                                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                    errno != ECONNABORTED && running) {
+                    LOG_ERROR("接受连接失败: " + string(strerror(errno)));
+                }
+                break;
+            }
+
+            // 地址格式化和日志放到处理连接的worker中，accept路径只做accept
+            if (local && accept_loop != nullptr) {
+                begin_handshake(accept_loop, client_fd, client_addr);
+                continue;
+            }
+            EventLoop* loop = reactor->next_loop();
+            auto self = shared_from_this();
+            loop->post([self, loop, client_fd, client_addr]() {
+                self->begin_handshake(loop, client_fd, client_addr);
+            });
+        }
     }
 
-    bool start() {
+private:
+    int create_listen_socket(bool reuseport) {
         // 创建IPv6 socket（支持双栈：同时接受IPv4和IPv6连接）
-        listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+        int listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (listen_fd < 0) {
-            Logger::error("[" + server_name + "] 创建socket失败");
-            return false;
+            LOG_ERROR("[" + server_name + "] 创建socket失败");
+            return -1;
         }
 
         int opt = 1;
         setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            LOG_ERROR("[" + server_name + "] 设置SO_REUSEPORT失败: " + strerror(errno));
+            close(listen_fd);
+            return -1;
+        }
 
         // 设置双栈模式：IPV6_V6ONLY=0 允许接受IPv4连接
         int v6only = 0;
         if (setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
-            Logger::warning("[" + server_name + "] 设置双栈模式失败，将只支持IPv6");
+            LOG_WARN("[" + server_name + "] 设置双栈模式失败，将只支持IPv6");
         } else {
-            Logger::debug("[" + server_name + "] 已启用IPv4/IPv6双栈模式");
+            LOG_DEBUG("[" + server_name + "] 已启用IPv4/IPv6双栈模式");
         }
 
+        // 客户端连接后立即发送握手，等握手数据到达后才唤醒accept
+        int defer_secs = 10;
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_secs, sizeof(defer_secs));
+
         sockaddr_in6 addr{};
         addr.sin6_family = AF_INET6;
         addr.sin6_addr = in6addr_any;  // 监听所有IPv6地址（双栈模式下也监听IPv4）
         addr.sin6_port = htons(config.listen_port);
 
         if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
-            Logger::error("[" + server_name + "] 绑定端口失败: " + to_string(config.listen_port));
+            LOG_ERROR("[" + server_name + "] 绑定端口失败: " + to_string(config.listen_port));
             close(listen_fd);
-            return false;
+            return -1;
         }
 
         if (listen(listen_fd, config.max_connections) < 0) {
-            Logger::error("[" + server_name + "] 监听失败");
+            LOG_ERROR("[" + server_name + "] 监听失败");
             close(listen_fd);
-            return false;
+            return -1;
         }
-
-        running = true;
-        Logger::info("[" + server_name + "] 服务器启动成功，监听端口: " + to_string(config.listen_port) + " (IPv4/IPv6双栈)");
-        Logger::info("[" + server_name + "] 游戏服务器: " + config.game_server_ip);
-
-        accept_loop();
-        return true;
+        return listen_fd;
     }
 
-    void stop() {
-        running = false;
-        if (listen_fd >= 0) {
-            close(listen_fd);
-            listen_fd = -1;
+    // classic BPF: 取客户端源IP(IPv4全部/IPv6最后4字节)对分片数取模，作为reuseport组内的socket下标
+    void attach_reuseport_bpf(int fd, int shards) {
+        sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, (uint32_t)SKF_NET_OFF),        // A = IP版本字节
+            BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 2),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12)), // IPv4源地址
+            BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 20)), // IPv6源地址低32位
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)shards),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        sock_fprog prog;
+        prog.len = sizeof(code) / sizeof(code[0]);
+        prog.filter = code;
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+            LOG_WARN("[" + server_name + "] 加载reuseport BPF失败(" + string(strerror(errno)) +
+                   ")，使用内核默认哈希");
+        } else {
+            LOG_INFO("[" + server_name + "] 已启用按客户端IP分配accept分片");
         }
     }
 
-private:
-    void accept_loop() {
-        while (running) {
-            sockaddr_storage client_addr{};  // 使用sockaddr_storage支持IPv4/IPv6
-            socklen_t addr_len = sizeof(client_addr);
-
-            int client_fd = accept(listen_fd, (sockaddr*)&client_addr, &addr_len);
-            if (client_fd < 0) {
-                if (running) {
-                    Logger::error("接受连接失败");
-                }
-                continue;
-            }
-
-            // 提取客户端IP地址（支持IPv4和IPv6）
-            char client_ip[INET6_ADDRSTRLEN];
-            int client_port = 0;
-            string client_str;
-
-            if (client_addr.ss_family == AF_INET) {
-                // IPv4客户端
-                sockaddr_in* addr_in = (sockaddr_in*)&client_addr;
-                inet_ntop(AF_INET, &addr_in->sin_addr, client_ip, INET6_ADDRSTRLEN);
-                client_port = ntohs(addr_in->sin_port);
-                client_str = string(client_ip) + ":" + to_string(client_port);
-            } else if (client_addr.ss_family == AF_INET6) {
-                // IPv6客户端
-                sockaddr_in6* addr_in6 = (sockaddr_in6*)&client_addr;
-                inet_ntop(AF_INET6, &addr_in6->sin6_addr, client_ip, INET6_ADDRSTRLEN);
-                client_port = ntohs(addr_in6->sin6_port);
-                client_str = "[" + string(client_ip) + "]:" + to_string(client_port);
-            } else {
-                client_str = "unknown";
-            }
+    // 在处理该连接的worker中创建握手状态
+    void begin_handshake(EventLoop* loop, int client_fd, const sockaddr_storage& client_addr) {
+        // 提取客户端IP地址（支持IPv4和IPv6）
+        char client_ip[INET6_ADDRSTRLEN];
+        int client_port = 0;
+        string client_str;
+
+        if (client_addr.ss_family == AF_INET) {
+            // IPv4客户端
+            sockaddr_in* addr_in = (sockaddr_in*)&client_addr;
+            inet_ntop(AF_INET, &addr_in->sin_addr, client_ip, INET6_ADDRSTRLEN);
+            client_port = ntohs(addr_in->sin_port);
+            client_str = string(client_ip) + ":" + to_string(client_port);
+        } else if (client_addr.ss_family == AF_INET6) {
+            // IPv6客户端
+            sockaddr_in6* addr_in6 = (sockaddr_in6*)&client_addr;
+            inet_ntop(AF_INET6, &addr_in6->sin6_addr, client_ip, INET6_ADDRSTRLEN);
+            client_port = ntohs(addr_in6->sin6_port);
+            client_str = "[" + string(client_ip) + "]:" + to_string(client_port);
+        } else {
+            client_str = "unknown";
+        }
 
-            Logger::info("新客户端连接: " + client_str);
+        LOG_INFO("新客户端连接: " + client_str);
 
-            // 在新线程中处理客户端 - 使用shared_from_this()避免Use-After-Free
-            auto self = shared_from_this();
-            thread([self, client_fd, client_str]() {
-                self->handle_client(client_fd, client_str);
-            }).detach();
+        shared_ptr<PendingClient> pending(new PendingClient(this, loop, client_fd, client_str));
+        loop->adopt(pending);
+        if (!loop->watch(&pending->watch, EPOLLIN)) {
+            close(client_fd);
+            loop->retire(pending.get());
+            return;
         }
+        // TCP_DEFER_ACCEPT下握手数据通常已到达，直接读取，省一次事件循环
+        on_handshake_readable(pending.get());
     }
 
-    void handle_client(int client_fd, const string& client_str) {
-        try {
-            // v4.5.0: 用于存储从UDP握手payload中解析的客户端IP
-            string client_ipv4 = "";
-
-            // 接收握手：conn_id(4) + dst_port(2) + session_uuid_len(1) + session_uuid(N)
-            uint8_t handshake[7];
-            int n = recv(client_fd, handshake, 7, MSG_WAITALL);
+    // 握手失败：关闭客户端socket并释放握手状态
+    void abort_handshake(PendingClient* pending) {
+        pending->loop->close_watch(&pending->watch);
+        pending->loop->retire(pending);
+    }
 
-            if (n != 7) {
-                Logger::error("客户端 " + client_str + " 握手失败 (recv=" + to_string(n) + ", 期望7字节)");
-                close(client_fd);
-                return;
+    void on_handshake_readable(PendingClient* pending) {
+        // 按阶段精确读取所需字节数，握手后的数据留在socket中由转发对象读取
+        size_t need = pending->stage_size();
+        int n = recv(pending->client_fd, pending->stage_buffer() + pending->received,
+                     need - pending->received, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+
+        if (n <= 0) {
+            int got = (int)pending->received;
+            if (pending->stage == PendingClient::STAGE_HEADER) {
+                LOG_ERROR("客户端 " + pending->client_str + " 握手失败 (recv=" +
+                        to_string(n < 0 ? n : got) + ", 期望7字节)");
+            } else if (pending->stage == PendingClient::STAGE_UUID) {
+                LOG_WARN("[握手] 接收会话UUID失败 (期望" + to_string(pending->uuid_buf.size()) +
+                       "字节, 收到" + to_string(got) + "字节)");
+            } else {
+                LOG_ERROR("[UDP Tunnel] 握手失败: 未接收到客户端IPv4地址 (received=" +
+                        to_string(got) + ")");
             }
+            abort_handshake(pending);
+            return;
+        }
 
+        pending->received += n;
+        if (pending->received < need) return;
+        pending->received = 0;
+
+        uint8_t* handshake = pending->handshake;
+        if (pending->stage == PendingClient::STAGE_HEADER) {
             // ===== 调试日志:打印原始握手数据 =====
-            char hex_buf[100];
-            sprintf(hex_buf, "%02x %02x %02x %02x %02x %02x %02x",
-                    handshake[0], handshake[1], handshake[2],
-                    handshake[3], handshake[4], handshake[5], handshake[6]);
-            Logger::debug("[握手] 收到握手数据(hex): " + string(hex_buf));
-
-            uint32_t conn_id = ntohl(*(uint32_t*)handshake);
-            uint16_t dst_port = ntohs(*(uint16_t*)(handshake + 4));
-            uint8_t session_uuid_len = handshake[6];
+            LOG_DEBUG("[握手] 收到握手数据(hex): " + hex_dump(handshake, HANDSHAKE_HEADER));
 
             // 接收session UUID
-            string session_uuid = "";
+            uint8_t session_uuid_len = handshake[6];
             if (session_uuid_len > 0 && session_uuid_len < 255) {
-                vector<char> uuid_buf(session_uuid_len + 1, 0);
-                int uuid_recv = recv(client_fd, uuid_buf.data(), session_uuid_len, MSG_WAITALL);
-                if (uuid_recv == (int)session_uuid_len) {
-                    session_uuid = string(uuid_buf.data(), session_uuid_len);
-                } else {
-                    Logger::warning("[握手] 接收会话UUID失败 (期望" + to_string(session_uuid_len) +
-                                  "字节, 收到" + to_string(uuid_recv) + "字节)");
-                }
-            }
-
-            char conn_id_hex[20];
-            sprintf(conn_id_hex, "0x%08x", conn_id);
-            Logger::debug("[握手] 解析结果: conn_id=" + to_string(conn_id) +
-                        " (" + string(conn_id_hex) + "), dst_port=" + to_string(dst_port) +
-                        ", session_uuid=" + session_uuid);
-
-            // ===== 关键修改：识别UDP tunnel连接 =====
-            const uint32_t UDP_MAGIC = 0xFFFFFFFF;
-
-            Logger::debug("[握手] 判断UDP Tunnel: conn_id=" + to_string(conn_id) +
-                        ", UDP_MAGIC=" + to_string(UDP_MAGIC) +
-                        ", 相等?" + (conn_id == UDP_MAGIC ? "YES" : "NO"));
-
-            if (conn_id == UDP_MAGIC) {
-                Logger::info("[UDP Tunnel|" + session_uuid + "] ✓ 识别为UDP Tunnel连接!");
-                Logger::info("[UDP Tunnel|" + session_uuid + "] 收到UDP握手请求(第一部分): 客户端=" + client_str +
-                           ", 游戏端口=" + to_string(dst_port));
-
-                // ===== 新协议: 接收客户端IPv4地址(4字节) =====
-                uint8_t ipv4_bytes[4];
-                int ip_received = recv(client_fd, ipv4_bytes, 4, MSG_WAITALL);
-                if (ip_received != 4) {
-                    Logger::error("[UDP Tunnel|" + session_uuid + "] 握手失败: 未接收到客户端IPv4地址 (received=" +
-                                to_string(ip_received) + ")");
-                    close(client_fd);
-                    return;
-                }
-
-                // 将IPv4字节转换为字符串
-                char ipv4_str[INET_ADDRSTRLEN];
-                struct in_addr ipv4_addr;
-                memcpy(&ipv4_addr, ipv4_bytes, 4);
-                inet_ntop(AF_INET, &ipv4_addr, ipv4_str, INET_ADDRSTRLEN);
-                client_ipv4 = string(ipv4_str);  // v4.5.0: 赋值给外层变量,不重新声明
-
-                Logger::info("[UDP Tunnel|" + session_uuid + "] 收到客户端IPv4地址(payload中): " + client_ipv4);
-
-                // v5.0: 存储TCP源IP到客户端真实IPv4的映射
-                string tcp_source_ip = extract_tcp_source_ip(client_str);
-                if (!tcp_source_ip.empty() && !client_ipv4.empty()) {
-                    lock_guard<mutex> lock(ip_map_mutex);
-                    client_ip_map[tcp_source_ip] = client_ipv4;
-                    Logger::info("[UDP Tunnel|" + session_uuid + "] v5.0存储IP映射: TCP源IP=" + tcp_source_ip +
-                               " -> 客户端真实IPv4=" + client_ipv4);
-                }
-
-                // 发送UDP握手确认响应(与TCP握手相同的6字节格式)
-                uint8_t ack[6];
-                *(uint32_t*)ack = htonl(0xFFFFFFFF);  // conn_id=0xFFFFFFFF表示握手确认
-                *(uint16_t*)(ack + 4) = htons(dst_port);  // 回传端口
-
-                if (send(client_fd, ack, 6, 0) != 6) {
-                    Logger::error("[UDP Tunnel|" + session_uuid + "] 发送握手确认失败");
-                    close(client_fd);
-                    return;
-                }
-
-                Logger::info("[UDP Tunnel|" + session_uuid + "] 握手成功,已发送确认");
-                Logger::info("[UDP Tunnel|" + session_uuid + "] 调用 handle_udp_tunnel()");
-                // v4.5.0: 传递TCP真实IP(client_str)和payload中的IP(client_ipv4)
-                handle_udp_tunnel(client_fd, client_str, client_ipv4, dst_port, session_uuid);
-                Logger::info("[UDP Tunnel|" + session_uuid + "] handle_udp_tunnel()函数已返回");
+                pending->uuid_buf.assign(session_uuid_len, 0);
+                pending->stage = PendingClient::STAGE_UUID;
                 return;
             }
+        } else if (pending->stage == PendingClient::STAGE_UUID) {
+            // 已收到完整UUID，继续
+        } else {
+            on_udp_handshake_complete(pending);
+            return;
+        }
 
-            Logger::debug("[握手] ✗ 不是UDP Tunnel,按普通TCP连接处理");
-            Logger::info("[连接" + to_string(conn_id) + "|" + session_uuid + "] 握手成功: 目标端口=" +
-                        to_string(dst_port) + ", 客户端=" + client_str);
+        HandshakeHeader header = decode_handshake_header(handshake);
+        uint32_t conn_id = header.conn_id;
+        uint16_t dst_port = header.dst_port;
+        string session_uuid(pending->uuid_buf.begin(), pending->uuid_buf.end());
+
+        char conn_id_hex[20];
+        sprintf(conn_id_hex, "0x%08x", conn_id);
+        LOG_DEBUG("[握手] 解析结果: conn_id=" + to_string(conn_id) +
+                " (" + string(conn_id_hex) + "), dst_port=" + to_string(dst_port) +
+                ", session_uuid=" + session_uuid);
+
+        // ===== 关键修改：识别UDP tunnel连接 =====
+        if (conn_id == UDP_TUNNEL_CONN_ID) {
+            LOG_INFO("[UDP Tunnel|" + session_uuid + "] ✓ 识别为UDP Tunnel连接!");
+            LOG_INFO("[UDP Tunnel|" + session_uuid + "] 收到UDP握手请求(第一部分): 客户端=" + pending->client_str +
+                   ", 游戏端口=" + to_string(dst_port));
+            // ===== 新协议: 接收客户端IPv4地址(4字节) =====
+            pending->stage = PendingClient::STAGE_IPV4;
+            return;
+        }
 
-            // v5.0: 从映射中查询客户端真实IPv4
-            string tcp_source_ip = extract_tcp_source_ip(client_str);
-            string client_real_ipv4 = "";
-            {
-                lock_guard<mutex> lock(ip_map_mutex);
-                auto it = client_ip_map.find(tcp_source_ip);
-                if (it != client_ip_map.end()) {
-                    client_real_ipv4 = it->second;
-                }
-            }
+        LOG_DEBUG("[握手] ✗ 不是UDP Tunnel,按普通TCP连接处理");
+        on_tcp_handshake_complete(pending, conn_id, dst_port, session_uuid);
+    }
 
-            // v5.0: 计算代理服务器本地IP(用于连接游戏服务器的本地IP)
-            string proxy_local_ip = get_local_ip(config.game_server_ip);
-
-            Logger::debug("[连接" + to_string(conn_id) + "|" + session_uuid + "] v5.0 IP替换准备: TCP源IP=" + tcp_source_ip +
-                        ", 客户端真实IPv4=" + client_real_ipv4 + ", 代理IP=" + proxy_local_ip);
-
-            // 创建连接对象 - 使用智能指针
-            // v5.0: 传递IP参数以支持TCP payload IP替换
-            // client_real_ipv4可能为空（TCP连接在UDP tunnel之前建立）
-            // 传递tcp_source_ip和映射指针，支持动态查询
-            auto conn = make_shared<TunnelConnection>(
-                conn_id, client_fd, config.game_server_ip, dst_port,
-                client_real_ipv4,  // client_real_ip (可能为空)
-                proxy_local_ip,    // proxy_ip
-                tcp_source_ip,     // tcp_source_ip (用于动态查询)
-                &client_ip_map,    // IP映射指针
-                &ip_map_mutex,     // 映射互斥锁指针
-                session_uuid       // 会话UUID
-            );
-
-            string conn_key = client_str + ":" + to_string(conn_id);
-            {
-                lock_guard<mutex> lock(conn_mutex);
-                connections[conn_key] = conn;
-            }
-
-            // 启动连接（启动双向转发线程）
-            if (!conn->start()) {
-                lock_guard<mutex> lock(conn_mutex);
-                connections.erase(conn_key);
-                // 智能指针自动释放，无需delete
-                return;
-            }
+    void on_udp_handshake_complete(PendingClient* pending) {
+        uint16_t dst_port = decode_handshake_header(pending->handshake).dst_port;
+        string session_uuid(pending->uuid_buf.begin(), pending->uuid_buf.end());
+        const string& client_str = pending->client_str;
+        int client_fd = pending->client_fd;
+
+        // 将IPv4字节转换为字符串
+        char ipv4_str[INET_ADDRSTRLEN];
+        struct in_addr ipv4_addr;
+        memcpy(&ipv4_addr, pending->ipv4_bytes, 4);
+        inet_ntop(AF_INET, &ipv4_addr, ipv4_str, INET_ADDRSTRLEN);
+        string client_ipv4 = string(ipv4_str);
+
+        LOG_INFO("[UDP Tunnel|" + session_uuid + "] 收到客户端IPv4地址(payload中): " + client_ipv4);
+
+        // v5.0: 存储TCP源IP到客户端真实IPv4的映射
+        string tcp_source_ip = extract_tcp_source_ip(client_str);
+        if (!tcp_source_ip.empty() && !client_ipv4.empty()) {
+            lock_guard<mutex> lock(ip_map_mutex);
+            client_ip_map[tcp_source_ip] = client_ipv4;
+            LOG_INFO("[UDP Tunnel|" + session_uuid + "] v5.0存储IP映射: TCP源IP=" + tcp_source_ip +
+                   " -> 客户端真实IPv4=" + client_ipv4);
+        }
 
-            // 等待连接结束
-            while (conn->is_running()) {
-                this_thread::sleep_for(chrono::seconds(1));
-            }
+        // 发送UDP握手确认响应(与TCP握手相同的6字节格式)
+        // conn_id=0xFFFFFFFF表示握手确认，回传端口
+        uint8_t ack[HANDSHAKE_ACK_SIZE];
+        encode_handshake_ack(ack, UDP_TUNNEL_CONN_ID, dst_port);
 
-            // 清理 - 关键修复: 在mutex保护下擦除，智能指针自动管理内存
-            {
-                lock_guard<mutex> lock(conn_mutex);
-                connections.erase(conn_key);
-            }
-            // 智能指针自动释放，无需delete - 修复了原来第992行的race condition!
+        if (send(client_fd, ack, sizeof(ack), MSG_NOSIGNAL) != (ssize_t)sizeof(ack)) {
+            LOG_ERROR("[UDP Tunnel|" + session_uuid + "] 发送握手确认失败");
+            abort_handshake(pending);
+            return;
+        }
 
-        } catch (exception& e) {
-            Logger::error("处理客户端 " + client_str + " 时出错: " + string(e.what()));
-            close(client_fd);
+        LOG_INFO("[UDP Tunnel|" + session_uuid + "] 握手成功,已发送确认");
+
+        // 客户端socket交给UdpTunnel
+        EventLoop* loop = pending->loop;
+        loop->unwatch(&pending->watch);
+        pending->watch.owner = nullptr;
+        loop->retire(pending);
+
+        auto tunnel = make_shared<UdpTunnel>(loop, client_fd, client_str, client_ipv4,
+                                             config.game_server_ip, session_uuid);
+        tunnel->set_rewrite_policy(rewrite_policy);
+        StatsShard* shard = stats_shards[loop->id()].get();
+        tunnel->set_stats_shard(shard, latency_per_session);
+        StatsShard::bump(shard->udp_opened);
+        loop->adopt(tunnel);
+        {
+            lock_guard<mutex> lock(conn_mutex);
+            udp_tunnels[client_str] = tunnel;
         }
+        auto self = shared_from_this();
+        tunnel->set_on_closed([self, client_str, shard]() {
+            StatsShard::bump(shard->udp_closed);
+            lock_guard<mutex> lock(self->conn_mutex);
+            self->udp_tunnels.erase(client_str);
+        });
+        tunnel->start();
     }
 
-    // 处理UDP tunnel连接
-    // v4.5.0: 添加client_ipv4_from_payload参数,包含客户端payload中声明的IP
-    void handle_udp_tunnel(int client_fd, const string& client_str,
-                          const string& client_ipv4_from_payload, uint16_t game_port,
-                          const string& session_uuid = "") {
-        try {
-            // 提取客户端真实IP地址(TCP连接源IP,客户端公网IP)
-            string real_client_ip;
-
-            // 处理IPv6格式: [xxxx]:port 或 IPv4格式: x.x.x.x:port
-            if (client_str.front() == '[') {
-                // IPv6格式: [xxxx]:port
-                // 找到最后一个']'的位置
-                size_t bracket_end = client_str.find(']');
-                if (bracket_end != string::npos) {
-                    // 提取方括号内的内容
-                    string ip_with_brackets = client_str.substr(0, bracket_end + 1);
-                    // 去掉方括号
-                    real_client_ip = ip_with_brackets.substr(1, ip_with_brackets.length() - 2);
-
-                    // 检查是否是IPv6映射的IPv4地址 (::ffff:x.x.x.x)
-                    if (real_client_ip.find("::ffff:") == 0) {
-                        // 提取IPv4部分
-                        real_client_ip = real_client_ip.substr(7);  // 去掉"::ffff:"前缀
-                    }
-                } else {
-                    // 格式错误,使用整个字符串
-                    real_client_ip = client_str;
-                }
-            } else {
-                // 纯IPv4格式: x.x.x.x:port
-                size_t colon_pos = client_str.find(":");
-                if (colon_pos != string::npos) {
-                    real_client_ip = client_str.substr(0, colon_pos);
-                } else {
-                    real_client_ip = client_str;
-                }
-            }
-
-            // v4.5.0: 使用传入的payload IP
-            string client_ipv4 = client_ipv4_from_payload;
-
-            string uuid_prefix = session_uuid.empty() ? "[UDP Tunnel]" : "[UDP Tunnel|" + session_uuid + "]";
-
-            Logger::info(uuid_prefix + " 开始处理UDP代理连接");
-            Logger::info(uuid_prefix + " 客户端字符串: " + client_str);
-            Logger::info(uuid_prefix + " 客户端公网IP(TCP源): " + real_client_ip);
-            Logger::info(uuid_prefix + " 客户端私网IP(payload): " + client_ipv4);
-
-            // ===== v4.5.0关键: 获取代理服务器本地IP =====
-            string proxy_local_ip = get_local_ip(config.game_server_ip);
-            if (proxy_local_ip.empty()) {
-                Logger::error(uuid_prefix + " 无法获取代理服务器本地IP,使用默认值");
-                proxy_local_ip = "192.168.2.75";  // 回退默认值
-            }
-            Logger::info(uuid_prefix + " 代理服务器本地IP: " + proxy_local_ip);
-            Logger::info(uuid_prefix + " v5.0策略: 客户端→服务器(客户端IP→代理IP), 服务器→客户端(代理IP→客户端IP)");
-
-            // **关键修复v3.5**: 使用shared_ptr包装本地变量,防止线程持有悬垂引用
-            // v4.7.0重构: 按源端口管理UDP socket - 每个客户端源端口一个socket
-            // v5.1修复: 支持多用户 - 按(client_str, src_port)管理socket
-            // 原因: 多个客户端可能使用相同源端口(如5063),需要区分
-            auto udp_sockets = make_shared<map<string, int>>();  // ["client_str:src_port"] = socket
-            auto udp_recv_threads = make_shared<map<string, shared_ptr<thread>>>();  // ["client_str:src_port"] = thread
-
-            // v4.7.0: 存储每个数据流(src_port, dst_port)的元数据
-            // v5.1修复: key改为"client_str:src_port:dst_port"支持多用户
-            struct FlowMetadata {
-                uint32_t conn_id;
-                uint16_t src_port;          // 客户端源端口
-                uint16_t dst_port;          // 游戏服务器目标端口
-                string client_public_ip;    // 客户端公网IP (TCP源IP)
-                string client_private_ip;   // 客户端私网IP (payload中)
-            };
-            // v5.1: 使用 "client_str:src_port:dst_port" 作为key
-            auto flow_metadata = make_shared<map<string, FlowMetadata>>();
-            auto udp_mutex = make_shared<mutex>();
-            auto send_mutex = make_shared<mutex>();  // 保护client_fd的send操作,防止多线程竞争
-            auto running = make_shared<atomic<bool>>(true);
-
-            // v4.5.0: 捕获proxy_local_ip用于IP替换（已废弃）
-            string proxy_ip_for_lambda = proxy_local_ip;  // Lambda捕获用
-
-            // 创建UDP接收线程的lambda函数 - 返回智能指针
-            // **关键修复v3.5**: 捕获shared_ptr而不是引用,确保变量生命周期正确
-            // v4.5.0: 新增proxy_ip_for_lambda用于IP替换（已废弃）
-            // v4.7.0重构: 参数改为src_port，一个线程处理该源端口的所有流量
-            // v4.7.3: 移除game_server_ip_for_lambda，改用client_public_ip（从flow_metadata获取）
-            // v5.1修复: 参数改为socket_key="client_str:src_port"支持多用户
-            auto create_udp_receiver = [udp_sockets, flow_metadata, udp_mutex, send_mutex, running, proxy_ip_for_lambda](const string& socket_key, uint16_t src_port, int client_fd) -> shared_ptr<thread> {
-                return make_shared<thread>([udp_sockets, flow_metadata, udp_mutex, send_mutex, running, proxy_ip_for_lambda, socket_key, src_port, client_fd]() {
-                    try {
-                        int udp_fd;
-                        {
-                            lock_guard<mutex> lock(*udp_mutex);
-                            if (udp_sockets->find(socket_key) == udp_sockets->end()) {
-                                Logger::error("[UDP Tunnel|" + socket_key + "] socket不存在");
-                                return;
-                            }
-                            udp_fd = (*udp_sockets)[socket_key];
-                        }
-
-                        uint8_t buffer[65535];
-                        sockaddr_storage from_addr{};
-                        socklen_t from_len = sizeof(from_addr);
-
-                        Logger::info("[UDP Tunnel|" + socket_key + "] 接收线程已启动");
-
-                        while (*running) {
-                            Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "] 等待从游戏服务器接收UDP数据...");
-
-                            from_len = sizeof(from_addr);
-                            int n = recvfrom(udp_fd, buffer, sizeof(buffer), 0,
-                                           (sockaddr*)&from_addr, &from_len);
-
-                            if (n <= 0) {
-                                int err = errno;
-                                Logger::info("[UDP Tunnel|src=" + to_string(src_port) +
-                                           "] recvfrom返回: n=" + to_string(n) +
-                                           ", errno=" + to_string(err) + " (" + strerror(err) + ")");
-                                break;
-                            }
-
-                            // v4.7.0: 获取游戏服务器的端口（响应来自哪个目标端口）
-                            uint16_t game_server_port = 0;
-                            if (from_addr.ss_family == AF_INET) {
-                                sockaddr_in* addr_in = (sockaddr_in*)&from_addr;
-                                game_server_port = ntohs(addr_in->sin_port);
-                            } else if (from_addr.ss_family == AF_INET6) {
-                                sockaddr_in6* addr_in6 = (sockaddr_in6*)&from_addr;
-                                game_server_port = ntohs(addr_in6->sin6_port);
-                            }
-
-                            Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                        "] ←[游戏服务器] 接收到UDP数据: " + to_string(n) + "字节");
-
-                            // v4.7.0: 根据(src_port, game_server_port)查找流元数据
-                            // v5.1修复: flow_key改为"socket_key:dst_port"支持多用户
-                            uint32_t conn_id = 0;
-                            uint16_t client_port = src_port;
-                            string client_public_ip = "";
-                            string client_private_ip = "";
-
-                            {
-                                lock_guard<mutex> lock(*udp_mutex);
-                                string flow_key = socket_key + ":" + to_string(game_server_port);
-                                auto flow_it = flow_metadata->find(flow_key);
-                                if (flow_it != flow_metadata->end()) {
-                                    conn_id = flow_it->second.conn_id;
-                                    client_port = flow_it->second.src_port;
-                                    client_public_ip = flow_it->second.client_public_ip;
-                                    client_private_ip = flow_it->second.client_private_ip;
-                                } else {
-                                    Logger::warning("[UDP Tunnel|" + socket_key + "|dst=" +
-                                                  to_string(game_server_port) + "] 未找到流元数据，可能是延迟响应");
-                                    continue;
-                                }
-                            }
-
-                            // 打印接收到的UDP payload hex dump
-                            string payload_hex = "";
-                            for (int i = 0; i < n; i++) {
-                                if (i > 0 && i % 16 == 0) {
-                                    payload_hex += "\n                    ";
-                                }
-                                char hex_buf[4];
-                                sprintf(hex_buf, "%02x ", buffer[i]);
-                                payload_hex += hex_buf;
-                            }
-                            Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                        "] UDP Payload(" + to_string(n) + "字节):\n                    " + payload_hex);
-
-                            // ===== v4.9.1关键修复: UDP握手响应 - 替换IP字段和端口字段 =====
-                            // 算法发现: 通过多次抓包分析确认
-                            //          IP字段 = UDP包的源IP
-                            //          最后2字节 = UDP包的源端口（小端序）
-                            //          游戏服务器完全基于收到的UDP包源地址计算响应
-                            // 异地代理问题:
-                            //          代理用自己的IP:Port发送UDP包到游戏服务器
-                            //          服务器返回基于代理IP:Port的响应
-                            //          但客户端期望看到基于自己IP:Port的响应
-                            // 解决方案: 同时替换IP字段和端口字段为客户端真实值
-                            if (n >= 7 && buffer[0] == 0x02) {
-                                // 握手响应格式: 02 + IP(4字节,DNF字节序) + Port(2字节,小端序)
-
-                                // 读取服务器返回的IP字段（DNF字节序 [d,c,b,a] 表示 a.b.c.d）
-                                char server_ip_str[20];
-                                sprintf(server_ip_str, "%d.%d.%d.%d", buffer[4], buffer[3], buffer[2], buffer[1]);
-
-                                // 读取服务器返回的端口字段（小端序）
-                                uint16_t server_port_le = ((uint16_t)buffer[6] << 8) | buffer[5];
-
-                                Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                           "] 检测到UDP握手响应，服务器返回: IP=" + string(server_ip_str) +
-                                           ", Port=" + to_string(server_port_le) + " (0x" +
-                                           [](uint16_t v){ char buf[8]; sprintf(buf, "%04x", v); return string(buf); }(server_port_le) + ")");
-
-                                // v5.0关键修复: 替换为客户端真实IP（从payload提取）
-                                // 原因: 游戏客户端期望UDP握手响应IP = 自己的真实IP（payload中的IP）
-                                //      代理发送时已将payload中的IP替换为代理IP
-                                //      游戏服务器返回基于代理IP的响应
-                                //      必须还原为客户端真实IP让客户端验证通过
-                                if (!client_private_ip.empty()) {
-                                    unsigned int a, b, c, d;
-                                    if (sscanf(client_private_ip.c_str(), "%u.%u.%u.%u", &a, &b, &c, &d) == 4) {
-                                        Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                   "] 替换为客户端真实IP: " + client_private_ip + ", Port=" + to_string(client_port));
-
-                                        // 替换IP字段（DNF字节序 [d,c,b,a]）
-                                        buffer[1] = (uint8_t)d;
-                                        buffer[2] = (uint8_t)c;
-                                        buffer[3] = (uint8_t)b;
-                                        buffer[4] = (uint8_t)a;
-
-                                        // 替换端口字段（小端序 [low, high]）
-                                        buffer[5] = (uint8_t)(client_port & 0xFF);         // 低字节
-                                        buffer[6] = (uint8_t)((client_port >> 8) & 0xFF);  // 高字节
-
-                                        Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                   "] ✓ 已替换IP字段和端口字段");
-
-                                        // 打印替换后的payload
-                                        char new_hex[50];
-                                        sprintf(new_hex, "%02x %02x %02x %02x %02x %02x %02x",
-                                               buffer[0], buffer[1], buffer[2], buffer[3],
-                                               buffer[4], buffer[5], buffer[6]);
-                                        Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                   "] 替换后payload: " + string(new_hex));
-                                    } else {
-                                        Logger::warning("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                      "] 客户端IP格式错误: " + client_private_ip);
-                                    }
-                                } else {
-                                    Logger::warning("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                  "] 客户端真实IP为空，无法替换");
-                                }
-                            }
-
-                            // 封装协议：msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
-                            vector<uint8_t> response(11 + n);
-                            response[0] = 0x03;  // msg_type=UDP
-                            *(uint32_t*)(&response[1]) = htonl(conn_id);
-                            *(uint16_t*)(&response[5]) = htons(game_server_port);   // src_port=游戏服务器端口
-                            *(uint16_t*)(&response[7]) = htons(client_port);        // dst_port=客户端端口
-                            *(uint16_t*)(&response[9]) = htons(n);
-                            memcpy(&response[11], buffer, n);
-
-                            // 打印封装后的完整response数据包
-                            string response_hex = "";
-                            int dump_len = min(28, (int)response.size());  // 打印前28字节(协议头11+部分payload)
-                            for (int i = 0; i < dump_len; i++) {
-                                if (i > 0 && i % 16 == 0) {
-                                    response_hex += "\n                    ";
-                                }
-                                char hex_buf[4];
-                                sprintf(hex_buf, "%02x ", response[i]);
-                                response_hex += hex_buf;
-                            }
-                            Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                        "] 封装后数据包(前" + to_string(dump_len) + "字节):\n                    " + response_hex);
-
-                            // 发送到客户端 - 使用互斥锁保护,防止多线程同时send()导致数据损坏
-                            {
-                                lock_guard<mutex> lock(*send_mutex);
-                                Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                           "] →[客户端] 准备发送: " + to_string(response.size()) +
-                                           "字节 (client_fd=" + to_string(client_fd) +
-                                           ", conn_id=" + to_string(conn_id) + ")");
-
-                                int sent = 0;
-                                while (sent < (int)response.size() && *running) {
-                                    int ret = send(client_fd, response.data() + sent,
-                                                 response.size() - sent, 0);
-
-                                    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                               "] send()返回: " + to_string(ret) +
-                                               " (已发送: " + to_string(sent) +
-                                               "/" + to_string(response.size()) + "字节)");
-
-                                    if (ret <= 0) {
-                                        int err = errno;
-                                        Logger::error("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                    "] send()失败: 返回值=" + to_string(ret) +
-                                                    ", errno=" + to_string(err) + " (" + strerror(err) + ")");
-                                        *running = false;
-                                        break;
-                                    }
-                                    sent += ret;
-                                }
-
-                                if (sent == (int)response.size()) {
-                                    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(game_server_port) +
-                                                "] ✓ 成功发送到客户端: " + to_string(response.size()) +
-                                                "字节 (conn_id=" + to_string(conn_id) + ")");
-                                } else {
-                                    Logger::error("[UDP Tunnel|src=" + to_string(src_port) +
-                                                "] ✗ 发送不完整: 仅发送 " + to_string(sent) +
-                                                "/" + to_string(response.size()) + "字节");
-                                }
-                            }
-                        }
-
-                        Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "] 接收线程退出");
-                    } catch (exception& e) {
-                        Logger::error("[UDP Tunnel] 接收线程异常: " + string(e.what()));
-                    }
-                });
-            };
-
-            // 主循环：接收客户端的UDP数据
-            vector<uint8_t> buffer;
-            uint8_t recv_buf[4096];
-
-            Logger::info(uuid_prefix + " 进入UDP转发循环 (client_fd=" + to_string(client_fd) + ")");
-
-            while (*running) {
-                Logger::debug(uuid_prefix + " 等待从客户端接收数据...");
+    void on_tcp_handshake_complete(PendingClient* pending, uint32_t conn_id, uint16_t dst_port,
+                                   const string& session_uuid) {
+        const string client_str = pending->client_str;
+        int client_fd = pending->client_fd;
+        EventLoop* loop = pending->loop;
 
-                int n = recv(client_fd, recv_buf, sizeof(recv_buf), 0);
+        LogSession log_session = Logger::session(conn_id, session_uuid);
+        LOG_EVENT(Logger::PRIORITY_INFO, EVT_CONN_HANDSHAKE, log_session, client_str, dst_port);
 
-                if (n <= 0) {
-                    int err = errno;
-                    if (n == 0) {
-                        Logger::info(uuid_prefix + " 客户端正常断开 (recv返回0)");
-                    } else {
-                        Logger::error(uuid_prefix + " 客户端连接错误 (recv返回" + to_string(n) +
-                                    ", errno=" + to_string(err) + ": " + strerror(err) + ")");
-                    }
-                    break;
-                }
-
-                Logger::info(uuid_prefix + " ←[客户端] 收到 " + to_string(n) + "字节");
+        // 客户端socket交给TunnelConnection
+        loop->unwatch(&pending->watch);
+        pending->watch.owner = nullptr;
+        loop->retire(pending);
 
-                // 添加到缓冲区
-                buffer.insert(buffer.end(), recv_buf, recv_buf + n);
-
-                // 解析协议：msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
-                while (buffer.size() >= 11 && *running) {
-                    uint8_t msg_type = buffer[0];
-                    uint32_t msg_conn_id = ntohl(*(uint32_t*)&buffer[1]);
-                    uint16_t src_port = ntohs(*(uint16_t*)&buffer[5]);
-                    uint16_t dst_port = ntohs(*(uint16_t*)&buffer[7]);
-                    uint16_t data_len = ntohs(*(uint16_t*)&buffer[9]);
+        // v5.0: 从映射中查询客户端真实IPv4
+        string tcp_source_ip = extract_tcp_source_ip(client_str);
+        string client_real_ipv4 = "";
+        {
+            lock_guard<mutex> lock(ip_map_mutex);
+            auto it = client_ip_map.find(tcp_source_ip);
+            if (it != client_ip_map.end()) {
+                client_real_ipv4 = it->second;
+            }
+        }
 
-                    // 检查数据是否完整
-                    if (buffer.size() < static_cast<size_t>(11 + data_len)) {
-                        break;
-                    }
+        // v5.0: 计算代理服务器本地IP(用于连接游戏服务器的本地IP)
+        string proxy_local_ip = get_local_ip(config.game_server_ip);
+
+        LOG_DEBUG("[连接" + to_string(conn_id) + "|" + session_uuid + "] v5.0 IP替换准备: TCP源IP=" + tcp_source_ip +
+                ", 客户端真实IPv4=" + client_real_ipv4 + ", 代理IP=" + proxy_local_ip);
+
+        // 创建连接对象
+        // client_real_ipv4可能为空（TCP连接在UDP tunnel之前建立），传递tcp_source_ip和映射指针支持动态查询
+        auto conn = make_shared<TunnelConnection>(
+            loop, conn_id, client_fd, config.game_server_ip, dst_port,
+            client_real_ipv4,  // client_real_ip (可能为空)
+            proxy_local_ip,    // proxy_ip
+            tcp_source_ip,     // tcp_source_ip (用于动态查询)
+            &client_ip_map,    // IP映射指针
+            &ip_map_mutex,     // 映射互斥锁指针
+            log_session        // 会话UUID及日志会话序号
+        );
+        conn->set_rewrite_policy(rewrite_policy);
+        StatsShard* shard = stats_shards[loop->id()].get();
+        conn->set_stats_shard(shard, latency_per_session);
+        StatsShard::bump(shard->tcp_opened);
+        loop->adopt(conn);
+
+        string conn_key = client_str + ":" + to_string(conn_id);
+        {
+            lock_guard<mutex> lock(conn_mutex);
+            connections[conn_key] = conn;
+        }
+        auto self = shared_from_this();
+        conn->set_on_closed([self, conn_key, shard]() {
+            StatsShard::bump(shard->tcp_closed);
+            lock_guard<mutex> lock(self->conn_mutex);
+            self->connections.erase(conn_key);
+        });
 
-                    if (msg_type != 0x03) {
-                        Logger::warning("[UDP Tunnel] 未知消息类型: " + to_string((int)msg_type));
-                        buffer.erase(buffer.begin(), buffer.begin() + 1);
-                        continue;
-                    }
+        // 发起非阻塞连接，失败时连接自行关闭并从connections中移除
+        conn->start();
+    }
+};
 
-                    // 提取payload
-                    vector<uint8_t> payload(buffer.begin() + 11, buffer.begin() + 11 + data_len);
-                    buffer.erase(buffer.begin(), buffer.begin() + 11 + data_len);
-
-                    Logger::debug("[UDP Tunnel] 解析: conn_id=" + to_string(msg_conn_id) +
-                                ", src=" + to_string(src_port) + ", dst=" + to_string(dst_port) +
-                                ", len=" + to_string(data_len));
-
-                    // v4.7.0: 按源端口获取或创建UDP socket
-                    // v5.1修复: 使用client_str:src_port作为key支持多用户
-                    // v5.1: 构造socket_key = "client_str:src_port" (在块外定义，供后续使用)
-                    string socket_key = client_str + ":" + to_string(src_port);
-
-                    {
-                        lock_guard<mutex> lock(*udp_mutex);
-
-                        // 检查此客户端的源端口是否已有socket
-                        if (udp_sockets->find(socket_key) == udp_sockets->end()) {
-                            // 首次遇到此源端口，创建socket并bind
-                            int udp_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-                            if (udp_fd < 0) {
-                                Logger::error("[UDP Tunnel|src=" + to_string(src_port) +
-                                            "] 创建UDP socket失败");
-                                continue;
-                            }
-
-                            // v4.9.0: 普通bind到源端口（不做源IP欺骗）
-                            // v5.1修复: bind失败时允许系统自动分配（支持多用户共享端口）
-                            // 原因: 多个客户端可能使用相同源端口，第一个成功bind，后续使用自动分配
-                            // v5.2修复: bind到proxy_local_ip而不是INADDR_ANY，解决多网卡环境下UDP路由问题
-                            struct sockaddr_in local_addr{};
-                            local_addr.sin_family = AF_INET;
-                            // 使用proxy_local_ip确保UDP包从正确的网卡发出（与游戏服务器同网段）
-                            if (inet_pton(AF_INET, proxy_ip_for_lambda.c_str(), &local_addr.sin_addr) != 1) {
-                                Logger::warning("[UDP Tunnel|" + socket_key +
-                                              "] proxy_local_ip无效(" + proxy_ip_for_lambda +
-                                              ")，回退到INADDR_ANY");
-                                local_addr.sin_addr.s_addr = INADDR_ANY;
-                            }
-                            local_addr.sin_port = htons(src_port);
-
-                            bool bind_success = true;
-                            if (bind(udp_fd, (struct sockaddr*)&local_addr, sizeof(local_addr)) < 0) {
-                                int bind_err = errno;
-                                if (bind_err == EADDRINUSE) {
-                                    // v5.1: 端口被占用（多用户场景），允许系统自动分配
-                                    Logger::info("[UDP Tunnel|" + socket_key +
-                                                "] 端口" + to_string(src_port) + "已被占用，使用系统自动分配");
-                                    bind_success = false;  // 不bind，系统会自动分配端口
-                                } else {
-                                    Logger::error("[UDP Tunnel|" + socket_key +
-                                                "] bind失败: " + strerror(bind_err));
-                                    close(udp_fd);
-                                    continue;
-                                }
-                            }
-
-                            (*udp_sockets)[socket_key] = udp_fd;
-                            if (bind_success) {
-                                Logger::info("[UDP Tunnel|" + socket_key +
-                                           "] ✓ 创建UDP socket并bind到 " + proxy_ip_for_lambda +
-                                           ":" + to_string(src_port));
-                            } else {
-                                Logger::info("[UDP Tunnel|" + socket_key +
-                                           "] ✓ 创建UDP socket（系统自动分配端口）");
-                            }
-
-                            // 启动接收线程（每个客户端的源端口一个线程）
-                            auto t = create_udp_receiver(socket_key, src_port, client_fd);
-                            (*udp_recv_threads)[socket_key] = t;
-                            Logger::info("[UDP Tunnel|" + socket_key + "] 接收线程已启动");
-                        } else {
-                            Logger::debug("[UDP Tunnel|" + socket_key + "] UDP socket已存在，复用");
-                        }
+// ==================== 延迟日志 ====================
+// v6.20: 每latency_log_interval_sec秒在日志中输出各服务器本周期的延迟分位数(p50/p99/p999/max)
+class LatencyReporter {
+public:
+    static void start(const vector<shared_ptr<TunnelServer>>* server_list, int interval_sec) {
+        servers = server_list;
+        interval = interval_sec;
+        stopping = false;
+        worker = thread(run);
+    }
 
-                        // 保存或更新流元数据
-                        // v5.1: flow_key改为"socket_key:dst_port"支持多用户
-                        string meta_private_ip = client_ipv4.empty() ? real_client_ip : client_ipv4;
-                        string flow_key = socket_key + ":" + to_string(dst_port);
-                        (*flow_metadata)[flow_key] = {msg_conn_id, src_port, dst_port,
-                                                     real_client_ip, meta_private_ip};
+    static void stop() {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
 
-                        Logger::debug("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
-                                    "] 流元数据已保存 (conn_id=" + to_string(msg_conn_id) +
-                                    ", private_ip=" + meta_private_ip + ")");
-                    }
+private:
+    static void run() {
+        unique_lock<mutex> lock(wake_mutex);
+        while (!wake_cv.wait_for(lock, chrono::seconds(interval), [] { return stopping; })) {
+            lock.unlock();
+            for (const auto& server : *servers) server->log_latency(interval);
+            lock.lock();
+        }
+    }
 
-                    // ===== v5.0关键修改: 发送前替换payload中的客户端IP为代理IP =====
-                    // 让游戏服务器认为所有流量来自代理服务器
-                    string private_ip = client_ipv4.empty() ? real_client_ip : client_ipv4;
-
-                    Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
-                                "] 准备替换payload: " + private_ip + " -> " + proxy_ip_for_lambda);
-
-                    int replaced_send = replace_ip_in_payload(
-                        const_cast<uint8_t*>(payload.data()),
-                        payload.size(),
-                        private_ip,
-                        proxy_ip_for_lambda,  // v5.0: 替换为代理IP而不是TCP源IP
-                        0,  // UDP tunnel 没有 conn_id
-                        session_uuid
-                    );
-
-                    if (replaced_send > 0) {
-                        Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
-                                   "] ✓ 已替换发送payload中的IP: " + private_ip + " -> " +
-                                   proxy_ip_for_lambda + " (替换" + to_string(replaced_send) + "处)");
-                    }
+    static const vector<shared_ptr<TunnelServer>>* servers;
+    static int interval;
+    static thread worker;
+    static mutex wake_mutex;
+    static condition_variable wake_cv;
+    static bool stopping;
+};
 
-                    // v4.7.0: 使用源端口的socket发送到目标端口
-                    // v5.1修复: 使用socket_key获取此客户端的socket
-                    int udp_fd = (*udp_sockets)[socket_key];
-
-                    // 解析游戏服务器地址
-                    struct addrinfo hints{}, *result = nullptr;
-                    hints.ai_family = AF_UNSPEC;
-                    hints.ai_socktype = SOCK_DGRAM;
-                    hints.ai_protocol = IPPROTO_UDP;
-
-                    string port_str = to_string(dst_port);
-                    int ret = getaddrinfo(config.game_server_ip.c_str(), port_str.c_str(),
-                                        &hints, &result);
-
-                    if (ret == 0 && result != nullptr) {
-                        int sent = sendto(udp_fd, payload.data(), payload.size(), 0,
-                                        result->ai_addr, result->ai_addrlen);
-                        freeaddrinfo(result);
-
-                        if (sent > 0) {
-                            Logger::info("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
-                                        "] ✓ 成功发送UDP数据: " + config.game_server_ip + ":" +
-                                        to_string(dst_port) + " (" + to_string(sent) + "字节)");
-                        } else {
-                            Logger::error("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
-                                         "] ✗ UDP发送失败 (errno=" + to_string(errno) +
-                                         ": " + strerror(errno) + ")");
-                        }
-                    } else {
-                        Logger::error("[UDP Tunnel|src=" + to_string(src_port) + "|dst=" + to_string(dst_port) +
-                                     "] DNS解析失败: " + config.game_server_ip);
-                    }
-                }
-            }
+const vector<shared_ptr<TunnelServer>>* LatencyReporter::servers = nullptr;
+int LatencyReporter::interval = 0;
+thread LatencyReporter::worker;
+mutex LatencyReporter::wake_mutex;
+condition_variable LatencyReporter::wake_cv;
+bool LatencyReporter::stopping = false;
+
+// ==================== Prometheus指标 ====================
+// v6.19: GET /metrics 的文本格式(version 0.0.4)。只读各服务器的统计分片和DNS缓存的原子计数，不加锁
+
+string prometheus_label(const string& value) {
+    string out;
+    out.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
 
-            // 清理
-            *running = false;
-            Logger::info("[UDP Tunnel] 开始清理资源");
+void metrics_family(string& out, const char* name, const char* type, const char* help) {
+    out.append("# HELP ").append(name).append(1, ' ').append(help).append(1, '\n');
+    out.append("# TYPE ").append(name).append(1, ' ').append(type).append(1, '\n');
+}
 
-            // **关键修复v3.5.1**: 先shutdown再close所有UDP sockets,强制让阻塞的recvfrom()返回
-            // v5.1修复: pair.first已是string类型，无需to_string()
-            for (auto& pair : *udp_sockets) {
-                Logger::debug("[UDP Tunnel|" + pair.first + "] 关闭UDP socket");
-                shutdown(pair.second, SHUT_RDWR);  // 先shutdown,强制唤醒阻塞的recvfrom()
-                close(pair.second);
-            }
+void metrics_sample(string& out, const char* name, const string& labels, uint64_t value) {
+    out.append(name);
+    if (!labels.empty()) out.append(1, '{').append(labels).append(1, '}');
+    out.append(1, ' ').append(to_string(value)).append(1, '\n');
+}
 
-            // 然后等待所有UDP接收线程结束
-            for (auto& pair : *udp_recv_threads) {
-                if (pair.second && pair.second->joinable()) {
-                    Logger::debug("[UDP Tunnel|" + pair.first + "] 等待接收线程结束");
-                    pair.second->join();
-                }
-                // 智能指针自动释放，无需delete - 修复了原来第1324行的线程安全问题!
-            }
+// 桶上界 2^10ns(约1us) .. 2^30ns(约1.07s)，与直方图子桶7的上界对齐
+void metrics_histogram(string& out, const char* name, const string& labels, const LatencySnapshot& latency) {
+    static const int LE_MIN_SHIFT = 10;
+    static const int LE_MAX_SHIFT = 30;
+    string bucket_name = string(name) + "_bucket";
+    char value[32];
+    uint64_t cumulative = 0;
+    int index = 0;
+    for (int shift = LE_MIN_SHIFT; shift <= LE_MAX_SHIFT; shift++) {
+        uint64_t le_ns = 1ULL << shift;
+        for (; index < LatencyHistogram::BUCKETS && LatencyHistogram::bucket_upper(index) <= le_ns; index++) {
+            cumulative += latency.counts[index];
+        }
+        snprintf(value, sizeof(value), "%.10g", le_ns / 1e9);
+        metrics_sample(out, bucket_name.c_str(), labels + ",le=\"" + value + "\"", cumulative);
+    }
+    for (; index < LatencyHistogram::BUCKETS; index++) cumulative += latency.counts[index];
+    metrics_sample(out, bucket_name.c_str(), labels + ",le=\"+Inf\"", cumulative);
+    snprintf(value, sizeof(value), "%.9f", latency.sum_ns / 1e9);
+    out.append(name).append("_sum{").append(labels).append("} ").append(value).append(1, '\n');
+    metrics_sample(out, (string(name) + "_count").c_str(), labels, cumulative);
+}
 
-            close(client_fd);
-            Logger::info("[UDP Tunnel] 连接已关闭");
+string build_metrics_text(const vector<shared_ptr<TunnelServer>>& servers) {
+    vector<unique_ptr<ServerStatsSnapshot>> snaps;
+    vector<string> labels;
+    for (const auto& server : servers) {
+        snaps.emplace_back(new ServerStatsSnapshot());
+        server->snapshot(*snaps.back());
+        labels.push_back("server=\"" + prometheus_label(server->name()) + "\"");
+    }
 
-        } catch (exception& e) {
-            Logger::error("[UDP Tunnel] 异常: " + string(e.what()));
-            close(client_fd);
+    string out;
+    out.reserve(4096 + servers.size() * 4096);
+
+    metrics_family(out, "dnf_tunnel_tcp_connections", "gauge", "当前TCP隧道连接数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_tcp_connections", labels[i], snaps[i]->tcp_connections);
+    metrics_family(out, "dnf_tunnel_udp_tunnels", "gauge", "当前UDP隧道数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_udp_tunnels", labels[i], snaps[i]->udp_tunnels);
+    metrics_family(out, "dnf_tunnel_tcp_connections_total", "counter", "累计建立的TCP隧道连接数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_tcp_connections_total", labels[i], snaps[i]->tcp_total);
+    metrics_family(out, "dnf_tunnel_udp_tunnels_total", "counter", "累计建立的UDP隧道数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_udp_tunnels_total", labels[i], snaps[i]->udp_total);
+
+    metrics_family(out, "dnf_tunnel_frames_total", "counter", "转发的帧数");
+    for (size_t i = 0; i < snaps.size(); i++) {
+        metrics_sample(out, "dnf_tunnel_frames_total", labels[i] + ",direction=\"to_game\"", snaps[i]->counters[STAT_FRAMES_TO_GAME]);
+        metrics_sample(out, "dnf_tunnel_frames_total", labels[i] + ",direction=\"to_client\"", snaps[i]->counters[STAT_FRAMES_TO_CLIENT]);
+    }
+    metrics_family(out, "dnf_tunnel_bytes_total", "counter", "转发的负载字节数");
+    for (size_t i = 0; i < snaps.size(); i++) {
+        metrics_sample(out, "dnf_tunnel_bytes_total", labels[i] + ",direction=\"to_game\"", snaps[i]->counters[STAT_BYTES_TO_GAME]);
+        metrics_sample(out, "dnf_tunnel_bytes_total", labels[i] + ",direction=\"to_client\"", snaps[i]->counters[STAT_BYTES_TO_CLIENT]);
+    }
+    metrics_family(out, "dnf_tunnel_heartbeats_total", "counter", "收到的客户端心跳数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_heartbeats_total", labels[i], snaps[i]->counters[STAT_HEARTBEATS]);
+    metrics_family(out, "dnf_tunnel_ip_rewrite_hits_total", "counter", "游戏数据中替换的IP个数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_ip_rewrite_hits_total", labels[i], snaps[i]->counters[STAT_REWRITE_HITS]);
+    metrics_family(out, "dnf_tunnel_send_failures_total", "counter", "发送失败次数");
+    for (size_t i = 0; i < snaps.size(); i++) metrics_sample(out, "dnf_tunnel_send_failures_total", labels[i], snaps[i]->counters[STAT_SEND_FAILURES]);
+
+    metrics_family(out, "dnf_tunnel_forward_latency_seconds", "histogram", "recv返回到帧发出的时间(每帧一个样本)");
+    for (size_t i = 0; i < snaps.size(); i++) {
+        for (int d = LAT_TO_GAME; d <= LAT_TO_CLIENT; d++) {
+            string direction = labels[i] + ",direction=\"" + LAT_NAMES[d] + "\"";
+            metrics_histogram(out, "dnf_tunnel_forward_latency_seconds", direction, snaps[i]->latency[d]);
         }
     }
-};
+    metrics_family(out, "dnf_tunnel_client_send_blocked_seconds", "histogram", "客户端socket发送缓冲满到数据写完的时间(每次阻塞一个样本)");
+    for (size_t i = 0; i < snaps.size(); i++) {
+        metrics_histogram(out, "dnf_tunnel_client_send_blocked_seconds", labels[i], snaps[i]->latency[LAT_CLIENT_BLOCKED]);
+    }
+    metrics_family(out, "dnf_tunnel_client_rtt_seconds", "histogram", "v2心跳测得的客户端往返时间(每次心跳一个样本)");
+    for (size_t i = 0; i < snaps.size(); i++) {
+        metrics_histogram(out, "dnf_tunnel_client_rtt_seconds", labels[i], snaps[i]->latency[LAT_CLIENT_RTT]);
+    }
+    metrics_family(out, "dnf_tunnel_game_rtt_seconds", "histogram", "收到心跳时到游戏服务器的TCP平滑RTT(每次心跳一个样本)");
+    for (size_t i = 0; i < snaps.size(); i++) {
+        metrics_histogram(out, "dnf_tunnel_game_rtt_seconds", labels[i], snaps[i]->latency[LAT_GAME_RTT]);
+    }
+    metrics_family(out, "dnf_tunnel_latency_max_seconds", "gauge", "启动以来的最大值");
+    char value[32];
+    for (size_t i = 0; i < snaps.size(); i++) {
+        for (int d = 0; d < LAT_COUNT; d++) {
+            snprintf(value, sizeof(value), "%.9f", snaps[i]->latency[d].max_ns / 1e9);
+            out.append("dnf_tunnel_latency_max_seconds{").append(labels[i]).append(",kind=\"").append(LAT_NAMES[d]);
+            out.append("\"} ").append(value).append(1, '\n');
+        }
+    }
+
+    metrics_family(out, "dnf_dns_cache_entries", "gauge", "DNS缓存条目数");
+    metrics_sample(out, "dnf_dns_cache_entries", "", DnsCache::entries_count());
+    metrics_family(out, "dnf_dns_cache_hits_total", "counter", "DNS缓存命中次数");
+    metrics_sample(out, "dnf_dns_cache_hits_total", "", DnsCache::hit_count());
+    metrics_family(out, "dnf_dns_cache_misses_total", "counter", "DNS缓存未命中次数");
+    metrics_sample(out, "dnf_dns_cache_misses_total", "", DnsCache::miss_count());
+    metrics_family(out, "dnf_dns_cache_refreshes_total", "counter", "后台重新解析次数");
+    metrics_sample(out, "dnf_dns_cache_refreshes_total", "", DnsCache::refresh_count());
+    metrics_family(out, "dnf_dns_cache_failures_total", "counter", "解析失败次数");
+    metrics_sample(out, "dnf_dns_cache_failures_total", "", DnsCache::failure_count());
+    return out;
+}
 
 // ==================== 辅助函数 ====================
 int extract_number(const string& str) {
@@ -2163,7 +4239,7 @@ GlobalConfig load_config(const string& filename) {
 
     ifstream file(filename);
     if (!file.is_open()) {
-        Logger::warning("配置文件不存在: " + filename + "，使用默认配置");
+        LOG_WARN("配置文件不存在: " + filename + "，使用默认配置");
         // 返回包含一个默认服务器的配置
         ServerConfig default_server;
         global_config.servers.push_back(default_server);
@@ -2244,6 +4320,30 @@ GlobalConfig load_config(const string& filename) {
                         if (num > 0) current_server.max_connections = num;
                     }
                 }
+                else if (line.find("\"acceptor_shards\"") != string::npos) {
+                    size_t pos = line.find(":");
+                    if (pos != string::npos) {
+                        int num = extract_number(line.substr(pos + 1));
+                        if (num > 0) current_server.acceptor_shards = num;
+                    }
+                }
+                else if (line.find("\"reuseport_bpf\"") != string::npos) {
+                    current_server.reuseport_bpf = line.find("true") != string::npos;
+                }
+                else if (line.find("\"ip_rewrite\"") != string::npos) {
+                    size_t start = line.find("\"", line.find(":")) + 1;
+                    size_t end = line.find("\"", start);
+                    if (start != string::npos && end != string::npos) {
+                        current_server.ip_rewrite = line.substr(start, end - start);
+                    }
+                }
+                else if (line.find("\"game_msg_format\"") != string::npos) {
+                    size_t start = line.find("\"", line.find(":")) + 1;
+                    size_t end = line.find("\"", start);
+                    if (start != string::npos && end != string::npos) {
+                        current_server.game_msg_format = line.substr(start, end - start);
+                    }
+                }
             }
         }
 
@@ -2256,6 +4356,155 @@ GlobalConfig load_config(const string& filename) {
             }
         }
 
+        // 解析全局worker_threads
+        if (!in_servers_array && line.find("\"worker_threads\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.worker_threads = num;
+            }
+        }
+
+        // 解析全局io_backend
+        if (!in_servers_array && line.find("\"io_backend\"") != string::npos) {
+            size_t start = line.find("\"", line.find(":")) + 1;
+            size_t end = line.find("\"", start);
+            if (start != string::npos && end != string::npos) {
+                global_config.io_backend = line.substr(start, end - start);
+            }
+        }
+
+        // 解析全局写合并参数
+        if (!in_servers_array && line.find("\"coalesce_max_bytes\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.coalesce_max_bytes = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"coalesce_max_delay_us\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.coalesce_max_delay_us = num;
+            }
+        }
+
+        // 解析全局DNS刷新间隔
+        if (!in_servers_array && line.find("\"dns_refresh_sec\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.dns_refresh_sec = num;
+            }
+        }
+
+        // 解析全局UDP批量收发个数
+        if (!in_servers_array && line.find("\"udp_batch\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num > 0) global_config.udp_batch = min(num, (int)UDP_BATCH_MAX);
+            }
+        }
+
+        // 解析全局UDP空闲回收时间
+        if (!in_servers_array && line.find("\"udp_idle_timeout_sec\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.udp_idle_timeout_sec = num;
+            }
+        }
+
+        // 解析全局异步日志参数
+        if (!in_servers_array && line.find("\"log_flush_interval_ms\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num > 0) global_config.log_flush_interval_ms = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"log_flush_bytes\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num > 0) global_config.log_flush_bytes = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"log_queue_full\"") != string::npos) {
+            size_t start = line.find("\"", line.find(":")) + 1;
+            size_t end = line.find("\"", start);
+            if (start != string::npos && end != string::npos) {
+                global_config.log_queue_full = line.substr(start, end - start);
+            }
+        }
+        if (!in_servers_array && line.find("\"log_console\"") != string::npos) {
+            global_config.log_console = line.find("true") != string::npos;
+        }
+        if (!in_servers_array && line.find("\"log_format\"") != string::npos) {
+            size_t start = line.find("\"", line.find(":")) + 1;
+            size_t end = line.find("\"", start);
+            if (start != string::npos && end != string::npos) {
+                global_config.log_format = line.substr(start, end - start);
+            }
+        }
+        if (!in_servers_array && line.find("\"log_rotate_mb\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.log_rotate_mb = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"log_rotate_hours\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.log_rotate_hours = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"log_keep_files\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.log_keep_files = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"log_compress\"") != string::npos) {
+            global_config.log_compress = line.find("true") != string::npos;
+        }
+        if (!in_servers_array && line.find("\"log_max_bytes_per_sec\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.log_max_bytes_per_sec = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"metrics_port\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0 && num <= 65535) global_config.metrics_port = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"latency_per_session\"") != string::npos) {
+            global_config.latency_per_session = line.find("true") != string::npos;
+        }
+        if (!in_servers_array && line.find("\"latency_log_interval_sec\"") != string::npos) {
+            size_t pos = line.find(":");
+            if (pos != string::npos) {
+                int num = extract_number(line.substr(pos + 1));
+                if (num >= 0) global_config.latency_log_interval_sec = num;
+            }
+        }
+        if (!in_servers_array && line.find("\"metrics_bind\"") != string::npos) {
+            size_t start = line.find("\"", line.find(":")) + 1;
+            size_t end = line.find("\"", start);
+            if (start != string::npos && end != string::npos) {
+                global_config.metrics_bind = line.substr(start, end - start);
+            }
+        }
+
         // 解析API配置 (简单判断:在api_config后面的字段)
         static bool in_api_config = false;
         if (line.find("\"api_config\"") != string::npos) {
@@ -2297,7 +4546,7 @@ GlobalConfig load_config(const string& filename) {
 
     // 如果没有解析到任何服务器，添加默认服务器
     if (global_config.servers.empty()) {
-        Logger::warning("配置文件中未找到服务器配置，使用默认配置");
+        LOG_WARN("配置文件中未找到服务器配置，使用默认配置");
         ServerConfig default_server;
         global_config.servers.push_back(default_server);
     }
@@ -2330,6 +4579,18 @@ bool generate_default_config(const string& filename) {
     file << "// max_connections  - 最大并发连接数\n";
     file << "//                    根据服务器性能调整，建议 50-500\n";
     file << "//\n";
+    file << "// acceptor_shards  - 监听分片数（可选，默认1）\n";
+    file << "//                    大于1时使用SO_REUSEPORT，多个worker同时accept\n";
+    file << "//\n";
+    file << "// reuseport_bpf    - 按客户端IP选择监听分片（可选，默认false）\n";
+    file << "//\n";
+    file << "// ip_rewrite       - payload中客户端IP替换规则（可选，默认scan）\n";
+    file << "//                    scan: 扫描全部数据  off: 不替换  head:N: 只扫描每条游戏消息前N字节\n";
+    file << "//                    offsets:OP@A,B;OP2@C: 只检查指定opcode消息中偏移A、B处的IP\n";
+    file << "// game_msg_format  - 游戏消息头格式（head/offsets规则使用），例如:\n";
+    file << "//                    len_offset=0,len_size=2,len_adjust=0,opcode_offset=2,opcode_size=2,endian=little\n";
+    file << "//                    消息总长=长度字段+len_adjust；UDP每个数据报为一条消息\n";
+    file << "//\n";
     file << "// download_url     - 客户端下载地址（可选）\n";
     file << "//                    HTTP/HTTPS链接，用于客户端GUI显示下载地址\n";
     file << "//                    例如: http://192.168.2.22:5244/d/DOF/客户端.7z\n";
@@ -2337,6 +4598,40 @@ bool generate_default_config(const string& filename) {
     file << "// log_level        - 全局日志级别: DEBUG, INFO, WARN, ERROR\n";
     file << "//                    生产环境建议使用 INFO\n";
     file << "//\n";
+    file << "// worker_threads   - 事件循环线程数（所有服务器共用）\n";
+    file << "//                    0 表示使用CPU核数\n";
+    file << "//\n";
+    file << "// io_backend       - I/O后端: epoll 或 io_uring\n";
+    file << "//                    io_uring需要内核6.0+，不支持时自动回退epoll\n";
+    file << "//\n";
+    file << "// coalesce_max_bytes    - 写合并: 同一轮事件中发往同一客户端的小帧合并为一次send\n";
+    file << "//                         合并数据达到该字节数时立即发送，0 表示关闭合并（默认16384）\n";
+    file << "// coalesce_max_delay_us - 写合并最多额外等待的微秒数，0 表示不增加延迟（默认0）\n";
+    file << "//\n";
+    file << "// dns_refresh_sec  - game_server_ip为域名时重新解析的间隔秒数（默认60）\n";
+    file << "//                    解析结果缓存，0 表示只在启动时解析；IP地址不受影响\n";
+    file << "//\n";
+    file << "// udp_batch        - UDP批量收发: 每次recvmmsg/sendmmsg最多处理的数据报个数（1-128，默认32）\n";
+    file << "// udp_idle_timeout_sec - 按端口创建的UDP socket空闲超过该秒数后关闭（默认300）\n";
+    file << "//                    之后再有数据时重新创建，0 表示保留到隧道关闭\n";
+    file << "//\n";
+    file << "// log_flush_interval_ms - 日志由后台线程批量写入，最长等待的毫秒数（默认100）\n";
+    file << "// log_flush_bytes  - 积压日志达到该字节数时立即写入（默认65536）\n";
+    file << "// log_queue_full   - 日志队列满时: drop 丢弃并计数（默认），block 等待写入\n";
+    file << "// log_console      - 日志同时输出到控制台（默认true）\n";
+    file << "// log_format       - 日志文件格式: text（默认）或 binary\n";
+    file << "//                    binary写入log/server_log_*.bin，用 dnf-log-decode 转为文本/JSON并按会话或连接过滤\n";
+    file << "// log_rotate_mb    - 日志文件超过该大小(MB)时换新文件（默认100），0 表示不按大小轮转\n";
+    file << "// log_rotate_hours - 日志文件写入超过该小时数时换新文件（默认24），0 表示不按时间轮转\n";
+    file << "// log_keep_files   - 最多保留的日志文件个数，含当前文件（默认0，全部保留）\n";
+    file << "// log_compress     - 轮转出的旧文件用gzip压缩，低I/O优先级后台执行（默认true）\n";
+    file << "// log_max_bytes_per_sec - 每秒最多写入日志文件的字节数（默认0，不限制）\n";
+    file << "//                    超出部分丢弃并计数（ERROR日志除外），避免DEBUG日志占满磁盘I/O\n";
+    file << "// metrics_port     - Prometheus指标端口，HTTP GET /metrics（默认0，不启用）\n";
+    file << "// metrics_bind     - 指标端口的监听地址（默认127.0.0.1，只允许本机抓取）\n";
+    file << "// latency_per_session - 每个会话另外记录延迟直方图，每会话约7KB内存（默认false）\n";
+    file << "// latency_log_interval_sec - 每隔该秒数在日志中输出延迟p50/p99/p999/max（默认60，0不输出）\n";
+    file << "//\n";
     file << "// ============================================================\n";
     file << "//\n";
     file << "// 配置示例:\n";
@@ -2405,6 +4700,8 @@ bool generate_default_config(const string& filename) {
     file << "    }\n";
     file << "  ],\n";
     file << "  \"log_level\": \"INFO\",\n";
+    file << "  \"worker_threads\": 0,\n";
+    file << "  \"io_backend\": \"epoll\",\n";
     file << "  \"api_config\": {\n";
     file << "    \"enabled\": true,\n";
     file << "    \"port\": 33231,\n";
@@ -2427,6 +4724,7 @@ void signal_handler(int signum) {
 
     // 其他信号: 崩溃处理
     // 只使用异步信号安全的函数: write(), backtrace(), backtrace_symbols_fd()
+    Logger::flush_on_crash();  // v6.14: 异步队列中还没写出的日志
     const char* msg1 = "\n========================================\n!!! CRASH DETECTED !!!\nSignal: ";
     ssize_t ret;  // 用于接收返回值，避免编译警告
     ret = write(STDERR_FILENO, msg1, strlen(msg1));
@@ -2468,7 +4766,7 @@ void install_signal_handlers() {
     signal(SIGILL, signal_handler);   // Illegal Instruction
     signal(SIGHUP, signal_handler);   // Hangup - 用于热重载配置
 
-    Logger::info("信号处理器已安装 (SIGSEGV, SIGABRT, SIGFPE, SIGILL, SIGHUP)");
+    LOG_INFO("信号处理器已安装 (SIGSEGV, SIGABRT, SIGFPE, SIGILL, SIGHUP)");
 }
 
 // ==================== 主函数 ====================
@@ -2476,22 +4774,16 @@ int main() {
     // 创建log目录（如果不存在）
     mkdir("log", 0755);
 
-    // 生成带时间戳的日志文件名(使用北京时间UTC+8)
-    auto now = chrono::system_clock::now();
-    auto beijing_time = chrono::system_clock::to_time_t(now + chrono::hours(8));
-    stringstream log_filename;
-    log_filename << "log/server_log_" << put_time(gmtime(&beijing_time), "%Y%m%d_%H%M%S") << ".txt";
-
-    // 初始化日志系统
-    Logger::init(log_filename.str());
+    // 初始化日志系统，文件名带时间戳(使用北京时间UTC+8): log/server_log_YYYYMMDD_HHMMSS.txt
+    Logger::init("log/server_log_", ".txt");
 
     // 安装信号处理器
     install_signal_handlers();
 
     cout << "============================================================" << endl;
-    cout << "DNF多端口隧道服务器 v3.6.1 (C++ 版本 - Python架构)" << endl;
+    cout << "DNF多端口隧道服务器 v6.0 (C++ 版本 - epoll事件循环)" << endl;
     cout << "支持 TCP + UDP 双协议转发 + 多游戏服务器" << endl;
-    cout << "v3.6.1: forward后主动reset shared_ptr防止析构在线程内执行" << endl;
+    cout << "v6.0: 固定worker线程 + 非阻塞socket，不再为每个连接创建线程" << endl;
     cout << "============================================================" << endl;
     cout << endl;
 
@@ -2509,8 +4801,8 @@ int main() {
         cout << "========================================" << endl;
         cout << endl;
 
-        Logger::info("未找到配置文件: " + config_file);
-        Logger::info("正在生成默认配置文件...");
+        LOG_INFO("未找到配置文件: " + config_file);
+        LOG_INFO("正在生成默认配置文件...");
 
         if (generate_default_config(config_file)) {
             cout << "✓ 配置文件已生成: " << config_file << endl;
@@ -2528,13 +4820,13 @@ int main() {
             cout << "----------------------------------------" << endl;
             cout << endl;
 
-            Logger::info("配置文件已生成，等待用户配置");
-            Logger::info("程序退出，请修改配置后重新启动");
+            LOG_INFO("配置文件已生成，等待用户配置");
+            LOG_INFO("程序退出，请修改配置后重新启动");
             Logger::close();
             return 0;  // 正常退出
         } else {
             cout << "✗ 生成配置文件失败" << endl;
-            Logger::error("无法创建配置文件: " + config_file);
+            LOG_ERROR("无法创建配置文件: " + config_file);
             Logger::close();
             return 1;  // 错误退出
         }
@@ -2545,61 +4837,128 @@ int main() {
 
     // 设置日志级别
     Logger::set_log_level(global_config.log_level);
+    Logger::configure(global_config.log_flush_interval_ms, (size_t)global_config.log_flush_bytes,
+                      global_config.log_queue_full == "block", global_config.log_console);
+    Logger::configure_files(global_config.log_rotate_mb, global_config.log_rotate_hours,
+                            global_config.log_keep_files, global_config.log_compress,
+                            (size_t)global_config.log_max_bytes_per_sec);
+
+    // v6.16: 二进制日志: 文本日志文件只保留启动信息，之后写入log/server_log_*.bin
+    if (global_config.log_format == "binary") {
+        LOG_INFO("日志改为二进制格式: log/server_log_*.bin (用dnf-log-decode查看)");
+        Logger::close();
+        Logger::init("log/server_log_", ".bin", true);
+    }
 
-    Logger::info("配置加载完成，共 " + to_string(global_config.servers.size()) + " 个服务器");
-    Logger::info("日志级别: " + global_config.log_level);
+    LOG_INFO("配置加载完成，共 " + to_string(global_config.servers.size()) + " 个服务器");
+    LOG_INFO("日志级别: " + global_config.log_level);
     cout << endl;
 
     // 显示所有服务器配置
     for (size_t i = 0; i < global_config.servers.size(); i++) {
         const ServerConfig& srv = global_config.servers[i];
-        Logger::info("[" + srv.name + "] 端口:" + to_string(srv.listen_port) +
-                    " → " + srv.game_server_ip +
-                    " (最大连接:" + to_string(srv.max_connections) + ")");
+        LOG_INFO("[" + srv.name + "] 端口:" + to_string(srv.listen_port) +
+                " → " + srv.game_server_ip +
+                " (最大连接:" + to_string(srv.max_connections) + ")");
     }
     cout << endl;
 
+    // v6.8: 预解析所有游戏服务器地址，之后由后台线程刷新
+    for (const ServerConfig& srv : global_config.servers) {
+        DnsCache::preresolve(srv.game_server_ip, SOCK_STREAM);
+        DnsCache::preresolve(srv.game_server_ip, SOCK_DGRAM);
+    }
+    DnsCache::start(global_config.dns_refresh_sec);
+
+    // v6.0: 启动事件循环线程，所有服务器共用
+    ReactorPool reactor;
+    IoBackend backend = BACKEND_EPOLL;
+    if (global_config.io_backend == "io_uring") {
+        backend = BACKEND_IO_URING;
+    } else if (global_config.io_backend != "epoll") {
+        LOG_WARN("未知的io_backend: " + global_config.io_backend + "，使用epoll");
+    }
+    if (!reactor.start(global_config.worker_threads, backend,
+                       (size_t)global_config.coalesce_max_bytes,
+                       (uint64_t)global_config.coalesce_max_delay_us,
+                       (size_t)global_config.udp_batch,
+                       (uint64_t)global_config.udp_idle_timeout_sec * 1000)) {
+        LOG_ERROR("事件循环启动失败");
+        DnsCache::stop();
+        Logger::close();
+        return 1;
+    }
+
     // 创建所有TunnelServer实例 - 使用智能指针
     vector<shared_ptr<TunnelServer>> servers;
-    vector<shared_ptr<thread>> server_threads;
 
     for (const ServerConfig& srv_cfg : global_config.servers) {
-        auto server = make_shared<TunnelServer>(srv_cfg);
+        auto server = make_shared<TunnelServer>(srv_cfg, &reactor, global_config.latency_per_session);
         servers.push_back(server);
     }
 
-    Logger::info("正在启动所有隧道服务器...");
+    LOG_INFO("正在启动所有隧道服务器...");
 
-    // 在独立线程中启动每个服务器
+    // 监听socket注册到事件循环后立即返回
     for (auto server : servers) {
-        auto t = make_shared<thread>([server]() {
-            server->start();
-        });
-        server_threads.push_back(t);
+        server->start();
     }
 
-    Logger::info("所有隧道服务器已启动");
+    LOG_INFO("所有隧道服务器已启动");
     cout << endl;
 
+    // v6.20: 周期输出延迟分位数
+    if (global_config.latency_log_interval_sec > 0) {
+        LatencyReporter::start(&servers, global_config.latency_log_interval_sec);
+    }
+
+    // v6.18: GET_STATS [服务器名称] 返回转发统计，指定名称时附带每个会话
+    set_tcp_config_stats_provider([&servers](const string& name) -> string {
+        string json = "{\"servers\":[";
+        bool found = false;
+        for (auto& server : servers) {
+            if (!name.empty() && server->name() != name) continue;
+            if (found) json += ',';
+            server->stats_json(json, !name.empty());
+            found = true;
+        }
+        if (!found && !name.empty()) return "";
+        return json + "]}";
+    });
+
     // 启动HTTP API服务器 (用于多服务器客户端)
     pthread_t api_thread = 0;
     if (global_config.api_config.enabled) {
-        Logger::info("正在启动TCP配置服务器...");
-        Logger::info("API配置: 端口=" + to_string(global_config.api_config.port) +
-                    ", 隧道服务器IP=" + global_config.api_config.tunnel_server_ip);
+        LOG_INFO("正在启动TCP配置服务器...");
+        LOG_INFO("API配置: 端口=" + to_string(global_config.api_config.port) +
+                ", 隧道服务器IP=" + global_config.api_config.tunnel_server_ip);
 
         api_thread = start_tcp_config_server(config_file.c_str(),
                                              global_config.api_config.tunnel_server_ip.c_str(),
                                              global_config.api_config.port);
         if (api_thread == 0) {
-            Logger::error("TCP配置服务器启动失败");
+            LOG_ERROR("TCP配置服务器启动失败");
         } else {
-            Logger::info("TCP配置服务器已启动在端口 " + to_string(global_config.api_config.port));
+            LOG_INFO("TCP配置服务器已启动在端口 " + to_string(global_config.api_config.port));
             cout << "TCP配置服务器: " << global_config.api_config.tunnel_server_ip
-                 << ":" << global_config.api_config.port << " (协议: GET_SERVERS)" << endl;
+                 << ":" << global_config.api_config.port << " (协议: GET_SERVERS / GET_STATS)" << endl;
         }
     } else {
-        Logger::info("HTTP API服务器已禁用 (在config.json中设置api_config.enabled=true启用)");
+        LOG_INFO("HTTP API服务器已禁用 (在config.json中设置api_config.enabled=true启用)");
+    }
+
+    // v6.19: Prometheus指标服务器，抓取只读统计分片，不与转发线程争锁
+    pthread_t metrics_thread = 0;
+    if (global_config.metrics_port > 0) {
+        metrics_thread = start_http_api_server(global_config.metrics_bind.c_str(), global_config.metrics_port,
+                                               [&servers]() { return build_metrics_text(servers); });
+        if (metrics_thread == 0) {
+            LOG_ERROR("指标服务器启动失败: " + global_config.metrics_bind + ":" +
+                      to_string(global_config.metrics_port));
+        } else {
+            LOG_INFO("指标服务器已启动: http://" + global_config.metrics_bind + ":" +
+                     to_string(global_config.metrics_port) + "/metrics");
+        }
     }
 
     cout << endl;
@@ -2609,24 +4968,34 @@ int main() {
     cout << "  • 查看进程ID: echo $$" << endl;
     cout << "============================================================" << endl;
 
-    // 等待所有线程
-    for (auto t : server_threads) {
-        if (t->joinable()) {
-            t->join();
-        }
+    // 等待所有事件循环线程
+    reactor.join();
+    DnsCache::stop();
+    for (auto server : servers) {
+        server->log_rewrite_stats();
+    }
+
+    if (global_config.latency_log_interval_sec > 0) {
+        LatencyReporter::stop();
+    }
+
+    // v6.19: 停止指标服务器
+    if (metrics_thread != 0) {
+        stop_http_api_server();
+        pthread_join(metrics_thread, NULL);
+        LOG_INFO("指标服务器已停止");
     }
 
     // 停止TCP配置服务器
     if (api_thread != 0) {
-        Logger::info("正在停止TCP配置服务器...");
+        LOG_INFO("正在停止TCP配置服务器...");
         stop_tcp_config_server();
         pthread_join(api_thread, NULL);
-        Logger::info("TCP配置服务器已停止");
+        LOG_INFO("TCP配置服务器已停止");
     }
 
     // 智能指针自动清理，无需手动delete
-    Logger::info("所有服务器已正常关闭");
-    server_threads.clear();
+    LOG_INFO("所有服务器已正常关闭");
     servers.clear();
 
     Logger::close();
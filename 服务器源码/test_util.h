@@ -0,0 +1,71 @@
+/*
+ * 单元测试辅助 (make test，仅头文件，无外部依赖)
+ *
+ * TEST(name) { ... } 定义用例，main中调用 run_all_tests() 依次运行
+ * CHECK(cond) / CHECK_EQ(a, b) 失败时输出位置并记录，不中断当前用例
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <cstdio>
+#include <vector>
+
+struct TestCase {
+    const char* name;
+    void (*fn)();
+};
+
+inline std::vector<TestCase>& test_registry() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+inline int& test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct TestRegistrar {
+    TestRegistrar(const char* name, void (*fn)()) { test_registry().push_back(TestCase{name, fn}); }
+};
+
+#define TEST(name)                                              \
+    static void test_##name();                                  \
+    static TestRegistrar test_registrar_##name(#name, test_##name); \
+    static void test_##name()
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "  %s:%d: CHECK(%s) 失败\n", __FILE__, __LINE__, #cond); \
+            test_failures()++;                                                 \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                         \
+    do {                                                                                       \
+        long long check_a = (long long)(a);                                                    \
+        long long check_b = (long long)(b);                                                    \
+        if (check_a != check_b) {                                                              \
+            fprintf(stderr, "  %s:%d: CHECK_EQ(%s, %s) 失败: %lld != %lld\n", __FILE__, __LINE__, \
+                    #a, #b, check_a, check_b);                                                 \
+            test_failures()++;                                                                 \
+        }                                                                                      \
+    } while (0)
+
+// 运行全部用例，返回进程退出码
+inline int run_all_tests(const char* suite) {
+    int failed_tests = 0;
+    for (const TestCase& t : test_registry()) {
+        int before = test_failures();
+        t.fn();
+        bool ok = test_failures() == before;
+        if (!ok) failed_tests++;
+        printf("%s %s/%s\n", ok ? "PASS" : "FAIL", suite, t.name);
+    }
+    printf("%s: %zu个用例，%d个失败\n", suite, test_registry().size(), failed_tests);
+    return failed_tests == 0 ? 0 : 1;
+}
+
+#endif // TEST_UTIL_H
@@ -0,0 +1,2393 @@
+/*
+ * dnf-tunnel-bench - 隧道服务器压测工具
+ *
+ * 用法: dnf-tunnel-bench [选项]
+ *   --server HOST:PORT      隧道服务器地址(默认127.0.0.1:33223)
+ *   --game-port N           握手中的目标端口，也是内置游戏服务器的监听端口(默认10011)
+ *   --game echo|sink|none   内置游戏服务器: echo原样返回(客户端测往返延迟)，sink只接收(游戏端测单程延迟)，
+ *                           none不启动(使用已监听该端口的echo服务器)
+ *   --connections N         并发连接数(默认16)
+ *   --threads N             客户端线程数(默认1)
+ *   --duration SEC          统计时长(默认10)
+ *   --warmup SEC            预热时长，不计入结果(默认1)
+ *   --size N | MIN-MAX      每条消息(一个0x01帧的payload)的字节数，范围时均匀随机(默认64，最小16)
+ *   --rate N                每个连接每秒发送的消息数，0=不限速(默认0)
+ *   --window N              echo不限速时每个连接最多未返回的消息数(默认16)
+ *   --heartbeat-ms N        心跳间隔，0=不发送(默认0)
+ *   --heartbeat-v2          发送带时间戳的v2心跳
+ *   --churn-ms N            每个连接存活N毫秒后关闭，以新conn_id重连，0=不重连(默认0)
+ *   --burst N               突发模式: 内置游戏服务器每--burst-ms毫秒在每个连接上连续发出N条消息(每条一次send)，
+ *                           客户端不发消息，记录游戏服务器→客户端的单程延迟，0=关闭(默认0)
+ *   --burst-ms N            突发间隔(默认10)
+ *   --json FILE             结果写入文件(默认标准输出)
+ *   --server-pid PID        隧道服务器进程号(本机)。tcp/udp: 统计窗口内服务器的系统调用数(perf raw_syscalls，需要root)、
+ *                           线程数、上下文切换次数和CPU时间(/proc/PID/stat的utime+stime)，输出每转发一帧的系统调用数、
+ *                           每1k pps的上下文切换、服务器占用的核数(tcp另输出每核连接数)；teardown: 见下
+ *   --mode tcp|udp|teardown tcp: 0x01帧TCP转发(默认)；udp: UDP隧道(0x03帧)，--connections为隧道数；
+ *                           teardown: 隧道开闭压测，--connections为开闭的隧道总数
+ * UDP模式选项:
+ *   --ports M               每个隧道的客户端源端口数(默认1)，--rate为每个源端口每秒的数据报数(默认50)
+ *   --src-port-base N       第一个源端口(默认20000)，隧道i第m个端口为 N + i*M + m
+ *   --client-ip IP          握手中上报的客户端IPv4，各字节须<0x80(默认10.1.2.3)
+ *   --probe-every K         每个端口每K个数据报中有一个0x01探测包，0=不发送(默认0)
+ *   --drain-ms N            停止发送后继续接收的时间，之后未到的数据报计为丢失(默认300)
+ * teardown模式选项:
+ *   --batch N               每批同时打开的隧道数(默认500)
+ *   --server-pid PID        读取/proc/PID/fd和/proc/PID/status统计服务器fd数与线程数
+ *
+ * 隧道服务器配置中game_server_ip设为127.0.0.1，转发的连接即到达内置游戏服务器
+ * 消息格式(0x01帧payload): len(4) + seq(4) + send_ns(8, CLOCK_MONOTONIC) + 填充
+ *   echo: 服务器可能重新分帧，客户端按len从回程数据流中切分消息，记录往返时间并检查seq连续
+ *   sink: 游戏服务器按len切分消息，记录单程时间(与客户端在同一台机器，时钟可比)
+ * UDP模式: 内置游戏服务器为UDP(127.0.0.1:game_port)，echo回送数据报并写入收到时间，sink只接收；
+ *   服务器把0x03帧转成从代理UDP socket发出的数据报，游戏服务器记录去程单程延迟/丢包/乱序，
+ *   并检查payload中的客户端IP已被替换；客户端记录往返延迟、回程单程延迟、丢包和乱序
+ *   探测包模拟DNF的UDP握手: 游戏服务器回复7字节 0x02 + 发送方IP + 端口，服务器应改写为客户端IP和源端口
+ * 计数和延迟只统计预热结束后duration秒内发生的事件(UDP按发送时间)
+ * teardown模式: 每批打开batch个隧道，各发一条消息并等到回显(服务器已连上游戏服务器)，然后全部shutdown写端，
+ *   记录每个隧道收到服务器FIN的时间；指定--server-pid时记录关闭后服务器fd数回到基线的时间，
+ *   以及全过程中服务器fd数、线程数的峰值；--duration/--warmup/--rate等不使用
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>       // tcp_info的tcpi_segs_in/tcpi_data_segs_in只在内核头文件中
+#include <arpa/inet.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "tunnel_protocol.h"
+
+using namespace std;
+
+struct BenchOptions {
+    string server_host = "127.0.0.1";
+    int server_port = 33223;
+    int game_port = 10011;
+    string game = "echo";
+    int connections = 16;
+    int threads = 1;
+    double duration_sec = 10;
+    double warmup_sec = 1;
+    size_t min_size = 64;
+    size_t max_size = 64;
+    double rate = 0;
+    int window = 16;
+    int heartbeat_ms = 0;
+    bool heartbeat_v2 = false;
+    int churn_ms = 0;
+    int burst = 0;
+    int burst_ms = 10;
+    string json_path;
+    // UDP模式
+    string mode = "tcp";
+    int ports = 1;
+    int src_port_base = 20000;
+    string client_ip = "10.1.2.3";
+    int probe_every = 0;
+    int drain_ms = 300;
+    // teardown模式
+    int batch = 500;
+    int server_pid = 0;
+};
+
+static const size_t MESSAGE_HEADER = 16;        // len(4) + seq(4) + send_ns(8)
+static const size_t OUT_BACKLOG_MAX = 256 * 1024;  // 发送缓冲积压超过该值时暂停生成消息
+static const int RECONNECT_DELAY_MS = 100;
+
+static uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// ==================== 延迟直方图 ====================
+// 与服务器LatencyHistogram相同的对数线性分桶(每个2的幂区间8个子桶，相对误差<12.5%)
+// 每个线程一份，结束后合并，不需要原子操作
+struct Histogram {
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = 38 * SUB_COUNT;
+
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+
+    Histogram() : total(0), sum_ns(0), max_ns(0) { memset(counts, 0, sizeof(counts)); }
+
+    static int bucket_of(uint64_t ns) {
+        if (ns < (uint64_t)SUB_COUNT) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int index = (msb - SUB_BITS + 1) * SUB_COUNT + (int)((ns >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+        return index < BUCKETS ? index : BUCKETS - 1;
+    }
+
+    static uint64_t bucket_upper(int index) {
+        if (index < SUB_COUNT) return (uint64_t)index + 1;
+        int group = index / SUB_COUNT;
+        int sub = index % SUB_COUNT;
+        return (uint64_t)(SUB_COUNT + sub + 1) << (group - 1);
+    }
+
+    void record(uint64_t ns) {
+        counts[bucket_of(ns)]++;
+        total++;
+        sum_ns += ns;
+        if (ns > max_ns) max_ns = ns;
+    }
+
+    void merge(const Histogram& other) {
+        for (int i = 0; i < BUCKETS; i++) counts[i] += other.counts[i];
+        total += other.total;
+        sum_ns += other.sum_ns;
+        max_ns = max(max_ns, other.max_ns);
+    }
+
+    // 所在桶的上界(不超过max)，没有样本时返回0
+    uint64_t percentile(double q) const {
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(q * total);
+        if (rank < q * total || rank == 0) rank++;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) return min(bucket_upper(i), max_ns);
+        }
+        return max_ns;
+    }
+
+    // {"count":N,"mean_ns":..,"p50_ns":..,"p90_ns":..,"p99_ns":..,"p999_ns":..,"max_ns":..}
+    string json() const {
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "{\"count\":%llu,\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,"
+                 "\"p999_ns\":%llu,\"max_ns\":%llu}",
+                 (unsigned long long)total, (unsigned long long)(total ? sum_ns / total : 0),
+                 (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.9),
+                 (unsigned long long)percentile(0.99), (unsigned long long)percentile(0.999),
+                 (unsigned long long)max_ns);
+        return buf;
+    }
+};
+
+// 统计窗口: 预热结束到结束时间之间
+struct MeasureWindow {
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    bool contains(uint64_t ns) const { return ns >= start_ns && ns < end_ns; }
+};
+
+// 消息流切分: 按len(4)从连续字节流中取出完整消息，返回(seq, send_ns)
+class MessageStream {
+public:
+    MessageStream() : pos(0) {}
+
+    void append(const uint8_t* data, size_t n) {
+        if (pos > 0 && pos == buf.size()) {
+            buf.clear();
+            pos = 0;
+        }
+        buf.insert(buf.end(), data, data + n);
+    }
+
+    // 返回false表示数据不足；bad表示len字段非法(流已错位)
+    bool next(uint32_t& seq, uint64_t& send_ns, bool& bad) {
+        bad = false;
+        if (buf.size() - pos < MESSAGE_HEADER) return compact();
+        uint32_t len = load_be32(&buf[pos]);
+        if (len < MESSAGE_HEADER || len > MAX_FRAME_PAYLOAD) {
+            bad = true;
+            return false;
+        }
+        if (buf.size() - pos < len) return compact();
+        seq = load_be32(&buf[pos + 4]);
+        send_ns = ((uint64_t)load_be32(&buf[pos + 8]) << 32) | load_be32(&buf[pos + 12]);
+        pos += len;
+        return true;
+    }
+
+    void reset() {
+        buf.clear();
+        pos = 0;
+    }
+
+private:
+    vector<uint8_t> buf;
+    size_t pos;
+
+    bool compact() {
+        if (pos > 0) {
+            buf.erase(buf.begin(), buf.begin() + pos);
+            pos = 0;
+        }
+        return false;
+    }
+};
+
+// ==================== 内置游戏服务器 ====================
+struct GameStats {
+    uint64_t accepted = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t messages = 0;        // sink: 切分出的完整消息
+    uint64_t stream_errors = 0;   // sink: len字段非法
+    uint64_t burst_messages = 0;  // 突发模式: 发出的消息
+    uint64_t burst_skipped = 0;   // 突发模式: 连接积压超过4MB时跳过的消息
+    Histogram one_way;            // sink: 客户端发送到游戏服务器收到
+};
+
+class GameServer {
+public:
+    GameServer(int port, bool echo, const MeasureWindow& w)
+        : listen_port(port), echo_mode(echo), window(w), listen_fd(-1), epoll_fd(-1), running(false),
+          burst_frames(0), burst_interval_ns(0), burst_min_size(0), burst_max_size(0), rng(0x2545F4914F6CDD1DULL) {}
+
+    // 突发模式: 每interval_ms毫秒在每个连接上连续发出frames条min_size~max_size字节的消息，在start()之前调用
+    void set_burst(int frames, int interval_ms, size_t min_size, size_t max_size) {
+        burst_frames = frames;
+        burst_interval_ns = (uint64_t)interval_ms * 1000000ULL;
+        burst_min_size = min_size;
+        burst_max_size = max_size;
+        burst_buf.resize(max_size);
+    }
+
+    ~GameServer() {
+        if (listen_fd >= 0) close(listen_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+
+    bool start() {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (listen_fd < 0) return false;
+        int opt = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(listen_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1024) < 0) {
+            fprintf(stderr, "游戏服务器监听 127.0.0.1:%d 失败: %s\n", listen_port, strerror(errno));
+            return false;
+        }
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+        running = true;
+        worker = thread(&GameServer::run, this);
+        return true;
+    }
+
+    void stop() {
+        running = false;
+        if (worker.joinable()) worker.join();
+        conns.clear();
+    }
+
+    const GameStats& stats() const { return game_stats; }
+
+private:
+    struct Conn {
+        int fd;
+        vector<uint8_t> pending;   // echo: 未发回的数据
+        size_t pending_pos;
+        bool reading;
+        bool closed;               // 已关闭，本轮事件处理完后释放
+        uint32_t burst_seq;
+        MessageStream stream;
+
+        Conn(int f) : fd(f), pending_pos(0), reading(true), closed(false), burst_seq(0) {}
+        ~Conn() { close(fd); }
+    };
+
+    int listen_port;
+    bool echo_mode;
+    MeasureWindow window;
+    int listen_fd;
+    int epoll_fd;
+    atomic<bool> running;
+    thread worker;
+    vector<unique_ptr<Conn>> conns;
+    GameStats game_stats;
+    int burst_frames;
+    uint64_t burst_interval_ns;
+    size_t burst_min_size;
+    size_t burst_max_size;
+    uint64_t rng;
+    vector<uint8_t> burst_buf;
+
+    size_t burst_message_size() {
+        if (burst_max_size <= burst_min_size) return burst_min_size;
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return burst_min_size + (size_t)(rng % (burst_max_size - burst_min_size + 1));
+    }
+
+    // 连续发出burst_frames条消息，每条一次send(游戏服务器不合并)；发不出的部分进入pending等待EPOLLOUT
+    void send_burst(Conn* c, uint64_t now) {
+        bool counted = window.contains(now);
+        if (c->pending.size() - c->pending_pos >= 4 * 1024 * 1024) {
+            if (counted) game_stats.burst_skipped += burst_frames;
+            return;
+        }
+        for (int k = 0; k < burst_frames; k++) {
+            size_t len = burst_message_size();
+            uint8_t* p = burst_buf.data();
+            store_be32(p, (uint32_t)len);
+            store_be32(p + 4, c->burst_seq++);
+            store_be32(p + 8, (uint32_t)(now >> 32));
+            store_be32(p + 12, (uint32_t)now);
+            memset(p + MESSAGE_HEADER, 'x', len - MESSAGE_HEADER);
+            if (counted) game_stats.burst_messages++;
+            size_t sent = 0;
+            if (c->pending_pos == c->pending.size()) {
+                ssize_t n = send(c->fd, p, len, MSG_NOSIGNAL);
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    drop(c);
+                    return;
+                }
+                if (n > 0) {
+                    sent = n;
+                    if (counted) game_stats.bytes_out += n;
+                }
+            }
+            if (sent < len) c->pending.insert(c->pending.end(), p + sent, p + len);
+        }
+        if (c->pending_pos < c->pending.size()) update_events(c);
+    }
+
+    void update_events(Conn* c) {
+        epoll_event ev;
+        ev.events = (c->reading ? EPOLLIN : 0) | (c->pending_pos < c->pending.size() ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+
+    void drop(Conn* c) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+        c->closed = true;
+    }
+
+    // 返回false表示连接已关闭
+    bool flush(Conn* c) {
+        while (c->pending_pos < c->pending.size()) {
+            ssize_t n = send(c->fd, c->pending.data() + c->pending_pos, c->pending.size() - c->pending_pos, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            c->pending_pos += n;
+            if (window.contains(monotonic_ns())) game_stats.bytes_out += n;
+        }
+        if (c->pending_pos == c->pending.size()) {
+            c->pending.clear();
+            c->pending_pos = 0;
+        }
+        // 对端不读时停止读取，积压不超过4MB
+        c->reading = c->pending.size() - c->pending_pos < 4 * 1024 * 1024;
+        update_events(c);
+        return true;
+    }
+
+    void on_readable(Conn* c, uint8_t* buf, size_t cap) {
+        for (int rounds = 0; rounds < 16 && c->reading; rounds++) {
+            ssize_t n = recv(c->fd, buf, cap, 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                drop(c);
+                return;
+            }
+            if (n < 0) break;
+            uint64_t now = monotonic_ns();
+            if (window.contains(now)) game_stats.bytes_in += n;
+            if (echo_mode) {
+                c->pending.insert(c->pending.end(), buf, buf + n);
+                if (!flush(c)) {
+                    drop(c);
+                    return;
+                }
+                continue;
+            }
+            c->stream.append(buf, n);
+            uint32_t seq;
+            uint64_t send_ns;
+            bool bad;
+            while (c->stream.next(seq, send_ns, bad)) {
+                if (!window.contains(now)) continue;
+                game_stats.messages++;
+                game_stats.one_way.record(now - send_ns);
+            }
+            if (bad) {
+                game_stats.stream_errors++;
+                c->stream.reset();
+            }
+        }
+    }
+
+    void run() {
+        vector<uint8_t> buf(65536);
+        epoll_event events[64];
+        uint64_t next_burst_ns = monotonic_ns();
+        while (running) {
+            int timeout_ms = 100;
+            if (burst_frames > 0) {
+                uint64_t now = monotonic_ns();
+                if (now >= next_burst_ns) {
+                    for (auto& c : conns) {
+                        if (!c->closed) send_burst(c.get(), now);
+                    }
+                    next_burst_ns += burst_interval_ns;
+                    if (next_burst_ns <= now) next_burst_ns = now + burst_interval_ns;
+                }
+                timeout_ms = (int)((next_burst_ns - now + 999999) / 1000000);
+            }
+            int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+            for (int i = 0; i < n; i++) {
+                Conn* c = (Conn*)events[i].data.ptr;
+                if (c == nullptr) {
+                    int fd;
+                    while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                        int opt = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+                        conns.emplace_back(new Conn(fd));
+                        epoll_event ev;
+                        ev.events = EPOLLIN;
+                        ev.data.ptr = conns.back().get();
+                        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+                        game_stats.accepted++;
+                    }
+                    continue;
+                }
+                if (c->closed) continue;
+                if ((events[i].events & EPOLLOUT) && !flush(c)) {
+                    drop(c);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) on_readable(c, buf.data(), buf.size());
+            }
+            conns.erase(remove_if(conns.begin(), conns.end(),
+                                  [](const unique_ptr<Conn>& c) { return c->closed; }),
+                        conns.end());
+        }
+    }
+};
+
+// ==================== 隧道客户端 ====================
+struct ClientStats {
+    uint64_t connects = 0;
+    uint64_t connect_failures = 0;
+    uint64_t disconnects = 0;        // 非主动关闭的断开
+    uint64_t churn_closes = 0;
+    uint64_t messages_sent = 0;
+    uint64_t bytes_sent = 0;         // 消息字节(不含7字节帧头)
+    uint64_t messages_received = 0;  // echo: 回程切分出的消息
+    uint64_t bytes_received = 0;     // 回程0x01帧的payload字节
+    uint64_t frames_received = 0;
+    uint64_t rate_misses = 0;        // 限速模式下因发送积压未按时发出的消息
+    uint64_t sequence_errors = 0;    // echo: seq不连续或流错位
+    uint64_t heartbeats_sent = 0;
+    uint64_t heartbeat_replies = 0;
+    uint64_t open_at_end = 0;        // 结束时处于连接状态的连接数
+    uint64_t segs_in = 0;            // 统计窗口内隧道socket收到的TCP段(tcpi_segs_in)
+    uint64_t data_segs_in = 0;       // 其中带数据的段(tcpi_data_segs_in)
+    Histogram rtt;                   // echo: 消息往返时间；突发模式: 游戏服务器→客户端单程时间
+    Histogram connect_time;          // connect发起到可写
+    Histogram heartbeat_rtt;
+
+    void merge(const ClientStats& o) {
+        connects += o.connects;
+        connect_failures += o.connect_failures;
+        disconnects += o.disconnects;
+        churn_closes += o.churn_closes;
+        messages_sent += o.messages_sent;
+        bytes_sent += o.bytes_sent;
+        messages_received += o.messages_received;
+        bytes_received += o.bytes_received;
+        frames_received += o.frames_received;
+        rate_misses += o.rate_misses;
+        sequence_errors += o.sequence_errors;
+        heartbeats_sent += o.heartbeats_sent;
+        heartbeat_replies += o.heartbeat_replies;
+        open_at_end += o.open_at_end;
+        segs_in += o.segs_in;
+        data_segs_in += o.data_segs_in;
+        rtt.merge(o.rtt);
+        connect_time.merge(o.connect_time);
+        heartbeat_rtt.merge(o.heartbeat_rtt);
+    }
+};
+
+static atomic<uint32_t> g_next_conn_id(1);
+
+class ClientWorker {
+public:
+    ClientWorker(const BenchOptions& o, const sockaddr_storage& addr, socklen_t addr_len,
+                 const MeasureWindow& w, int first_slot, int count)
+        : opt(o), server_addr(addr), server_addr_len(addr_len), window(w), epoll_fd(-1),
+          rng(0x9E3779B97F4A7C15ULL ^ ((uint64_t)first_slot << 17) ^ (uint64_t)getpid()) {
+        for (int i = 0; i < count; i++) conns.emplace_back(new Conn(first_slot + i));
+        interval_ns = opt.rate > 0 ? (uint64_t)(1e9 / opt.rate) : 0;
+        // 突发模式的回程消息与echo格式相同，按同样方式切分
+        echo_mode = opt.game != "sink" || opt.burst > 0;
+    }
+
+    void start() { worker = thread(&ClientWorker::run, this); }
+    void join() { if (worker.joinable()) worker.join(); }
+    const ClientStats& stats() const { return client_stats; }
+
+private:
+    struct Conn {
+        int slot;
+        int fd;
+        uint32_t conn_id;
+        bool connected;
+        bool want_out;
+        bool send_blocked;            // 上次send返回EAGAIN，等待EPOLLOUT
+        uint64_t connect_start_ns;
+        uint64_t reconnect_at_ns;
+        uint64_t close_at_ns;
+        uint64_t next_send_ns;
+        uint64_t next_heartbeat_ns;
+        uint64_t heartbeat_sent_ns;   // v1心跳: 未回复的心跳发送时间
+        uint32_t heartbeat_seq;
+        uint32_t heartbeat_rtt_us;    // v2心跳: 上一次RTT，下一次心跳中上报
+        uint32_t send_seq;
+        uint32_t recv_seq;
+        uint32_t inflight;
+        bool segs_tracking;           // 已记下统计窗口开始(或窗口内建立连接)时的段计数
+        uint32_t segs_base;
+        uint32_t data_segs_base;
+        vector<uint8_t> out;
+        size_t out_pos;
+        FrameDecoder decoder;
+        MessageStream stream;
+
+        explicit Conn(int s)
+            : slot(s), fd(-1), conn_id(0), connected(false), want_out(false), send_blocked(false), connect_start_ns(0),
+              reconnect_at_ns(0), close_at_ns(0), next_send_ns(0), next_heartbeat_ns(0),
+              heartbeat_sent_ns(0), heartbeat_seq(0), heartbeat_rtt_us(0), send_seq(0), recv_seq(0),
+              inflight(0), segs_tracking(false), segs_base(0), data_segs_base(0), out_pos(0),
+              decoder(frame_type_bit(FRAME_TCP_DATA) | frame_type_bit(FRAME_HEARTBEAT)) {}
+
+        size_t backlog() const { return out.size() - out_pos; }
+    };
+
+    const BenchOptions& opt;
+    sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    MeasureWindow window;
+    int epoll_fd;
+    uint64_t rng;
+    uint64_t interval_ns;
+    bool echo_mode;
+    vector<unique_ptr<Conn>> conns;
+    thread worker;
+    ClientStats client_stats;
+
+    uint64_t next_random() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    }
+
+    size_t message_size() {
+        if (opt.max_size <= opt.min_size) return opt.min_size;
+        return opt.min_size + (size_t)(next_random() % (opt.max_size - opt.min_size + 1));
+    }
+
+    void set_events(Conn* c, bool want_out) {
+        if (c->want_out == want_out) return;
+        c->want_out = want_out;
+        epoll_event ev;
+        ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+
+    void open_conn(Conn* c, uint64_t now) {
+        c->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (c->fd < 0) {
+            client_stats.connect_failures++;
+            c->reconnect_at_ns = now + RECONNECT_DELAY_MS * 1000000ULL;
+            return;
+        }
+        int opt_on = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &opt_on, sizeof(opt_on));
+        c->conn_id = g_next_conn_id.fetch_add(1);
+        if (c->conn_id == UDP_TUNNEL_CONN_ID) c->conn_id = g_next_conn_id.fetch_add(1);
+        c->connected = false;
+        c->send_blocked = false;
+        c->connect_start_ns = now;
+        c->reconnect_at_ns = 0;
+        c->out.clear();
+        c->out_pos = 0;
+        c->decoder.reset();
+        c->decoder.expect_conn_id(c->conn_id);
+        c->stream.reset();
+        c->send_seq = 0;
+        c->recv_seq = 0;
+        c->inflight = 0;
+        c->heartbeat_sent_ns = 0;
+        c->heartbeat_rtt_us = 0;
+
+        // 握手与客户端相同: conn_id(4) + dst_port(2) + uuid_len(1) + uuid
+        char uuid[64];
+        int uuid_len = snprintf(uuid, sizeof(uuid), "bench-%d-%d", (int)getpid(), c->slot);
+        c->out.resize(HANDSHAKE_HEADER + uuid_len);
+        encode_handshake(c->out.data(), c->conn_id, (uint16_t)opt.game_port, uuid, (uint8_t)uuid_len);
+
+        c->want_out = true;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+
+        if (connect(c->fd, (sockaddr*)&server_addr, server_addr_len) < 0 && errno != EINPROGRESS) {
+            client_stats.connect_failures++;
+            close_conn(c, now, false);
+        }
+    }
+
+    static bool read_segs(int fd, uint32_t& segs, uint32_t& data_segs) {
+        tcp_info info;
+        socklen_t len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) return false;
+        segs = info.tcpi_segs_in;
+        data_segs = info.tcpi_data_segs_in;
+        return true;
+    }
+
+    // 统计窗口开始或窗口内建立连接时记下段计数，关闭或结束时累加差值
+    void segs_begin(Conn* c) {
+        c->segs_tracking = read_segs(c->fd, c->segs_base, c->data_segs_base);
+    }
+
+    void segs_end(Conn* c) {
+        uint32_t segs, data_segs;
+        if (c->segs_tracking && read_segs(c->fd, segs, data_segs)) {
+            client_stats.segs_in += segs - c->segs_base;
+            client_stats.data_segs_in += data_segs - c->data_segs_base;
+        }
+        c->segs_tracking = false;
+    }
+
+    // expected: 主动关闭(连接轮换/结束)，不计为断开
+    void close_conn(Conn* c, uint64_t now, bool expected) {
+        if (c->fd < 0) return;
+        segs_end(c);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+        close(c->fd);
+        c->fd = -1;
+        if (!expected && c->connected && window.contains(now)) client_stats.disconnects++;
+        c->connected = false;
+        c->reconnect_at_ns = now + (expected ? 0 : RECONNECT_DELAY_MS * 1000000ULL);
+    }
+
+    void on_connected(Conn* c, uint64_t now) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            client_stats.connect_failures++;
+            close_conn(c, now, false);
+            return;
+        }
+        c->connected = true;
+        if (window.contains(now)) {
+            client_stats.connects++;
+            client_stats.connect_time.record(now - c->connect_start_ns);
+            segs_begin(c);
+        }
+        c->next_send_ns = now;
+        c->next_heartbeat_ns = opt.heartbeat_ms > 0 ? now + opt.heartbeat_ms * 1000000ULL : 0;
+        c->close_at_ns = opt.churn_ms > 0 ? now + opt.churn_ms * 1000000ULL : 0;
+    }
+
+    void append_message(Conn* c, uint64_t now) {
+        size_t len = message_size();
+        size_t old = c->out.size();
+        c->out.resize(old + TCP_FRAME_HEADER + len);
+        uint8_t* p = c->out.data() + old;
+        encode_tcp_header(p, c->conn_id, (uint16_t)len);
+        p += TCP_FRAME_HEADER;
+        store_be32(p, (uint32_t)len);
+        store_be32(p + 4, c->send_seq++);
+        store_be32(p + 8, (uint32_t)(now >> 32));
+        store_be32(p + 12, (uint32_t)now);
+        memset(p + MESSAGE_HEADER, 'x', len - MESSAGE_HEADER);
+        c->inflight++;
+        if (window.contains(now)) {
+            client_stats.messages_sent++;
+            client_stats.bytes_sent += len;
+        }
+    }
+
+    void append_heartbeat(Conn* c, uint64_t now) {
+        size_t old = c->out.size();
+        c->out.resize(old + HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REQUEST_LEN);
+        size_t n;
+        if (opt.heartbeat_v2) {
+            n = encode_heartbeat_v2(c->out.data() + old, c->conn_id, c->heartbeat_seq++, now / 1000, c->heartbeat_rtt_us);
+        } else {
+            n = encode_heartbeat(c->out.data() + old, c->conn_id);
+            if (c->heartbeat_sent_ns == 0) c->heartbeat_sent_ns = now;
+        }
+        c->out.resize(old + n);
+        if (window.contains(now)) client_stats.heartbeats_sent++;
+    }
+
+    // 按限速/窗口生成消息和心跳
+    void generate(Conn* c, uint64_t now) {
+        if (c->next_heartbeat_ns != 0 && now >= c->next_heartbeat_ns) {
+            append_heartbeat(c, now);
+            c->next_heartbeat_ns = now + opt.heartbeat_ms * 1000000ULL;
+        }
+        if (opt.burst > 0) return;
+        if (interval_ns > 0) {
+            while (c->next_send_ns <= now) {
+                if (c->backlog() >= OUT_BACKLOG_MAX) {
+                    // 积压时丢弃落后的发送机会，不在恢复后集中补发
+                    uint64_t missed = (now - c->next_send_ns) / interval_ns + 1;
+                    if (window.contains(now)) client_stats.rate_misses += missed;
+                    c->next_send_ns += missed * interval_ns;
+                    break;
+                }
+                append_message(c, c->next_send_ns);
+                c->next_send_ns += interval_ns;
+            }
+        } else if (echo_mode) {
+            while (c->inflight < (uint32_t)opt.window && c->backlog() < OUT_BACKLOG_MAX) append_message(c, now);
+        } else {
+            while (c->backlog() < 64 * 1024) append_message(c, now);
+        }
+    }
+
+    // 返回false表示连接已关闭
+    bool flush(Conn* c, uint64_t now) {
+        if (c->send_blocked) return true;
+        while (c->out_pos < c->out.size()) {
+            ssize_t n = send(c->fd, c->out.data() + c->out_pos, c->out.size() - c->out_pos, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    c->send_blocked = true;
+                    break;
+                }
+                close_conn(c, now, false);
+                return false;
+            }
+            c->out_pos += n;
+        }
+        if (c->out_pos == c->out.size()) {
+            c->out.clear();
+            c->out_pos = 0;
+        } else if (c->out_pos >= 64 * 1024) {
+            c->out.erase(c->out.begin(), c->out.begin() + c->out_pos);
+            c->out_pos = 0;
+        }
+        set_events(c, c->out_pos < c->out.size());
+        return true;
+    }
+
+    void on_frame(Conn* c, const FrameView& frame, uint64_t now) {
+        bool counted = window.contains(now);
+        if (frame.type == FRAME_HEARTBEAT) {
+            HeartbeatV2 hb;
+            uint64_t rtt_ns = 0;
+            if (decode_heartbeat_v2_reply(frame.payload, frame.length, hb)) {
+                rtt_ns = now - hb.client_send_us * 1000;
+                c->heartbeat_rtt_us = (uint32_t)max<uint64_t>(rtt_ns / 1000, 1);
+            } else if (c->heartbeat_sent_ns != 0) {
+                rtt_ns = now - c->heartbeat_sent_ns;
+                c->heartbeat_sent_ns = 0;
+            }
+            if (counted) {
+                client_stats.heartbeat_replies++;
+                if (rtt_ns > 0) client_stats.heartbeat_rtt.record(rtt_ns);
+            }
+            return;
+        }
+
+        if (counted) {
+            client_stats.frames_received++;
+            client_stats.bytes_received += frame.length;
+        }
+        if (!echo_mode) return;
+        c->stream.append(frame.payload, frame.length);
+        uint32_t seq;
+        uint64_t send_ns;
+        bool bad;
+        while (c->stream.next(seq, send_ns, bad)) {
+            if (c->inflight > 0) c->inflight--;
+            if (seq != c->recv_seq && counted) client_stats.sequence_errors++;
+            c->recv_seq = seq + 1;
+            if (counted) {
+                client_stats.messages_received++;
+                client_stats.rtt.record(now - send_ns);
+            }
+        }
+        if (bad) {
+            if (counted) client_stats.sequence_errors++;
+            c->stream.reset();
+            c->inflight = 0;
+        }
+    }
+
+    void on_readable(Conn* c, uint8_t* buf, size_t cap) {
+        for (int rounds = 0; rounds < 16; rounds++) {
+            ssize_t n = recv(c->fd, buf, cap, 0);
+            uint64_t now = monotonic_ns();
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                close_conn(c, now, false);
+                return;
+            }
+            if (n < 0) return;
+            c->decoder.feed(buf, n);
+            FrameView frame;
+            FrameResult r;
+            while ((r = c->decoder.next(frame)) != FRAME_INCOMPLETE) {
+                if (r == FRAME_UNKNOWN) {
+                    // 错误的conn_id或未知类型: 流已不可信
+                    if (window.contains(now)) client_stats.sequence_errors++;
+                    close_conn(c, now, false);
+                    return;
+                }
+                on_frame(c, frame, now);
+            }
+            if ((size_t)n < cap) return;
+        }
+    }
+
+    void run() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        vector<uint8_t> buf(65536);
+        epoll_event events[256];
+
+        uint64_t now = monotonic_ns();
+        for (auto& c : conns) open_conn(c.get(), now);
+
+        bool window_started = false;
+        while ((now = monotonic_ns()) < window.end_ns) {
+            if (!window_started && now >= window.start_ns) {
+                for (auto& c : conns) {
+                    if (c->connected) segs_begin(c.get());
+                }
+                window_started = true;
+            }
+            int n = epoll_wait(epoll_fd, events, 256, 1);
+            now = monotonic_ns();
+            for (int i = 0; i < n; i++) {
+                Conn* c = (Conn*)events[i].data.ptr;
+                if (c->fd < 0) continue;
+                if (!c->connected) {
+                    if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) on_connected(c, now);
+                    if (c->fd < 0 || !c->connected) continue;
+                }
+                if (events[i].events & EPOLLOUT) c->send_blocked = false;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) on_readable(c, buf.data(), buf.size());
+            }
+
+            now = monotonic_ns();
+            for (auto& p : conns) {
+                Conn* c = p.get();
+                if (c->fd < 0) {
+                    if (now >= c->reconnect_at_ns) open_conn(c, now);
+                    continue;
+                }
+                if (!c->connected) continue;
+                if (c->close_at_ns != 0 && now >= c->close_at_ns) {
+                    if (window.contains(now)) client_stats.churn_closes++;
+                    close_conn(c, now, true);
+                    open_conn(c, now);
+                    continue;
+                }
+                generate(c, now);
+                flush(c, now);
+            }
+        }
+
+        for (auto& c : conns) {
+            if (c->connected) client_stats.open_at_end++;
+            close_conn(c.get(), now, true);
+        }
+        close(epoll_fd);
+    }
+};
+
+// ==================== UDP隧道 ====================
+// 数据报: marker(1)=0xB7 + flow(4) + client_ip(4) + seq(5) + send_ns(10) + game_ns(10) + 填充
+//   数值字段按7位一组存放、每字节最高位为1，不会与客户端IP(须各字节<0x80，默认10.1.2.3)匹配而被服务器替换；
+//   client_ip为握手中上报的客户端IP，去程应被服务器替换为代理IP，游戏服务器检查是否已替换(回程不扫描数据报)
+//   game_ns由游戏服务器在收到时写入，客户端据此拆分去程/回程单程时间
+// 探测包: 0x01开头，游戏服务器回复 0x02 + 发送方IP(DNF字节序) + 端口(小端序)，服务器应还原为客户端IP和源端口
+static const uint8_t UDP_MARKER = 0xB7;
+static const uint8_t UDP_PROBE = 0x01;
+static const uint8_t UDP_PROBE_REPLY = 0x02;
+static const size_t UDP_PROBE_REPLY_LEN = 7;
+static const size_t UDP_OFF_FLOW = 1;
+static const size_t UDP_OFF_IP = 5;
+static const size_t UDP_OFF_SEQ = 9;
+static const size_t UDP_OFF_SEND = 14;
+static const size_t UDP_OFF_GAME = 24;
+static const size_t UDP_MESSAGE_HEADER = 34;
+static const uint8_t UDP_FILL = 0xA5;
+static const int UDP_BATCH = 32;
+
+static void store_u7(uint8_t* p, uint64_t v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        p[i] = (uint8_t)(0x80 | (v & 0x7F));
+        v >>= 7;
+    }
+}
+
+static uint64_t load_u7(const uint8_t* p, int n) {
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++) v = (v << 7) | (p[i] & 0x7F);
+    return v;
+}
+
+// 每个流的顺序检查: seq小于已收到的最大值记为乱序
+struct SeqTracker {
+    bool any = false;
+    uint32_t highest = 0;
+
+    bool reordered(uint32_t seq) {
+        if (any && seq < highest) return true;
+        any = true;
+        highest = seq;
+        return false;
+    }
+};
+
+struct UdpGameStats {
+    uint64_t datagrams_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t received = 0;        // 统计窗口内发出的数据报
+    uint64_t reordered = 0;
+    uint64_t probes = 0;
+    uint64_t ip_rewritten = 0;    // payload中的客户端IP已被替换
+    uint64_t ip_unchanged = 0;    // 仍是客户端IP(ip_rewrite为off或替换失效)
+    Histogram to_game;            // 客户端发送到游戏服务器收到
+};
+
+class UdpGameServer {
+public:
+    UdpGameServer(int port, bool echo, const string& client_ip, const MeasureWindow& w)
+        : listen_port(port), echo_mode(echo), window(w), fd(-1), running(false) {
+        inet_pton(AF_INET, client_ip.c_str(), client_ip_bytes);
+    }
+
+    ~UdpGameServer() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool start() {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        int buf_size = 4 * 1024 * 1024;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+        timeval timeout = {0, 100000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(listen_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "UDP游戏服务器监听 127.0.0.1:%d 失败: %s\n", listen_port, strerror(errno));
+            return false;
+        }
+        running = true;
+        worker = thread(&UdpGameServer::run, this);
+        return true;
+    }
+
+    void stop() {
+        running = false;
+        if (worker.joinable()) worker.join();
+    }
+
+    const UdpGameStats& stats() const { return game_stats; }
+
+private:
+    int listen_port;
+    bool echo_mode;
+    MeasureWindow window;
+    uint8_t client_ip_bytes[4];
+    int fd;
+    atomic<bool> running;
+    thread worker;
+    UdpGameStats game_stats;
+    unordered_map<uint32_t, SeqTracker> flows;
+
+    // 返回需要发回的字节数，0表示不回复
+    size_t handle(uint8_t* data, size_t len, const sockaddr_in& from, uint64_t now) {
+        game_stats.datagrams_in++;
+        game_stats.bytes_in += len;
+        if (len >= 1 && data[0] == UDP_PROBE) {
+            // 与游戏服务器的UDP握手响应相同: 按收到的源地址回复
+            game_stats.probes++;
+            uint32_t ip = ntohl(from.sin_addr.s_addr);
+            uint16_t port = ntohs(from.sin_port);
+            data[0] = UDP_PROBE_REPLY;
+            data[1] = (uint8_t)ip;
+            data[2] = (uint8_t)(ip >> 8);
+            data[3] = (uint8_t)(ip >> 16);
+            data[4] = (uint8_t)(ip >> 24);
+            data[5] = (uint8_t)port;
+            data[6] = (uint8_t)(port >> 8);
+            return UDP_PROBE_REPLY_LEN;
+        }
+        if (len >= UDP_MESSAGE_HEADER && data[0] == UDP_MARKER) {
+            uint32_t flow = (uint32_t)load_u7(data + UDP_OFF_FLOW, 4);
+            uint32_t seq = (uint32_t)load_u7(data + UDP_OFF_SEQ, 5);
+            uint64_t send_ns = load_u7(data + UDP_OFF_SEND, 10);
+            if (window.contains(send_ns)) {
+                game_stats.received++;
+                game_stats.to_game.record(now - send_ns);
+                if (flows[flow].reordered(seq)) game_stats.reordered++;
+                if (memcmp(data + UDP_OFF_IP, client_ip_bytes, 4) == 0) {
+                    game_stats.ip_unchanged++;
+                } else {
+                    game_stats.ip_rewritten++;
+                }
+            }
+            store_u7(data + UDP_OFF_GAME, now, 10);
+        }
+        return echo_mode ? len : 0;
+    }
+
+    void run() {
+        vector<uint8_t> bufs(UDP_BATCH * 65536);
+        mmsghdr in[UDP_BATCH];
+        mmsghdr out[UDP_BATCH];
+        iovec in_iov[UDP_BATCH];
+        iovec out_iov[UDP_BATCH];
+        sockaddr_in from[UDP_BATCH];
+        while (running) {
+            for (int i = 0; i < UDP_BATCH; i++) {
+                in_iov[i].iov_base = bufs.data() + i * 65536;
+                in_iov[i].iov_len = 65536;
+                memset(&in[i].msg_hdr, 0, sizeof(in[i].msg_hdr));
+                in[i].msg_hdr.msg_iov = &in_iov[i];
+                in[i].msg_hdr.msg_iovlen = 1;
+                in[i].msg_hdr.msg_name = &from[i];
+                in[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            }
+            int n = recvmmsg(fd, in, UDP_BATCH, MSG_WAITFORONE, nullptr);
+            if (n <= 0) continue;
+            uint64_t now = monotonic_ns();
+            int replies = 0;
+            for (int i = 0; i < n; i++) {
+                uint8_t* data = (uint8_t*)in_iov[i].iov_base;
+                size_t reply_len = handle(data, in[i].msg_len, from[i], now);
+                if (reply_len == 0) continue;
+                out_iov[replies].iov_base = data;
+                out_iov[replies].iov_len = reply_len;
+                memset(&out[replies].msg_hdr, 0, sizeof(out[replies].msg_hdr));
+                out[replies].msg_hdr.msg_iov = &out_iov[replies];
+                out[replies].msg_hdr.msg_iovlen = 1;
+                out[replies].msg_hdr.msg_name = &from[i];
+                out[replies].msg_hdr.msg_namelen = sizeof(from[i]);
+                replies++;
+            }
+            for (int sent = 0; sent < replies;) {
+                int k = sendmmsg(fd, out + sent, replies - sent, 0);
+                if (k <= 0) break;
+                sent += k;
+            }
+        }
+    }
+};
+
+struct UdpClientStats {
+    uint64_t connects = 0;           // 收到握手确认的隧道
+    uint64_t connect_failures = 0;
+    uint64_t disconnects = 0;
+    uint64_t open_at_end = 0;
+    uint64_t sent = 0;               // 统计窗口内发出的数据报(不含探测包)
+    uint64_t bytes_sent = 0;
+    uint64_t rate_misses = 0;
+    uint64_t received = 0;           // 回程收到的、统计窗口内发出的数据报
+    uint64_t reordered = 0;
+    uint64_t unknown = 0;            // 无法识别的回程数据报
+    uint64_t probes_sent = 0;
+    uint64_t probes_answered = 0;
+    uint64_t probe_rewrite_ok = 0;
+    uint64_t probe_rewrite_bad = 0;
+    Histogram handshake_time;        // connect发起到收到握手确认
+    Histogram round_trip;
+    Histogram to_client;             // 游戏服务器收到到客户端收到回程
+    Histogram probe_rtt;
+
+    void merge(const UdpClientStats& o) {
+        connects += o.connects;
+        connect_failures += o.connect_failures;
+        disconnects += o.disconnects;
+        open_at_end += o.open_at_end;
+        sent += o.sent;
+        bytes_sent += o.bytes_sent;
+        rate_misses += o.rate_misses;
+        received += o.received;
+        reordered += o.reordered;
+        unknown += o.unknown;
+        probes_sent += o.probes_sent;
+        probes_answered += o.probes_answered;
+        probe_rewrite_ok += o.probe_rewrite_ok;
+        probe_rewrite_bad += o.probe_rewrite_bad;
+        handshake_time.merge(o.handshake_time);
+        round_trip.merge(o.round_trip);
+        to_client.merge(o.to_client);
+        probe_rtt.merge(o.probe_rtt);
+    }
+};
+
+// N个UDP隧道(每个一条TCP连接)，每个隧道M个客户端源端口，按固定pps轮流发送0x03帧
+// 发送在统计窗口结束时停止，之后再接收drain_ms，迟到的回程计为丢失
+class UdpClientWorker {
+public:
+    UdpClientWorker(const BenchOptions& o, const sockaddr_storage& addr, socklen_t addr_len,
+                    const MeasureWindow& w, int first_slot, int count)
+        : opt(o), server_addr(addr), server_addr_len(addr_len), window(w), epoll_fd(-1) {
+        inet_pton(AF_INET, opt.client_ip.c_str(), client_ip);
+        for (int i = 0; i < count; i++) {
+            int slot = first_slot + i;
+            unique_ptr<Tunnel> t(new Tunnel(slot));
+            t->base_port = (uint16_t)(opt.src_port_base + slot * opt.ports);
+            for (int m = 0; m < opt.ports; m++) {
+                Flow f;
+                f.src_port = (uint16_t)(t->base_port + m);
+                f.id = (uint32_t)(slot * opt.ports + m);
+                t->flows.push_back(f);
+            }
+            tunnels.push_back(std::move(t));
+        }
+        interval_ns = (uint64_t)(1e9 / (opt.rate * opt.ports));
+    }
+
+    void start() { worker = thread(&UdpClientWorker::run, this); }
+    void join() { if (worker.joinable()) worker.join(); }
+    const UdpClientStats& stats() const { return client_stats; }
+
+private:
+    struct Flow {
+        uint16_t src_port;
+        uint32_t id;
+        uint32_t send_seq = 0;
+        uint64_t datagrams = 0;      // 已发出的数据报(含探测包)，决定下一个是否探测
+        uint64_t probe_sent_ns = 0;  // 未回复的探测包发送时间
+        SeqTracker order;
+    };
+
+    struct Tunnel {
+        int slot;
+        int fd;
+        bool connected;
+        bool acked;
+        bool want_out;
+        bool send_blocked;
+        uint8_t ack[HANDSHAKE_ACK_SIZE];
+        size_t ack_len;
+        uint16_t base_port;
+        uint64_t connect_start_ns;
+        uint64_t reconnect_at_ns;
+        uint64_t next_send_ns;
+        size_t next_flow;
+        vector<Flow> flows;
+        vector<uint8_t> out;
+        size_t out_pos;
+        FrameDecoder decoder;
+
+        explicit Tunnel(int s)
+            : slot(s), fd(-1), connected(false), acked(false), want_out(false), send_blocked(false),
+              ack_len(0), base_port(0), connect_start_ns(0), reconnect_at_ns(0), next_send_ns(0),
+              next_flow(0), out_pos(0), decoder(frame_type_bit(FRAME_UDP_DATA)) {}
+
+        size_t backlog() const { return out.size() - out_pos; }
+    };
+
+    const BenchOptions& opt;
+    sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    MeasureWindow window;
+    int epoll_fd;
+    uint8_t client_ip[4];
+    uint64_t interval_ns;
+    vector<unique_ptr<Tunnel>> tunnels;
+    thread worker;
+    UdpClientStats client_stats;
+
+    void set_events(Tunnel* t, bool want_out) {
+        if (t->want_out == want_out) return;
+        t->want_out = want_out;
+        epoll_event ev;
+        ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+        ev.data.ptr = t;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, t->fd, &ev);
+    }
+
+    void open_tunnel(Tunnel* t, uint64_t now) {
+        t->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (t->fd < 0) {
+            client_stats.connect_failures++;
+            t->reconnect_at_ns = now + RECONNECT_DELAY_MS * 1000000ULL;
+            return;
+        }
+        int opt_on = 1;
+        setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &opt_on, sizeof(opt_on));
+        t->connected = false;
+        t->acked = false;
+        t->send_blocked = false;
+        t->ack_len = 0;
+        t->connect_start_ns = now;
+        t->reconnect_at_ns = 0;
+        t->decoder.reset();
+        for (auto& f : t->flows) {
+            f.probe_sent_ns = 0;
+            f.order = SeqTracker();
+        }
+
+        // UDP隧道握手: conn_id=0xFFFFFFFF + dst_port + uuid，随后客户端IPv4(4)
+        char uuid[64];
+        int uuid_len = snprintf(uuid, sizeof(uuid), "bench-udp-%d-%d", (int)getpid(), t->slot);
+        t->out.resize(HANDSHAKE_HEADER + uuid_len + 4);
+        encode_handshake(t->out.data(), UDP_TUNNEL_CONN_ID, (uint16_t)opt.game_port, uuid, (uint8_t)uuid_len);
+        memcpy(t->out.data() + HANDSHAKE_HEADER + uuid_len, client_ip, 4);
+        t->out_pos = 0;
+
+        t->want_out = true;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.ptr = t;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, t->fd, &ev);
+
+        if (connect(t->fd, (sockaddr*)&server_addr, server_addr_len) < 0 && errno != EINPROGRESS) {
+            client_stats.connect_failures++;
+            close_tunnel(t, now, false);
+        }
+    }
+
+    void close_tunnel(Tunnel* t, uint64_t now, bool expected) {
+        if (t->fd < 0) return;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, t->fd, nullptr);
+        close(t->fd);
+        t->fd = -1;
+        if (!expected && t->acked && window.contains(now)) client_stats.disconnects++;
+        t->connected = false;
+        t->acked = false;
+        t->reconnect_at_ns = now + RECONNECT_DELAY_MS * 1000000ULL;
+    }
+
+    void on_connected(Tunnel* t, uint64_t now) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(t->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            client_stats.connect_failures++;
+            close_tunnel(t, now, false);
+            return;
+        }
+        t->connected = true;
+    }
+
+    void append_datagram(Tunnel* t, uint64_t now) {
+        Flow& f = t->flows[t->next_flow];
+        t->next_flow = (t->next_flow + 1) % t->flows.size();
+        bool counted = window.contains(now);
+        bool probe = opt.probe_every > 0 && (f.datagrams + 1) % opt.probe_every == 0;
+        f.datagrams++;
+
+        size_t len = probe ? 8 : opt.min_size;
+        if (!probe && opt.max_size > opt.min_size) len += (size_t)(now % (opt.max_size - opt.min_size + 1));
+        size_t old = t->out.size();
+        t->out.resize(old + UDP_FRAME_HEADER + len);
+        uint8_t* p = t->out.data() + old;
+        encode_udp_header(p, f.id, f.src_port, (uint16_t)opt.game_port, (uint16_t)len);
+        p += UDP_FRAME_HEADER;
+        memset(p, UDP_FILL, len);
+        if (probe) {
+            p[0] = UDP_PROBE;
+            f.probe_sent_ns = now;
+            if (counted) client_stats.probes_sent++;
+            return;
+        }
+        p[0] = UDP_MARKER;
+        store_u7(p + UDP_OFF_FLOW, f.id, 4);
+        memcpy(p + UDP_OFF_IP, client_ip, 4);
+        store_u7(p + UDP_OFF_SEQ, f.send_seq++, 5);
+        store_u7(p + UDP_OFF_SEND, now, 10);
+        if (counted) {
+            client_stats.sent++;
+            client_stats.bytes_sent += len;
+        }
+    }
+
+    void generate(Tunnel* t, uint64_t now) {
+        uint64_t stop = min(now + 1, window.end_ns);
+        while (t->next_send_ns < stop) {
+            if (t->backlog() >= OUT_BACKLOG_MAX) {
+                uint64_t missed = (now - t->next_send_ns) / interval_ns + 1;
+                if (window.contains(now)) client_stats.rate_misses += missed;
+                t->next_send_ns += missed * interval_ns;
+                break;
+            }
+            append_datagram(t, t->next_send_ns);
+            t->next_send_ns += interval_ns;
+        }
+    }
+
+    bool flush(Tunnel* t, uint64_t now) {
+        if (t->send_blocked) return true;
+        while (t->out_pos < t->out.size()) {
+            ssize_t n = send(t->fd, t->out.data() + t->out_pos, t->out.size() - t->out_pos, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    t->send_blocked = true;
+                    break;
+                }
+                close_tunnel(t, now, false);
+                return false;
+            }
+            t->out_pos += n;
+        }
+        if (t->out_pos == t->out.size()) {
+            t->out.clear();
+            t->out_pos = 0;
+        } else if (t->out_pos >= 64 * 1024) {
+            t->out.erase(t->out.begin(), t->out.begin() + t->out_pos);
+            t->out_pos = 0;
+        }
+        set_events(t, t->out_pos < t->out.size());
+        return true;
+    }
+
+    void on_datagram(Tunnel* t, const FrameView& frame, uint64_t now) {
+        size_t index = (size_t)(frame.dst_port - t->base_port);
+        if (frame.dst_port < t->base_port || index >= t->flows.size() || frame.length == 0) {
+            client_stats.unknown++;
+            return;
+        }
+        Flow& f = t->flows[index];
+        const uint8_t* p = frame.payload;
+
+        if (p[0] == UDP_PROBE_REPLY && frame.length == UDP_PROBE_REPLY_LEN) {
+            // 服务器应把游戏服务器看到的代理地址还原为 客户端IP(DNF字节序) + 客户端源端口(小端序)
+            bool ok = p[1] == client_ip[3] && p[2] == client_ip[2] && p[3] == client_ip[1] && p[4] == client_ip[0] &&
+                      p[5] == (uint8_t)f.src_port && p[6] == (uint8_t)(f.src_port >> 8);
+            if (!window.contains(f.probe_sent_ns)) return;
+            client_stats.probes_answered++;
+            if (ok) {
+                client_stats.probe_rewrite_ok++;
+            } else {
+                client_stats.probe_rewrite_bad++;
+            }
+            client_stats.probe_rtt.record(now - f.probe_sent_ns);
+            f.probe_sent_ns = 0;
+            return;
+        }
+        if (p[0] != UDP_MARKER || frame.length < UDP_MESSAGE_HEADER) {
+            client_stats.unknown++;
+            return;
+        }
+        uint32_t seq = (uint32_t)load_u7(p + UDP_OFF_SEQ, 5);
+        uint64_t send_ns = load_u7(p + UDP_OFF_SEND, 10);
+        uint64_t game_ns = load_u7(p + UDP_OFF_GAME, 10);
+        if (!window.contains(send_ns)) return;
+        client_stats.received++;
+        if (f.order.reordered(seq)) client_stats.reordered++;
+        client_stats.round_trip.record(now - send_ns);
+        if (game_ns >= send_ns && game_ns <= now) client_stats.to_client.record(now - game_ns);
+    }
+
+    void on_readable(Tunnel* t, uint8_t* buf, size_t cap) {
+        for (int rounds = 0; rounds < 16; rounds++) {
+            ssize_t n = recv(t->fd, buf, cap, 0);
+            uint64_t now = monotonic_ns();
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                close_tunnel(t, now, false);
+                return;
+            }
+            if (n < 0) return;
+            size_t pos = 0;
+            if (!t->acked) {
+                // 握手确认: 0xFFFFFFFF(4) + dst_port(2)
+                size_t k = min((size_t)n, HANDSHAKE_ACK_SIZE - t->ack_len);
+                memcpy(t->ack + t->ack_len, buf, k);
+                t->ack_len += k;
+                pos = k;
+                if (t->ack_len < HANDSHAKE_ACK_SIZE) continue;
+                if (load_be32(t->ack) != UDP_TUNNEL_CONN_ID || load_be16(t->ack + 4) != (uint16_t)opt.game_port) {
+                    client_stats.connect_failures++;
+                    close_tunnel(t, now, false);
+                    return;
+                }
+                // 隧道通常在预热期间建立，握手不按统计窗口过滤
+                t->acked = true;
+                t->next_send_ns = now;
+                client_stats.connects++;
+                client_stats.handshake_time.record(now - t->connect_start_ns);
+            }
+            t->decoder.feed(buf + pos, n - pos);
+            FrameView frame;
+            FrameResult r;
+            while ((r = t->decoder.next(frame)) != FRAME_INCOMPLETE) {
+                if (r == FRAME_UNKNOWN) {
+                    client_stats.unknown++;
+                    close_tunnel(t, now, false);
+                    return;
+                }
+                on_datagram(t, frame, now);
+            }
+            if ((size_t)n < cap) return;
+        }
+    }
+
+    void run() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        vector<uint8_t> buf(65536);
+        epoll_event events[256];
+        uint64_t drain_end = window.end_ns + (uint64_t)opt.drain_ms * 1000000ULL;
+
+        uint64_t now = monotonic_ns();
+        for (auto& t : tunnels) open_tunnel(t.get(), now);
+
+        while ((now = monotonic_ns()) < drain_end) {
+            int n = epoll_wait(epoll_fd, events, 256, 1);
+            now = monotonic_ns();
+            for (int i = 0; i < n; i++) {
+                Tunnel* t = (Tunnel*)events[i].data.ptr;
+                if (t->fd < 0) continue;
+                if (!t->connected) {
+                    if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) on_connected(t, now);
+                    if (t->fd < 0 || !t->connected) continue;
+                }
+                if (events[i].events & EPOLLOUT) t->send_blocked = false;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) on_readable(t, buf.data(), buf.size());
+            }
+
+            now = monotonic_ns();
+            for (auto& p : tunnels) {
+                Tunnel* t = p.get();
+                if (t->fd < 0) {
+                    if (now >= t->reconnect_at_ns && now < window.end_ns) open_tunnel(t, now);
+                    continue;
+                }
+                if (!t->connected) continue;
+                if (t->acked) generate(t, now);
+                flush(t, now);
+            }
+        }
+
+        for (auto& t : tunnels) {
+            if (t->acked) client_stats.open_at_end++;
+            close_tunnel(t.get(), now, true);
+        }
+        close(epoll_fd);
+    }
+};
+
+// ==================== 服务器进程统计(--server-pid) ====================
+// 服务器进程的fd数(/proc/PID/fd的条目数)，失败返回-1
+static long count_proc_fds(int pid) {
+    string path = "/proc/" + to_string(pid) + "/fd";
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) return -1;
+    long count = 0;
+    while (dirent* entry = readdir(d)) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(d);
+    return count;
+}
+
+// 服务器进程的线程数(/proc/PID/status的Threads行)，失败返回-1
+static long read_proc_threads(int pid) {
+    string path = "/proc/" + to_string(pid) + "/status";
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) return -1;
+    char line[256];
+    long threads = -1;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (strncmp(line, "Threads:", 8) == 0) {
+            threads = atol(line + 8);
+            break;
+        }
+    }
+    fclose(f);
+    return threads;
+}
+
+// 服务器进程累计的CPU时间(秒): /proc/PID/stat第14、15字段utime+stime(时钟滴答，含已退出的线程)，失败返回-1
+static double read_proc_cpu_sec(int pid) {
+    string path = "/proc/" + to_string(pid) + "/stat";
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) return -1;
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // 进程名(第2字段)可能含空格和括号，从最后一个')'之后的第3字段(state)开始数
+    char* p = strrchr(buf, ')');
+    if (p == nullptr) return -1;
+    unsigned long long utime = 0, stime = 0;
+    if (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) return -1;
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// 服务器所有线程的上下文切换次数: /proc/PID/task/*/status 中voluntary_ctxt_switches与nonvoluntary_ctxt_switches之和
+// (已退出线程的次数不再计入)
+struct CtxSwitches {
+    uint64_t voluntary = 0;
+    uint64_t nonvoluntary = 0;
+};
+
+static bool read_proc_ctx_switches(int pid, CtxSwitches& out) {
+    string path = "/proc/" + to_string(pid) + "/task";
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) return false;
+    out = CtxSwitches();
+    while (dirent* entry = readdir(d)) {
+        if (entry->d_name[0] == '.') continue;
+        FILE* f = fopen((path + "/" + entry->d_name + "/status").c_str(), "r");
+        if (f == nullptr) continue;
+        char line[256];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            if (strncmp(line, "voluntary_ctxt_switches:", 24) == 0) {
+                out.voluntary += strtoull(line + 24, nullptr, 10);
+            } else if (strncmp(line, "nonvoluntary_ctxt_switches:", 27) == 0) {
+                out.nonvoluntary += strtoull(line + 27, nullptr, 10);
+            }
+        }
+        fclose(f);
+    }
+    closedir(d);
+    return true;
+}
+
+// 服务器各线程进入系统调用的次数: perf_event_open计数tracepoint raw_syscalls:sys_enter，每个线程一个计数器
+// (inherit: 之后创建的线程计入创建它的线程)。需要root(或CAP_PERFMON)，且tracefs已挂载
+class SyscallCounter {
+public:
+    SyscallCounter() {}
+    ~SyscallCounter() {
+        for (int fd : fds) close(fd);
+    }
+
+    bool open(int pid) {
+        long id = tracepoint_id();
+        if (id < 0) {
+            error = "找不到tracepoint raw_syscalls/sys_enter (mount -t tracefs nodev /sys/kernel/tracing)";
+            return false;
+        }
+        string path = "/proc/" + to_string(pid) + "/task";
+        DIR* d = opendir(path.c_str());
+        if (d == nullptr) {
+            error = "无法读取" + path + ": " + strerror(errno);
+            return false;
+        }
+        while (dirent* entry = readdir(d)) {
+            if (entry->d_name[0] == '.') continue;
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_TRACEPOINT;
+            attr.size = sizeof(attr);
+            attr.config = (uint64_t)id;
+            attr.inherit = 1;
+            int fd = (int)syscall(SYS_perf_event_open, &attr, atoi(entry->d_name), -1, -1, PERF_FLAG_FD_CLOEXEC);
+            if (fd < 0) {
+                error = string("perf_event_open失败: ") + strerror(errno);
+                break;
+            }
+            fds.push_back(fd);
+        }
+        closedir(d);
+        if (!error.empty() || fds.empty()) {
+            for (int fd : fds) close(fd);
+            fds.clear();
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (int fd : fds) {
+            uint64_t value = 0;
+            if (read(fd, &value, sizeof(value)) == (ssize_t)sizeof(value)) sum += value;
+        }
+        return sum;
+    }
+
+    string error;
+
+private:
+    vector<int> fds;
+
+    static long tracepoint_id() {
+        const char* paths[] = {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                               "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+        for (const char* path : paths) {
+            FILE* f = fopen(path, "r");
+            if (f == nullptr) continue;
+            long id = -1;
+            if (fscanf(f, "%ld", &id) != 1) id = -1;
+            fclose(f);
+            if (id >= 0) return id;
+        }
+        return -1;
+    }
+};
+
+// 统计窗口开始和结束时各读取一次服务器进程的计数，结果为两次之差
+struct ServerWindowStats {
+    bool syscalls_valid = false;
+    uint64_t syscalls = 0;
+    long threads_start = -1;     // 窗口开始/结束时的线程数(Threads)
+    long threads_end = -1;
+    bool ctx_valid = false;
+    CtxSwitches ctx;             // 窗口内的上下文切换次数
+    double cpu_sec = -1;         // 窗口内的CPU时间(utime+stime)，-1表示读取失败
+};
+
+class ServerProbe {
+public:
+    ServerProbe(int p, const MeasureWindow& w) : pid(p), window(w) {}
+
+    // 计数器打不开时只输出提示，压测照常进行
+    void start() {
+        if (!syscalls.open(pid)) {
+            fprintf(stderr, "服务器系统调用计数不可用: %s\n", syscalls.error.c_str());
+        } else {
+            result.syscalls_valid = true;
+        }
+        worker = thread(&ServerProbe::run, this);
+    }
+
+    void join() {
+        if (worker.joinable()) worker.join();
+    }
+
+    const ServerWindowStats& stats() const { return result; }
+
+private:
+    int pid;
+    MeasureWindow window;
+    SyscallCounter syscalls;
+    ServerWindowStats result;
+    thread worker;
+
+    static void sleep_until(uint64_t ns) {
+        uint64_t now = monotonic_ns();
+        if (ns > now) usleep((useconds_t)((ns - now) / 1000));
+    }
+
+    void run() {
+        sleep_until(window.start_ns);
+        uint64_t syscalls_start = result.syscalls_valid ? syscalls.total() : 0;
+        result.threads_start = read_proc_threads(pid);
+        CtxSwitches ctx_start;
+        bool ctx_ok = read_proc_ctx_switches(pid, ctx_start);
+        double cpu_start = read_proc_cpu_sec(pid);
+
+        sleep_until(window.end_ns);
+        if (result.syscalls_valid) result.syscalls = syscalls.total() - syscalls_start;
+        result.threads_end = read_proc_threads(pid);
+        CtxSwitches ctx_end;
+        if (ctx_ok && read_proc_ctx_switches(pid, ctx_end)) {
+            result.ctx_valid = true;
+            result.ctx.voluntary = ctx_end.voluntary - ctx_start.voluntary;
+            result.ctx.nonvoluntary = ctx_end.nonvoluntary - ctx_start.nonvoluntary;
+        }
+        double cpu_end = read_proc_cpu_sec(pid);
+        if (cpu_start >= 0 && cpu_end >= 0) result.cpu_sec = cpu_end - cpu_start;
+    }
+};
+
+// ==================== 参数与结果 ====================
+static void usage() {
+    fprintf(stderr,
+            "用法: dnf-tunnel-bench [--server HOST:PORT] [--game-port N] [--game echo|sink|none]\n"
+            "                       [--connections N] [--threads N] [--duration SEC] [--warmup SEC]\n"
+            "                       [--size N|MIN-MAX] [--rate N] [--window N] [--heartbeat-ms N] [--heartbeat-v2]\n"
+            "                       [--churn-ms N] [--burst N] [--burst-ms N] [--json FILE] [--server-pid PID]\n"
+            "                       [--mode tcp|udp] [--ports M] [--src-port-base N] [--client-ip IP]\n"
+            "                       [--probe-every K] [--drain-ms N]\n"
+            "                       [--mode teardown] [--batch N]\n");
+}
+
+static bool parse_options(int argc, char* argv[], BenchOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--heartbeat-v2") {
+            opt.heartbeat_v2 = true;
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            exit(0);
+        } else if (!has_value) {
+            return false;
+        } else if (arg == "--server") {
+            string v = argv[++i];
+            size_t colon = v.rfind(':');
+            if (colon == string::npos) return false;
+            opt.server_host = v.substr(0, colon);
+            if (opt.server_host.size() > 2 && opt.server_host[0] == '[') {
+                opt.server_host = opt.server_host.substr(1, opt.server_host.size() - 2);
+            }
+            opt.server_port = atoi(v.c_str() + colon + 1);
+        } else if (arg == "--game-port") {
+            opt.game_port = atoi(argv[++i]);
+        } else if (arg == "--game") {
+            opt.game = argv[++i];
+            if (opt.game != "echo" && opt.game != "sink" && opt.game != "none") return false;
+        } else if (arg == "--connections") {
+            opt.connections = atoi(argv[++i]);
+        } else if (arg == "--threads") {
+            opt.threads = atoi(argv[++i]);
+        } else if (arg == "--duration") {
+            opt.duration_sec = atof(argv[++i]);
+        } else if (arg == "--warmup") {
+            opt.warmup_sec = atof(argv[++i]);
+        } else if (arg == "--size") {
+            const char* v = argv[++i];
+            opt.min_size = strtoul(v, nullptr, 10);
+            const char* dash = strchr(v, '-');
+            opt.max_size = dash ? strtoul(dash + 1, nullptr, 10) : opt.min_size;
+        } else if (arg == "--rate") {
+            opt.rate = atof(argv[++i]);
+        } else if (arg == "--window") {
+            opt.window = atoi(argv[++i]);
+        } else if (arg == "--heartbeat-ms") {
+            opt.heartbeat_ms = atoi(argv[++i]);
+        } else if (arg == "--churn-ms") {
+            opt.churn_ms = atoi(argv[++i]);
+        } else if (arg == "--burst") {
+            opt.burst = atoi(argv[++i]);
+        } else if (arg == "--burst-ms") {
+            opt.burst_ms = atoi(argv[++i]);
+        } else if (arg == "--json") {
+            opt.json_path = argv[++i];
+        } else if (arg == "--mode") {
+            opt.mode = argv[++i];
+            if (opt.mode != "tcp" && opt.mode != "udp" && opt.mode != "teardown") return false;
+        } else if (arg == "--ports") {
+            opt.ports = atoi(argv[++i]);
+        } else if (arg == "--src-port-base") {
+            opt.src_port_base = atoi(argv[++i]);
+        } else if (arg == "--client-ip") {
+            opt.client_ip = argv[++i];
+        } else if (arg == "--probe-every") {
+            opt.probe_every = atoi(argv[++i]);
+        } else if (arg == "--drain-ms") {
+            opt.drain_ms = atoi(argv[++i]);
+        } else if (arg == "--batch") {
+            opt.batch = atoi(argv[++i]);
+        } else if (arg == "--server-pid") {
+            opt.server_pid = atoi(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    if (opt.mode == "udp") {
+        in_addr ip;
+        if (inet_pton(AF_INET, opt.client_ip.c_str(), &ip) != 1) {
+            fprintf(stderr, "--client-ip 不是有效的IPv4地址\n");
+            return false;
+        }
+        const uint8_t* b = (const uint8_t*)&ip;
+        if ((b[0] | b[1] | b[2] | b[3]) & 0x80) {
+            fprintf(stderr, "--client-ip 各字节须小于128，否则可能与消息中的数值字段混淆\n");
+            return false;
+        }
+        if (opt.ports < 1 || opt.probe_every < 0 || opt.drain_ms < 0 || opt.src_port_base < 1 ||
+            opt.src_port_base + (long)opt.connections * opt.ports - 1 > 65535) {
+            fprintf(stderr, "UDP源端口超出范围: %d + %d*%d\n", opt.src_port_base, opt.connections, opt.ports);
+            return false;
+        }
+        if (opt.rate <= 0) opt.rate = 50;
+        if (opt.min_size < UDP_MESSAGE_HEADER) {
+            fprintf(stderr, "UDP模式 --size 最小为 %zu\n", UDP_MESSAGE_HEADER);
+            return false;
+        }
+    }
+    if (opt.min_size < MESSAGE_HEADER || opt.max_size < opt.min_size || opt.max_size > MAX_FRAME_PAYLOAD) {
+        fprintf(stderr, "--size 须在 %zu~%zu 之间\n", MESSAGE_HEADER, MAX_FRAME_PAYLOAD);
+        return false;
+    }
+    if (opt.connections < 1 || opt.threads < 1 || opt.window < 1 || opt.duration_sec <= 0 || opt.warmup_sec < 0 ||
+        opt.game_port <= 0 || opt.game_port > 65535 || opt.server_port <= 0 || opt.server_port > 65535) {
+        return false;
+    }
+    if (opt.threads > opt.connections) opt.threads = opt.connections;
+    if (opt.burst < 0 || opt.burst_ms < 1 || (opt.burst > 0 && (opt.mode != "tcp" || opt.game == "none"))) {
+        fprintf(stderr, "--burst 只用于tcp模式的内置游戏服务器\n");
+        return false;
+    }
+    if (opt.mode == "teardown" && (opt.batch < 1 || opt.server_pid < 0)) return false;
+    return true;
+}
+
+static bool resolve_server(const BenchOptions& opt, sockaddr_storage& addr, socklen_t& len) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    string port = to_string(opt.server_port);
+    int err = getaddrinfo(opt.server_host.c_str(), port.c_str(), &hints, &result);
+    if (err != 0 || result == nullptr) {
+        fprintf(stderr, "无法解析隧道服务器地址 %s: %s\n", opt.server_host.c_str(), gai_strerror(err));
+        return false;
+    }
+    memcpy(&addr, result->ai_addr, result->ai_addrlen);
+    len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+static string format_double(double v) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.3f", v);
+    return buf;
+}
+
+// "server":{...}片段；frames为统计窗口内服务器双向转发的帧数(UDP模式即数据报数)
+// ctx_switches_per_1k_pps: 每秒上下文切换次数 / (每秒转发帧数/1000)
+// connections: 压测的并发连接数(tcp模式)，0表示不输出connections_per_core
+static string server_json(const BenchOptions& opt, const ServerWindowStats& st, uint64_t frames, int connections) {
+    double sec = opt.duration_sec;
+    double kpps = frames / sec / 1000;
+    string out = "\"server\": {\"pid\":" + to_string(opt.server_pid) +
+                 ",\"forwarded_frames\":" + to_string(frames) + ",\"frames_per_sec\":" + format_double(frames / sec) +
+                 ",\"server_threads\":" + to_string(st.threads_end) +
+                 ",\"server_threads_start\":" + to_string(st.threads_start);
+    if (st.syscalls_valid) {
+        out += ",\"syscalls\":" + to_string(st.syscalls) + ",\"syscalls_per_sec\":" + format_double(st.syscalls / sec) +
+               ",\"syscalls_per_frame\":" + format_double(frames ? (double)st.syscalls / frames : 0);
+    }
+    if (st.cpu_sec >= 0) {
+        double cores = st.cpu_sec / sec;
+        out += ",\"server_cpu_sec\":" + format_double(st.cpu_sec) + ",\"server_cpu_cores\":" + format_double(cores);
+        if (connections > 0) out += ",\"connections_per_core\":" + format_double(cores > 0 ? connections / cores : 0);
+    }
+    if (st.ctx_valid) {
+        uint64_t total = st.ctx.voluntary + st.ctx.nonvoluntary;
+        out += ",\"voluntary_ctx_switches\":" + to_string(st.ctx.voluntary) +
+               ",\"nonvoluntary_ctx_switches\":" + to_string(st.ctx.nonvoluntary) +
+               ",\"ctx_switches_per_sec\":" + format_double(total / sec) +
+               ",\"ctx_switches_per_1k_pps\":" + format_double(kpps > 0 ? total / sec / kpps : 0);
+    }
+    out += "}";
+    return out;
+}
+
+static string build_result_json(const BenchOptions& opt, const ClientStats& s, const GameStats* game,
+                                const ServerWindowStats* server) {
+    double sec = opt.duration_sec;
+    string out = "{\n";
+    out += "  \"tool\": \"dnf-tunnel-bench\",\n";
+    out += "  \"mode\": \"tcp\",\n";
+    out += "  \"config\": {\"server\":\"" + opt.server_host + ":" + to_string(opt.server_port) +
+           "\",\"game\":\"" + opt.game + "\",\"game_port\":" + to_string(opt.game_port) +
+           ",\"connections\":" + to_string(opt.connections) + ",\"threads\":" + to_string(opt.threads) +
+           ",\"duration_sec\":" + format_double(opt.duration_sec) + ",\"warmup_sec\":" + format_double(opt.warmup_sec) +
+           ",\"min_size\":" + to_string(opt.min_size) + ",\"max_size\":" + to_string(opt.max_size) +
+           ",\"rate_per_conn\":" + format_double(opt.rate) + ",\"window\":" + to_string(opt.window) +
+           ",\"heartbeat_ms\":" + to_string(opt.heartbeat_ms) + ",\"heartbeat_v2\":" + (opt.heartbeat_v2 ? "true" : "false") +
+           ",\"churn_ms\":" + to_string(opt.churn_ms) + ",\"burst\":" + to_string(opt.burst) +
+           ",\"burst_ms\":" + to_string(opt.burst_ms) + "},\n";
+    out += "  \"connections\": {\"connects\":" + to_string(s.connects) + ",\"connect_failures\":" + to_string(s.connect_failures) +
+           ",\"disconnects\":" + to_string(s.disconnects) + ",\"churn_closes\":" + to_string(s.churn_closes) +
+           ",\"open_at_end\":" + to_string(s.open_at_end) +
+           ",\"connects_per_sec\":" + format_double(s.connects / sec) + ",\"connect_time\":" + s.connect_time.json() + "},\n";
+    out += "  \"sent\": {\"messages\":" + to_string(s.messages_sent) + ",\"bytes\":" + to_string(s.bytes_sent) +
+           ",\"messages_per_sec\":" + format_double(s.messages_sent / sec) +
+           ",\"mbytes_per_sec\":" + format_double(s.bytes_sent / sec / 1e6) +
+           ",\"rate_misses\":" + to_string(s.rate_misses) + "},\n";
+    out += "  \"received\": {\"frames\":" + to_string(s.frames_received) + ",\"bytes\":" + to_string(s.bytes_received) +
+           ",\"messages\":" + to_string(s.messages_received) +
+           ",\"frames_per_sec\":" + format_double(s.frames_received / sec) +
+           ",\"messages_per_sec\":" + format_double(s.messages_received / sec) +
+           ",\"mbytes_per_sec\":" + format_double(s.bytes_received / sec / 1e6) +
+           ",\"sequence_errors\":" + to_string(s.sequence_errors) +
+           ",\"segments\":" + to_string(s.segs_in) + ",\"data_segments\":" + to_string(s.data_segs_in) +
+           ",\"data_segments_per_frame\":" +
+           format_double(s.frames_received ? (double)s.data_segs_in / s.frames_received : 0) + "},\n";
+    if (opt.burst > 0) {
+        out += "  \"latency\": {\"kind\":\"burst_one_way\"," + s.rtt.json().substr(1) + ",\n";
+    } else if (opt.game == "sink" && game != nullptr) {
+        out += "  \"latency\": {\"kind\":\"one_way\"," + game->one_way.json().substr(1) + ",\n";
+    } else {
+        out += "  \"latency\": {\"kind\":\"rtt\"," + s.rtt.json().substr(1) + ",\n";
+    }
+    out += "  \"heartbeats\": {\"sent\":" + to_string(s.heartbeats_sent) + ",\"replies\":" + to_string(s.heartbeat_replies) +
+           ",\"rtt\":" + s.heartbeat_rtt.json() + "}";
+    if (game != nullptr) {
+        out += ",\n  \"game_server\": {\"accepted\":" + to_string(game->accepted) + ",\"bytes_in\":" + to_string(game->bytes_in) +
+               ",\"bytes_out\":" + to_string(game->bytes_out) + ",\"messages\":" + to_string(game->messages) +
+               ",\"stream_errors\":" + to_string(game->stream_errors) +
+               ",\"burst_messages\":" + to_string(game->burst_messages) +
+               ",\"burst_skipped\":" + to_string(game->burst_skipped) +
+               ",\"mbytes_in_per_sec\":" + format_double(game->bytes_in / sec / 1e6) + "}";
+    }
+    if (server != nullptr) {
+        // 服务器转发的帧: 去程每条消息一帧(突发模式没有)，回程为客户端收到的0x01帧
+        out += ",\n  " + server_json(opt, *server, s.messages_sent + s.frames_received, opt.connections);
+    }
+    out += "\n}\n";
+    return out;
+}
+
+// 发出sent个、收到received个时的丢包统计片段
+static string loss_json(uint64_t sent, uint64_t received) {
+    uint64_t lost = sent > received ? sent - received : 0;
+    return "\"received\":" + to_string(received) + ",\"lost\":" + to_string(lost) +
+           ",\"loss_ratio\":" + format_double(sent ? (double)lost / sent : 0);
+}
+
+static string build_udp_result_json(const BenchOptions& opt, const UdpClientStats& s, const UdpGameStats* game,
+                                    const ServerWindowStats* server) {
+    double sec = opt.duration_sec;
+    string out = "{\n";
+    out += "  \"tool\": \"dnf-tunnel-bench\",\n";
+    out += "  \"mode\": \"udp\",\n";
+    out += "  \"config\": {\"server\":\"" + opt.server_host + ":" + to_string(opt.server_port) +
+           "\",\"game\":\"" + opt.game + "\",\"game_port\":" + to_string(opt.game_port) +
+           ",\"tunnels\":" + to_string(opt.connections) + ",\"ports_per_tunnel\":" + to_string(opt.ports) +
+           ",\"threads\":" + to_string(opt.threads) + ",\"duration_sec\":" + format_double(opt.duration_sec) +
+           ",\"warmup_sec\":" + format_double(opt.warmup_sec) + ",\"min_size\":" + to_string(opt.min_size) +
+           ",\"max_size\":" + to_string(opt.max_size) + ",\"pps_per_port\":" + format_double(opt.rate) +
+           ",\"src_port_base\":" + to_string(opt.src_port_base) + ",\"client_ip\":\"" + opt.client_ip +
+           "\",\"probe_every\":" + to_string(opt.probe_every) + ",\"drain_ms\":" + to_string(opt.drain_ms) + "},\n";
+    out += "  \"tunnels\": {\"connects\":" + to_string(s.connects) + ",\"connect_failures\":" + to_string(s.connect_failures) +
+           ",\"disconnects\":" + to_string(s.disconnects) + ",\"open_at_end\":" + to_string(s.open_at_end) +
+           ",\"handshake_time\":" + s.handshake_time.json() + "},\n";
+    out += "  \"sent\": {\"datagrams\":" + to_string(s.sent) + ",\"bytes\":" + to_string(s.bytes_sent) +
+           ",\"pps\":" + format_double(s.sent / sec) + ",\"rate_misses\":" + to_string(s.rate_misses) + "},\n";
+    if (game != nullptr) {
+        out += "  \"to_game\": {" + loss_json(s.sent, game->received) + ",\"reordered\":" + to_string(game->reordered) +
+               ",\"ip_rewritten\":" + to_string(game->ip_rewritten) + ",\"ip_unchanged\":" + to_string(game->ip_unchanged) +
+               ",\"delivered_pps\":" + format_double(game->received / sec) + ",\"latency\":" + game->to_game.json() + "},\n";
+    }
+    if (opt.game != "sink") {
+        out += "  \"round_trip\": {" + loss_json(s.sent, s.received) + ",\"reordered\":" + to_string(s.reordered) +
+               ",\"delivered_pps\":" + format_double(s.received / sec) + ",\"latency\":" + s.round_trip.json() +
+               ",\"to_client_latency\":" + s.to_client.json() + "},\n";
+    }
+    out += "  \"unknown_datagrams\": " + to_string(s.unknown) + ",\n";
+    out += "  \"probes\": {\"sent\":" + to_string(s.probes_sent) + ",\"answered\":" + to_string(s.probes_answered) +
+           ",\"rewrite_ok\":" + to_string(s.probe_rewrite_ok) + ",\"rewrite_bad\":" + to_string(s.probe_rewrite_bad) +
+           ",\"rtt\":" + s.probe_rtt.json() + "}";
+    if (game != nullptr) {
+        out += ",\n  \"game_server\": {\"datagrams_in\":" + to_string(game->datagrams_in) +
+               ",\"bytes_in\":" + to_string(game->bytes_in) + ",\"probes\":" + to_string(game->probes) + "}";
+    }
+    if (server != nullptr) {
+        // 服务器转发的数据报: 去程为游戏服务器收到的(没有内置游戏服务器时按客户端发出的计)，echo另加回程
+        uint64_t forwarded = (game != nullptr ? game->received : s.sent) + (opt.game != "sink" ? s.received : 0);
+        out += ",\n  " + server_json(opt, *server, forwarded, 0);
+    }
+    out += "\n}\n";
+    return out;
+}
+
+static bool write_result(const BenchOptions& opt, const string& json) {
+    if (opt.json_path.empty()) {
+        fputs(json.c_str(), stdout);
+        return true;
+    }
+    FILE* f = fopen(opt.json_path.c_str(), "w");
+    if (f == nullptr) {
+        fprintf(stderr, "无法写入 %s: %s\n", opt.json_path.c_str(), strerror(errno));
+        return false;
+    }
+    fputs(json.c_str(), f);
+    fclose(f);
+    return true;
+}
+
+// ==================== 隧道开闭(teardown) ====================
+// 后台每10ms采样一次服务器fd数和线程数，记录峰值
+class ProcSampler {
+public:
+    explicit ProcSampler(int p) : pid(p), running(false), peak_fds(-1), peak_threads(-1) {}
+
+    void start() {
+        running = true;
+        worker = thread([this]() {
+            while (running) {
+                sample();
+                usleep(10 * 1000);
+            }
+        });
+    }
+
+    void stop() {
+        running = false;
+        if (worker.joinable()) worker.join();
+        sample();
+    }
+
+    void sample() {
+        long fds = count_proc_fds(pid);
+        long threads = read_proc_threads(pid);
+        long old = peak_fds.load();
+        while (fds > old && !peak_fds.compare_exchange_weak(old, fds)) {}
+        old = peak_threads.load();
+        while (threads > old && !peak_threads.compare_exchange_weak(old, threads)) {}
+    }
+
+    long max_fds() const { return peak_fds.load(); }
+    long max_threads() const { return peak_threads.load(); }
+
+private:
+    int pid;
+    atomic<bool> running;
+    atomic<long> peak_fds;
+    atomic<long> peak_threads;
+    thread worker;
+};
+
+struct TeardownStats {
+    uint64_t opened = 0;
+    uint64_t open_failures = 0;      // connect/握手发送失败
+    uint64_t echo_failures = 0;      // 5秒内没有收到回显
+    uint64_t eof_timeouts = 0;       // shutdown后5秒内没有收到服务器FIN
+    uint64_t fd_release_timeouts = 0;
+    double elapsed_sec = 0;
+    Histogram teardown;              // shutdown(SHUT_WR)到收到服务器FIN
+    Histogram fd_release;            // 一批全部shutdown到服务器fd数回到基线
+    long baseline_fds = -1;
+    long baseline_threads = -1;
+    long peak_fds = -1;
+    long peak_threads = -1;
+    long final_fds = -1;
+    long final_threads = -1;
+};
+
+static const int TEARDOWN_TIMEOUT_MS = 5000;
+
+// 连接并发送握手和一条消息，返回fd，失败返回-1
+static int open_echo_tunnel(const BenchOptions& opt, const sockaddr_storage& addr, socklen_t addr_len,
+                            uint32_t conn_id, int slot) {
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    timeval tv = {TEARDOWN_TIMEOUT_MS / 1000, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (const sockaddr*)&addr, addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char uuid[64];
+    int uuid_len = snprintf(uuid, sizeof(uuid), "teardown-%d-%d", (int)getpid(), slot);
+    vector<uint8_t> out(HANDSHAKE_HEADER + uuid_len + TCP_FRAME_HEADER + MESSAGE_HEADER);
+    encode_handshake(out.data(), conn_id, (uint16_t)opt.game_port, uuid, (uint8_t)uuid_len);
+    uint8_t* p = out.data() + HANDSHAKE_HEADER + uuid_len;
+    encode_tcp_header(p, conn_id, (uint16_t)MESSAGE_HEADER);
+    uint64_t now = monotonic_ns();
+    store_be32(p + TCP_FRAME_HEADER, (uint32_t)MESSAGE_HEADER);
+    store_be32(p + TCP_FRAME_HEADER + 4, 0);
+    store_be32(p + TCP_FRAME_HEADER + 8, (uint32_t)(now >> 32));
+    store_be32(p + TCP_FRAME_HEADER + 12, (uint32_t)now);
+    if (send(fd, out.data(), out.size(), MSG_NOSIGNAL) != (ssize_t)out.size()) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 读取回显(一个或多个0x01帧，payload共MESSAGE_HEADER字节)
+static bool read_echo(int fd, uint32_t conn_id) {
+    size_t payload = 0;
+    while (payload < MESSAGE_HEADER) {
+        uint8_t header[TCP_FRAME_HEADER];
+        size_t got = 0;
+        while (got < sizeof(header)) {
+            ssize_t n = recv(fd, header + got, sizeof(header) - got, 0);
+            if (n <= 0) return false;
+            got += n;
+        }
+        if (header[0] != FRAME_TCP_DATA || load_be32(header + 1) != conn_id) return false;
+        size_t len = ((size_t)header[5] << 8) | header[6];
+        uint8_t body[MESSAGE_HEADER];
+        if (len > sizeof(body)) return false;
+        got = 0;
+        while (got < len) {
+            ssize_t n = recv(fd, body + got, len - got, 0);
+            if (n <= 0) return false;
+            got += n;
+        }
+        payload += len;
+    }
+    return true;
+}
+
+// 等待服务器fd数回到基线，返回是否在超时前回到
+static bool wait_fd_release(int pid, long baseline, uint64_t& release_ns) {
+    uint64_t start = monotonic_ns();
+    uint64_t deadline = start + TEARDOWN_TIMEOUT_MS * 1000000ULL;
+    for (;;) {
+        long fds = count_proc_fds(pid);
+        uint64_t now = monotonic_ns();
+        if (fds >= 0 && fds <= baseline) {
+            release_ns = now;
+            return true;
+        }
+        if (now >= deadline) return false;
+        usleep(1000);
+    }
+}
+
+static string build_teardown_result_json(const BenchOptions& opt, const TeardownStats& s) {
+    string out = "{\n";
+    out += "  \"tool\": \"dnf-tunnel-bench\",\n";
+    out += "  \"mode\": \"teardown\",\n";
+    out += "  \"config\": {\"server\":\"" + opt.server_host + ":" + to_string(opt.server_port) +
+           "\",\"game\":\"" + opt.game + "\",\"game_port\":" + to_string(opt.game_port) +
+           ",\"tunnels\":" + to_string(opt.connections) + ",\"batch\":" + to_string(opt.batch) +
+           ",\"server_pid\":" + to_string(opt.server_pid) + "},\n";
+    out += "  \"tunnels\": {\"opened\":" + to_string(s.opened) + ",\"open_failures\":" + to_string(s.open_failures) +
+           ",\"echo_failures\":" + to_string(s.echo_failures) + ",\"eof_timeouts\":" + to_string(s.eof_timeouts) +
+           ",\"elapsed_sec\":" + format_double(s.elapsed_sec) +
+           ",\"tunnels_per_sec\":" + format_double(s.elapsed_sec > 0 ? s.opened / s.elapsed_sec : 0) + "},\n";
+    out += "  \"teardown\": " + s.teardown.json() + ",\n";
+    out += "  \"fd_release\": {\"timeouts\":" + to_string(s.fd_release_timeouts) + ",\"latency\":" +
+           s.fd_release.json() + "},\n";
+    out += "  \"server\": {\"baseline_fds\":" + to_string(s.baseline_fds) + ",\"peak_fds\":" + to_string(s.peak_fds) +
+           ",\"final_fds\":" + to_string(s.final_fds) + ",\"baseline_threads\":" + to_string(s.baseline_threads) +
+           ",\"peak_threads\":" + to_string(s.peak_threads) + ",\"final_threads\":" + to_string(s.final_threads) + "}\n";
+    out += "}\n";
+    return out;
+}
+
+static int run_teardown(const BenchOptions& opt, const sockaddr_storage& server_addr, socklen_t server_addr_len) {
+    MeasureWindow always = {0, UINT64_MAX};
+    unique_ptr<GameServer> game;
+    if (opt.game != "none") {
+        game.reset(new GameServer(opt.game_port, true, always));
+        if (!game->start()) return 1;
+    }
+
+    TeardownStats s;
+    unique_ptr<ProcSampler> sampler;
+    if (opt.server_pid > 0) {
+        s.baseline_fds = count_proc_fds(opt.server_pid);
+        s.baseline_threads = read_proc_threads(opt.server_pid);
+        if (s.baseline_fds < 0 || s.baseline_threads < 0) {
+            fprintf(stderr, "无法读取 /proc/%d: %s\n", opt.server_pid, strerror(errno));
+            return 1;
+        }
+        sampler.reset(new ProcSampler(opt.server_pid));
+        sampler->start();
+    }
+
+    fprintf(stderr, "dnf-tunnel-bench: 开闭%d个隧道(每批%d个) → %s:%d (游戏端口%d)%s\n",
+            opt.connections, opt.batch, opt.server_host.c_str(), opt.server_port, opt.game_port,
+            opt.server_pid > 0 ? "，统计服务器fd/线程" : "");
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    uint64_t start = monotonic_ns();
+    for (int first = 0; first < opt.connections; first += opt.batch) {
+        int count = min(opt.batch, opt.connections - first);
+        vector<int> fds;
+        vector<uint32_t> ids;
+        for (int i = 0; i < count; i++) {
+            uint32_t conn_id = g_next_conn_id.fetch_add(1);
+            if (conn_id == UDP_TUNNEL_CONN_ID) conn_id = g_next_conn_id.fetch_add(1);
+            int fd = open_echo_tunnel(opt, server_addr, server_addr_len, conn_id, first + i);
+            if (fd < 0) {
+                s.open_failures++;
+                continue;
+            }
+            fds.push_back(fd);
+            ids.push_back(conn_id);
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (read_echo(fds[i], ids[i])) {
+                s.opened++;
+            } else {
+                s.echo_failures++;
+            }
+        }
+
+        // 全部shutdown写端，服务器收到FIN后关闭客户端与游戏服务器两侧的连接
+        vector<uint64_t> shut_ns(fds.size());
+        for (size_t i = 0; i < fds.size(); i++) {
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &ev);
+            shut_ns[i] = monotonic_ns();
+            shutdown(fds[i], SHUT_WR);
+        }
+        uint64_t batch_closed_ns = monotonic_ns();
+        size_t remaining = fds.size();
+        vector<bool> done(fds.size(), false);
+        uint64_t deadline = batch_closed_ns + TEARDOWN_TIMEOUT_MS * 1000000ULL;
+        uint8_t buf[4096];
+        while (remaining > 0 && monotonic_ns() < deadline) {
+            epoll_event events[256];
+            int n = epoll_wait(epoll_fd, events, 256, 100);
+            uint64_t now = monotonic_ns();
+            for (int k = 0; k < n; k++) {
+                size_t i = (size_t)events[k].data.u64;
+                if (done[i]) continue;
+                ssize_t r = recv(fds[i], buf, sizeof(buf), MSG_DONTWAIT);
+                if (r > 0 || (r < 0 && (errno == EAGAIN || errno == EINTR))) continue;
+                s.teardown.record(now - shut_ns[i]);
+                done[i] = true;
+                remaining--;
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fds[i], nullptr);
+            }
+        }
+        s.eof_timeouts += remaining;
+        for (int fd : fds) close(fd);
+
+        if (opt.server_pid > 0) {
+            uint64_t release_ns = 0;
+            if (wait_fd_release(opt.server_pid, s.baseline_fds, release_ns)) {
+                s.fd_release.record(release_ns - batch_closed_ns);
+            } else {
+                s.fd_release_timeouts++;
+            }
+        }
+    }
+    s.elapsed_sec = (monotonic_ns() - start) / 1e9;
+    close(epoll_fd);
+
+    if (sampler) {
+        sampler->stop();
+        s.peak_fds = sampler->max_fds();
+        s.peak_threads = sampler->max_threads();
+        s.final_fds = count_proc_fds(opt.server_pid);
+        s.final_threads = read_proc_threads(opt.server_pid);
+    }
+    if (game) game->stop();
+
+    if (!write_result(opt, build_teardown_result_json(opt, s))) return 1;
+    bool leaked = opt.server_pid > 0 && (s.fd_release_timeouts > 0 || s.final_fds > s.baseline_fds);
+    return s.opened > 0 && s.eof_timeouts == 0 && !leaked ? 0 : 1;
+}
+
+static int run_udp(const BenchOptions& opt, const sockaddr_storage& server_addr, socklen_t server_addr_len,
+                   const MeasureWindow& window) {
+    unique_ptr<UdpGameServer> game;
+    if (opt.game != "none") {
+        game.reset(new UdpGameServer(opt.game_port, opt.game == "echo", opt.client_ip, window));
+        if (!game->start()) return 1;
+    }
+
+    fprintf(stderr, "dnf-tunnel-bench: %d个UDP隧道 x %d个源端口 → %s:%d (游戏端口%d, %s)，每端口%.0fpps，预热%.1f秒，统计%.1f秒\n",
+            opt.connections, opt.ports, opt.server_host.c_str(), opt.server_port, opt.game_port, opt.game.c_str(),
+            opt.rate, opt.warmup_sec, opt.duration_sec);
+
+    unique_ptr<ServerProbe> probe;
+    if (opt.server_pid > 0) {
+        probe.reset(new ServerProbe(opt.server_pid, window));
+        probe->start();
+    }
+    vector<unique_ptr<UdpClientWorker>> workers;
+    int slot = 0;
+    for (int t = 0; t < opt.threads; t++) {
+        int count = opt.connections / opt.threads + (t < opt.connections % opt.threads ? 1 : 0);
+        workers.emplace_back(new UdpClientWorker(opt, server_addr, server_addr_len, window, slot, count));
+        slot += count;
+    }
+    for (auto& w : workers) w->start();
+    UdpClientStats total;
+    for (auto& w : workers) {
+        w->join();
+        total.merge(w->stats());
+    }
+    if (probe) probe->join();
+    if (game) game->stop();
+
+    if (!write_result(opt, build_udp_result_json(opt, total, game ? &game->stats() : nullptr,
+                                                 probe ? &probe->stats() : nullptr))) {
+        return 1;
+    }
+    return total.open_at_end > 0 || total.connects > 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    sockaddr_storage server_addr;
+    socklen_t server_addr_len = 0;
+    if (!resolve_server(opt, server_addr, server_addr_len)) return 1;
+
+    uint64_t start = monotonic_ns();
+    MeasureWindow window;
+    window.start_ns = start + (uint64_t)(opt.warmup_sec * 1e9);
+    window.end_ns = window.start_ns + (uint64_t)(opt.duration_sec * 1e9);
+    if (opt.mode == "udp") return run_udp(opt, server_addr, server_addr_len, window);
+    if (opt.mode == "teardown") return run_teardown(opt, server_addr, server_addr_len);
+
+    unique_ptr<GameServer> game;
+    if (opt.game != "none") {
+        game.reset(new GameServer(opt.game_port, opt.game == "echo", window));
+        if (opt.burst > 0) game->set_burst(opt.burst, opt.burst_ms, opt.min_size, opt.max_size);
+        if (!game->start()) return 1;
+    }
+
+    fprintf(stderr, "dnf-tunnel-bench: %d个连接 → %s:%d (游戏端口%d, %s)，预热%.1f秒，统计%.1f秒\n",
+            opt.connections, opt.server_host.c_str(), opt.server_port, opt.game_port, opt.game.c_str(),
+            opt.warmup_sec, opt.duration_sec);
+
+    unique_ptr<ServerProbe> probe;
+    if (opt.server_pid > 0) {
+        probe.reset(new ServerProbe(opt.server_pid, window));
+        probe->start();
+    }
+    vector<unique_ptr<ClientWorker>> workers;
+    int slot = 0;
+    for (int t = 0; t < opt.threads; t++) {
+        int count = opt.connections / opt.threads + (t < opt.connections % opt.threads ? 1 : 0);
+        workers.emplace_back(new ClientWorker(opt, server_addr, server_addr_len, window, slot, count));
+        slot += count;
+    }
+    for (auto& w : workers) w->start();
+    ClientStats total;
+    for (auto& w : workers) {
+        w->join();
+        total.merge(w->stats());
+    }
+    if (probe) probe->join();
+    if (game) game->stop();
+
+    if (!write_result(opt, build_result_json(opt, total, game ? &game->stats() : nullptr,
+                                             probe ? &probe->stats() : nullptr))) {
+        return 1;
+    }
+    return total.open_at_end > 0 || total.connects > 0 ? 0 : 1;
+}
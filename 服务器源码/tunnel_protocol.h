@@ -0,0 +1,362 @@
+/*
+ * 隧道协议编解码 (服务器与客户端共用，仅头文件)
+ *
+ * 握手(客户端→服务器): conn_id(4) + dst_port(2) + uuid_len(1) + uuid(N)
+ *   UDP隧道: conn_id=0xFFFFFFFF，握手后再发送客户端IPv4(4)，服务器回复 0xFFFFFFFF(4) + dst_port(2)
+ * 数据帧(双向):
+ *   0x01 TCP数据: msg_type(1) + conn_id(4) + data_len(2) + payload
+ *   0x02 心跳:    msg_type(1) + conn_id(4) + data_len(2)=0
+ *     v2心跳(服务器列表带 "heartbeat_v2":true 时客户端才发送):
+ *       请求 data_len=16: seq(4) + client_send_us(8) + last_rtt_us(4)
+ *       回复 data_len=20: seq(4) + client_send_us(8) + server_recv_us(8)
+ *       client_send_us原样回显，客户端用 当前时间-client_send_us 得到RTT，在下一次心跳的last_rtt_us中上报(0=暂无)
+ *   0x03 UDP数据: msg_type(1) + conn_id(4) + src_port(2) + dst_port(2) + data_len(2) + payload
+ * 所有整数为网络字节序
+ *
+ * - 读写按字节进行，不依赖对齐(替代 *(uint32_t*)&buf[i] 强转)，编译器会合并为单条load+bswap
+ * - 不分配内存；FrameDecoder只在帧跨越两次recv时使用拼接缓冲(不超过一帧)
+ * - 只依赖C++标准库，g++ -std=c++11 与 MSVC /std:c++14 均可编译
+ */
+
+#ifndef TUNNEL_PROTOCOL_H
+#define TUNNEL_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+const uint8_t FRAME_TCP_DATA = 0x01;
+const uint8_t FRAME_HEARTBEAT = 0x02;
+const uint8_t FRAME_UDP_DATA = 0x03;
+
+const size_t TCP_FRAME_HEADER = 7;
+const size_t HEARTBEAT_FRAME_SIZE = 7;
+const size_t HEARTBEAT_V2_REQUEST_LEN = 16;
+const size_t HEARTBEAT_V2_REPLY_LEN = 20;
+const size_t UDP_FRAME_HEADER = 11;
+const size_t HANDSHAKE_HEADER = 7;
+const size_t HANDSHAKE_ACK_SIZE = 6;
+
+const uint32_t UDP_TUNNEL_CONN_ID = 0xFFFFFFFF;
+
+// 协议data_len为uint16_t，单帧payload最大65535字节
+const size_t MAX_FRAME_PAYLOAD = 65535;
+
+// FrameDecoder/parse_frame的类型过滤
+inline unsigned frame_type_bit(uint8_t type) {
+    return type < 32 ? (1u << type) : 0;
+}
+
+// ==================== 字节序读写 ====================
+inline uint16_t load_be16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+inline uint32_t load_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline uint64_t load_be64(const uint8_t* p) {
+    return ((uint64_t)load_be32(p) << 32) | load_be32(p + 4);
+}
+
+inline void store_be16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+inline void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+inline void store_be64(uint8_t* p, uint64_t v) {
+    store_be32(p, (uint32_t)(v >> 32));
+    store_be32(p + 4, (uint32_t)v);
+}
+
+// ==================== 编码 ====================
+// 均返回写入的字节数，out由调用方保证足够大
+
+inline size_t encode_tcp_header(uint8_t* out, uint32_t conn_id, uint16_t data_len) {
+    out[0] = FRAME_TCP_DATA;
+    store_be32(out + 1, conn_id);
+    store_be16(out + 5, data_len);
+    return TCP_FRAME_HEADER;
+}
+
+inline size_t encode_heartbeat(uint8_t* out, uint32_t conn_id) {
+    out[0] = FRAME_HEARTBEAT;
+    store_be32(out + 1, conn_id);
+    store_be16(out + 5, 0);
+    return HEARTBEAT_FRAME_SIZE;
+}
+
+inline size_t encode_heartbeat_v2(uint8_t* out, uint32_t conn_id, uint32_t seq,
+                                  uint64_t client_send_us, uint32_t last_rtt_us) {
+    out[0] = FRAME_HEARTBEAT;
+    store_be32(out + 1, conn_id);
+    store_be16(out + 5, (uint16_t)HEARTBEAT_V2_REQUEST_LEN);
+    store_be32(out + 7, seq);
+    store_be64(out + 11, client_send_us);
+    store_be32(out + 19, last_rtt_us);
+    return HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REQUEST_LEN;
+}
+
+inline size_t encode_heartbeat_v2_reply(uint8_t* out, uint32_t conn_id, uint32_t seq,
+                                        uint64_t client_send_us, uint64_t server_recv_us) {
+    out[0] = FRAME_HEARTBEAT;
+    store_be32(out + 1, conn_id);
+    store_be16(out + 5, (uint16_t)HEARTBEAT_V2_REPLY_LEN);
+    store_be32(out + 7, seq);
+    store_be64(out + 11, client_send_us);
+    store_be64(out + 19, server_recv_us);
+    return HEARTBEAT_FRAME_SIZE + HEARTBEAT_V2_REPLY_LEN;
+}
+
+inline size_t encode_udp_header(uint8_t* out, uint32_t conn_id, uint16_t src_port,
+                                uint16_t dst_port, uint16_t data_len) {
+    out[0] = FRAME_UDP_DATA;
+    store_be32(out + 1, conn_id);
+    store_be16(out + 5, src_port);
+    store_be16(out + 7, dst_port);
+    store_be16(out + 9, data_len);
+    return UDP_FRAME_HEADER;
+}
+
+inline size_t encode_handshake(uint8_t* out, uint32_t conn_id, uint16_t dst_port,
+                               const void* uuid, uint8_t uuid_len) {
+    store_be32(out, conn_id);
+    store_be16(out + 4, dst_port);
+    out[6] = uuid_len;
+    if (uuid_len > 0) memcpy(out + HANDSHAKE_HEADER, uuid, uuid_len);
+    return HANDSHAKE_HEADER + uuid_len;
+}
+
+inline size_t encode_handshake_ack(uint8_t* out, uint32_t conn_id, uint16_t dst_port) {
+    store_be32(out, conn_id);
+    store_be16(out + 4, dst_port);
+    return HANDSHAKE_ACK_SIZE;
+}
+
+// ==================== 解码 ====================
+struct HandshakeHeader {
+    uint32_t conn_id;
+    uint16_t dst_port;
+    uint8_t uuid_len;
+};
+
+inline HandshakeHeader decode_handshake_header(const uint8_t* p) {
+    HandshakeHeader h;
+    h.conn_id = load_be32(p);
+    h.dst_port = load_be16(p + 4);
+    h.uuid_len = p[6];
+    return h;
+}
+
+// v2心跳请求/回复的payload，长度不足时返回false(旧版0长度心跳)
+struct HeartbeatV2 {
+    uint32_t seq;
+    uint64_t client_send_us;
+    uint32_t last_rtt_us;      // 仅请求
+    uint64_t server_recv_us;   // 仅回复
+};
+
+inline bool decode_heartbeat_v2_request(const uint8_t* payload, size_t len, HeartbeatV2& hb) {
+    if (len < HEARTBEAT_V2_REQUEST_LEN) return false;
+    hb.seq = load_be32(payload);
+    hb.client_send_us = load_be64(payload + 4);
+    hb.last_rtt_us = load_be32(payload + 12);
+    hb.server_recv_us = 0;
+    return true;
+}
+
+inline bool decode_heartbeat_v2_reply(const uint8_t* payload, size_t len, HeartbeatV2& hb) {
+    if (len < HEARTBEAT_V2_REPLY_LEN) return false;
+    hb.seq = load_be32(payload);
+    hb.client_send_us = load_be64(payload + 4);
+    hb.last_rtt_us = 0;
+    hb.server_recv_us = load_be64(payload + 12);
+    return true;
+}
+
+struct FrameView {
+    uint8_t type;
+    uint32_t conn_id;
+    uint16_t src_port;     // 仅0x03
+    uint16_t dst_port;     // 仅0x03
+    uint8_t* payload;      // 指向输入缓冲，可原地修改
+    size_t length;
+};
+
+enum FrameResult { FRAME_OK, FRAME_INCOMPLETE, FRAME_UNKNOWN };
+
+// 解析p处的一帧
+// accept_mask: 接受的帧类型(frame_type_bit)；其他类型返回FRAME_UNKNOWN(已填type和conn_id)
+// need: 继续解析所需的字节数，FRAME_OK时即整帧长度
+inline FrameResult parse_frame(uint8_t* p, size_t avail, unsigned accept_mask,
+                               FrameView& frame, size_t& need) {
+    need = 5;
+    if (avail < need) return FRAME_INCOMPLETE;
+
+    frame.type = p[0];
+    frame.conn_id = load_be32(p + 1);
+    if (!(accept_mask & frame_type_bit(frame.type))) return FRAME_UNKNOWN;
+
+    size_t header = frame.type == FRAME_UDP_DATA ? UDP_FRAME_HEADER : TCP_FRAME_HEADER;
+    need = header;
+    if (avail < need) return FRAME_INCOMPLETE;
+
+    frame.src_port = 0;
+    frame.dst_port = 0;
+    frame.length = 0;
+    if (frame.type == FRAME_UDP_DATA) {
+        frame.src_port = load_be16(p + 5);
+        frame.dst_port = load_be16(p + 7);
+        frame.length = load_be16(p + 9);
+    } else {
+        // 心跳的data_len: 旧版为0，v2为时间戳payload长度
+        frame.length = load_be16(p + 5);
+    }
+    need = header + frame.length;
+    if (avail < need) return FRAME_INCOMPLETE;
+
+    frame.payload = p + header;
+    return FRAME_OK;
+}
+
+// 批量解码: 从data开头连续解析最多max_frames个完整帧
+// 遇到不完整的帧或不接受的类型时停止，consumed返回已解析的字节数
+inline size_t decode_frames(uint8_t* data, size_t len, unsigned accept_mask,
+                            FrameView* frames, size_t max_frames, size_t& consumed) {
+    size_t count = 0;
+    size_t need = 0;
+    consumed = 0;
+    while (count < max_frames &&
+           parse_frame(data + consumed, len - consumed, accept_mask, frames[count], need) == FRAME_OK) {
+        consumed += need;
+        count++;
+    }
+    return count;
+}
+
+// 流式解码: 每次recv后feed()，再反复next()直到FRAME_INCOMPLETE
+// - 完整的帧直接在接收缓冲中解析，FrameView指向原数据
+// - 跨越两次recv的帧复制到拼接缓冲，拼完后同样输出视图
+// - FrameView在下一次next()之前有效
+class FrameDecoder {
+public:
+    explicit FrameDecoder(unsigned type_mask)
+        : accept_mask(type_mask), filter_conn_id(false), expected_conn_id(0),
+          stash_len(0), stash_done(false), skip_left(0), data(nullptr), size(0), pos(0) {}
+
+    // 只接受指定conn_id的帧: 收到帧头前5字节即可判定，其他conn_id返回FRAME_UNKNOWN，不等待payload
+    void expect_conn_id(uint32_t conn_id) {
+        filter_conn_id = true;
+        expected_conn_id = conn_id;
+    }
+
+    void feed(uint8_t* recv_data, size_t n) {
+        data = recv_data;
+        size = n;
+        pos = 0;
+        if (skip_left > 0) skip(0);
+    }
+
+    FrameResult next(FrameView& frame) {
+        if (stash_done) {
+            stash_len = 0;
+            stash_done = false;
+        }
+
+        size_t need = 0;
+        if (stash_len == 0) {
+            FrameResult r = parse(data + pos, size - pos, frame, need);
+            if (r == FRAME_OK) {
+                pos += need;
+            } else if (r == FRAME_INCOMPLETE) {
+                // 不完整的帧留到下一次recv拼接
+                stash_len = size - pos;
+                if (stash.size() < stash_len) stash.resize(stash_len);
+                if (stash_len > 0) memcpy(stash.data(), data + pos, stash_len);
+                pos = size;
+            }
+            return r;
+        }
+
+        // 上次剩下半帧: 每次只补齐解析下一步所需的字节，完整后其余数据回到原地解析
+        for (;;) {
+            FrameResult r = parse(stash.data(), stash_len, frame, need);
+            if (r == FRAME_OK) {
+                stash_done = true;
+                return r;
+            }
+            if (r == FRAME_UNKNOWN) return r;
+
+            size_t copy = need - stash_len;
+            if (copy > size - pos) copy = size - pos;
+            if (copy == 0) return FRAME_INCOMPLETE;
+            if (stash.size() < need) stash.resize(need);
+            memcpy(stash.data() + stash_len, data + pos, copy);
+            stash_len += copy;
+            pos += copy;
+        }
+    }
+
+    // 跳过n字节(在FRAME_UNKNOWN之后调用)，当前数据不足时剩余部分从下一次feed()的数据中跳过
+    void skip(size_t n) {
+        n += skip_left;
+        skip_left = 0;
+        if (stash_len > 0) {
+            size_t k = n < stash_len ? n : stash_len;
+            memmove(stash.data(), stash.data() + k, stash_len - k);
+            stash_len -= k;
+            n -= k;
+        }
+        size_t k = n < size - pos ? n : size - pos;
+        pos += k;
+        skip_left = n - k;
+    }
+
+    // 最近一次next()输出的帧是否位于拼接缓冲中(其payload在下一次next()后失效)
+    bool frame_in_stash() const { return stash_done; }
+
+    // 丢弃未解析完的数据(连接重建时使用)
+    void reset() {
+        stash_len = 0;
+        stash_done = false;
+        skip_left = 0;
+        data = nullptr;
+        size = 0;
+        pos = 0;
+    }
+
+private:
+    unsigned accept_mask;
+    bool filter_conn_id;
+    uint32_t expected_conn_id;
+
+    std::vector<uint8_t> stash;   // 跨recv的半帧
+    size_t stash_len;
+    bool stash_done;              // stash中的帧已输出，下次next()时释放
+    size_t skip_left;
+
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+
+    FrameResult parse(uint8_t* p, size_t avail, FrameView& frame, size_t& need) {
+        FrameResult r = parse_frame(p, avail, accept_mask, frame, need);
+        // need > 5 说明已读到conn_id
+        if (filter_conn_id && r != FRAME_UNKNOWN && (r == FRAME_OK || need > 5) &&
+            frame.conn_id != expected_conn_id) {
+            return FRAME_UNKNOWN;
+        }
+        return r;
+    }
+};
+
+#endif // TUNNEL_PROTOCOL_H
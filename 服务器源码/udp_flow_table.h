@@ -0,0 +1,119 @@
+/*
+ * UDP隧道的流表 (服务器、单元测试与微基准共用，仅头文件)
+ *
+ * (客户端源端口, 游戏服务器端口) → conn_id/握手响应还原字节
+ * - 开放寻址(线性探测)，键为两个端口打包的32位整数，容量为2的幂，负载不超过1/2
+ * - 删除不留墓碑: remove_if批量删除后按剩余数量重建(也会缩小)，探测链不会因流的建立/过期而变长
+ * - 每个UdpTunnel一张表，只由所属EventLoop线程访问，无需加锁
+ */
+
+#ifndef UDP_FLOW_TABLE_H
+#define UDP_FLOW_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// v6.11: 握手响应要写回的IP(DNF字节序)+端口(小端序)在建立流时编码好，不再每个响应sscanf
+struct UdpFlow {
+    uint32_t key;              // src_port << 16 | game_port
+    uint32_t conn_id;
+    uint16_t client_port;      // 客户端源端口
+    bool used;                 // false表示空槽
+    bool rewrite_valid;        // 客户端私网IP为IPv4时才能还原握手响应
+    uint8_t rewrite[6];        // 握手响应(0x02)第1-6字节: IP(DNF字节序 d,c,b,a) + 端口(小端序)
+    uint64_t last_active_ms;
+};
+
+class UdpFlowTable {
+public:
+    UdpFlowTable() : count(0) { slots.resize(MIN_CAPACITY); }
+
+    static uint32_t make_key(uint16_t src_port, uint16_t game_port) {
+        return ((uint32_t)src_port << 16) | game_port;
+    }
+
+    UdpFlow* find(uint16_t src_port, uint16_t game_port) {
+        uint32_t key = make_key(src_port, game_port);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            if (!slots[i].used) return nullptr;
+            if (slots[i].key == key) return &slots[i];
+        }
+    }
+
+    // 查找或插入，新插入的项除key外全部清零
+    UdpFlow* upsert(uint16_t src_port, uint16_t game_port) {
+        UdpFlow* flow = find(src_port, game_port);
+        if (flow != nullptr) return flow;
+        if ((count + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+        flow = insert_slot(make_key(src_port, game_port));
+        count++;
+        return flow;
+    }
+
+    // 删除满足条件的流，返回删除个数；表按剩余数量重建(也会缩小)
+    template <typename Pred>
+    size_t remove_if(Pred pred) {
+        size_t removed = 0;
+        for (auto& flow : slots) {
+            if (flow.used && pred(flow)) {
+                flow.used = false;
+                removed++;
+            }
+        }
+        if (removed == 0) return 0;
+        count -= removed;
+        size_t capacity = MIN_CAPACITY;
+        while (count * 2 > capacity) capacity *= 2;
+        rehash(capacity);
+        return removed;
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return slots.size(); }
+
+    // 所有流中最长的探测距离(从哈希位置到所在槽的步数)，用于测试与基准检查表是否退化
+    size_t max_probe() const {
+        size_t mask = slots.size() - 1;
+        size_t longest = 0;
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (!slots[i].used) continue;
+            size_t dist = (i - (hash(slots[i].key) & mask)) & mask;
+            if (dist > longest) longest = dist;
+        }
+        return longest;
+    }
+
+    static const size_t MIN_CAPACITY = 16;
+
+private:
+    std::vector<UdpFlow> slots;
+    size_t count;
+
+    static size_t hash(uint32_t key) {
+        return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    UdpFlow* insert_slot(uint32_t key) {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(key) & mask;
+        while (slots[i].used) i = (i + 1) & mask;
+        slots[i] = UdpFlow();
+        slots[i].key = key;
+        slots[i].used = true;
+        return &slots[i];
+    }
+
+    // 删除后的空槽会截断探测链，因此删除统一在rehash中完成
+    void rehash(size_t capacity) {
+        std::vector<UdpFlow> old;
+        old.swap(slots);
+        slots.assign(capacity, UdpFlow());
+        for (auto& flow : old) {
+            if (flow.used) *insert_slot(flow.key) = flow;
+        }
+    }
+};
+
+#endif // UDP_FLOW_TABLE_H
@@ -0,0 +1,108 @@
+/*
+ * udp_flow_table.h 单元测试 (make test)
+ * 查找/插入/按条件删除，流反复建立与过期后容量、探测距离保持有界，剩余的流仍能找到
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <set>
+#include <vector>
+#include "udp_flow_table.h"
+#include "test_util.h"
+
+using namespace std;
+
+TEST(upsert_find) {
+    UdpFlowTable table;
+    CHECK(table.find(1000, 7001) == nullptr);
+    UdpFlow* flow = table.upsert(1000, 7001);
+    CHECK(flow != nullptr);
+    CHECK_EQ(flow->conn_id, 0);
+    CHECK(!flow->rewrite_valid);
+    flow->conn_id = 42;
+    flow->client_port = 1000;
+
+    CHECK(table.upsert(1000, 7001) == table.find(1000, 7001));
+    CHECK_EQ(table.find(1000, 7001)->conn_id, 42);
+    CHECK_EQ(table.size(), 1);
+    // 端口对调是不同的流
+    CHECK(table.find(7001, 1000) == nullptr);
+}
+
+TEST(grows_and_keeps_entries) {
+    UdpFlowTable table;
+    for (uint32_t i = 0; i < 5000; i++) {
+        UdpFlow* flow = table.upsert((uint16_t)(10000 + i % 500), (uint16_t)(7000 + i / 500));
+        flow->conn_id = i;
+    }
+    CHECK_EQ(table.size(), 5000);
+    CHECK(table.size() * 2 <= table.capacity());
+    for (uint32_t i = 0; i < 5000; i++) {
+        UdpFlow* flow = table.find((uint16_t)(10000 + i % 500), (uint16_t)(7000 + i / 500));
+        CHECK(flow != nullptr && flow->conn_id == i);
+    }
+}
+
+TEST(remove_if_shrinks) {
+    UdpFlowTable table;
+    for (uint16_t port = 0; port < 1000; port++) table.upsert(port, 7000)->client_port = port;
+    size_t grown = table.capacity();
+    CHECK_EQ(table.remove_if([](const UdpFlow& f) { return f.client_port >= 10; }), 990);
+    CHECK_EQ(table.size(), 10);
+    CHECK(table.capacity() < grown);
+    CHECK(table.capacity() <= 32);
+    for (uint16_t port = 0; port < 1000; port++) {
+        CHECK((table.find(port, 7000) != nullptr) == (port < 10));
+    }
+    table.remove_if([](const UdpFlow&) { return true; });
+    CHECK_EQ(table.size(), 0);
+    CHECK_EQ(table.capacity(), UdpFlowTable::MIN_CAPACITY);
+}
+
+// 模拟UdpTunnel: 每个tick新建一批流、过期一批空闲的流，活跃流数量在一个范围内波动
+TEST(churn_stays_bounded) {
+    UdpFlowTable table;
+    set<uint32_t> live;
+    srand(12345);
+    const size_t LIVE_MAX = 2000;
+    size_t max_capacity = 0;
+    size_t max_probe = 0;
+    for (uint64_t tick = 1; tick <= 500; tick++) {
+        for (int i = 0; i < 200; i++) {
+            uint16_t src = (uint16_t)(rand() % 60000 + 1024);
+            uint16_t game = (uint16_t)(7000 + rand() % 8);
+            UdpFlow* flow = table.upsert(src, game);
+            flow->client_port = src;
+            flow->last_active_ms = tick;
+            live.insert(UdpFlowTable::make_key(src, game));
+        }
+        // 空闲超过idle个tick的流过期，活跃流约为 200 * idle
+        uint64_t idle = 3 + tick % 8;
+        table.remove_if([tick, idle](const UdpFlow& f) { return tick - f.last_active_ms >= idle; });
+        for (auto it = live.begin(); it != live.end();) {
+            UdpFlow* flow = table.find((uint16_t)(*it >> 16), (uint16_t)(*it & 0xffff));
+            if (flow == nullptr) {
+                it = live.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        CHECK_EQ(table.size(), live.size());
+        CHECK(table.size() <= LIVE_MAX);
+        if (table.capacity() > max_capacity) max_capacity = table.capacity();
+        if (table.max_probe() > max_probe) max_probe = table.max_probe();
+    }
+    // 删除不留墓碑: 容量只由活跃流数量决定，按条件删除重建后不超过活跃流数量的4倍
+    CHECK(max_capacity <= LIVE_MAX * 4);
+    CHECK(table.capacity() <= (table.size() + 1) * 4 || table.capacity() == UdpFlowTable::MIN_CAPACITY);
+    // 负载1/2的线性探测，探测距离远小于容量
+    CHECK(max_probe < 64);
+    for (uint32_t key : live) CHECK(table.find((uint16_t)(key >> 16), (uint16_t)(key & 0xffff)) != nullptr);
+
+    table.remove_if([](const UdpFlow&) { return true; });
+    CHECK_EQ(table.capacity(), UdpFlowTable::MIN_CAPACITY);
+}
+
+int main() {
+    return run_all_tests("udp_flow");
+}